@@ -0,0 +1,714 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Persistent registration of wait objects and timers
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#if defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "event_loop.h"
+#include "os_calls.h"
+#include "log.h"
+
+/* most events handled for each call to epoll_wait() */
+#define EVENT_LOOP_MAX_EVENTS 64
+
+/* wait objects are a pair of pipe fds. As with g_obj_wait(), the read
+ * side is the one we wait for */
+#define OBJ_FD(obj) ((int)((obj) & 0xffff))
+
+struct event_loop_watch
+{
+    event_loop_obj_proc proc; /* NULL if the slot is unused */
+    void *arg;
+    tintptr obj;
+    int events;
+    int active; /* fd is in the kernel's set (epoll only) */
+    unsigned int generation; /* changes whenever proc is changed */
+};
+
+struct event_loop_timer
+{
+    tui64 expire_ms;
+    tui64 seq; /* orders timers with the same expiry time */
+    unsigned int index; /* position on the heap */
+    event_loop_timer_proc proc;
+    void *arg;
+};
+
+struct event_loop
+{
+    struct event_loop_watch *watches; /* indexed by fd */
+    int watches_size;
+    struct event_loop_timer **timers; /* heap, soonest first */
+    unsigned int timer_count;
+    unsigned int timer_size;
+    tui64 timer_seq;
+#if defined(HAVE_SYS_EPOLL_H)
+    int epfd;
+#else
+    struct pollfd *pollfds;
+    unsigned int *poll_generations;
+    int pollfd_count;
+    int pollfd_size;
+    int pollfds_dirty; /* pollfds need rebuilding from watches */
+#endif
+};
+
+/*****************************************************************************/
+static tui64
+now_ms(void)
+{
+    return g_time_us() / 1000;
+}
+
+/*****************************************************************************/
+struct event_loop *
+event_loop_create(void)
+{
+    struct event_loop *self;
+
+    self = g_new0(struct event_loop, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+#if defined(HAVE_SYS_EPOLL_H)
+    self->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epfd < 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "event_loop_create: epoll_create1 failed [%s]",
+            g_get_strerror());
+        g_free(self);
+        return NULL;
+    }
+#endif
+    return self;
+}
+
+/*****************************************************************************/
+void
+event_loop_delete(struct event_loop *self)
+{
+    unsigned int i;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < self->timer_count; i++)
+    {
+        g_free(self->timers[i]);
+    }
+    g_free(self->timers);
+    g_free(self->watches);
+#if defined(HAVE_SYS_EPOLL_H)
+    g_file_close(self->epfd);
+#else
+    g_free(self->pollfds);
+    g_free(self->poll_generations);
+#endif
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* Makes sure there's a watch slot for an fd */
+static int
+grow_watches(struct event_loop *self, int fd)
+{
+    struct event_loop_watch *watches;
+    int size;
+
+    if (fd < self->watches_size)
+    {
+        return 0;
+    }
+    size = MAX(self->watches_size * 2, 64);
+    while (size <= fd)
+    {
+        size *= 2;
+    }
+    watches = (struct event_loop_watch *)
+              realloc(self->watches, size * sizeof(watches[0]));
+    if (watches == NULL)
+    {
+        return 1;
+    }
+    g_memset(watches + self->watches_size, 0,
+             (size - self->watches_size) * sizeof(watches[0]));
+    self->watches = watches;
+    self->watches_size = size;
+    return 0;
+}
+
+#if defined(HAVE_SYS_EPOLL_H)
+/*****************************************************************************/
+/* Brings the kernel's set up to date with a watch */
+static int
+update_kernel(struct event_loop *self, int fd)
+{
+    struct event_loop_watch *w = &self->watches[fd];
+    struct epoll_event ev;
+    int op;
+
+    if (w->proc == NULL || w->events == 0)
+    {
+        /* Even with no events, epoll would report hangups, so take
+         * the fd out of the set altogether */
+        if (w->active)
+        {
+            w->active = 0;
+            epoll_ctl(self->epfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+        return 0;
+    }
+
+    g_memset(&ev, 0, sizeof(ev));
+    ev.events = 0;
+    if (w->events & EVENT_LOOP_READ)
+    {
+        ev.events |= EPOLLIN;
+    }
+    if (w->events & EVENT_LOOP_WRITE)
+    {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.u64 = ((tui64)w->generation << 32) | (unsigned int)fd;
+    op = w->active ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(self->epfd, op, fd, &ev) != 0)
+    {
+        /* The fd may have been closed and reopened without us being
+         * told, or closed while it was out of the set */
+        if (op == EPOLL_CTL_ADD && errno == EEXIST)
+        {
+            op = EPOLL_CTL_MOD;
+        }
+        else if (op == EPOLL_CTL_MOD && errno == ENOENT)
+        {
+            op = EPOLL_CTL_ADD;
+        }
+        else
+        {
+            op = -1;
+        }
+        if (op < 0 || epoll_ctl(self->epfd, op, fd, &ev) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "event_loop: can't wait for fd %d [%s]",
+                fd, g_get_strerror());
+            w->active = 0;
+            return 1;
+        }
+    }
+    w->active = 1;
+    return 0;
+}
+#else
+/*****************************************************************************/
+static int
+update_kernel(struct event_loop *self, int fd)
+{
+    self->pollfds_dirty = 1;
+    return 0;
+}
+
+/*****************************************************************************/
+/* Rebuilds the poll set from the watches */
+static int
+rebuild_pollfds(struct event_loop *self)
+{
+    struct event_loop_watch *w;
+    struct pollfd *pollfds;
+    unsigned int *generations;
+    int count;
+    int fd;
+
+    count = 0;
+    for (fd = 0; fd < self->watches_size; fd++)
+    {
+        count += self->watches[fd].proc != NULL &&
+                 self->watches[fd].events != 0;
+    }
+    if (count > self->pollfd_size)
+    {
+        pollfds = (struct pollfd *)
+                  realloc(self->pollfds, count * sizeof(pollfds[0]));
+        if (pollfds == NULL)
+        {
+            return 1;
+        }
+        self->pollfds = pollfds;
+        generations = (unsigned int *)
+                      realloc(self->poll_generations,
+                              count * sizeof(generations[0]));
+        if (generations == NULL)
+        {
+            return 1;
+        }
+        self->poll_generations = generations;
+        self->pollfd_size = count;
+    }
+    count = 0;
+    for (fd = 0; fd < self->watches_size; fd++)
+    {
+        w = &self->watches[fd];
+        if (w->proc != NULL && w->events != 0)
+        {
+            self->pollfds[count].fd = fd;
+            self->pollfds[count].events = 0;
+            if (w->events & EVENT_LOOP_READ)
+            {
+                self->pollfds[count].events |= POLLIN;
+            }
+            if (w->events & EVENT_LOOP_WRITE)
+            {
+                self->pollfds[count].events |= POLLOUT;
+            }
+            self->poll_generations[count] = w->generation;
+            count++;
+        }
+    }
+    self->pollfd_count = count;
+    self->pollfds_dirty = 0;
+    return 0;
+}
+#endif
+
+/*****************************************************************************/
+int
+event_loop_add(struct event_loop *self, tintptr obj, int events,
+               event_loop_obj_proc proc, void *arg)
+{
+    struct event_loop_watch *w;
+    int fd;
+
+    fd = OBJ_FD(obj);
+    if (fd <= 0 || proc == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "event_loop_add: bad object or callback");
+        return 1;
+    }
+    if (grow_watches(self, fd) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "event_loop_add: out of memory");
+        return 1;
+    }
+    w = &self->watches[fd];
+    w->proc = proc;
+    w->arg = arg;
+    w->obj = obj;
+    w->events = events;
+    w->generation++;
+    if (update_kernel(self, fd) != 0)
+    {
+        w->proc = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+event_loop_modify(struct event_loop *self, tintptr obj, int events)
+{
+    struct event_loop_watch *w;
+    int fd;
+
+    fd = OBJ_FD(obj);
+    if (fd <= 0 || fd >= self->watches_size ||
+            self->watches[fd].proc == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "event_loop_modify: object %d not registered",
+            fd);
+        return 1;
+    }
+    w = &self->watches[fd];
+    if (w->events == events)
+    {
+        return 0;
+    }
+    w->events = events;
+    return update_kernel(self, fd);
+}
+
+/*****************************************************************************/
+void
+event_loop_remove(struct event_loop *self, tintptr obj)
+{
+    struct event_loop_watch *w;
+    int fd;
+
+    fd = OBJ_FD(obj);
+    if (fd <= 0 || fd >= self->watches_size ||
+            self->watches[fd].proc == NULL)
+    {
+        return;
+    }
+    w = &self->watches[fd];
+    w->proc = NULL;
+    w->arg = NULL;
+    w->generation++;
+    update_kernel(self, fd);
+}
+
+/*****************************************************************************/
+/* Calls the callback for a ready fd, unless its registration has
+ * changed since the event was reported */
+static void
+call_watch(struct event_loop *self, int fd, unsigned int generation,
+           int ready)
+{
+    struct event_loop_watch *w;
+    event_loop_obj_proc proc;
+
+    if (fd >= self->watches_size)
+    {
+        return;
+    }
+    w = &self->watches[fd];
+    ready &= w->events;
+    if (w->proc == NULL || w->generation != generation || ready == 0)
+    {
+        return;
+    }
+    /* the callback may move the watches */
+    proc = w->proc;
+    proc(self, w->obj, ready, w->arg);
+}
+
+#if defined(HAVE_SYS_EPOLL_H)
+/*****************************************************************************/
+static int
+dispatch_objs(struct event_loop *self, int timeout)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int count;
+    int ready;
+    int i;
+
+    count = epoll_wait(self->epfd, events, EVENT_LOOP_MAX_EVENTS, timeout);
+    if (count < 0)
+    {
+        /* a signal isn't an error */
+        return errno != EINTR;
+    }
+    for (i = 0; i < count; i++)
+    {
+        ready = 0;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            ready |= EVENT_LOOP_READ;
+        }
+        if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        {
+            ready |= EVENT_LOOP_WRITE;
+        }
+        call_watch(self, (int)(events[i].data.u64 & 0xffffffff),
+                   (unsigned int)(events[i].data.u64 >> 32), ready);
+    }
+    return 0;
+}
+#else
+/*****************************************************************************/
+static int
+dispatch_objs(struct event_loop *self, int timeout)
+{
+    int count;
+    int ready;
+    int i;
+
+    if (self->pollfds_dirty && rebuild_pollfds(self) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "event_loop: out of memory");
+        return 1;
+    }
+    if (poll(self->pollfds, self->pollfd_count, timeout) < 0)
+    {
+        return errno != EINTR;
+    }
+    /* callbacks may mark the set dirty, but won't rebuild it */
+    count = self->pollfd_count;
+    for (i = 0; i < count; i++)
+    {
+        ready = 0;
+        if (self->pollfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ready |= EVENT_LOOP_READ;
+        }
+        if (self->pollfds[i].revents & (POLLOUT | POLLHUP | POLLERR))
+        {
+            ready |= EVENT_LOOP_WRITE;
+        }
+        if (ready != 0)
+        {
+            call_watch(self, self->pollfds[i].fd,
+                       self->poll_generations[i], ready);
+        }
+    }
+    return 0;
+}
+#endif
+
+/*****************************************************************************/
+static int
+timer_before(const struct event_loop_timer *a,
+             const struct event_loop_timer *b)
+{
+    if (a->expire_ms != b->expire_ms)
+    {
+        return a->expire_ms < b->expire_ms;
+    }
+    return a->seq < b->seq;
+}
+
+/*****************************************************************************/
+static void
+timer_set(struct event_loop *self, unsigned int index,
+          struct event_loop_timer *timer)
+{
+    self->timers[index] = timer;
+    timer->index = index;
+}
+
+/*****************************************************************************/
+/* Moves a timer towards the top of the heap until it's in order */
+static void
+timer_sift_up(struct event_loop *self, unsigned int index)
+{
+    struct event_loop_timer *timer = self->timers[index];
+    unsigned int parent;
+
+    while (index > 0)
+    {
+        parent = (index - 1) / 2;
+        if (!timer_before(timer, self->timers[parent]))
+        {
+            break;
+        }
+        timer_set(self, index, self->timers[parent]);
+        index = parent;
+    }
+    timer_set(self, index, timer);
+}
+
+/*****************************************************************************/
+/* Moves a timer towards the bottom of the heap until it's in order */
+static void
+timer_sift_down(struct event_loop *self, unsigned int index)
+{
+    struct event_loop_timer *timer = self->timers[index];
+    unsigned int child;
+
+    while ((child = index * 2 + 1) < self->timer_count)
+    {
+        if (child + 1 < self->timer_count &&
+                timer_before(self->timers[child + 1], self->timers[child]))
+        {
+            child++;
+        }
+        if (!timer_before(self->timers[child], timer))
+        {
+            break;
+        }
+        timer_set(self, index, self->timers[child]);
+        index = child;
+    }
+    timer_set(self, index, timer);
+}
+
+/*****************************************************************************/
+/* Takes a timer off the heap. The timer isn't freed */
+static void
+timer_remove(struct event_loop *self, struct event_loop_timer *timer)
+{
+    unsigned int index = timer->index;
+    struct event_loop_timer *last;
+
+    self->timer_count--;
+    if (index < self->timer_count)
+    {
+        /* fill the hole with the last timer, which may need to go
+         * either way */
+        last = self->timers[self->timer_count];
+        timer_set(self, index, last);
+        timer_sift_down(self, index);
+        timer_sift_up(self, last->index);
+    }
+}
+
+/*****************************************************************************/
+struct event_loop_timer *
+event_loop_add_timer(struct event_loop *self, int msoffset,
+                     event_loop_timer_proc proc, void *arg)
+{
+    struct event_loop_timer **timers;
+    struct event_loop_timer *timer;
+    unsigned int size;
+
+    if (self->timer_count == self->timer_size)
+    {
+        size = MAX(self->timer_size * 2, 16);
+        timers = (struct event_loop_timer **)
+                 realloc(self->timers, size * sizeof(timers[0]));
+        if (timers == NULL)
+        {
+            return NULL;
+        }
+        self->timers = timers;
+        self->timer_size = size;
+    }
+    timer = g_new0(struct event_loop_timer, 1);
+    if (timer == NULL)
+    {
+        return NULL;
+    }
+    timer->expire_ms = now_ms() + MAX(msoffset, 0);
+    timer->seq = self->timer_seq++;
+    timer->proc = proc;
+    timer->arg = arg;
+    self->timers[self->timer_count] = timer;
+    timer->index = self->timer_count++;
+    timer_sift_up(self, timer->index);
+    return timer;
+}
+
+/*****************************************************************************/
+void
+event_loop_cancel_timer(struct event_loop *self,
+                        struct event_loop_timer *timer)
+{
+    if (timer == NULL)
+    {
+        return;
+    }
+    timer_remove(self, timer);
+    g_free(timer);
+}
+
+/*****************************************************************************/
+/* Reduces a timeout so we wake up for the next timer */
+static void
+timer_timeout(struct event_loop *self, int *timeout)
+{
+    tui64 now;
+    tui64 expire_ms;
+    int ms;
+
+    if (self->timer_count == 0)
+    {
+        return;
+    }
+    now = now_ms();
+    expire_ms = self->timers[0]->expire_ms;
+    ms = (expire_ms <= now) ? 0 : (int)MIN(expire_ms - now, 0x7fffffff);
+    if (*timeout < 0 || ms < *timeout)
+    {
+        *timeout = ms;
+    }
+}
+
+/*****************************************************************************/
+static void
+run_timers(struct event_loop *self)
+{
+    struct event_loop_timer *timer;
+    event_loop_timer_proc proc;
+    void *arg;
+    tui64 now;
+    tui64 seq_limit;
+
+    now = now_ms();
+    /* don't call timers added by callbacks until next time, or a timer
+     * which re-adds itself would keep us here */
+    seq_limit = self->timer_seq;
+    while (self->timer_count > 0)
+    {
+        timer = self->timers[0];
+        if (timer->expire_ms > now || timer->seq >= seq_limit)
+        {
+            break;
+        }
+        timer_remove(self, timer);
+        proc = timer->proc;
+        arg = timer->arg;
+        g_free(timer);
+        proc(self, arg);
+    }
+}
+
+/*****************************************************************************/
+int
+event_loop_get_wait_objs(struct event_loop *self,
+                         tintptr *robjs, int *rcount,
+                         tintptr *wobjs, int *wcount, int *timeout)
+{
+#if defined(HAVE_SYS_EPOLL_H)
+    robjs[(*rcount)++] = self->epfd;
+#else
+    struct event_loop_watch *w;
+    int fd;
+
+    for (fd = 0; fd < self->watches_size; fd++)
+    {
+        w = &self->watches[fd];
+        if (w->proc == NULL)
+        {
+            continue;
+        }
+        if (w->events & EVENT_LOOP_READ)
+        {
+            robjs[(*rcount)++] = w->obj;
+        }
+        if (w->events & EVENT_LOOP_WRITE)
+        {
+            wobjs[(*wcount)++] = w->obj;
+        }
+    }
+#endif
+    timer_timeout(self, timeout);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+event_loop_check_wait_objs(struct event_loop *self)
+{
+    int rv;
+
+    rv = dispatch_objs(self, 0);
+    run_timers(self);
+    return rv;
+}
+
+/*****************************************************************************/
+int
+event_loop_run_once(struct event_loop *self, int timeout)
+{
+    int rv;
+
+    timer_timeout(self, &timeout);
+    rv = dispatch_objs(self, timeout);
+    run_timers(self);
+    return rv;
+}
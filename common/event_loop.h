@@ -0,0 +1,205 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/event_loop.h
+ * @brief   Persistent registration of wait objects and timers
+ *
+ * Sockets and wait objects are registered with the loop once, rather
+ * than being collected on every pass through a main loop. When one of
+ * them is ready, a callback registered with it is called. Only the
+ * objects which are ready are looked at.
+ *
+ * On Linux, the loop uses epoll(7), and the whole loop can be waited
+ * for as a single wait object. This allows a main loop which still
+ * uses g_obj_wait() for some of its objects to move the others onto
+ * an event loop a few at a time. Elsewhere, poll(2) is used on a set
+ * of objects which is only rebuilt when the registrations change.
+ *
+ * Timers are kept on a heap ordered by expiry time.
+ *
+ * A loop must only be used from one thread. Callbacks may add and
+ * remove any registrations, including their own.
+ *
+ * With epoll, the kernel's set of objects is shared with any child
+ * process, so a child must not change the registrations before it
+ * execs.
+ */
+
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include "arch.h"
+
+/* Events for an object */
+#define EVENT_LOOP_READ 1
+#define EVENT_LOOP_WRITE 2
+
+struct event_loop;
+struct event_loop_timer;
+
+/**
+ * Called when a registered object is ready
+ *
+ * @param loop Event loop
+ * @param obj Object which is ready
+ * @param events Ready events (EVENT_LOOP_READ/EVENT_LOOP_WRITE)
+ * @param arg Argument passed when the object was registered
+ */
+typedef void (*event_loop_obj_proc)(struct event_loop *loop, tintptr obj,
+                                    int events, void *arg);
+
+/**
+ * Called when a timer expires
+ *
+ * The timer has been deleted by the time this is called.
+ *
+ * @param loop Event loop
+ * @param arg Argument passed when the timer was added
+ */
+typedef void (*event_loop_timer_proc)(struct event_loop *loop, void *arg);
+
+/**
+ * Create a new event loop
+ *
+ * @return loop, or NULL if no memory
+ */
+struct event_loop *
+event_loop_create(void);
+
+/**
+ * Delete an event loop
+ *
+ * Registered objects are not closed. Pending timers are deleted
+ * without being called.
+ *
+ * @param self loop to delete (may be NULL)
+ */
+void
+event_loop_delete(struct event_loop *self);
+
+/**
+ * Register an object with the loop
+ *
+ * The object is a socket, or a wait object from g_create_wait_obj().
+ * Wait objects can only be waited for with EVENT_LOOP_READ.
+ *
+ * If the object is already registered, its registration is replaced.
+ *
+ * @param self Event loop
+ * @param obj Object to wait for
+ * @param events Events to wait for (EVENT_LOOP_READ/EVENT_LOOP_WRITE)
+ * @param proc Callback for when the object is ready
+ * @param arg Argument for the callback
+ * @return 0 for success
+ */
+int
+event_loop_add(struct event_loop *self, tintptr obj, int events,
+               event_loop_obj_proc proc, void *arg);
+
+/**
+ * Change the events waited for on a registered object
+ *
+ * @param self Event loop
+ * @param obj Registered object
+ * @param events Events to wait for. May be 0
+ * @return 0 for success
+ */
+int
+event_loop_modify(struct event_loop *self, tintptr obj, int events);
+
+/**
+ * Remove an object from the loop
+ *
+ * This must be done before the object is closed. Once this returns,
+ * the callback for the object will not be called again.
+ *
+ * @param self Event loop
+ * @param obj Object to remove. Objects which aren't registered are ignored
+ */
+void
+event_loop_remove(struct event_loop *self, tintptr obj);
+
+/**
+ * Add a timer
+ *
+ * Timers which expire at the same time are called in the order they
+ * were added.
+ *
+ * @param self Event loop
+ * @param msoffset Milliseconds from now until the timer expires
+ * @param proc Callback for when the timer expires
+ * @param arg Argument for the callback
+ * @return timer, or NULL if no memory. The timer is only valid until
+ *         its callback is called
+ */
+struct event_loop_timer *
+event_loop_add_timer(struct event_loop *self, int msoffset,
+                     event_loop_timer_proc proc, void *arg);
+
+/**
+ * Delete a timer without calling it
+ *
+ * @param self Event loop
+ * @param timer Timer which has not yet expired (may be NULL)
+ */
+void
+event_loop_cancel_timer(struct event_loop *self,
+                        struct event_loop_timer *timer);
+
+/**
+ * Get the wait objects for the loop, for use with g_obj_wait()
+ *
+ * @param self Event loop
+ * @param robjs Read objects are added to this array
+ * @param rcount Count of robjs. Updated on return
+ * @param wobjs Write objects are added to this array
+ * @param wcount Count of wobjs. Updated on return
+ * @param[in,out] timeout Timeout for g_obj_wait(). Reduced if a timer
+ *                expires sooner
+ * @return 0 for success
+ *
+ * With epoll, a single read object is returned. Otherwise, all the
+ * registered objects are returned.
+ */
+int
+event_loop_get_wait_objs(struct event_loop *self,
+                         tintptr *robjs, int *rcount,
+                         tintptr *wobjs, int *wcount, int *timeout);
+
+/**
+ * Call the callbacks for any ready objects and expired timers
+ *
+ * Does not wait.
+ *
+ * @param self Event loop
+ * @return 0 for success
+ */
+int
+event_loop_check_wait_objs(struct event_loop *self);
+
+/**
+ * Wait for registered objects and timers, and call their callbacks
+ *
+ * @param self Event loop
+ * @param timeout Maximum milliseconds to wait, or -1 to wait until an
+ *                object is ready or a timer expires
+ * @return 0 for success
+ */
+int
+event_loop_run_once(struct event_loop *self, int timeout);
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/histogram.c
+ * @brief   Fixed-size log-linear histogram of unsigned values
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <string.h>
+
+#include "histogram.h"
+
+/*****************************************************************************/
+/* returns the index of the highest set bit in a non-zero value */
+static unsigned int
+highest_bit(unsigned int value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 31 - __builtin_clz(value);
+#else
+    unsigned int rv = 0;
+    while (value > 1)
+    {
+        value >>= 1;
+        ++rv;
+    }
+    return rv;
+#endif
+}
+
+/*****************************************************************************/
+static unsigned int
+bucket_index(unsigned int value)
+{
+    unsigned int shift;
+
+    if (value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return value;
+    }
+    shift = highest_bit(value) - HISTOGRAM_SUB_BUCKET_BITS;
+    return HISTOGRAM_SUB_BUCKETS + shift * HISTOGRAM_SUB_BUCKETS +
+           ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/*****************************************************************************/
+/* returns the largest value which is counted in a bucket */
+static unsigned int
+bucket_upper_bound(unsigned int index)
+{
+    unsigned int shift;
+    unsigned int sub;
+
+    if (index < HISTOGRAM_SUB_BUCKETS)
+    {
+        return index;
+    }
+    shift = (index - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS;
+    sub = (index - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub) << shift) + ((1U << shift) - 1);
+}
+
+/*****************************************************************************/
+void
+histogram_init(struct histogram *self)
+{
+    memset(self, 0, sizeof(*self));
+}
+
+/*****************************************************************************/
+void
+histogram_record(struct histogram *self, unsigned int value)
+{
+    if (self->count == 0 || value < self->min)
+    {
+        self->min = value;
+    }
+    if (value > self->max)
+    {
+        self->max = value;
+    }
+    self->count++;
+    self->sum += value;
+    self->buckets[bucket_index(value)]++;
+}
+
+/*****************************************************************************/
+unsigned int
+histogram_mean(const struct histogram *self)
+{
+    if (self->count == 0)
+    {
+        return 0;
+    }
+    return (unsigned int)(self->sum / self->count);
+}
+
+/*****************************************************************************/
+unsigned int
+histogram_percentile(const struct histogram *self, unsigned int percentile)
+{
+    tui64 rank;
+    tui64 seen;
+    unsigned int index;
+    unsigned int rv;
+
+    if (self->count == 0)
+    {
+        return 0;
+    }
+    if (percentile > 100)
+    {
+        percentile = 100;
+    }
+    /* rank of the wanted value, counting from 1 */
+    rank = ((tui64)self->count * percentile + 99) / 100;
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    seen = 0;
+    rv = self->max;
+    for (index = 0; index < HISTOGRAM_BUCKETS; ++index)
+    {
+        seen += self->buckets[index];
+        if (seen >= rank)
+        {
+            rv = bucket_upper_bound(index);
+            break;
+        }
+    }
+
+    if (rv > self->max)
+    {
+        rv = self->max;
+    }
+    if (rv < self->min)
+    {
+        rv = self->min;
+    }
+    return rv;
+}
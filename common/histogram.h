@@ -0,0 +1,90 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/histogram.h
+ * @brief   Fixed-size log-linear histogram of unsigned values
+ *
+ * Values are counted in buckets which are exact below 8, and above
+ * that split each power of two into 8 equal sub-buckets. This gives
+ * a worst-case relative error of 12.5% over the full 32-bit range
+ * with a fixed number of buckets, and recording a value is a few
+ * instructions with no allocation.
+ *
+ * A histogram is not thread-safe.
+ */
+
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include "arch.h"
+
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+/* Exact buckets, plus SUB_BUCKETS for each power of two from 8 to 2^31 */
+#define HISTOGRAM_BUCKETS \
+    (HISTOGRAM_SUB_BUCKETS + \
+     (32 - HISTOGRAM_SUB_BUCKET_BITS) * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram
+{
+    unsigned int count;
+    unsigned int min;
+    unsigned int max;
+    tui64 sum;
+    unsigned int buckets[HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Initialise (or reset) a histogram
+ *
+ * @param self histogram
+ */
+void
+histogram_init(struct histogram *self);
+
+/**
+ * Add a value to a histogram
+ *
+ * @param self histogram
+ * @param value Value to add
+ */
+void
+histogram_record(struct histogram *self, unsigned int value);
+
+/**
+ * Get the mean of the values in a histogram
+ *
+ * @param self histogram
+ * @return mean, rounded down, or 0 for an empty histogram
+ */
+unsigned int
+histogram_mean(const struct histogram *self);
+
+/**
+ * Get a percentile from a histogram
+ *
+ * The returned value is the upper bound of the bucket containing the
+ * requested percentile, clamped to the recorded min and max.
+ *
+ * @param self histogram
+ * @param percentile Percentile to get, from 0 to 100
+ * @return value, or 0 for an empty histogram
+ */
+unsigned int
+histogram_percentile(const struct histogram *self, unsigned int percentile);
+
+#endif
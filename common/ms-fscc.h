@@ -44,6 +44,17 @@ enum FS_INFORMATION_CLASS
     FileStandardInformation      = 5   /* Query */
 };
 
+/*
+ * File system information classes (section 2.5)
+ */
+enum FS_VOLUME_INFORMATION_CLASS
+{
+    FileFsAttributeInformation   = 5   /* Query */
+};
+
+/* File system attributes (section 2.5.1) */
+#define FILE_CASE_SENSITIVE_SEARCH      0x00000001
+
 /*
  * Size of structs above without trailing RESERVED fields (MS-RDPEFS
  * 2.2.3.3.8)
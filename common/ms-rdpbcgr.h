@@ -151,6 +151,8 @@
 #define RDP_LOGON_NORMAL               0x0033
 #define RDP_COMPRESSION                0x0080
 #define RDP_LOGON_BLOB                 0x0100
+#define RDP_COMPRESSION_TYPE_MASK      0x1E00
+#define RDP_COMPRESSION_TYPE_SHIFT     9
 #define RDP_LOGON_LEAVE_AUDIO          0x2000
 #define RDP_LOGON_RAIL                 0x8000
 
@@ -594,6 +596,12 @@
 #define RDP_MPPC_FLUSH                 0x80
 #define RDP_MPPC_DICT_SIZE             8192 /* RDP 4.0 | MS-RDPBCGR 3.1.8 */
 
+/* Compression Types (3.1.8) */
+#define PACKET_COMPR_TYPE_8K           0x00 /* RDP 4.0 */
+#define PACKET_COMPR_TYPE_64K          0x01 /* RDP 5.0 */
+#define PACKET_COMPR_TYPE_RDP6         0x02
+#define PACKET_COMPR_TYPE_RDP61        0x03
+
 /* largePointerSupprtFlags (2.2.7.2.7) */
 #define LARGE_POINTER_FLAG_96x96   0x00000001
 #define LARGE_POINTER_FLAG_384x384 0x00000002
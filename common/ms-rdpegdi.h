@@ -56,4 +56,10 @@
 #define TS_CACHE_BRUSH                      0x07
 #define TS_CACHE_BITMAP_COMPRESSED_REV3     0x08
 
+/* RDP 6.1 Compressed Data: Level1ComprFlags (RDP61_COMPRESSED_DATA) */
+#define L1_COMPRESSED                   0x01
+#define L1_NO_COMPRESSION               0x02
+#define L1_PACKET_AT_FRONT              0x04
+#define L1_INNER_COMPRESSION            0x10
+
 #endif /* MS_RDPEGDI_H */
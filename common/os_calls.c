@@ -1530,6 +1530,34 @@ g_sck_send_fd_set(int sck, const void *ptr, unsigned int len,
     return rv;
 }
 
+/*****************************************************************************/
+int
+g_sck_send_iov(int sck, const void *const bufs[],
+               const unsigned int lens[], unsigned int count)
+{
+#if defined(_WIN32)
+    if (count == 0)
+    {
+        return 0;
+    }
+    return send(sck, (const char *)bufs[0], lens[0], 0);
+#else
+    struct msghdr msg = {0};
+    struct iovec iov[G_SCK_MAX_IOV];
+    unsigned int index;
+
+    count = MIN(count, G_SCK_MAX_IOV);
+    for (index = 0; index < count; index++)
+    {
+        iov[index].iov_base = (void *)bufs[index];
+        iov[index].iov_len = lens[index];
+    }
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(sck, &msg, 0);
+#endif
+}
+
 /*****************************************************************************/
 /* returns boolean */
 int
@@ -2680,6 +2708,18 @@ g_file_delete(const char *filename)
 #endif
 }
 
+/*****************************************************************************/
+/* returns non zero if the file was renamed */
+int
+g_file_rename(const char *oldname, const char *newname)
+{
+#if defined(_WIN32)
+    return MoveFileExA(oldname, newname, MOVEFILE_REPLACE_EXISTING);
+#else
+    return rename(oldname, newname) != -1;
+#endif
+}
+
 /*****************************************************************************/
 /* returns file size, -1 on error */
 int
@@ -3825,6 +3865,23 @@ g_time3(void)
 #endif
 }
 
+/*****************************************************************************/
+/* returns time in microseconds from a clock which isn't affected by
+   changes to the system time. Only useful for measuring intervals.
+   does not work in win32 */
+tui64
+g_time_us(void)
+{
+#if defined(_WIN32)
+    return 0;
+#else
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return ((tui64)tp.tv_sec * 1000000) + (tp.tv_nsec / 1000);
+#endif
+}
+
 /******************************************************************************/
 /******************************************************************************/
 struct bmp_magic
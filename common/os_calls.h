@@ -38,10 +38,14 @@ struct proc_exit_status
 
 struct list;
 
+/* Most buffers g_sck_send_iov() sends in one call */
+#define G_SCK_MAX_IOV 64
+
 #define g_tcp_can_recv g_sck_can_recv
 #define g_tcp_can_send g_sck_can_send
 #define g_tcp_recv g_sck_recv
 #define g_tcp_send g_sck_send
+#define g_tcp_send_iov g_sck_send_iov
 #define g_tcp_close g_sck_close
 #define g_tcp_last_error_would_block g_sck_last_error_would_block
 #define g_tcp_set_non_blocking g_sck_set_non_blocking
@@ -124,6 +128,19 @@ int      g_sck_recv_fd_set(int sck, void *ptr, unsigned int len,
  */
 int      g_sck_send_fd_set(int sck, const void *ptr, unsigned int len,
                            int fds[], unsigned int fdcount);
+/**
+ * Sends data from several buffers with a single call
+ *
+ * @param sck - Socket to send data on
+ * @param bufs - Buffers to send, in order
+ * @param lens - Length of each buffer
+ * @param count - Number of buffers. At most G_SCK_MAX_IOV are sent
+ * @return Bytes sent, or < 0 for error.
+ *
+ * As with g_sck_send(), fewer bytes than requested may be sent.
+ */
+int      g_sck_send_iov(int sck, const void *const bufs[],
+                        const unsigned int lens[], unsigned int count);
 int      g_sck_last_error_would_block(int sck);
 int      g_sck_socket_ok(int sck);
 /**
@@ -262,6 +279,7 @@ int      g_create_dir(const char *dirname);
 int      g_create_path(const char *path);
 int      g_remove_dir(const char *dirname);
 int      g_file_delete(const char *filename);
+int      g_file_rename(const char *oldname, const char *newname);
 int      g_file_get_size(const char *filename);
 int      g_file_get_device_number(const char *filename);
 int      g_file_get_inode_num(const char *filename);
@@ -396,6 +414,7 @@ int      g_check_user_in_group(const char *username, int gid, int *ok);
 int      g_time1(void);
 int      g_time2(void);
 int      g_time3(void);
+tui64    g_time_us(void);
 int      g_save_to_bmp(const char *filename, char *data, int stride_bytes,
                        int width, int height, int depth, int bits_per_pixel);
 void    *g_shmat(int shmid);
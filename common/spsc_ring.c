@@ -0,0 +1,211 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/spsc_ring.c
+ * @brief   Lock-free single-producer/single-consumer ring of pointers
+ *
+ * The ring is a power-of-two sized array of item pointers, with two
+ * free-running indexes. 'writer' is only ever written by the producer,
+ * and 'reader' is only ever written by the consumer. The number of
+ * items in the ring is (writer - reader).
+ *
+ * The producer stores an item before publishing the new writer index
+ * with release semantics. The consumer loads the writer index with
+ * acquire semantics before reading the item, and the same happens
+ * in reverse for reader.
+ *
+ * Each side keeps a private copy of the other side's index, and only
+ * reloads it when the ring looks full (producer) or empty (consumer).
+ * The two sides are kept on separate cache lines so they don't
+ * bounce a line between CPUs on every operation.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdlib.h>
+
+#include "spsc_ring.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#error "spsc_ring needs __atomic builtins"
+#endif
+
+#define CACHE_LINE_BYTES 64
+
+/* Largest ring we'll create. Keeps the index arithmetic in range */
+#define MAX_RING_ITEMS (1U << 24)
+
+struct spsc_ring
+{
+    char pad0[CACHE_LINE_BYTES];
+    /* Producer side */
+    unsigned int writer;
+    unsigned int reader_cache;
+    char pad1[CACHE_LINE_BYTES - 2 * sizeof(unsigned int)];
+    /* Consumer side */
+    unsigned int reader;
+    unsigned int writer_cache;
+    char pad2[CACHE_LINE_BYTES - 2 * sizeof(unsigned int)];
+    /* Constant after creation */
+    unsigned int size;
+    unsigned int mask;
+    void **items;
+    /** Item destructor function, or NULL */
+    fifo_item_destructor item_destructor;
+    char pad3[CACHE_LINE_BYTES];
+};
+
+/*****************************************************************************/
+struct spsc_ring *
+spsc_ring_create(unsigned int min_items,
+                 fifo_item_destructor item_destructor)
+{
+    struct spsc_ring *result;
+    unsigned int size = 1;
+
+    if (min_items > MAX_RING_ITEMS)
+    {
+        return NULL;
+    }
+    while (size < min_items)
+    {
+        size <<= 1;
+    }
+
+    result = (struct spsc_ring *)calloc(1, sizeof(struct spsc_ring));
+    if (result != NULL)
+    {
+        result->items = (void **)calloc(size, sizeof(void *));
+        if (result->items == NULL)
+        {
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            result->size = size;
+            result->mask = size - 1;
+            result->item_destructor = item_destructor;
+        }
+    }
+    return result;
+}
+
+/*****************************************************************************/
+void
+spsc_ring_delete(struct spsc_ring *self, void *closure)
+{
+    if (self != NULL)
+    {
+        spsc_ring_clear(self, closure);
+        free(self->items);
+        free(self);
+    }
+}
+
+/*****************************************************************************/
+void
+spsc_ring_clear(struct spsc_ring *self, void *closure)
+{
+    if (self != NULL)
+    {
+        unsigned int i;
+        unsigned int writer = LOAD_ACQUIRE(&self->writer);
+
+        if (self->item_destructor != NULL)
+        {
+            for (i = self->reader; i != writer; ++i)
+            {
+                (*self->item_destructor)(self->items[i & self->mask],
+                                         closure);
+            }
+        }
+        self->reader = writer;
+        self->writer_cache = writer;
+        self->reader_cache = writer;
+    }
+}
+
+/*****************************************************************************/
+int
+spsc_ring_add_item(struct spsc_ring *self, void *item)
+{
+    unsigned int writer;
+
+    if (self == NULL || item == NULL)
+    {
+        return 0;
+    }
+    writer = self->writer;
+    if (writer - self->reader_cache == self->size)
+    {
+        self->reader_cache = LOAD_ACQUIRE(&self->reader);
+        if (writer - self->reader_cache == self->size)
+        {
+            return 0;
+        }
+    }
+    self->items[writer & self->mask] = item;
+    STORE_RELEASE(&self->writer, writer + 1);
+    return 1;
+}
+
+/*****************************************************************************/
+void *
+spsc_ring_remove_item(struct spsc_ring *self)
+{
+    unsigned int reader;
+    void *item;
+
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    reader = self->reader;
+    if (reader == self->writer_cache)
+    {
+        self->writer_cache = LOAD_ACQUIRE(&self->writer);
+        if (reader == self->writer_cache)
+        {
+            return NULL;
+        }
+    }
+    item = self->items[reader & self->mask];
+    STORE_RELEASE(&self->reader, reader + 1);
+    return item;
+}
+
+/*****************************************************************************/
+int
+spsc_ring_is_empty(struct spsc_ring *self)
+{
+    return (self == NULL ||
+            self->reader == LOAD_ACQUIRE(&self->writer));
+}
+
+/*****************************************************************************/
+int
+spsc_ring_is_full(struct spsc_ring *self)
+{
+    return (self != NULL &&
+            self->writer - LOAD_ACQUIRE(&self->reader) == self->size);
+}
@@ -0,0 +1,112 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/spsc_ring.h
+ * @brief   Lock-free single-producer/single-consumer ring of pointers
+ *
+ * Declares a bounded FIFO-queue for void * pointers which can be shared
+ * between exactly two threads without locking. One thread may only
+ * add items, the other may only remove them.
+ *
+ * Items are handled in the same way as for a struct fifo.
+ */
+
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+#include "fifo.h"
+
+struct spsc_ring;
+
+/**
+ * Create new ring
+ *
+ * @param min_items Minimum number of items the ring can hold. This is
+ *                  rounded up to a power of two
+ * @param item_destructor Destructor for ring items, or NULL for none
+ * @return ring, or NULL if no memory
+ */
+struct spsc_ring *
+spsc_ring_create(unsigned int min_items,
+                 fifo_item_destructor item_destructor);
+
+/**
+ * Delete an existing ring
+ *
+ * Any existing entries on the ring are passed in order to the
+ * item destructor specified when the ring was created.
+ *
+ * Neither the producer nor the consumer may be using the ring.
+ *
+ * @param self ring to delete (may be NULL)
+ * @param closure Additional parameter for ring item destructor
+ */
+void
+spsc_ring_delete(struct spsc_ring *self, void *closure);
+
+/**
+ * Clear(empty) an existing ring
+ *
+ * Any existing entries on the ring are passed in order to the
+ * item destructor specified when the ring was created.
+ *
+ * Neither the producer nor the consumer may be using the ring.
+ *
+ * @param self ring to clear (may be NULL)
+ * @param closure Additional parameter for ring item destructor
+ */
+void
+spsc_ring_clear(struct spsc_ring *self, void *closure);
+
+/** Add an item to a ring. Producer thread only.
+ * @param self ring
+ * @param item Item to add
+ * @return 1 if successful, 0 if the ring is full, or tried to add NULL
+ */
+int
+spsc_ring_add_item(struct spsc_ring *self, void *item);
+
+/** Remove an item from a ring. Consumer thread only.
+ * @param self ring
+ * @return item if successful, NULL for no items in ring
+ */
+void *
+spsc_ring_remove_item(struct spsc_ring *self);
+
+/** Is ring empty?
+ *
+ * Only reliable when called from the consumer thread, as the producer
+ * may add an item at any time.
+ *
+ * @param self ring
+ * @return 1 if ring is empty, 0 if not
+ */
+int
+spsc_ring_is_empty(struct spsc_ring *self);
+
+/** Is ring full?
+ *
+ * Only reliable when called from the producer thread, as the consumer
+ * may remove an item at any time.
+ *
+ * @param self ring
+ * @return 1 if ring is full, 0 if not
+ */
+int
+spsc_ring_is_full(struct spsc_ring *self);
+
+#endif
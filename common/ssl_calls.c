@@ -63,6 +63,7 @@ struct ssl_tls
     struct trans *trans;
     tintptr rwo; /* wait obj */
     int error_logged; /* Error has already been logged */
+    int ktls_send; /* kernel is encrypting what we send */
 };
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
@@ -1026,7 +1027,7 @@ log_encrypted_file_unsupported(char *buf, int size, int rwflag, void *u)
 
 int
 ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
-               const char *tls_ciphers)
+               const char *tls_ciphers, int ktls)
 {
     int connection_status;
     long options = 0;
@@ -1074,6 +1075,23 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
      */
     options |= SSL_OP_DONT_INSERT_EMPTY_FRAGMENTS;
 
+    /**
+     * SSL_OP_ENABLE_KTLS:
+     *
+     * Once the handshake is done, pass the keys to the kernel TLS ULP
+     * if the kernel and the negotiated cipher allow it. If not,
+     * OpenSSL carries on doing the encryption itself.
+     */
+    if (ktls)
+    {
+#if defined(SSL_OP_ENABLE_KTLS)
+        options |= SSL_OP_ENABLE_KTLS;
+#else
+        LOG(LOG_LEVEL_WARNING, "Kernel TLS was requested, but is not "
+            "supported by %s", get_openssl_version());
+#endif
+    }
+
     self->ctx = SSL_CTX_new(SSLv23_server_method());
     if (self->ctx == NULL)
     {
@@ -1225,6 +1243,16 @@ ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
 
     LOG(LOG_LEVEL_TRACE, "TLS connection accepted");
 
+#if defined(SSL_OP_ENABLE_KTLS)
+    if (ktls)
+    {
+        self->ktls_send = BIO_get_ktls_send(SSL_get_wbio(self->ssl));
+        LOG(LOG_LEVEL_INFO, "Kernel TLS %s for sending with cipher %s",
+            self->ktls_send ? "enabled" : "not available",
+            SSL_get_cipher_name(self->ssl));
+    }
+#endif
+
     return 0;
 }
 
@@ -1422,6 +1450,13 @@ ssl_get_rwo(const struct ssl_tls *ssl)
     return ssl->rwo;
 }
 
+/*****************************************************************************/
+int
+ssl_tls_ktls_send(const struct ssl_tls *ssl)
+{
+    return ssl->ktls_send;
+}
+
 /*****************************************************************************/
 int
 ssl_get_protocols_from_string(const char *str, long *ssl_protocols)
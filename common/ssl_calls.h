@@ -88,9 +88,21 @@ ssl_gen_key_xrdp1(int key_size_in_bits, const char *exp, int exp_len,
 /* xrdp_tls.c */
 struct ssl_tls *
 ssl_tls_create(struct trans *trans, const char *key, const char *cert);
+/**
+ * Performs the server side of a TLS handshake
+ *
+ * @param self TLS object
+ * @param ssl_protocols SSL_OP_NO_* flags for protocols to disable
+ * @param tls_ciphers OpenSSL cipher list, or NULL
+ * @param ktls Try to use kernel TLS once the handshake is complete
+ * @return 0 for success
+ *
+ * Kernel TLS not being available is not an error. Use
+ * ssl_tls_ktls_send() to find out if it's being used.
+ */
 int
 ssl_tls_accept(struct ssl_tls *self, long ssl_protocols,
-               const char *tls_ciphers);
+               const char *tls_ciphers, int ktls);
 int
 ssl_tls_disconnect(struct ssl_tls *self);
 void
@@ -111,5 +123,16 @@ const char *
 get_openssl_version(void);
 tintptr
 ssl_get_rwo(const struct ssl_tls *ssl);
+/**
+ * Is the kernel encrypting data we send on this connection?
+ *
+ * If so, application data can be written straight to the socket,
+ * bypassing OpenSSL.
+ *
+ * @param ssl TLS object
+ * @return boolean
+ */
+int
+ssl_tls_ktls_send(const struct ssl_tls *ssl);
 
 #endif
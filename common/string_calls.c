@@ -1406,6 +1406,38 @@ utf8_as_utf16_word_count(const char *utf8str, unsigned int len)
     return rv;
 }
 
+/*****************************************************************************/
+unsigned int
+utf8_whole_chars_len(const char *utf8str, unsigned int len)
+{
+    const unsigned char *cp = (const unsigned char *)utf8str;
+    unsigned int i;
+    unsigned int c;
+    unsigned int seq_len;
+
+    /* Look back for the start of the last character */
+    for (i = 1; i <= len && i <= MAXLEN_UTF8_CHAR; ++i)
+    {
+        c = cp[len - i];
+        if (c < 0x80)
+        {
+            break;
+        }
+        if (c >= 0xc0)
+        {
+            seq_len = (c < 0xe0) ? 2 : (c < 0xf0) ? 3 : (c < 0xf8) ? 4 : 1;
+            if (seq_len > i)
+            {
+                return len - i;
+            }
+            break;
+        }
+        /* Continuation character - keep looking */
+    }
+
+    return len;
+}
+
 /*****************************************************************************/
 int
 utf8_add_char_at(char *utf8str, unsigned int len, char32_t c32,
@@ -378,6 +378,19 @@ utf8_char_count(const char *utf8str);
 unsigned int
 utf8_as_utf16_word_count(const char *utf8str, unsigned int len);
 
+/**
+ * Returns the length of a UTF-8 buffer, less any character at the end
+ * which is cut short
+ * @param utf8str UTF-8 buffer (need not be terminated)
+ * @param len Length of buffer
+ * @result Bytes of the buffer which can be decoded now. The rest must
+ *         be kept until more data arrives.
+ *
+ * This is for converting text which arrives in chunks.
+ */
+unsigned int
+utf8_whole_chars_len(const char *utf8str, unsigned int len);
+
 /**
  * Add a Unicode character into a UTF-8 string
  * @param utf8str Pointer to UTF-8 string
@@ -36,6 +36,10 @@
 #define CONNECT_TERM_POLL_MS 3000
 /** Time we wait before another connect() attempt if one fails immediately */
 #define CONNECT_DELAY_ON_FAIL_MS 2000
+/** Most queued streams sent in one system call */
+#define TRANS_MAX_IOV G_SCK_MAX_IOV
+/** Largest TLS record payload (RFC 8446 5.1) */
+#define TRANS_TLS_RECORD_BYTES 16384
 
 /*****************************************************************************/
 static int
@@ -117,6 +121,26 @@ trans_create(int mode, int in_size, int out_size)
     return self;
 }
 
+/*****************************************************************************/
+static void
+trans_free_waiting(struct trans *self)
+{
+    struct stream *temp_s;
+
+    while (self->wait_s != 0)
+    {
+        temp_s = self->wait_s;
+        if (temp_s->source != 0)
+        {
+            temp_s->source[0] -= (int) (temp_s->end - temp_s->p);
+        }
+        self->wait_s = temp_s->next;
+        free_stream(temp_s);
+    }
+    self->wait_s_tail = 0;
+    self->wait_bytes = 0;
+}
+
 /*****************************************************************************/
 void
 trans_delete(struct trans *self)
@@ -132,8 +156,10 @@ trans_delete(struct trans *self)
         self->extra_destructor(self);
     }
 
+    trans_detach_event_loop(self);
     free_stream(self->in_s);
     free_stream(self->out_s);
+    trans_free_waiting(self);
 
     if (self->sck >= 0)
     {
@@ -214,7 +240,8 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
         return 1;
     }
 
-    if ((self->si != 0) && (self->si->source[self->my_source] > MAX_SBYTES))
+    if (self->read_paused ||
+            (self->si != 0 && self->si->source[self->my_source] > MAX_SBYTES))
     {
     }
     else
@@ -235,69 +262,186 @@ trans_get_wait_objs_rw(struct trans *self, tbus *robjs, int *rcount,
 }
 
 /*****************************************************************************/
+/* Events an attached event loop should wait for */
 static int
-trans_send_waiting(struct trans *self, int block)
+trans_loop_events(const struct trans *self)
+{
+    return (self->read_paused ? 0 : EVENT_LOOP_READ) |
+           (self->wait_s != 0 ? EVENT_LOOP_WRITE : 0);
+}
+
+/*****************************************************************************/
+/* Adds a stream to the end of the output queue. The data from s->p to
+ * s->end will be sent */
+static void
+trans_queue_s(struct trans *self, struct stream *s)
+{
+    s->next = NULL;
+    s->source = NULL;
+    self->wait_bytes += (int) (s->end - s->p);
+    if (self->si != 0)
+    {
+        if ((self->si->cur_source != XRDP_SOURCE_NONE) &&
+                (self->si->cur_source != self->my_source))
+        {
+            self->si->source[self->si->cur_source] += (int) (s->end - s->p);
+            s->source = self->si->source + self->si->cur_source;
+        }
+    }
+    if (self->wait_s == 0)
+    {
+        self->wait_s = s;
+        if (self->loop != NULL)
+        {
+            event_loop_modify(self->loop, self->sck, trans_loop_events(self));
+        }
+    }
+    else
+    {
+        self->wait_s_tail->next = s;
+    }
+    self->wait_s_tail = s;
+}
+
+/*****************************************************************************/
+/* Removes bytes which have been sent from the front of the output queue */
+static void
+trans_consume_waiting(struct trans *self, int sent)
+{
+    struct stream *temp_s;
+    int bytes;
+
+    while (sent > 0 && self->wait_s != 0)
+    {
+        temp_s = self->wait_s;
+        bytes = MIN((int) (temp_s->end - temp_s->p), sent);
+        temp_s->p += bytes;
+        sent -= bytes;
+        self->wait_bytes -= bytes;
+        if (temp_s->source != 0)
+        {
+            temp_s->source[0] -= bytes;
+        }
+        if (temp_s->p >= temp_s->end)
+        {
+            self->wait_s = temp_s->next;
+            free_stream(temp_s);
+        }
+    }
+    if (self->wait_s == 0 && self->wait_s_tail != 0)
+    {
+        self->wait_s_tail = 0;
+        if (self->loop != NULL)
+        {
+            event_loop_modify(self->loop, self->sck, trans_loop_events(self));
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Sends small PDUs from the front of the output queue as one TLS
+ * record, rather than a record each */
+static int
+trans_tls_send_waiting(struct trans *self)
 {
+    char record[TRANS_TLS_RECORD_BYTES];
     struct stream *temp_s;
     int bytes;
+    int total;
+
+    total = 0;
+    for (temp_s = self->wait_s; temp_s != 0; temp_s = temp_s->next)
+    {
+        bytes = MIN((int) (temp_s->end - temp_s->p),
+                    TRANS_TLS_RECORD_BYTES - total);
+        g_memcpy(record + total, temp_s->p, bytes);
+        total += bytes;
+        if (total >= TRANS_TLS_RECORD_BYTES)
+        {
+            break;
+        }
+    }
+    return self->trans_send(self, record, total);
+}
+
+/*****************************************************************************/
+/* Makes one attempt to send from the front of the output queue.
+ * Returns as for trans_send */
+static int
+trans_send_waiting_once(struct trans *self)
+{
+    const void *bufs[TRANS_MAX_IOV];
+    unsigned int lens[TRANS_MAX_IOV];
+    struct stream *temp_s;
+    unsigned int count;
+
+    temp_s = self->wait_s;
+    if (self->trans_send == trans_tcp_send)
+    {
+        /* as much of the queue as the socket will take */
+        count = 0;
+        while (temp_s != 0 && count < TRANS_MAX_IOV)
+        {
+            bufs[count] = temp_s->p;
+            lens[count] = (unsigned int) (temp_s->end - temp_s->p);
+            count++;
+            temp_s = temp_s->next;
+        }
+        return g_tcp_send_iov(self->sck, bufs, lens, count);
+    }
+    if (self->trans_send == trans_tls_send && temp_s->next != 0 &&
+            temp_s->end - temp_s->p < TRANS_TLS_RECORD_BYTES)
+    {
+        return trans_tls_send_waiting(self);
+    }
+    /* other transports may need to see PDUs one at a time */
+    return self->trans_send(self, temp_s->p, (int) (temp_s->end - temp_s->p));
+}
+
+/*****************************************************************************/
+static int
+trans_send_waiting(struct trans *self, int block)
+{
     int sent;
     int timeout;
-    int cont;
 
     timeout = block ? 100 : 0;
-    cont = 1;
-    while (cont)
+    while (self->wait_s != 0)
     {
-        if (self->wait_s != 0)
+        if (!g_tcp_can_send(self->sck, timeout))
         {
-            temp_s = self->wait_s;
-            if (g_tcp_can_send(self->sck, timeout))
+            if (!block)
             {
-                bytes = (int) (temp_s->end - temp_s->p);
-                sent = self->trans_send(self, temp_s->p, bytes);
-                if (sent > 0)
-                {
-                    temp_s->p += sent;
-                    if (temp_s->source != 0)
-                    {
-                        temp_s->source[0] -= sent;
-                    }
-                    if (temp_s->p >= temp_s->end)
-                    {
-                        self->wait_s = temp_s->next;
-                        free_stream(temp_s);
-                    }
-                }
-                else if (sent == 0)
-                {
-                    return 1;
-                }
-                else
-                {
-                    if (!g_tcp_last_error_would_block(self->sck))
-                    {
-                        return 1;
-                    }
-                }
+                break;
             }
-            else if (block)
+            /* check for term here */
+            if (self->is_term != 0)
             {
-                /* check for term here */
-                if (self->is_term != 0)
+                if (self->is_term())
                 {
-                    if (self->is_term())
-                    {
-                        /* term */
-                        return 1;
-                    }
+                    /* term */
+                    return 1;
                 }
             }
+            continue;
         }
-        else
+        sent = trans_send_waiting_once(self);
+        if (sent > 0)
+        {
+            trans_consume_waiting(self, sent);
+        }
+        else if (sent == 0)
+        {
+            return 1;
+        }
+        else if (!g_tcp_last_error_would_block(self->sck))
+        {
+            return 1;
+        }
+        else if (!block)
         {
             break;
         }
-        cont = block;
     }
     return 0;
 }
@@ -371,7 +515,9 @@ trans_check_wait_objs(struct trans *self)
     }
     else /* connected server or client (2 or 3) */
     {
-        if (self->si != 0 && self->si->source[self->my_source] > MAX_SBYTES)
+        if (self->read_paused ||
+                (self->si != 0 &&
+                 self->si->source[self->my_source] > MAX_SBYTES))
         {
         }
         else if (self->trans_can_recv(self, self->sck, 0))
@@ -593,53 +739,56 @@ trans_force_write(struct trans *self)
 }
 
 /*****************************************************************************/
-int
-trans_write_copy_s(struct trans *self, struct stream *out_s)
+/* Sends as much as we can of some new data, if there's no output
+ * waiting to go before it. Returns the number of bytes sent, or -1 for
+ * an error */
+static int
+trans_send_new(struct trans *self, const char *data, int size)
 {
-    int size;
     int sent;
-    struct stream *wait_s;
-    struct stream *temp_s;
-    char *out_data;
 
     if (self->status != TRANS_STATUS_UP)
     {
-        return 1;
+        return -1;
     }
     /* try to send any left over */
     if (trans_send_waiting(self, 0) != 0)
     {
         /* error */
         self->status = TRANS_STATUS_DOWN;
-        return 1;
+        return -1;
+    }
+    if (size < 1 || self->wait_s != 0 || !g_tcp_can_send(self->sck, 0))
+    {
+        return 0;
+    }
+    sent = self->trans_send(self, data, size);
+    if (sent > 0)
+    {
+        return sent;
+    }
+    if (sent < 0 && g_tcp_last_error_would_block(self->sck))
+    {
+        return 0;
     }
-    out_data = out_s->data;
-    sent = 0;
+    return -1;
+}
+
+/*****************************************************************************/
+int
+trans_write_copy_s(struct trans *self, struct stream *out_s)
+{
+    int size;
+    int sent;
+    struct stream *wait_s;
+
     size = (int) (out_s->end - out_s->data);
-    if (self->wait_s == 0)
+    sent = trans_send_new(self, out_s->data, size);
+    if (sent < 0)
     {
-        /* if no left over, try to send this new data */
-        if (g_tcp_can_send(self->sck, 0))
-        {
-            sent = self->trans_send(self, out_s->data, size);
-            if (sent > 0)
-            {
-                out_data += sent;
-                size -= sent;
-            }
-            else if (sent == 0)
-            {
-                return 1;
-            }
-            else
-            {
-                if (!g_tcp_last_error_would_block(self->sck))
-                {
-                    return 1;
-                }
-            }
-        }
+        return 1;
     }
+    size -= sent;
     if (size < 1)
     {
         return 0;
@@ -647,31 +796,118 @@ trans_write_copy_s(struct trans *self, struct stream *out_s)
     /* did not send right away, have to copy */
     make_stream(wait_s);
     init_stream(wait_s, size);
-    if (self->si != 0)
-    {
-        if ((self->si->cur_source != XRDP_SOURCE_NONE) &&
-                (self->si->cur_source != self->my_source))
-        {
-            self->si->source[self->si->cur_source] += size;
-            wait_s->source = self->si->source + self->si->cur_source;
-        }
-    }
-    out_uint8a(wait_s, out_data, size);
+    out_uint8a(wait_s, out_s->data + sent, size);
     s_mark_end(wait_s);
     wait_s->p = wait_s->data;
-    if (self->wait_s == 0)
+    trans_queue_s(self, wait_s);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+trans_write_owned_s(struct trans *self, struct stream *out_s)
+{
+    int size;
+    int sent;
+
+    size = (int) (out_s->end - out_s->data);
+    sent = trans_send_new(self, out_s->data, size);
+    if (sent < 0)
     {
-        self->wait_s = wait_s;
+        free_stream(out_s);
+        return 1;
     }
-    else
+    if (sent >= size)
     {
-        temp_s = self->wait_s;
-        while (temp_s->next != 0)
+        free_stream(out_s);
+        return 0;
+    }
+    out_s->p = out_s->data + sent;
+    trans_queue_s(self, out_s);
+    return 0;
+}
+
+/*****************************************************************************/
+/* As trans_send_new(), for several buffers */
+static int
+trans_send_new_iov(struct trans *self, const void *const bufs[],
+                   const unsigned int lens[], unsigned int count)
+{
+    int sent;
+
+    /* try to send any left over */
+    if (trans_send_new(self, NULL, 0) != 0)
+    {
+        return -1;
+    }
+    if (count < 1 || self->wait_s != 0)
+    {
+        return 0;
+    }
+    if (self->trans_send != trans_tcp_send)
+    {
+        /* other transports take one buffer at a time */
+        return trans_send_new(self, (const char *) bufs[0], (int) lens[0]);
+    }
+    if (!g_tcp_can_send(self->sck, 0))
+    {
+        return 0;
+    }
+    sent = g_tcp_send_iov(self->sck, bufs, lens, MIN(count, TRANS_MAX_IOV));
+    if (sent > 0)
+    {
+        return sent;
+    }
+    if (sent < 0 && g_tcp_last_error_would_block(self->sck))
+    {
+        return 0;
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+int
+trans_write_iov(struct trans *self, const void *const bufs[],
+                const unsigned int lens[], unsigned int count)
+{
+    struct stream *wait_s;
+    unsigned int index;
+    int skip;
+    int size;
+    int bytes;
+
+    skip = trans_send_new_iov(self, bufs, lens, count);
+    if (skip < 0)
+    {
+        return 1;
+    }
+    size = 0;
+    for (index = 0; index < count; index++)
+    {
+        size += (int) lens[index];
+    }
+    size -= skip;
+    if (size < 1)
+    {
+        return 0;
+    }
+    /* did not all send right away, have to copy the rest */
+    make_stream(wait_s);
+    init_stream(wait_s, size);
+    for (index = 0; index < count; index++)
+    {
+        bytes = (int) lens[index];
+        if (skip >= bytes)
         {
-            temp_s = temp_s->next;
+            skip -= bytes;
+            continue;
         }
-        temp_s->next = wait_s;
+        out_uint8a(wait_s, (const char *) bufs[index] + skip, bytes - skip);
+        skip = 0;
     }
+    s_mark_end(wait_s);
+    wait_s->p = wait_s->data;
+    trans_queue_s(self, wait_s);
     return 0;
 }
 
@@ -1034,7 +1270,7 @@ trans_get_out_s(struct trans *self, int size)
 /* returns error */
 int
 trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
-                   long ssl_protocols, const char *tls_ciphers)
+                   long ssl_protocols, const char *tls_ciphers, int ktls)
 {
     self->tls = ssl_tls_create(self, key, cert);
     if (self->tls == NULL)
@@ -1043,7 +1279,7 @@ trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
         return 1;
     }
 
-    if (ssl_tls_accept(self->tls, ssl_protocols, tls_ciphers) != 0)
+    if (ssl_tls_accept(self->tls, ssl_protocols, tls_ciphers, ktls) != 0)
     {
         LOG(LOG_LEVEL_ERROR, "trans_set_tls_mode: ssl_tls_accept failed");
         return 1;
@@ -1053,6 +1289,12 @@ trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
     self->trans_recv = trans_tls_recv;
     self->trans_send = trans_tls_send;
     self->trans_can_recv = trans_tls_can_recv;
+    if (ssl_tls_ktls_send(self->tls))
+    {
+        /* the kernel encrypts anything we send, so the output queue
+         * can be sent as it is with plain socket calls */
+        self->trans_send = trans_tcp_send;
+    }
 
     self->ssl_protocol = ssl_get_version(self->tls);
     self->cipher_name = ssl_get_cipher_name(self->tls);
@@ -1077,3 +1319,51 @@ trans_shutdown_tls_mode(struct trans *self)
 
     return 0;
 }
+
+/*****************************************************************************/
+int
+trans_attach_event_loop(struct trans *self, struct event_loop *loop,
+                        event_loop_obj_proc proc, void *arg)
+{
+    if (self->status != TRANS_STATUS_UP || self->tls != NULL ||
+            self->si != NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "trans_attach_event_loop: "
+            "transport can't be used with an event loop");
+        return 1;
+    }
+    trans_detach_event_loop(self);
+    if (event_loop_add(loop, self->sck, trans_loop_events(self),
+                       proc, arg) != 0)
+    {
+        return 1;
+    }
+    self->loop = loop;
+    return 0;
+}
+
+/*****************************************************************************/
+void
+trans_detach_event_loop(struct trans *self)
+{
+    if (self->loop != NULL)
+    {
+        event_loop_remove(self->loop, self->sck);
+        self->loop = NULL;
+    }
+}
+
+/*****************************************************************************/
+void
+trans_set_read_paused(struct trans *self, int paused)
+{
+    paused = (paused != 0);
+    if (self->read_paused != paused)
+    {
+        self->read_paused = paused;
+        if (self->loop != NULL)
+        {
+            event_loop_modify(self->loop, self->sck, trans_loop_events(self));
+        }
+    }
+}
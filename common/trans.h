@@ -22,6 +22,7 @@
 #define TRANS_H
 
 #include "arch.h"
+#include "event_loop.h"
 #include "parse.h"
 
 #define TRANS_MODE_TCP 1 /* tcp6 if defined, else tcp4 */
@@ -103,7 +104,10 @@ struct trans
     struct stream *out_s;
     char *listen_filename;
     tis_term is_term; /* used to test for exit */
-    struct stream *wait_s;
+    struct stream *wait_s; /* output waiting to be sent, oldest first */
+    struct stream *wait_s_tail; /* last stream on wait_s */
+    int wait_bytes; /* bytes waiting to be sent on wait_s */
+    int read_paused; /* set by trans_set_read_paused() */
     int no_stream_init_on_data_in;
     int extra_flags; /* user defined */
     void *extra_data; /* user defined */
@@ -117,6 +121,7 @@ struct trans
     trans_can_recv_proc trans_can_recv;
     struct source_info *si;
     enum xrdp_source my_source;
+    struct event_loop *loop; /* set by trans_attach_event_loop() */
 };
 
 struct trans *
@@ -145,6 +150,39 @@ int
 trans_write_copy(struct trans *self);
 int
 trans_write_copy_s(struct trans *self, struct stream *out_s);
+/**
+ * Sends a stream without copying it
+ *
+ * Anything which can't be sent straight away is queued, as with
+ * trans_write_copy_s(), but the stream itself goes on the queue.
+ *
+ * @param self Transport
+ * @param out_s Stream from make_stream(). The data from out_s->data to
+ *              out_s->end is sent.
+ * @return 0 for success
+ *
+ * The transport owns out_s after this call, whatever the result. It is
+ * freed once it has been sent, or when the transport is deleted.
+ */
+int
+trans_write_owned_s(struct trans *self, struct stream *out_s);
+/**
+ * Sends data from several buffers, copying only what can't be sent
+ * straight away
+ *
+ * On a plain socket, the buffers are written with one call. Whatever
+ * the socket doesn't take is copied into a single stream and queued,
+ * as with trans_write_copy_s().
+ *
+ * @param self Transport
+ * @param bufs Buffers to send, in order
+ * @param lens Length of each buffer
+ * @param count Number of buffers
+ * @return 0 for success
+ */
+int
+trans_write_iov(struct trans *self, const void *const bufs[],
+                const unsigned int lens[], unsigned int count);
 /**
  * Connect the transport to the specified destination
  *
@@ -170,11 +208,63 @@ struct stream *
 trans_get_in_s(struct trans *self);
 struct stream *
 trans_get_out_s(struct trans *self, int size);
+/**
+ * Switch the transport to TLS, as a server
+ *
+ * @param self Transport
+ * @param key Private key file
+ * @param cert Certificate chain file
+ * @param ssl_protocols SSL_OP_NO_* flags for protocols to disable
+ * @param tls_ciphers OpenSSL cipher list, or NULL
+ * @param ktls Use kernel TLS for sending, if the kernel and cipher allow
+ * @return 0 for success
+ *
+ * With kernel TLS, the kernel encrypts whatever is written to the
+ * socket, so output goes out with plain socket calls.
+ */
 int
 trans_set_tls_mode(struct trans *self, const char *key, const char *cert,
-                   long ssl_protocols, const char *tls_ciphers);
+                   long ssl_protocols, const char *tls_ciphers, int ktls);
 int
 trans_shutdown_tls_mode(struct trans *self);
+/**
+ * Register a transport with an event loop
+ *
+ * The transport's socket is waited for by the loop, rather than being
+ * returned by trans_get_wait_objs(). It is waited for on writes only
+ * while there is output queued.
+ *
+ * @param self Transport. Must be up, and not using TLS or source_info
+ * @param loop Event loop
+ * @param proc Called when the transport is ready. This will usually
+ *             call trans_check_wait_objs(), and delete the transport
+ *             if that fails
+ * @param arg Argument for proc
+ * @return 0 for success
+ *
+ * The transport is removed from the loop when it is deleted.
+ */
+int
+trans_attach_event_loop(struct trans *self, struct event_loop *loop,
+                        event_loop_obj_proc proc, void *arg);
+/**
+ * Remove a transport from its event loop, if it has one
+ *
+ * @param self Transport
+ */
+void
+trans_detach_event_loop(struct trans *self);
+/**
+ * Stop or restart reading from a transport
+ *
+ * While reading is paused, incoming data is left with the socket, so
+ * the peer will eventually stop sending. Output is still sent.
+ *
+ * @param self Transport
+ * @param paused Non-zero to pause reading, 0 to restart it
+ */
+void
+trans_set_read_paused(struct trans *self, int paused);
 int
 trans_tcp_force_read_s(struct trans *self, struct stream *in_s, int size);
 
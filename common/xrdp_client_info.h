@@ -255,6 +255,8 @@ struct xrdp_client_info
 
     enum unicode_input_state unicode_input_support;
     enum xrdp_capture_code capture_code;
+
+    int use_ktls; /* try kernel TLS for sending */
 };
 
 enum xrdp_encoder_flags
@@ -274,6 +276,6 @@ enum xrdp_encoder_flags
 
 /* yyyymmdd of last incompatible change to xrdp_client_info */
 /* also used for changes to all the xrdp installed headers */
-#define CLIENT_INFO_CURRENT_VERSION 20240805
+#define CLIENT_INFO_CURRENT_VERSION 20261017
 
 #endif
@@ -43,6 +43,8 @@
 
 /* Sockets in XRDP_SOCKET_ROOT_PATH */
 #define SCP_LISTEN_PORT_BASE_STR   "sesman.socket"
+/* qualified by xrdp process ID and session number */
+#define XRDP_STATS_BASE_STR        "xrdp_stats_%d_%d"
 
 /* names of socket files within XRDP_SOCKET_PATH, qualified by
  * display number */
@@ -60,5 +62,6 @@
 #define CHANSRV_API_STR       XRDP_SOCKET_PATH "/" CHANSRV_API_BASE_STR
 #define XRDP_X11RDP_STR       XRDP_SOCKET_PATH "/" XRDP_X11RDP_BASE_STR
 #define XRDP_DISCONNECT_STR   XRDP_SOCKET_PATH "/" XRDP_DISCONNECT_BASE_STR
+#define XRDP_STATS_STR        XRDP_SOCKET_ROOT_PATH "/" XRDP_STATS_BASE_STR
 
 #endif
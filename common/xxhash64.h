@@ -0,0 +1,47 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/xxhash64.h
+ * @brief   64-bit non-cryptographic hash
+ *
+ * An implementation of the XXH64 algorithm. The output matches the
+ * reference implementation for the same input and seed.
+ *
+ * Not suitable where an attacker can choose the input to force
+ * collisions.
+ */
+
+#ifndef _XXHASH64_H
+#define _XXHASH64_H
+
+#include <stddef.h>
+
+#include "arch.h"
+
+/**
+ * Hash a block of memory
+ *
+ * @param data Data to hash
+ * @param len Length of data in bytes
+ * @param seed Starting value. Different seeds give unrelated hashes
+ *             for the same data
+ * @return hash
+ */
+tui64
+xxhash64(const void *data, size_t len, tui64 seed);
+
+#endif
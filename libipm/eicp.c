@@ -262,12 +262,14 @@ eicp_send_create_session_request(struct trans *trans,
                                  unsigned short height,
                                  unsigned char bpp,
                                  const char *shell,
-                                 const char *directory)
+                                 const char *directory,
+                                 int x_server_pid,
+                                 const char *xauth_cookie)
 {
     return libipm_msg_out_simple_send(
                trans,
                (int)E_EICP_CREATE_SESSION_REQUEST,
-               "huyqqyss",
+               "huyqqyssis",
                scp_fd,
                display,
                type,
@@ -275,7 +277,9 @@ eicp_send_create_session_request(struct trans *trans,
                height,
                bpp,
                shell,
-               directory);
+               directory,
+               x_server_pid,
+               xauth_cookie);
 }
 
 /*****************************************************************************/
@@ -289,7 +293,9 @@ eicp_get_create_session_request(struct trans *trans,
                                 unsigned short *height,
                                 unsigned char *bpp,
                                 const char **shell,
-                                const char **directory)
+                                const char **directory,
+                                int *x_server_pid,
+                                const char **xauth_cookie)
 {
     /* Intermediate values */
     uint32_t i_display;
@@ -297,10 +303,11 @@ eicp_get_create_session_request(struct trans *trans,
     uint16_t i_width;
     uint16_t i_height;
     uint8_t i_bpp;
+    int32_t i_x_server_pid;
 
     int rv = libipm_msg_in_parse(
                  trans,
-                 "huyqqyss",
+                 "huyqqyssis",
                  scp_fd,
                  &i_display,
                  &i_type,
@@ -308,7 +315,9 @@ eicp_get_create_session_request(struct trans *trans,
                  &i_height,
                  &i_bpp,
                  shell,
-                 directory);
+                 directory,
+                 &i_x_server_pid,
+                 xauth_cookie);
 
     if (rv == 0)
     {
@@ -318,6 +327,7 @@ eicp_get_create_session_request(struct trans *trans,
         *height = i_height;
         /* bpp is fixed for Xorg session types */
         *bpp = (*type == SCP_SESSION_TYPE_XORG) ? 24 : i_bpp;
+        *x_server_pid = i_x_server_pid;
     }
 
     return rv;
@@ -246,6 +246,9 @@ eicp_send_logout_request(struct trans *trans);
  * @param bpp Session bits-per-pixel (ignored for Xorg sessions)
  * @param shell User program to run. May be ""
  * @param directory Directory to run the program in. May be ""
+ * @param x_server_pid PID of a pooled X server already running on
+ *                     display, or 0 to start a new X server
+ * @param xauth_cookie Cookie for the pooled X server. May be ""
  * @return != 0 for error
  *
  * The UID for the session comes from one of two places:-
@@ -268,7 +271,9 @@ eicp_send_create_session_request(struct trans *trans,
                                  unsigned short height,
                                  unsigned char bpp,
                                  const char *shell,
-                                 const char *directory);
+                                 const char *directory,
+                                 int x_server_pid,
+                                 const char *xauth_cookie);
 
 
 /**
@@ -283,6 +288,8 @@ eicp_send_create_session_request(struct trans *trans,
  * @param[out] bpp Session bits-per-pixel (ignored for Xorg sessions)
  * @param[out] shell User program to run. May be ""
  * @param[out] directory Directory to run the program in. May be ""
+ * @param[out] x_server_pid PID of a pooled X server, or 0
+ * @param[out] xauth_cookie Cookie for the pooled X server. May be ""
  * @return != 0 for error
  *
  * Returned string pointers are valid until scp_msg_in_reset() is
@@ -297,6 +304,8 @@ eicp_get_create_session_request(struct trans *trans,
                                 unsigned short *height,
                                 unsigned char *bpp,
                                 const char **shell,
-                                const char **directory);
+                                const char **directory,
+                                int *x_server_pid,
+                                const char **xauth_cookie);
 
 #endif /* EICP_H */
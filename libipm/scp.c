@@ -55,6 +55,8 @@ msgno_to_str(unsigned short n)
 
         (n == E_SCP_LIST_SESSIONS_REQUEST) ? "SCP_LIST_SESSIONS_REQUEST" :
         (n == E_SCP_LIST_SESSIONS_RESPONSE) ? "SCP_LIST_SESSIONS_RESPONSE" :
+        (n == E_SCP_SESSION_USAGE_REQUEST) ? "SCP_SESSION_USAGE_REQUEST" :
+        (n == E_SCP_SESSION_USAGE_RESPONSE) ? "SCP_SESSION_USAGE_RESPONSE" :
 
         (n == E_SCP_CLOSE_CONNECTION_REQUEST) ? "SCP_CLOSE_CONNECTION_REQUEST" :
         NULL;
@@ -649,6 +651,105 @@ scp_get_list_sessions_response(
 
 /*****************************************************************************/
 
+int
+scp_send_session_usage_request(struct trans *trans)
+{
+    return libipm_msg_out_simple_send(
+               trans,
+               (int)E_SCP_SESSION_USAGE_REQUEST,
+               NULL);
+}
+
+/*****************************************************************************/
+
+int
+scp_send_session_usage_response(
+    struct trans *trans,
+    enum scp_list_sessions_status status,
+    const struct scp_session_usage *usage)
+{
+    int rv;
+
+    if (status != E_SCP_LS_SESSION_INFO)
+    {
+        rv = libipm_msg_out_simple_send(
+                 trans,
+                 (int)E_SCP_SESSION_USAGE_RESPONSE,
+                 "i", status);
+    }
+    else
+    {
+        rv = libipm_msg_out_simple_send(
+                 trans,
+                 (int)E_SCP_SESSION_USAGE_RESPONSE,
+                 "iiuibtt",
+                 status,
+                 usage->sid,
+                 usage->display,
+                 usage->uid,
+                 (usage->available != 0),
+                 usage->cpu_usec,
+                 usage->memory_bytes);
+    }
+
+    return rv;
+}
+
+/*****************************************************************************/
+
+int
+scp_get_session_usage_response(
+    struct trans *trans,
+    enum scp_list_sessions_status *status,
+    struct scp_session_usage *usage)
+{
+    int32_t i_status;
+    int rv;
+
+    if (usage == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "Bad pointer in %s", __func__);
+        rv = 1;
+    }
+    else if ((rv = libipm_msg_in_parse(trans, "i", &i_status)) == 0)
+    {
+        *status = (enum scp_list_sessions_status)i_status;
+
+        if (*status == E_SCP_LS_SESSION_INFO)
+        {
+            int32_t i_sid;
+            uint32_t i_display;
+            int32_t i_uid;
+            int i_available;
+            uint64_t i_cpu_usec;
+            uint64_t i_memory_bytes;
+
+            rv = libipm_msg_in_parse(
+                     trans,
+                     "iuibtt",
+                     &i_sid,
+                     &i_display,
+                     &i_uid,
+                     &i_available,
+                     &i_cpu_usec,
+                     &i_memory_bytes);
+
+            if (rv == 0)
+            {
+                usage->sid = i_sid;
+                usage->display = i_display;
+                usage->uid = i_uid;
+                usage->available = i_available;
+                usage->cpu_usec = i_cpu_usec;
+                usage->memory_bytes = i_memory_bytes;
+            }
+        }
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+
 int
 scp_send_close_connection_request(struct trans *trans)
 {
@@ -59,8 +59,11 @@ enum scp_msg_code
     E_SCP_LIST_SESSIONS_REQUEST,
     E_SCP_LIST_SESSIONS_RESPONSE,
 
-    E_SCP_CLOSE_CONNECTION_REQUEST
+    E_SCP_CLOSE_CONNECTION_REQUEST,
     // No E_SCP_CLOSE_CONNECTION_RESPONSE
+
+    E_SCP_SESSION_USAGE_REQUEST,
+    E_SCP_SESSION_USAGE_RESPONSE
 };
 
 /* Common facilities */
@@ -456,6 +459,47 @@ scp_get_list_sessions_response(
     enum scp_list_sessions_status *status,
     struct scp_session_info **info);
 
+/**
+ * Send an E_SCP_SESSION_USAGE_REQUEST (SCP client)
+ *
+ * @param trans SCP transport
+ * @return != 0 for error
+ *
+ * Server replies with one or more E_SCP_SESSION_USAGE_RESPONSE. The
+ * root user is sent all sessions. Other users are sent their own
+ * sessions.
+ */
+int
+scp_send_session_usage_request(struct trans *trans);
+
+/**
+ * Send an E_SCP_SESSION_USAGE_RESPONSE (SCP server)
+ *
+ * @param trans SCP transport
+ * @param status Status of request
+ * @param usage Session usage if status == E_SCP_LS_SESSION_INFO
+ * @return != 0 for error
+ */
+int
+scp_send_session_usage_response(
+    struct trans *trans,
+    enum scp_list_sessions_status status,
+    const struct scp_session_usage *usage);
+
+/**
+ * Parse an incoming E_SCP_SESSION_USAGE_RESPONSE (SCP client)
+ *
+ * @param trans SCP transport
+ * @param[out] status Status of request
+ * @param[out] usage Session usage if status == E_SCP_LS_SESSION_INFO
+ * @return != 0 for error
+ */
+int
+scp_get_session_usage_response(
+    struct trans *trans,
+    enum scp_list_sessions_status *status,
+    struct scp_session_usage *usage);
+
 /**
  * Send an E_CLOSE_CONNECTION_REQUEST (SCP client)
  *
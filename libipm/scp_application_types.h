@@ -26,6 +26,7 @@
 #ifndef SCP_APPLICATION_TYPES_H
 #define SCP_APPLICATION_TYPES_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 /**
@@ -59,6 +60,19 @@ struct scp_session_info
     char *start_ip_addr; ///< IP address of starting client
 };
 
+/**
+ * @brief Resources used by a particular sesman session
+ */
+struct scp_session_usage
+{
+    int sid; ///< Session ID
+    unsigned int display; ///< Display number
+    uid_t uid;     ///< Username for session
+    int available; ///< Are the figures below available?
+    uint64_t cpu_usec; ///< CPU time used by the session
+    uint64_t memory_bytes; ///< Memory currently used by the session
+};
+
 /**
  * Status of a login request
  */
@@ -112,6 +126,8 @@ scp_screate_status_to_str(enum scp_screate_status n,
 
 /**
  * Status of an list sessions message
+ *
+ * This is also used for session usage messages
  */
 enum scp_list_sessions_status
 {
@@ -1628,6 +1628,36 @@ libxrdp_codec_jpeg_compress(struct xrdp_session *session,
                                     cx, cy, quality, out_data, io_len);
 }
 
+/*****************************************************************************/
+void *EXPORT_CC
+libxrdp_codec_jpeg_init(void)
+{
+    return xrdp_jpeg_init();
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_codec_jpeg_deinit(void *handle)
+{
+    return xrdp_jpeg_deinit(handle);
+}
+
+/*****************************************************************************/
+/* as libxrdp_codec_jpeg_compress() but with a caller owned handle from
+   libxrdp_codec_jpeg_init() so several threads can compress at once */
+int EXPORT_CC
+libxrdp_codec_jpeg_compress_han(void *handle,
+                                int format, char *inp_data,
+                                int width, int height,
+                                int stride, int x, int y,
+                                int cx, int cy, int quality,
+                                char *out_data, int *io_len)
+{
+    return xrdp_codec_jpeg_compress(handle, format, inp_data,
+                                    width, height, stride, x, y,
+                                    cx, cy, quality, out_data, io_len);
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_fastpath_send_surface(struct xrdp_session *session,
@@ -1761,6 +1791,45 @@ libxrdp_fastpath_send_frame_marker(struct xrdp_session *session,
     return 0;
 }
 
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_fastpath_batch_begin(struct xrdp_session *session)
+{
+    struct xrdp_rdp *rdp = (struct xrdp_rdp *) (session->rdp);
+
+    return xrdp_sec_fastpath_batch_begin(rdp->sec_layer);
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_fastpath_batch_flush(struct xrdp_session *session)
+{
+    struct xrdp_rdp *rdp = (struct xrdp_rdp *) (session->rdp);
+
+    if (xrdp_sec_fastpath_batch_flush(rdp->sec_layer) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "libxrdp_fastpath_batch_flush: "
+            "xrdp_sec_fastpath_batch_flush failed");
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int EXPORT_CC
+libxrdp_fastpath_batch_end(struct xrdp_session *session)
+{
+    struct xrdp_rdp *rdp = (struct xrdp_rdp *) (session->rdp);
+
+    if (xrdp_sec_fastpath_batch_end(rdp->sec_layer) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "libxrdp_fastpath_batch_end: "
+            "xrdp_sec_fastpath_batch_end failed");
+        return 1;
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 int EXPORT_CC
 libxrdp_send_session_info(struct xrdp_session *session, const char *data,
@@ -133,6 +133,9 @@ struct xrdp_sec
     void *decrypt_fips_info;
     void *sign_fips_info;
     int is_security_header_present; /* boolean */
+    struct stream *fp_batch; /* fastpath updates waiting to be sent */
+    int fp_batch_count; /* number of updates in fp_batch */
+    int fp_batch_depth; /* > 0 while fastpath updates are batched */
 };
 
 struct xrdp_drdynvc
@@ -290,8 +293,13 @@ struct xrdp_orders
     struct stream *temp_s;
 };
 
+/* Bulk compressors. There is no RDP 6.0 (NCRUSH) one - clients which
+ * only go up to RDP 6.0 are given RDP 5.0 */
 #define PROTO_RDP_40 1
 #define PROTO_RDP_50 2
+#define PROTO_RDP_61 3
+
+struct xrdp_xcrush_enc;
 
 struct xrdp_mppc_enc
 {
@@ -300,12 +308,16 @@ struct xrdp_mppc_enc
     char  *outputBuffer;     /* contains compressed data */
     char  *outputBufferPlus;
     int    historyOffset;    /* next free slot in historyBuffer */
-    int    buf_len;          /* length of historyBuffer, protocol dependent */
+    int    buf_len;          /* length of historyBuffer, protocol dependent.
+                                for RDP 6.1, the longest input */
     int    bytes_in_opb;     /* compressed bytes available in outputBuffer */
     int    flags;            /* PACKET_COMPRESSED, PACKET_AT_FRONT, PACKET_FLUSHED etc */
     int    flagsHold;
     int    first_pkt;        /* this is the first pkt passing through enc */
     tui16 *hash_table;
+    /* RDP 6.1 only */
+    struct xrdp_xcrush_enc *xcrush; /* level 1 */
+    struct xrdp_mppc_enc *level2; /* RDP 5.0 */
 };
 
 int
@@ -315,6 +327,19 @@ mppc_enc_new(int protocol_type);
 void
 mppc_enc_free(struct xrdp_mppc_enc *enc);
 
+/* xrdp_xcrush_enc.c */
+struct xrdp_xcrush_enc *
+xcrush_enc_new(void);
+void
+xcrush_enc_free(struct xrdp_xcrush_enc *self);
+void
+xcrush_enc_reset(struct xrdp_xcrush_enc *self);
+/* returns Level1ComprFlags. len must not be more than 65535.
+   *out is valid until the next call */
+int
+xcrush_compress_l1(struct xrdp_xcrush_enc *self, const tui8 *src, int len,
+                   const char **out, int *out_len);
+
 /* xrdp_tcp.c */
 struct xrdp_tcp *
 xrdp_tcp_create(struct xrdp_iso *owner, struct trans *trans);
@@ -388,6 +413,12 @@ xrdp_sec_init_fastpath(struct xrdp_sec *self, struct stream *s);
 int
 xrdp_sec_send_fastpath(struct xrdp_sec *self, struct stream *s);
 int
+xrdp_sec_fastpath_batch_begin(struct xrdp_sec *self);
+int
+xrdp_sec_fastpath_batch_flush(struct xrdp_sec *self);
+int
+xrdp_sec_fastpath_batch_end(struct xrdp_sec *self);
+int
 xrdp_sec_recv_fastpath(struct xrdp_sec *self, struct stream *s);
 int
 xrdp_sec_recv(struct xrdp_sec *self, struct stream *s, int *chan);
@@ -652,6 +683,8 @@ int
 xrdp_fastpath_init(struct xrdp_fastpath *self, struct stream *s);
 int
 xrdp_fastpath_send(struct xrdp_fastpath *self, struct stream *s);
+int
+xrdp_fastpath_send_owned(struct xrdp_fastpath *self, struct stream *s);
 
 /* xrdp_caps.c */
 int
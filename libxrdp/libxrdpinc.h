@@ -298,6 +298,17 @@ libxrdp_codec_jpeg_compress(struct xrdp_session *session,
                             int stride, int x, int y,
                             int cx, int cy, int quality,
                             char *out_data, int *io_len);
+void *
+libxrdp_codec_jpeg_init(void);
+int
+libxrdp_codec_jpeg_deinit(void *handle);
+int
+libxrdp_codec_jpeg_compress_han(void *handle,
+                                int format, char *inp_data,
+                                int width, int height,
+                                int stride, int x, int y,
+                                int cx, int cy, int quality,
+                                char *out_data, int *io_len);
 int
 libxrdp_fastpath_send_surface(struct xrdp_session *session,
                               char *data_pad, int pad_bytes,
@@ -308,6 +319,43 @@ libxrdp_fastpath_send_surface(struct xrdp_session *session,
 int EXPORT_CC
 libxrdp_fastpath_send_frame_marker(struct xrdp_session *session,
                                    int frame_action, int frame_id);
+/**
+ * Starts batching fastpath updates
+ *
+ * Until the matching libxrdp_fastpath_batch_end(), fastpath updates are
+ * packed together into as few TS_FP_UPDATE_PDUs as possible. Calls may
+ * be nested.
+ *
+ * Other output to the client sends any batched updates first, so the
+ * order of the output is kept.
+ *
+ * @param session Session
+ * @return 0 for success
+ */
+int EXPORT_CC
+libxrdp_fastpath_batch_begin(struct xrdp_session *session);
+/**
+ * Sends any batched fastpath updates
+ *
+ * Use this to avoid delaying updates the client should see now,
+ * e.g. at the end of a frame.
+ *
+ * @param session Session
+ * @return 0 for success
+ */
+int EXPORT_CC
+libxrdp_fastpath_batch_flush(struct xrdp_session *session);
+/**
+ * Ends batching fastpath updates started with
+ * libxrdp_fastpath_batch_begin()
+ *
+ * Any batched updates are sent when the outermost batch ends.
+ *
+ * @param session Session
+ * @return 0 for success
+ */
+int EXPORT_CC
+libxrdp_fastpath_batch_end(struct xrdp_session *session);
 int EXPORT_CC
 libxrdp_send_session_info(struct xrdp_session *session, const char *data,
                           int data_bytes);
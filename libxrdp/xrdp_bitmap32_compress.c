@@ -30,164 +30,127 @@ http://msdn.microsoft.com/en-us/library/cc241877.aspx
 
 #include "libxrdp.h"
 
+/* The plane split, delta and run scan have SSE2 or NEON versions. Both
+ * are part of the base instruction set where they exist, so no run time
+ * check is needed */
+#if defined(L_ENDIAN) && defined(__SSE2__)
+#define PLANAR_SSE2
+#include <emmintrin.h>
+#elif defined(L_ENDIAN) && defined(__ARM_NEON)
+#define PLANAR_NEON
+#include <arm_neon.h>
+#endif
+
 #define FLAGS_RLE     0x10
 #define FLAGS_NOALPHA 0x20
 
-
+/* each plane is at most 64x64 */
+#define PLANE_MAX_BYTES (64 * 64)
+#define RUN_MASK_WORDS (PLANE_MAX_BYTES / 64)
 
 /*****************************************************************************/
-/* split RGB */
-static int
-fsplit3(char *in_data, int start_line, int width, int e,
-        char *r_data, char *g_data, char *b_data)
+/* Splits a line of width pixels into planes. a_data can be NULL */
+static void
+split_line(const char *in_data, int width,
+           char *a_data, char *r_data, char *g_data, char *b_data)
 {
-#if defined(L_ENDIAN)
-    int rp;
-    int gp;
-    int bp;
-#endif
+    const tui32 *ptr32;
+    tui32 pixel;
     int index;
-    int out_index;
-    int pixel;
-    int cy;
-    int *ptr32;
 
-    cy = 0;
-    out_index = 0;
-    while (start_line >= 0)
+    index = 0;
+#if defined(PLANAR_SSE2)
     {
-        ptr32 = (int *) (in_data + start_line * width * 4);
-        index = 0;
-#if defined(L_ENDIAN)
-        while (index + 4 <= width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            rp  = (pixel >> 16) & 0x000000ff;
-            gp  = (pixel >>  8) & 0x000000ff;
-            bp  = (pixel >>  0) & 0x000000ff;
-            pixel  = *ptr32;
-            ptr32++;
-            rp |= (pixel >>  8) & 0x0000ff00;
-            gp |= (pixel <<  0) & 0x0000ff00;
-            bp |= (pixel <<  8) & 0x0000ff00;
-            pixel = *ptr32;
-            ptr32++;
-            rp |= (pixel >>  0) & 0x00ff0000;
-            gp |= (pixel <<  8) & 0x00ff0000;
-            bp |= (pixel << 16) & 0x00ff0000;
-            pixel = *ptr32;
-            ptr32++;
-            rp |= (pixel <<  8) & 0xff000000;
-            gp |= (pixel << 16) & 0xff000000;
-            bp |= (pixel << 24) & 0xff000000;
-            *((int *)(r_data + out_index)) = rp;
-            *((int *)(g_data + out_index)) = gp;
-            *((int *)(b_data + out_index)) = bp;
-            out_index += 4;
-            index += 4;
-        }
-#endif
-        while (index < width)
+        const __m128i mask = _mm_set1_epi32(0xff);
+        __m128i p0;
+        __m128i p1;
+        __m128i p2;
+        __m128i p3;
+
+        /* 16 pixels at a time. The values are all 0 - 255, so the
+           saturating packs just narrow them */
+#define SSE2_PLANE(_shift) \
+    _mm_packus_epi16( \
+        _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, _shift), mask), \
+                        _mm_and_si128(_mm_srli_epi32(p1, _shift), mask)), \
+        _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, _shift), mask), \
+                        _mm_and_si128(_mm_srli_epi32(p3, _shift), mask)))
+        while (index + 16 <= width)
         {
-            pixel = *ptr32;
-            ptr32++;
-            r_data[out_index] = pixel >> 16;
-            g_data[out_index] = pixel >> 8;
-            b_data[out_index] = pixel >> 0;
-            out_index++;
-            index++;
+            p0 = _mm_loadu_si128((const __m128i *) (in_data + index * 4));
+            p1 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 16));
+            p2 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 32));
+            p3 = _mm_loadu_si128((const __m128i *) (in_data + index * 4 + 48));
+            if (a_data != NULL)
+            {
+                _mm_storeu_si128((__m128i *) (a_data + index), SSE2_PLANE(24));
+            }
+            _mm_storeu_si128((__m128i *) (r_data + index), SSE2_PLANE(16));
+            _mm_storeu_si128((__m128i *) (g_data + index), SSE2_PLANE(8));
+            _mm_storeu_si128((__m128i *) (b_data + index), SSE2_PLANE(0));
+            index += 16;
         }
-        for (index = 0; index < e; index++)
+#undef SSE2_PLANE
+    }
+#elif defined(PLANAR_NEON)
+    {
+        uint8x16x4_t pixels;
+
+        /* memory order is B, G, R, A */
+        while (index + 16 <= width)
         {
-            r_data[out_index] = r_data[out_index - 1];
-            g_data[out_index] = g_data[out_index - 1];
-            b_data[out_index] = b_data[out_index - 1];
-            out_index++;
+            pixels = vld4q_u8((const uint8_t *) (in_data + index * 4));
+            if (a_data != NULL)
+            {
+                vst1q_u8((uint8_t *) (a_data + index), pixels.val[3]);
+            }
+            vst1q_u8((uint8_t *) (r_data + index), pixels.val[2]);
+            vst1q_u8((uint8_t *) (g_data + index), pixels.val[1]);
+            vst1q_u8((uint8_t *) (b_data + index), pixels.val[0]);
+            index += 16;
         }
-        start_line--;
-        cy++;
-        if (out_index + width + e > 64 * 64)
+    }
+#endif
+    ptr32 = (const tui32 *) in_data;
+    while (index < width)
+    {
+        pixel = ptr32[index];
+        if (a_data != NULL)
         {
-            break;
+            a_data[index] = pixel >> 24;
         }
+        r_data[index] = pixel >> 16;
+        g_data[index] = pixel >> 8;
+        b_data[index] = pixel >> 0;
+        index++;
     }
-    return cy;
 }
 
 /*****************************************************************************/
-/* split ARGB */
+/* split ARGB, or RGB if a_data is NULL */
 static int
-fsplit4(char *in_data, int start_line, int width, int e,
-        char *a_data, char *r_data, char *g_data, char *b_data)
+fsplit(char *in_data, int start_line, int width, int e,
+       char *a_data, char *r_data, char *g_data, char *b_data)
 {
-#if defined(L_ENDIAN)
-    int ap;
-    int rp;
-    int gp;
-    int bp;
-#endif
     int index;
     int out_index;
-    int pixel;
     int cy;
-    int *ptr32;
 
     cy = 0;
     out_index = 0;
     while (start_line >= 0)
     {
-        ptr32 = (int *) (in_data + start_line * width * 4);
-        index = 0;
-#if defined(L_ENDIAN)
-        while (index + 4 <= width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            ap  = (pixel >> 24) & 0x000000ff;
-            rp  = (pixel >> 16) & 0x000000ff;
-            gp  = (pixel >>  8) & 0x000000ff;
-            bp  = (pixel >>  0) & 0x000000ff;
-            pixel  = *ptr32;
-            ptr32++;
-            ap |= (pixel >> 16) & 0x0000ff00;
-            rp |= (pixel >>  8) & 0x0000ff00;
-            gp |= (pixel <<  0) & 0x0000ff00;
-            bp |= (pixel <<  8) & 0x0000ff00;
-            pixel = *ptr32;
-            ptr32++;
-            ap |= (pixel >>  8) & 0x00ff0000;
-            rp |= (pixel >>  0) & 0x00ff0000;
-            gp |= (pixel <<  8) & 0x00ff0000;
-            bp |= (pixel << 16) & 0x00ff0000;
-            pixel = *ptr32;
-            ptr32++;
-            ap |= (pixel <<  0) & 0xff000000;
-            rp |= (pixel <<  8) & 0xff000000;
-            gp |= (pixel << 16) & 0xff000000;
-            bp |= (pixel << 24) & 0xff000000;
-            *((int *)(a_data + out_index)) = ap;
-            *((int *)(r_data + out_index)) = rp;
-            *((int *)(g_data + out_index)) = gp;
-            *((int *)(b_data + out_index)) = bp;
-            out_index += 4;
-            index += 4;
-        }
-#endif
-        while (index < width)
-        {
-            pixel = *ptr32;
-            ptr32++;
-            a_data[out_index] = pixel >> 24;
-            r_data[out_index] = pixel >> 16;
-            g_data[out_index] = pixel >> 8;
-            b_data[out_index] = pixel >> 0;
-            out_index++;
-            index++;
-        }
+        split_line(in_data + start_line * width * 4, width,
+                   a_data == NULL ? NULL : a_data + out_index,
+                   r_data + out_index, g_data + out_index,
+                   b_data + out_index);
+        out_index += width;
         for (index = 0; index < e; index++)
         {
-            a_data[out_index] = a_data[out_index - 1];
+            if (a_data != NULL)
+            {
+                a_data[out_index] = a_data[out_index - 1];
+            }
             r_data[out_index] = r_data[out_index - 1];
             g_data[out_index] = g_data[out_index - 1];
             b_data[out_index] = b_data[out_index - 1];
@@ -195,7 +158,7 @@ fsplit4(char *in_data, int start_line, int width, int e,
         }
         start_line--;
         cy++;
-        if (out_index + width + e > 64 * 64)
+        if (out_index + width + e > PLANE_MAX_BYTES)
         {
             break;
         }
@@ -204,43 +167,58 @@ fsplit4(char *in_data, int start_line, int width, int e,
 }
 
 /*****************************************************************************/
-#define DELTA_ONE \
-    do { \
-        delta = src8[cx] - src8[0]; \
-        is_neg = (delta >> 7) & 1; \
-        dst8[cx] = (((delta ^ -is_neg) + is_neg) << 1) - is_neg; \
-        src8++; \
-        dst8++; \
-    } while (0)
-
-/*****************************************************************************/
+/* Each line after the first is replaced by the difference from the line
+ * above. The sign goes in bit 0, so small differences either way give
+ * small values */
 static int
 fdelta(char *in_plane, char *out_plane, int cx, int cy)
 {
-    char delta;
-    char is_neg;
-    char *src8;
-    char *dst8;
-    char *src8_end;
+    const tui8 *src8;
+    tui8 *dst8;
+    int bytes;
+    int index;
+    tui8 delta;
 
     g_memcpy(out_plane, in_plane, cx);
-    src8 = in_plane;
-    dst8 = out_plane;
-    src8_end = src8 + (cx * cy - cx);
-    while (src8 + 8 <= src8_end)
+    src8 = (const tui8 *) in_plane;
+    dst8 = (tui8 *) out_plane + cx;
+    bytes = cx * cy - cx;
+    index = 0;
+#if defined(PLANAR_SSE2)
     {
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
-        DELTA_ONE;
+        const __m128i zero = _mm_setzero_si128();
+        __m128i d;
+
+        while (index + 16 <= bytes)
+        {
+            d = _mm_sub_epi8(
+                    _mm_loadu_si128((const __m128i *) (src8 + cx + index)),
+                    _mm_loadu_si128((const __m128i *) (src8 + index)));
+            d = _mm_xor_si128(_mm_add_epi8(d, d), _mm_cmplt_epi8(d, zero));
+            _mm_storeu_si128((__m128i *) (dst8 + index), d);
+            index += 16;
+        }
+    }
+#elif defined(PLANAR_NEON)
+    {
+        uint8x16_t d;
+
+        while (index + 16 <= bytes)
+        {
+            d = vsubq_u8(vld1q_u8(src8 + cx + index), vld1q_u8(src8 + index));
+            d = veorq_u8(vaddq_u8(d, d),
+                         vreinterpretq_u8_s8(
+                             vshrq_n_s8(vreinterpretq_s8_u8(d), 7)));
+            vst1q_u8(dst8 + index, d);
+            index += 16;
+        }
     }
-    while (src8 < src8_end)
+#endif
+    while (index < bytes)
     {
-        DELTA_ONE;
+        delta = src8[cx + index] - src8[index];
+        dst8[index] = (delta << 1) ^ -(delta >> 7);
+        index++;
     }
     return 0;
 }
@@ -310,69 +288,249 @@ fout(int collen, int replen, char *colptr, struct stream *s)
     return 0;
 }
 
+#if defined(PLANAR_SSE2) || defined(PLANAR_NEON)
 /*****************************************************************************/
 static int
-fpack(char *plane, int cx, int cy, struct stream *s)
+ctz64(tui64 val)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(val);
+#else
+    int rv;
+
+    rv = 0;
+    while ((val & 1) == 0)
+    {
+        val >>= 1;
+        rv++;
+    }
+    return rv;
+#endif
+}
+
+/*****************************************************************************/
+/* Sets bit n of mask if line[n] == line[n + 1], for n < count */
+static void
+run_mask(const tui8 *line, int count, tui64 *mask)
+{
+    int index;
+    tui64 bits;
+
+    index = 0;
+    /* the second load reads line[index + 16] */
+    while (index + 16 < count + 1)
+    {
+#if defined(PLANAR_SSE2)
+        bits = (tui16) _mm_movemask_epi8(_mm_cmpeq_epi8(
+                   _mm_loadu_si128((const __m128i *) (line + index)),
+                   _mm_loadu_si128((const __m128i *) (line + index + 1))));
+#else
+        static const uint8_t weights[16] =
+        {
+            1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+        };
+        uint8x16_t eq;
+        uint8x8_t sum;
+
+        eq = vandq_u8(vceqq_u8(vld1q_u8(line + index),
+                               vld1q_u8(line + index + 1)),
+                      vld1q_u8(weights));
+        /* add up the weights of each half */
+        sum = vpadd_u8(vget_low_u8(eq), vget_high_u8(eq));
+        sum = vpadd_u8(sum, sum);
+        sum = vpadd_u8(sum, sum);
+        bits = vget_lane_u8(sum, 0) | (vget_lane_u8(sum, 1) << 8);
+#endif
+        if ((index % 64) == 0)
+        {
+            mask[index / 64] = 0;
+        }
+        mask[index / 64] |= bits << (index % 64);
+        index += 16;
+    }
+    while (index < count)
+    {
+        if ((index % 64) == 0)
+        {
+            mask[index / 64] = 0;
+        }
+        if (line[index] == line[index + 1])
+        {
+            mask[index / 64] |= ((tui64) 1) << (index % 64);
+        }
+        index++;
+    }
+}
+
+/*****************************************************************************/
+/* Returns how many bits from start on are equal to set, stopping at end */
+static int
+run_length(const tui64 *mask, int start, int end, int set)
+{
+    int index;
+    int avail;
+    int same;
+    tui64 bits;
+
+    index = start;
+    while (index < end)
+    {
+        bits = mask[index / 64] >> (index % 64);
+        avail = 64 - (index % 64);
+        if (set)
+        {
+            bits = ~bits;
+        }
+        /* the zeros shifted in at the top are not part of the mask */
+        same = (bits == 0) ? 64 : ctz64(bits);
+        if (same < avail)
+        {
+            index += same;
+            break;
+        }
+        index += avail;
+    }
+    return MIN(index, end) - start;
+}
+
+/*****************************************************************************/
+/* Works through the line a run of repeats or changes at a time, rather
+ * than a byte at a time */
+static void
+fpack_line(char *line, int cx, struct stream *s)
 {
-    char *ptr8;
     char *colptr;
-    char *lend;
-    char *holdp;
-    int jndex;
+    int index;
+    int run;
     int collen;
     int replen;
+    tui64 mask[RUN_MASK_WORDS];
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "fpack:");
-    holdp = s->p;
-    for (jndex = 0; jndex < cy; jndex++)
+    colptr = line;
+    if (colptr[0] == 0)
     {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "line start line %d cx %d cy %d", jndex, cx, cy);
-        ptr8 = plane + jndex * cx;
-        LOG_DEVEL_HEXDUMP(LOG_LEVEL_TRACE, "line content", ptr8, cx);
-        lend = ptr8 + (cx - 1);
-        colptr = ptr8;
-        if (colptr[0] == 0)
-        {
-            collen = 0;
-            replen = 1;
-        }
-        else
+        collen = 0;
+        replen = 1;
+    }
+    else
+    {
+        collen = 1;
+        replen = 0;
+    }
+    /* bit n of the mask is set if byte n + 1 repeats byte n */
+    run_mask((const tui8 *) line, cx - 1, mask);
+    index = 0;
+    while (index < cx - 1)
+    {
+        run = run_length(mask, index, cx - 1, 1);
+        if (run > 0)
         {
-            collen = 1;
-            replen = 0;
+            replen += run;
+            index += run;
+            continue;
         }
-        while (ptr8 < lend)
+        /* a change ends any repeat */
+        if (replen > 0)
         {
-            if (ptr8[0] == ptr8[1])
+            if (replen < 3)
             {
-                replen++;
+                collen += replen + 1;
+                replen = 0;
             }
             else
             {
-                if (replen > 0)
+                fout(collen, replen, colptr, s);
+                colptr = line + index + 1;
+                replen = 0;
+                collen = 1;
+            }
+            index++;
+        }
+        run = run_length(mask, index, cx - 1, 0);
+        collen += run;
+        index += run;
+    }
+    /* end of line */
+    fout(collen, replen, colptr, s);
+}
+
+#else
+
+/*****************************************************************************/
+static void
+fpack_line(char *line, int cx, struct stream *s)
+{
+    char *ptr8;
+    char *colptr;
+    char *lend;
+    int collen;
+    int replen;
+
+    ptr8 = line;
+    lend = ptr8 + (cx - 1);
+    colptr = ptr8;
+    if (colptr[0] == 0)
+    {
+        collen = 0;
+        replen = 1;
+    }
+    else
+    {
+        collen = 1;
+        replen = 0;
+    }
+    while (ptr8 < lend)
+    {
+        if (ptr8[0] == ptr8[1])
+        {
+            replen++;
+        }
+        else
+        {
+            if (replen > 0)
+            {
+                if (replen < 3)
                 {
-                    if (replen < 3)
-                    {
-                        collen += replen + 1;
-                        replen = 0;
-                    }
-                    else
-                    {
-                        fout(collen, replen, colptr, s);
-                        colptr = ptr8 + 1;
-                        replen = 0;
-                        collen = 1;
-                    }
+                    collen += replen + 1;
+                    replen = 0;
                 }
                 else
                 {
-                    collen++;
+                    fout(collen, replen, colptr, s);
+                    colptr = ptr8 + 1;
+                    replen = 0;
+                    collen = 1;
                 }
             }
-            ptr8++;
+            else
+            {
+                collen++;
+            }
         }
-        /* end of line */
-        fout(collen, replen, colptr, s);
+        ptr8++;
+    }
+    /* end of line */
+    fout(collen, replen, colptr, s);
+}
+
+#endif
+
+/*****************************************************************************/
+static int
+fpack(char *plane, int cx, int cy, struct stream *s)
+{
+    char *ptr8;
+    char *holdp;
+    int jndex;
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "fpack:");
+    holdp = s->p;
+    for (jndex = 0; jndex < cy; jndex++)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "line start line %d cx %d cy %d", jndex, cx, cy);
+        ptr8 = plane + jndex * cx;
+        LOG_DEVEL_HEXDUMP(LOG_LEVEL_TRACE, "line content", ptr8, cx);
+        fpack_line(ptr8, cx, s);
     }
     return (int) (s->p - holdp);
 }
@@ -434,7 +592,7 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     int header;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_bitmap32_compress:");
-    max_bytes = 4 * 1024;
+    max_bytes = PLANE_MAX_BYTES;
     /* need max 8, 4K planes for work */
     if (max_bytes * 8 > temp_s->size)
     {
@@ -442,6 +600,10 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     }
     header = flags & 0xFF;
     cx = width + e;
+    if (cx > PLANE_MAX_BYTES)
+    {
+        return 0;
+    }
     sa_data = temp_s->data;
     sr_data = sa_data + max_bytes;
     sg_data = sr_data + max_bytes;
@@ -454,8 +616,8 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
 
     if (header & FLAGS_NOALPHA)
     {
-        cy = fsplit3(in_data, start_line, width, e,
-                     sr_data, sg_data, sb_data);
+        cy = fsplit(in_data, start_line, width, e,
+                    NULL, sr_data, sg_data, sb_data);
         if (header & FLAGS_RLE)
         {
             fdelta(sr_data, r_data, cx, cy);
@@ -503,8 +665,8 @@ xrdp_bitmap32_compress(char *in_data, int width, int height,
     }
     else
     {
-        cy = fsplit4(in_data, start_line, width, e,
-                     sa_data, sr_data, sg_data, sb_data);
+        cy = fsplit(in_data, start_line, width, e,
+                    sa_data, sr_data, sg_data, sb_data);
         if (header & FLAGS_RLE)
         {
             fdelta(sa_data, a_data, cx, cy);
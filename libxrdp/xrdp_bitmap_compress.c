@@ -18,6 +18,13 @@
  * bitmap compressor
  * This is the original RDP bitmap compression algorithm.  Pixel based.
  * This does not do 32 bpp compression, nscodec, rfx, etc
+ *
+ * Each line is first read into an array of pixels, and the fill, mix
+ * and colour tests for the whole line are done in separate simple
+ * loops which the compiler can vectorise. The run state machine then
+ * only looks at the results. Once a pixel repeats the one before it,
+ * the state machine is in a steady state, so the rest of the run is
+ * added in one step rather than a pixel at a time.
  */
 
 #if defined(HAVE_CONFIG_H)
@@ -28,1551 +35,675 @@
 
 #define BC_MAX_BYTES (16 * 1024)
 
-/*****************************************************************************/
-#define IN_PIXEL8(in_ptr, in_x, in_y, in_w, in_last_pixel, in_pixel); \
-    do { \
-        if (in_ptr == 0) \
-        { \
-            in_pixel = 0; \
-        } \
-        else if (in_x < in_w) \
-        { \
-            in_pixel = GETPIXEL8(in_ptr, in_x, in_y, in_w); \
-        } \
-        else \
-        { \
-            in_pixel = in_last_pixel; \
-        } \
-    } while (0)
-
-/*****************************************************************************/
-#define IN_PIXEL16(in_ptr, in_x, in_y, in_w, in_last_pixel, in_pixel); \
-    do { \
-        if (in_ptr == 0) \
-        { \
-            in_pixel = 0; \
-        } \
-        else if (in_x < in_w) \
-        { \
-            in_pixel = GETPIXEL16(in_ptr, in_x, in_y, in_w); \
-        } \
-        else \
-        { \
-            in_pixel = in_last_pixel; \
-        } \
-    } while (0)
-
-/*****************************************************************************/
-#define IN_PIXEL32(in_ptr, in_x, in_y, in_w, in_last_pixel, in_pixel); \
-    do { \
-        if (in_ptr == 0) \
-        { \
-            in_pixel = 0; \
-        } \
-        else if (in_x < in_w) \
-        { \
-            in_pixel = GETPIXEL32(in_ptr, in_x, in_y, in_w); \
-        } \
-        else \
-        { \
-            in_pixel = in_last_pixel; \
-        } \
-    } while (0)
-
-/*****************************************************************************/
-/* color */
-#define OUT_COLOR_COUNT1(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x3 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_data); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x60); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_data); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf3); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8(in_s, in_data); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
-
-/*****************************************************************************/
-/* color */
-#define OUT_COLOR_COUNT2(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x3 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                out_uint16_le(in_s, in_data); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x60); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                out_uint16_le(in_s, in_data); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf3); \
-                out_uint16_le(in_s, in_count); \
-                out_uint16_le(in_s, in_data); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
-
-/*****************************************************************************/
-/* color */
-#define OUT_COLOR_COUNT3(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x3 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_data & 0xff); \
-                out_uint8(in_s, (in_data >> 8) & 0xff); \
-                out_uint8(in_s, (in_data >> 16) & 0xff); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x60); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_data & 0xff); \
-                out_uint8(in_s, (in_data >> 8) & 0xff); \
-                out_uint8(in_s, (in_data >> 16) & 0xff); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf3); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8(in_s, in_data & 0xff); \
-                out_uint8(in_s, (in_data >> 8) & 0xff); \
-                out_uint8(in_s, (in_data >> 16) & 0xff); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
-
-/*****************************************************************************/
-/* copy */
-#define OUT_COPY_COUNT1(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x4 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_data->data, in_count); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x80); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_data->data, in_count); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf4); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8a(in_s, in_data->data, in_count); \
-            } \
-        } \
-        in_count = 0; \
-        init_stream(in_data, 0); \
-    } while (0)
+/* per pixel test results */
+#define BC_FILL 0x01 /* same as the pixel above */
+#define BC_MIX 0x02 /* pixel above xor the mix colour */
+#define BC_COLOR 0x04 /* same as the pixel before */
+
+/* order codes, MS-RDPBCGR 2.2.9.1.1.3.1.2.4 */
+#define BC_CODE_FILL 0x00
+#define BC_CODE_MIX 0x20
+#define BC_CODE_FOM 0x40
+#define BC_CODE_COLOR 0x60
+#define BC_CODE_COPY 0x80
+#define BC_CODE_BICOLOR 0xe0
+#define BC_CODE_MEGA_BICOLOR 0xf8
+
+struct bc_enc
+{
+    struct stream *s;
+    struct stream *temp_s; /* pixels from earlier lines not yet sent */
+    const tui8 *packed; /* current line in wire format */
+    int packed_start; /* first pixel of the line not in temp_s */
+    int packed_pos; /* pixel being added */
+    int out_bpp; /* bytes per pixel on the wire */
+    int count; /* pixels not yet sent */
+    int last_pixel;
+    int color_count;
+    int bicolor_count;
+    int bicolor1;
+    int bicolor2;
+    int bicolor_spin;
+    int fill_count;
+    int mix_count;
+    int fom_count;
+    int fom_mask_len;
+    char fom_mask[8192]; /* good for up to 64K bitmap */
+};
 
 /*****************************************************************************/
-/* copy */
-#define OUT_COPY_COUNT2(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x4 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                temp = in_count * 2; \
-                out_uint8a(in_s, in_data->data, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x80); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                temp = in_count * 2; \
-                out_uint8a(in_s, in_data->data, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf4); \
-                out_uint16_le(in_s, in_count); \
-                temp = in_count * 2; \
-                out_uint8a(in_s, in_data->data, temp); \
-            } \
-        } \
-        in_count = 0; \
-        init_stream(in_data, 0); \
-    } while (0)
+static void
+out_pixel(struct stream *s, int pixel, int out_bpp)
+{
+    if (out_bpp == 1)
+    {
+        out_uint8(s, pixel);
+    }
+    else if (out_bpp == 2)
+    {
+        out_uint16_le(s, pixel);
+    }
+    else
+    {
+        out_uint8(s, pixel & 0xff);
+        out_uint8(s, (pixel >> 8) & 0xff);
+        out_uint8(s, (pixel >> 16) & 0xff);
+    }
+}
 
 /*****************************************************************************/
-/* copy */
-#define OUT_COPY_COUNT3(in_count, in_s, in_data) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x4 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-                temp = in_count * 3; \
-                out_uint8a(in_s, in_data->end, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x80); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-                temp = in_count * 3; \
-                out_uint8a(in_s, in_data->end, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf4); \
-                out_uint16_le(in_s, in_count); \
-                temp = in_count * 3; \
-                out_uint8a(in_s, in_data->end, temp); \
-            } \
-        } \
-        in_count = 0; \
-        init_stream(in_data, 0); \
-    } while (0)
+/* header for the fill, mix, color and copy orders */
+static void
+out_run_header(struct stream *s, int code, int count)
+{
+    if (count < 32)
+    {
+        out_uint8(s, code | count);
+    }
+    else if (count < 256 + 32)
+    {
+        out_uint8(s, code);
+        out_uint8(s, count - 32);
+    }
+    else
+    {
+        out_uint8(s, 0xf0 | (code >> 5));
+        out_uint16_le(s, count);
+    }
+}
 
 /*****************************************************************************/
-/* bicolor */
-#define OUT_BICOLOR_COUNT1(in_count, in_s, in_color1, in_color2) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count / 2 < 16) \
-            { \
-                temp = (0xe << 4) | (in_count / 2); \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_color1); \
-                out_uint8(in_s, in_color2); \
-            } \
-            else if (in_count / 2 < 256 + 16) \
-            { \
-                out_uint8(in_s, 0xe0); \
-                temp = in_count / 2 - 16; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_color1); \
-                out_uint8(in_s, in_color2); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf8); \
-                temp = in_count / 2; \
-                out_uint16_le(in_s, temp); \
-                out_uint8(in_s, in_color1); \
-                out_uint8(in_s, in_color2); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* pixels of the current line are only moved into temp_s when needed */
+static void
+sync_temp_s(struct bc_enc *enc)
+{
+    int bytes;
 
-/*****************************************************************************/
-/* bicolor */
-#define OUT_BICOLOR_COUNT2(in_count, in_s, in_color1, in_color2) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count / 2 < 16) \
-            { \
-                temp = (0xe << 4) | (in_count / 2); \
-                out_uint8(in_s, temp); \
-                out_uint16_le(in_s, in_color1); \
-                out_uint16_le(in_s, in_color2); \
-            } \
-            else if (in_count / 2 < 256 + 16) \
-            { \
-                out_uint8(in_s, 0xe0); \
-                temp = in_count / 2 - 16; \
-                out_uint8(in_s, temp); \
-                out_uint16_le(in_s, in_color1); \
-                out_uint16_le(in_s, in_color2); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf8); \
-                temp = in_count / 2; \
-                out_uint16_le(in_s, temp); \
-                out_uint16_le(in_s, in_color1); \
-                out_uint16_le(in_s, in_color2); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+    bytes = (enc->packed_pos - enc->packed_start) * enc->out_bpp;
+    if (bytes > 0)
+    {
+        out_uint8a(enc->temp_s, enc->packed + enc->packed_start * enc->out_bpp,
+                   bytes);
+    }
+    enc->packed_start = enc->packed_pos;
+}
 
 /*****************************************************************************/
-/* bicolor */
-#define OUT_BICOLOR_COUNT3(in_count, in_s, in_color1, in_color2) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count / 2 < 16) \
-            { \
-                temp = (0xe << 4) | (in_count / 2); \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_color1 & 0xff); \
-                out_uint8(in_s, (in_color1 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color1 >> 16) & 0xff); \
-                out_uint8(in_s, in_color2 & 0xff); \
-                out_uint8(in_s, (in_color2 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color2 >> 16) & 0xff); \
-            } \
-            else if (in_count / 2 < 256 + 16) \
-            { \
-                out_uint8(in_s, 0xe0); \
-                temp = in_count / 2 - 16; \
-                out_uint8(in_s, temp); \
-                out_uint8(in_s, in_color1 & 0xff); \
-                out_uint8(in_s, (in_color1 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color1 >> 16) & 0xff); \
-                out_uint8(in_s, in_color2 & 0xff); \
-                out_uint8(in_s, (in_color2 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color2 >> 16) & 0xff); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf8); \
-                temp = in_count / 2; \
-                out_uint16_le(in_s, temp); \
-                out_uint8(in_s, in_color1 & 0xff); \
-                out_uint8(in_s, (in_color1 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color1 >> 16) & 0xff); \
-                out_uint8(in_s, in_color2 & 0xff); \
-                out_uint8(in_s, (in_color2 >> 8) & 0xff); \
-                out_uint8(in_s, (in_color2 >> 16) & 0xff); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* sends the first count pixels not yet sent as a copy, and drops the rest */
+static void
+out_copy(struct bc_enc *enc)
+{
+    if (enc->count > 0)
+    {
+        sync_temp_s(enc);
+        out_run_header(enc->s, BC_CODE_COPY, enc->count);
+        out_uint8a(enc->s, enc->temp_s->data, enc->count * enc->out_bpp);
+    }
+    enc->count = 0;
+    init_stream(enc->temp_s, 0);
+    enc->packed_start = enc->packed_pos;
+}
 
 /*****************************************************************************/
-/* fill */
-#define OUT_FILL_COUNT1(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                out_uint8(in_s, in_count); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x0); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf0); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+out_fill(struct bc_enc *enc)
+{
+    enc->count -= enc->fill_count;
+    out_copy(enc);
+    out_run_header(enc->s, BC_CODE_FILL, enc->fill_count);
+    enc->fill_count = 0;
+}
 
 /*****************************************************************************/
-/* fill */
-#define OUT_FILL_COUNT2(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                out_uint8(in_s, in_count); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x0); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf0); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+out_mix(struct bc_enc *enc)
+{
+    enc->count -= enc->mix_count;
+    out_copy(enc);
+    out_run_header(enc->s, BC_CODE_MIX, enc->mix_count);
+    enc->mix_count = 0;
+}
 
 /*****************************************************************************/
-/* fill */
-#define OUT_FILL_COUNT3(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                out_uint8(in_s, in_count); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x0); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf0); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+out_color(struct bc_enc *enc)
+{
+    enc->count -= enc->color_count;
+    out_copy(enc);
+    out_run_header(enc->s, BC_CODE_COLOR, enc->color_count);
+    out_pixel(enc->s, enc->last_pixel, enc->out_bpp);
+    enc->color_count = 0;
+}
 
 /*****************************************************************************/
-/* mix */
-#define OUT_MIX_COUNT1(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x1 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x20); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf1); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+out_bicolor(struct bc_enc *enc)
+{
+    int color1;
+    int color2;
+    int pairs;
 
-/*****************************************************************************/
-/* mix */
-#define OUT_MIX_COUNT2(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x1 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x20); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf1); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+    if ((enc->bicolor_count % 2) == 0)
+    {
+        color1 = enc->bicolor1;
+        color2 = enc->bicolor2;
+    }
+    else
+    {
+        /* the odd pixel goes in the next run */
+        enc->bicolor_count--;
+        color1 = enc->bicolor2;
+        color2 = enc->bicolor1;
+    }
+    enc->count -= enc->bicolor_count;
+    out_copy(enc);
+    pairs = enc->bicolor_count / 2;
+    if (pairs < 16)
+    {
+        out_uint8(enc->s, BC_CODE_BICOLOR | pairs);
+    }
+    else if (pairs < 256 + 16)
+    {
+        out_uint8(enc->s, BC_CODE_BICOLOR);
+        out_uint8(enc->s, pairs - 16);
+    }
+    else
+    {
+        out_uint8(enc->s, BC_CODE_MEGA_BICOLOR);
+        out_uint16_le(enc->s, pairs);
+    }
+    out_pixel(enc->s, color1, enc->out_bpp);
+    out_pixel(enc->s, color2, enc->out_bpp);
+    enc->bicolor_count = 0;
+}
 
 /*****************************************************************************/
-/* mix */
-#define OUT_MIX_COUNT3(in_count, in_s) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if (in_count < 32) \
-            { \
-                temp = (0x1 << 5) | in_count; \
-                out_uint8(in_s, temp); \
-            } \
-            else if (in_count < 256 + 32) \
-            { \
-                out_uint8(in_s, 0x20); \
-                temp = in_count - 32; \
-                out_uint8(in_s, temp); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf1); \
-                out_uint16_le(in_s, in_count); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* fill or mix (fom) */
+static void
+out_fom(struct bc_enc *enc)
+{
+    int fom_count;
 
-/*****************************************************************************/
-/* fom */
-#define OUT_FOM_COUNT1(in_count, in_s, in_mask, in_mask_len) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if ((in_count % 8) == 0 && in_count < 249) \
-            { \
-                temp = (0x2 << 5) | (in_count / 8); \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else if (in_count < 256) \
-            { \
-                out_uint8(in_s, 0x40); \
-                temp = in_count - 1; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf2); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+    fom_count = enc->fom_count;
+    enc->count -= fom_count;
+    out_copy(enc);
+    if ((fom_count % 8) == 0 && fom_count < 249)
+    {
+        out_uint8(enc->s, BC_CODE_FOM | (fom_count / 8));
+    }
+    else if (fom_count < 256)
+    {
+        out_uint8(enc->s, BC_CODE_FOM);
+        out_uint8(enc->s, fom_count - 1);
+    }
+    else
+    {
+        out_uint8(enc->s, 0xf2);
+        out_uint16_le(enc->s, fom_count);
+    }
+    out_uint8a(enc->s, enc->fom_mask, enc->fom_mask_len);
+    enc->fom_count = 0;
+}
 
 /*****************************************************************************/
-/* fom */
-#define OUT_FOM_COUNT2(in_count, in_s, in_mask, in_mask_len) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if ((in_count % 8) == 0 && in_count < 249) \
-            { \
-                temp = (0x2 << 5) | (in_count / 8); \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else if (in_count < 256) \
-            { \
-                out_uint8(in_s, 0x40); \
-                temp = in_count - 1; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf2); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+static void
+reset_counts(struct bc_enc *enc)
+{
+    enc->bicolor_count = 0;
+    enc->fill_count = 0;
+    enc->color_count = 0;
+    enc->mix_count = 0;
+    enc->fom_count = 0;
+    enc->fom_mask_len = 0;
+    enc->bicolor_spin = 0;
+}
 
 /*****************************************************************************/
-/* fill or mix (fom) */
-#define OUT_FOM_COUNT3(in_count, in_s, in_mask, in_mask_len) \
-    do { \
-        if (in_count > 0) \
-        { \
-            if ((in_count % 8) == 0 && in_count < 249) \
-            { \
-                temp = (0x2 << 5) | (in_count / 8); \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else if (in_count < 256) \
-            { \
-                out_uint8(in_s, 0x40); \
-                temp = in_count - 1; \
-                out_uint8(in_s, temp); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-            else \
-            { \
-                out_uint8(in_s, 0xf2); \
-                out_uint16_le(in_s, in_count); \
-                out_uint8a(in_s, in_mask, in_mask_len); \
-            } \
-        } \
-        in_count = 0; \
-    } while (0)
+/* true if a run is worth sending and no other run is longer */
+static int
+is_best_run(int count, const struct bc_enc *enc)
+{
+    return count > 3 &&
+           count >= enc->fill_count &&
+           count >= enc->mix_count &&
+           count >= enc->color_count &&
+           count >= enc->bicolor_count &&
+           count >= enc->fom_count;
+}
 
 /*****************************************************************************/
-#define TEST_FILL \
-    ((last_line == 0 && pixel == 0) || \
-     (last_line != 0 && pixel == ypixel))
-#define TEST_MIX \
-    ((last_line == 0 && pixel == mix) || \
-     (last_line != 0 && pixel == (ypixel ^ mix)))
-#define TEST_FOM (TEST_FILL || TEST_MIX)
-#define TEST_COLOR (pixel == last_pixel)
-#define TEST_BICOLOR \
-    ( \
-      (pixel != last_pixel) && \
-      ( \
-        (!bicolor_spin && pixel == bicolor1 && last_pixel == bicolor2) || \
-        (bicolor_spin && pixel == bicolor2 && last_pixel == bicolor1) \
-      ) \
-    )
-#define RESET_COUNTS \
-    do { \
-        bicolor_count = 0; \
-        fill_count = 0; \
-        color_count = 0; \
-        mix_count = 0; \
-        fom_count = 0; \
-        fom_mask_len = 0; \
-        bicolor_spin = 0; \
-    } while (0)
+static int
+test_bicolor(const struct bc_enc *enc, int pixel)
+{
+    if (pixel == enc->last_pixel)
+    {
+        return 0;
+    }
+    if (enc->bicolor_spin)
+    {
+        return pixel == enc->bicolor2 && enc->last_pixel == enc->bicolor1;
+    }
+    return pixel == enc->bicolor1 && enc->last_pixel == enc->bicolor2;
+}
 
 /*****************************************************************************/
-int
-xrdp_bitmap_compress(char *in_data, int width, int height,
-                     struct stream *s, int bpp, int byte_limit,
-                     int start_line, struct stream *temp_s,
-                     int e)
+static void
+add_fom_bits(struct bc_enc *enc, int num_bits, int mix)
 {
-    char *line;
-    char *last_line;
-    char fom_mask[8192]; /* good for up to 64K bitmap */
-    int lines_sent;
-    int pixel;
-    int count;
-    int color_count;
-    int last_pixel;
-    int bicolor_count;
-    int bicolor1;
-    int bicolor2;
-    int bicolor_spin;
-    int end;
-    int i;
-    int out_count;
-    int ypixel;
-    int last_ypixel;
-    int fill_count;
-    int mix_count;
-    int mix;
-    int fom_count;
-    int fom_mask_len;
-    int temp; /* used in macros */
+    int bit;
+    int bits;
 
-    init_stream(temp_s, 0);
-    fom_mask_len = 0;
-    last_line = 0;
-    lines_sent = 0;
-    end = width + e;
-    count = 0;
-    color_count = 0;
-    last_pixel = 0;
-    last_ypixel = 0;
-    bicolor_count = 0;
-    bicolor1 = 0;
-    bicolor2 = 0;
-    bicolor_spin = 0;
-    fill_count = 0;
-    mix_count = 0;
-    fom_count = 0;
-
-    if (bpp == 8)
+    while (num_bits > 0)
     {
-        mix = 0xff;
-        out_count = end;
-        line = in_data + width * start_line;
-
-        while (start_line >= 0 && out_count <= BC_MAX_BYTES)
+        bit = enc->fom_count % 8;
+        if (bit == 0)
         {
-            i = (s->p - s->data) + count;
-
-            if (i - color_count >= byte_limit &&
-                    i - bicolor_count >= byte_limit &&
-                    i - fill_count >= byte_limit &&
-                    i - mix_count >= byte_limit &&
-                    i - fom_count >= byte_limit)
-            {
-                break;
-            }
-
-            out_count += end;
-
-            for (i = 0; i < end; i++)
-            {
-                /* read next pixel */
-                IN_PIXEL8(line, i, 0, width, last_pixel, pixel);
-                IN_PIXEL8(last_line, i, 0, width, last_ypixel, ypixel);
-
-                if (!TEST_FILL)
-                {
-                    if (fill_count > 3 &&
-                            fill_count >= color_count &&
-                            fill_count >= bicolor_count &&
-                            fill_count >= mix_count &&
-                            fill_count >= fom_count)
-                    {
-                        count -= fill_count;
-                        OUT_COPY_COUNT1(count, s, temp_s);
-                        OUT_FILL_COUNT1(fill_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    fill_count = 0;
-                }
-
-                if (!TEST_MIX)
-                {
-                    if (mix_count > 3 &&
-                            mix_count >= fill_count &&
-                            mix_count >= bicolor_count &&
-                            mix_count >= color_count &&
-                            mix_count >= fom_count)
-                    {
-                        count -= mix_count;
-                        OUT_COPY_COUNT1(count, s, temp_s);
-                        OUT_MIX_COUNT1(mix_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    mix_count = 0;
-                }
-
-                if (!TEST_COLOR)
-                {
-                    if (color_count > 3 &&
-                            color_count >= fill_count &&
-                            color_count >= bicolor_count &&
-                            color_count >= mix_count &&
-                            color_count >= fom_count)
-                    {
-                        count -= color_count;
-                        OUT_COPY_COUNT1(count, s, temp_s);
-                        OUT_COLOR_COUNT1(color_count, s, last_pixel);
-                        RESET_COUNTS;
-                    }
-
-                    color_count = 0;
-                }
-
-                if (!TEST_BICOLOR)
-                {
-                    if (bicolor_count > 3 &&
-                            bicolor_count >= fill_count &&
-                            bicolor_count >= color_count &&
-                            bicolor_count >= mix_count &&
-                            bicolor_count >= fom_count)
-                    {
-                        if ((bicolor_count % 2) == 0)
-                        {
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT1(count, s, temp_s);
-                            OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor1, bicolor2);
-                        }
-                        else
-                        {
-                            bicolor_count--;
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT1(count, s, temp_s);
-                            OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor2, bicolor1);
-                        }
-
-                        RESET_COUNTS;
-                    }
-
-                    bicolor_count = 0;
-                    bicolor1 = last_pixel;
-                    bicolor2 = pixel;
-                    bicolor_spin = 0;
-                }
-
-                if (!TEST_FOM)
-                {
-                    if (fom_count > 3 &&
-                            fom_count >= fill_count &&
-                            fom_count >= color_count &&
-                            fom_count >= mix_count &&
-                            fom_count >= bicolor_count)
-                    {
-                        count -= fom_count;
-                        OUT_COPY_COUNT1(count, s, temp_s);
-                        OUT_FOM_COUNT1(fom_count, s, fom_mask, fom_mask_len);
-                        RESET_COUNTS;
-                    }
-
-                    fom_count = 0;
-                    fom_mask_len = 0;
-                }
-
-                if (TEST_FILL)
-                {
-                    fill_count++;
-                }
-
-                if (TEST_MIX)
-                {
-                    mix_count++;
-                }
-
-                if (TEST_COLOR)
-                {
-                    color_count++;
-                }
-
-                if (TEST_BICOLOR)
-                {
-                    bicolor_spin = !bicolor_spin;
-                    bicolor_count++;
-                }
-
-                if (TEST_FOM)
-                {
-                    if ((fom_count % 8) == 0)
-                    {
-                        fom_mask[fom_mask_len] = 0;
-                        fom_mask_len++;
-                    }
-
-                    if (pixel == (ypixel ^ mix))
-                    {
-                        fom_mask[fom_mask_len - 1] |= (1 << (fom_count % 8));
-                    }
-
-                    fom_count++;
-                }
-
-                out_uint8(temp_s, pixel);
-                count++;
-                last_pixel = pixel;
-                last_ypixel = ypixel;
-            }
-
-            /* can't take fix, mix, or fom past first line */
-            if (last_line == 0)
-            {
-                if (fill_count > 3 &&
-                        fill_count >= color_count &&
-                        fill_count >= bicolor_count &&
-                        fill_count >= mix_count &&
-                        fill_count >= fom_count)
-                {
-                    count -= fill_count;
-                    OUT_COPY_COUNT1(count, s, temp_s);
-                    OUT_FILL_COUNT1(fill_count, s);
-                    RESET_COUNTS;
-                }
-
-                fill_count = 0;
-
-                if (mix_count > 3 &&
-                        mix_count >= fill_count &&
-                        mix_count >= bicolor_count &&
-                        mix_count >= color_count &&
-                        mix_count >= fom_count)
-                {
-                    count -= mix_count;
-                    OUT_COPY_COUNT1(count, s, temp_s);
-                    OUT_MIX_COUNT1(mix_count, s);
-                    RESET_COUNTS;
-                }
-
-                mix_count = 0;
-
-                if (fom_count > 3 &&
-                        fom_count >= fill_count &&
-                        fom_count >= color_count &&
-                        fom_count >= mix_count &&
-                        fom_count >= bicolor_count)
-                {
-                    count -= fom_count;
-                    OUT_COPY_COUNT1(count, s, temp_s);
-                    OUT_FOM_COUNT1(fom_count, s, fom_mask, fom_mask_len);
-                    RESET_COUNTS;
-                }
-
-                fom_count = 0;
-                fom_mask_len = 0;
-            }
-
-            last_line = line;
-            line = line - width;
-            start_line--;
-            lines_sent++;
+            enc->fom_mask[enc->fom_mask_len] = 0;
+            enc->fom_mask_len++;
         }
-
-        if (fill_count > 3 &&
-                fill_count >= color_count &&
-                fill_count >= bicolor_count &&
-                fill_count >= mix_count &&
-                fill_count >= fom_count)
+        bits = MIN(8 - bit, num_bits);
+        if (mix)
         {
-            count -= fill_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_FILL_COUNT1(fill_count, s);
+            enc->fom_mask[enc->fom_mask_len - 1] |= ((1 << bits) - 1) << bit;
         }
-        else if (mix_count > 3 &&
-                 mix_count >= color_count &&
-                 mix_count >= bicolor_count &&
-                 mix_count >= fill_count &&
-                 mix_count >= fom_count)
+        enc->fom_count += bits;
+        num_bits -= bits;
+    }
+}
+
+/*****************************************************************************/
+static void
+add_pixel(struct bc_enc *enc, int pixel, int flags)
+{
+    if (!(flags & BC_FILL))
+    {
+        if (is_best_run(enc->fill_count, enc))
         {
-            count -= mix_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_MIX_COUNT1(mix_count, s);
+            out_fill(enc);
+            reset_counts(enc);
         }
-        else if (color_count > 3 &&
-                 color_count >= mix_count &&
-                 color_count >= bicolor_count &&
-                 color_count >= fill_count &&
-                 color_count >= fom_count)
+        enc->fill_count = 0;
+    }
+
+    if (!(flags & BC_MIX))
+    {
+        if (is_best_run(enc->mix_count, enc))
         {
-            count -= color_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_COLOR_COUNT1(color_count, s, last_pixel);
+            out_mix(enc);
+            reset_counts(enc);
         }
-        else if (bicolor_count > 3 &&
-                 bicolor_count >= mix_count &&
-                 bicolor_count >= color_count &&
-                 bicolor_count >= fill_count &&
-                 bicolor_count >= fom_count)
-        {
-            if ((bicolor_count % 2) == 0)
-            {
-                count -= bicolor_count;
-                OUT_COPY_COUNT1(count, s, temp_s);
-                OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor1, bicolor2);
-            }
-            else
-            {
-                bicolor_count--;
-                count -= bicolor_count;
-                OUT_COPY_COUNT1(count, s, temp_s);
-                OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor2, bicolor1);
-            }
+        enc->mix_count = 0;
+    }
 
-            count -= bicolor_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_BICOLOR_COUNT1(bicolor_count, s, bicolor1, bicolor2);
-        }
-        else if (fom_count > 3 &&
-                 fom_count >= mix_count &&
-                 fom_count >= color_count &&
-                 fom_count >= fill_count &&
-                 fom_count >= bicolor_count)
+    if (!(flags & BC_COLOR))
+    {
+        if (is_best_run(enc->color_count, enc))
         {
-            count -= fom_count;
-            OUT_COPY_COUNT1(count, s, temp_s);
-            OUT_FOM_COUNT1(fom_count, s, fom_mask, fom_mask_len);
+            out_color(enc);
+            reset_counts(enc);
         }
-        else
+        enc->color_count = 0;
+    }
+
+    if (!test_bicolor(enc, pixel))
+    {
+        if (is_best_run(enc->bicolor_count, enc))
         {
-            OUT_COPY_COUNT1(count, s, temp_s);
+            out_bicolor(enc);
+            reset_counts(enc);
         }
+        enc->bicolor_count = 0;
+        enc->bicolor1 = enc->last_pixel;
+        enc->bicolor2 = pixel;
+        enc->bicolor_spin = 0;
     }
-    else if ((bpp == 15) || (bpp == 16))
-    {
-        mix = (bpp == 15) ? 0xba1f : 0xffff;
-        out_count = end * 2;
-        line = in_data + width * start_line * 2;
 
-        while (start_line >= 0 && out_count <= BC_MAX_BYTES)
+    if (!(flags & (BC_FILL | BC_MIX)))
+    {
+        if (is_best_run(enc->fom_count, enc))
         {
-            i = (s->p - s->data) + count * 2;
-
-            if (i - (color_count * 2) >= byte_limit &&
-                    i - (bicolor_count * 2) >= byte_limit &&
-                    i - (fill_count * 2) >= byte_limit &&
-                    i - (mix_count * 2) >= byte_limit &&
-                    i - (fom_count * 2) >= byte_limit)
-            {
-                break;
-            }
-
-            out_count += end * 2;
-
-            for (i = 0; i < end; i++)
-            {
-                /* read next pixel */
-                IN_PIXEL16(line, i, 0, width, last_pixel, pixel);
-                IN_PIXEL16(last_line, i, 0, width, last_ypixel, ypixel);
-
-                if (!TEST_FILL)
-                {
-                    if (fill_count > 3 &&
-                            fill_count >= color_count &&
-                            fill_count >= bicolor_count &&
-                            fill_count >= mix_count &&
-                            fill_count >= fom_count)
-                    {
-                        count -= fill_count;
-                        OUT_COPY_COUNT2(count, s, temp_s);
-                        OUT_FILL_COUNT2(fill_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    fill_count = 0;
-                }
-
-                if (!TEST_MIX)
-                {
-                    if (mix_count > 3 &&
-                            mix_count >= fill_count &&
-                            mix_count >= bicolor_count &&
-                            mix_count >= color_count &&
-                            mix_count >= fom_count)
-                    {
-                        count -= mix_count;
-                        OUT_COPY_COUNT2(count, s, temp_s);
-                        OUT_MIX_COUNT2(mix_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    mix_count = 0;
-                }
-
-                if (!TEST_COLOR)
-                {
-                    if (color_count > 3 &&
-                            color_count >= fill_count &&
-                            color_count >= bicolor_count &&
-                            color_count >= mix_count &&
-                            color_count >= fom_count)
-                    {
-                        count -= color_count;
-                        OUT_COPY_COUNT2(count, s, temp_s);
-                        OUT_COLOR_COUNT2(color_count, s, last_pixel);
-                        RESET_COUNTS;
-                    }
-
-                    color_count = 0;
-                }
-
-                if (!TEST_BICOLOR)
-                {
-                    if (bicolor_count > 3 &&
-                            bicolor_count >= fill_count &&
-                            bicolor_count >= color_count &&
-                            bicolor_count >= mix_count &&
-                            bicolor_count >= fom_count)
-                    {
-                        if ((bicolor_count % 2) == 0)
-                        {
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT2(count, s, temp_s);
-                            OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor1, bicolor2);
-                        }
-                        else
-                        {
-                            bicolor_count--;
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT2(count, s, temp_s);
-                            OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor2, bicolor1);
-                        }
-
-                        RESET_COUNTS;
-                    }
-
-                    bicolor_count = 0;
-                    bicolor1 = last_pixel;
-                    bicolor2 = pixel;
-                    bicolor_spin = 0;
-                }
-
-                if (!TEST_FOM)
-                {
-                    if (fom_count > 3 &&
-                            fom_count >= fill_count &&
-                            fom_count >= color_count &&
-                            fom_count >= mix_count &&
-                            fom_count >= bicolor_count)
-                    {
-                        count -= fom_count;
-                        OUT_COPY_COUNT2(count, s, temp_s);
-                        OUT_FOM_COUNT2(fom_count, s, fom_mask, fom_mask_len);
-                        RESET_COUNTS;
-                    }
-
-                    fom_count = 0;
-                    fom_mask_len = 0;
-                }
-
-                if (TEST_FILL)
-                {
-                    fill_count++;
-                }
-
-                if (TEST_MIX)
-                {
-                    mix_count++;
-                }
-
-                if (TEST_COLOR)
-                {
-                    color_count++;
-                }
+            out_fom(enc);
+            reset_counts(enc);
+        }
+        enc->fom_count = 0;
+        enc->fom_mask_len = 0;
+    }
 
-                if (TEST_BICOLOR)
-                {
-                    bicolor_spin = !bicolor_spin;
-                    bicolor_count++;
-                }
+    if (flags & BC_FILL)
+    {
+        enc->fill_count++;
+    }
 
-                if (TEST_FOM)
-                {
-                    if ((fom_count % 8) == 0)
-                    {
-                        fom_mask[fom_mask_len] = 0;
-                        fom_mask_len++;
-                    }
+    if (flags & BC_MIX)
+    {
+        enc->mix_count++;
+    }
 
-                    if (pixel == (ypixel ^ mix))
-                    {
-                        fom_mask[fom_mask_len - 1] |= (1 << (fom_count % 8));
-                    }
+    if (flags & BC_COLOR)
+    {
+        enc->color_count++;
+    }
 
-                    fom_count++;
-                }
+    /* the sends above can reset bicolor_spin, so test again */
+    if (test_bicolor(enc, pixel))
+    {
+        enc->bicolor_spin = !enc->bicolor_spin;
+        enc->bicolor_count++;
+    }
 
-                out_uint16_le(temp_s, pixel);
-                count++;
-                last_pixel = pixel;
-                last_ypixel = ypixel;
-            }
+    if (flags & (BC_FILL | BC_MIX))
+    {
+        add_fom_bits(enc, 1, flags & BC_MIX);
+    }
 
-            /* can't take fix, mix, or fom past first line */
-            if (last_line == 0)
-            {
-                if (fill_count > 3 &&
-                        fill_count >= color_count &&
-                        fill_count >= bicolor_count &&
-                        fill_count >= mix_count &&
-                        fill_count >= fom_count)
-                {
-                    count -= fill_count;
-                    OUT_COPY_COUNT2(count, s, temp_s);
-                    OUT_FILL_COUNT2(fill_count, s);
-                    RESET_COUNTS;
-                }
+    enc->count++;
+    enc->last_pixel = pixel;
+}
 
-                fill_count = 0;
+/*****************************************************************************/
+/* Adds num more copies of last_pixel, all with the same flags as the
+ * last one added. After add_pixel() has seen a pixel equal to the one
+ * before it, nothing but the counts can change until the flags do */
+static void
+add_repeats(struct bc_enc *enc, int num, int flags)
+{
+    if (flags & BC_FILL)
+    {
+        enc->fill_count += num;
+    }
+    if (flags & BC_MIX)
+    {
+        enc->mix_count += num;
+    }
+    enc->color_count += num;
+    if (flags & (BC_FILL | BC_MIX))
+    {
+        add_fom_bits(enc, num, flags & BC_MIX);
+    }
+    enc->count += num;
+}
 
-                if (mix_count > 3 &&
-                        mix_count >= fill_count &&
-                        mix_count >= bicolor_count &&
-                        mix_count >= color_count &&
-                        mix_count >= fom_count)
-                {
-                    count -= mix_count;
-                    OUT_COPY_COUNT2(count, s, temp_s);
-                    OUT_MIX_COUNT2(mix_count, s);
-                    RESET_COUNTS;
-                }
+/*****************************************************************************/
+/* sends any run which has been stopped by the end of the first line */
+static void
+end_first_line(struct bc_enc *enc)
+{
+    if (is_best_run(enc->fill_count, enc))
+    {
+        out_fill(enc);
+        reset_counts(enc);
+    }
+    enc->fill_count = 0;
 
-                mix_count = 0;
+    if (is_best_run(enc->mix_count, enc))
+    {
+        out_mix(enc);
+        reset_counts(enc);
+    }
+    enc->mix_count = 0;
 
-                if (fom_count > 3 &&
-                        fom_count >= fill_count &&
-                        fom_count >= color_count &&
-                        fom_count >= mix_count &&
-                        fom_count >= bicolor_count)
-                {
-                    count -= fom_count;
-                    OUT_COPY_COUNT2(count, s, temp_s);
-                    OUT_FOM_COUNT2(fom_count, s, fom_mask, fom_mask_len);
-                    RESET_COUNTS;
-                }
+    if (is_best_run(enc->fom_count, enc))
+    {
+        out_fom(enc);
+        reset_counts(enc);
+    }
+    enc->fom_count = 0;
+    enc->fom_mask_len = 0;
+}
 
-                fom_count = 0;
-                fom_mask_len = 0;
-            }
+/*****************************************************************************/
+static void
+end_bitmap(struct bc_enc *enc)
+{
+    if (is_best_run(enc->fill_count, enc))
+    {
+        out_fill(enc);
+    }
+    else if (is_best_run(enc->mix_count, enc))
+    {
+        out_mix(enc);
+    }
+    else if (is_best_run(enc->color_count, enc))
+    {
+        out_color(enc);
+    }
+    else if (is_best_run(enc->bicolor_count, enc))
+    {
+        out_bicolor(enc);
+    }
+    else if (is_best_run(enc->fom_count, enc))
+    {
+        out_fom(enc);
+    }
+    else
+    {
+        out_copy(enc);
+    }
+}
 
-            last_line = line;
-            line = line - width * 2;
-            start_line--;
-            lines_sent++;
-        }
+/*****************************************************************************/
+/* Reads a line of in_bpp byte pixels. Pixels past the width repeat the
+ * last one */
+static void
+read_line(const char *line, int in_bpp, int width, int end, tui32 *pixels)
+{
+    int index;
 
-        if (fill_count > 3 &&
-                fill_count >= color_count &&
-                fill_count >= bicolor_count &&
-                fill_count >= mix_count &&
-                fill_count >= fom_count)
-        {
-            count -= fill_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_FILL_COUNT2(fill_count, s);
-        }
-        else if (mix_count > 3 &&
-                 mix_count >= color_count &&
-                 mix_count >= bicolor_count &&
-                 mix_count >= fill_count &&
-                 mix_count >= fom_count)
+    if (in_bpp == 1)
+    {
+        for (index = 0; index < width; index++)
         {
-            count -= mix_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_MIX_COUNT2(mix_count, s);
+            pixels[index] = ((const tui8 *) line)[index];
         }
-        else if (color_count > 3 &&
-                 color_count >= mix_count &&
-                 color_count >= bicolor_count &&
-                 color_count >= fill_count &&
-                 color_count >= fom_count)
+    }
+    else if (in_bpp == 2)
+    {
+        for (index = 0; index < width; index++)
         {
-            count -= color_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_COLOR_COUNT2(color_count, s, last_pixel);
+            pixels[index] = ((const tui16 *) line)[index];
         }
-        else if (bicolor_count > 3 &&
-                 bicolor_count >= mix_count &&
-                 bicolor_count >= color_count &&
-                 bicolor_count >= fill_count &&
-                 bicolor_count >= fom_count)
-        {
-            if ((bicolor_count % 2) == 0)
-            {
-                count -= bicolor_count;
-                OUT_COPY_COUNT2(count, s, temp_s);
-                OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor1, bicolor2);
-            }
-            else
-            {
-                bicolor_count--;
-                count -= bicolor_count;
-                OUT_COPY_COUNT2(count, s, temp_s);
-                OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor2, bicolor1);
-            }
+    }
+    else
+    {
+        g_memcpy(pixels, line, width * 4);
+    }
+    for (index = width; index < end; index++)
+    {
+        pixels[index] = pixels[width - 1];
+    }
+}
 
-            count -= bicolor_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_BICOLOR_COUNT2(bicolor_count, s, bicolor1, bicolor2);
-        }
-        else if (fom_count > 3 &&
-                 fom_count >= mix_count &&
-                 fom_count >= color_count &&
-                 fom_count >= fill_count &&
-                 fom_count >= bicolor_count)
+/*****************************************************************************/
+/* Converts a line to wire format, ready to be copied into temp_s */
+static void
+pack_line(const tui32 *pixels, int out_bpp, int end, tui8 *packed)
+{
+    int index;
+
+    if (out_bpp == 1)
+    {
+        for (index = 0; index < end; index++)
         {
-            count -= fom_count;
-            OUT_COPY_COUNT2(count, s, temp_s);
-            OUT_FOM_COUNT2(fom_count, s, fom_mask, fom_mask_len);
+            packed[index] = pixels[index];
         }
-        else
+    }
+    else if (out_bpp == 2)
+    {
+        for (index = 0; index < end; index++)
         {
-            OUT_COPY_COUNT2(count, s, temp_s);
+            packed[index * 2] = pixels[index];
+            packed[index * 2 + 1] = pixels[index] >> 8;
         }
     }
-    else if (bpp == 24)
+    else
     {
-        mix = 0xffffff;
-        out_count = end * 3;
-        line = in_data + width * start_line * 4;
-
-        while (start_line >= 0 && out_count <= BC_MAX_BYTES)
+        for (index = 0; index < end; index++)
         {
-            i = (s->p - s->data) + count * 3;
-
-            if (i - (color_count * 3) >= byte_limit &&
-                    i - (bicolor_count * 3) >= byte_limit &&
-                    i - (fill_count * 3) >= byte_limit &&
-                    i - (mix_count * 3) >= byte_limit &&
-                    i - (fom_count * 3) >= byte_limit)
-            {
-                break;
-            }
-
-            out_count += end * 3;
-
-            for (i = 0; i < end; i++)
-            {
-                /* read next pixel */
-                IN_PIXEL32(line, i, 0, width, last_pixel, pixel);
-                IN_PIXEL32(last_line, i, 0, width, last_ypixel, ypixel);
-
-                if (!TEST_FILL)
-                {
-                    if (fill_count > 3 &&
-                            fill_count >= color_count &&
-                            fill_count >= bicolor_count &&
-                            fill_count >= mix_count &&
-                            fill_count >= fom_count)
-                    {
-                        count -= fill_count;
-                        OUT_COPY_COUNT3(count, s, temp_s);
-                        OUT_FILL_COUNT3(fill_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    fill_count = 0;
-                }
-
-                if (!TEST_MIX)
-                {
-                    if (mix_count > 3 &&
-                            mix_count >= fill_count &&
-                            mix_count >= bicolor_count &&
-                            mix_count >= color_count &&
-                            mix_count >= fom_count)
-                    {
-                        count -= mix_count;
-                        OUT_COPY_COUNT3(count, s, temp_s);
-                        OUT_MIX_COUNT3(mix_count, s);
-                        RESET_COUNTS;
-                    }
-
-                    mix_count = 0;
-                }
-
-                if (!TEST_COLOR)
-                {
-                    if (color_count > 3 &&
-                            color_count >= fill_count &&
-                            color_count >= bicolor_count &&
-                            color_count >= mix_count &&
-                            color_count >= fom_count)
-                    {
-                        count -= color_count;
-                        OUT_COPY_COUNT3(count, s, temp_s);
-                        OUT_COLOR_COUNT3(color_count, s, last_pixel);
-                        RESET_COUNTS;
-                    }
-
-                    color_count = 0;
-                }
-
-                if (!TEST_BICOLOR)
-                {
-                    if (bicolor_count > 3 &&
-                            bicolor_count >= fill_count &&
-                            bicolor_count >= color_count &&
-                            bicolor_count >= mix_count &&
-                            bicolor_count >= fom_count)
-                    {
-                        if ((bicolor_count % 2) == 0)
-                        {
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT3(count, s, temp_s);
-                            OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor1, bicolor2);
-                        }
-                        else
-                        {
-                            bicolor_count--;
-                            count -= bicolor_count;
-                            OUT_COPY_COUNT3(count, s, temp_s);
-                            OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor2, bicolor1);
-                        }
-
-                        RESET_COUNTS;
-                    }
+            packed[index * 3] = pixels[index];
+            packed[index * 3 + 1] = pixels[index] >> 8;
+            packed[index * 3 + 2] = pixels[index] >> 16;
+        }
+    }
+}
 
-                    bicolor_count = 0;
-                    bicolor1 = last_pixel;
-                    bicolor2 = pixel;
-                    bicolor_spin = 0;
-                }
+/*****************************************************************************/
+/* Works out the fill, mix and colour tests for a line. These don't
+ * depend on the run state, so the loops have no branches */
+static void
+test_line(const tui32 *pixels, const tui32 *ypixels, tui32 mix,
+          tui32 last_pixel, int end, tui8 *flags)
+{
+    int index;
 
-                if (!TEST_FOM)
-                {
-                    if (fom_count > 3 &&
-                            fom_count >= fill_count &&
-                            fom_count >= color_count &&
-                            fom_count >= mix_count &&
-                            fom_count >= bicolor_count)
-                    {
-                        count -= fom_count;
-                        OUT_COPY_COUNT3(count, s, temp_s);
-                        OUT_FOM_COUNT3(fom_count, s, fom_mask, fom_mask_len);
-                        RESET_COUNTS;
-                    }
+    for (index = 0; index < end; index++)
+    {
+        flags[index] = (pixels[index] == ypixels[index]) ? BC_FILL : 0;
+    }
+    for (index = 0; index < end; index++)
+    {
+        flags[index] |= (pixels[index] == (ypixels[index] ^ mix)) ? BC_MIX : 0;
+    }
+    if (end > 0)
+    {
+        flags[0] |= (pixels[0] == last_pixel) ? BC_COLOR : 0;
+    }
+    for (index = 1; index < end; index++)
+    {
+        flags[index] |= (pixels[index] == pixels[index - 1]) ? BC_COLOR : 0;
+    }
+}
 
-                    fom_count = 0;
-                    fom_mask_len = 0;
-                }
+/*****************************************************************************/
+int
+xrdp_bitmap_compress(char *in_data, int width, int height,
+                     struct stream *s, int bpp, int byte_limit,
+                     int start_line, struct stream *temp_s,
+                     int e)
+{
+    struct bc_enc enc;
+    char *line;
+    tui32 *line_buf;
+    tui32 *pixels;
+    tui32 *ypixels;
+    tui32 *swap;
+    tui8 *flags;
+    tui8 *packed;
+    tui32 mix;
+    int in_bpp;
+    int first_line;
+    int lines_sent;
+    int end;
+    int i;
+    int run;
+    int out_count;
 
-                if (TEST_FILL)
-                {
-                    fill_count++;
-                }
+    switch (bpp)
+    {
+        case 8:
+            mix = 0xff;
+            in_bpp = 1;
+            break;
+        case 15:
+            mix = 0xba1f;
+            in_bpp = 2;
+            break;
+        case 16:
+            mix = 0xffff;
+            in_bpp = 2;
+            break;
+        case 24:
+            mix = 0xffffff;
+            in_bpp = 4;
+            break;
+        default:
+            return 0;
+    }
 
-                if (TEST_MIX)
-                {
-                    mix_count++;
-                }
+    end = width + e;
+    line_buf = g_new(tui32, end * 2 + 1);
+    flags = g_new(tui8, end + 1);
+    packed = g_new(tui8, end * 3 + 1);
+    if (line_buf == NULL || flags == NULL || packed == NULL)
+    {
+        g_free(line_buf);
+        g_free(flags);
+        g_free(packed);
+        return 0;
+    }
+    pixels = line_buf;
+    /* there is no line above the first one, treat it as black */
+    ypixels = line_buf + end;
+    g_memset(ypixels, 0, end * sizeof(tui32));
+
+    g_memset(&enc, 0, sizeof(enc));
+    enc.s = s;
+    enc.temp_s = temp_s;
+    enc.packed = packed;
+    enc.out_bpp = (bpp + 7) / 8;
+    init_stream(temp_s, 0);
 
-                if (TEST_COLOR)
-                {
-                    color_count++;
-                }
+    first_line = 1;
+    lines_sent = 0;
+    out_count = end * enc.out_bpp;
+    line = in_data + width * start_line * in_bpp;
 
-                if (TEST_BICOLOR)
-                {
-                    bicolor_spin = !bicolor_spin;
-                    bicolor_count++;
-                }
+    while (start_line >= 0 && out_count <= BC_MAX_BYTES)
+    {
+        i = (s->p - s->data) + enc.count * enc.out_bpp;
 
-                if (TEST_FOM)
-                {
-                    if ((fom_count % 8) == 0)
-                    {
-                        fom_mask[fom_mask_len] = 0;
-                        fom_mask_len++;
-                    }
+        if (i - enc.color_count * enc.out_bpp >= byte_limit &&
+                i - enc.bicolor_count * enc.out_bpp >= byte_limit &&
+                i - enc.fill_count * enc.out_bpp >= byte_limit &&
+                i - enc.mix_count * enc.out_bpp >= byte_limit &&
+                i - enc.fom_count * enc.out_bpp >= byte_limit)
+        {
+            break;
+        }
 
-                    if (pixel == (ypixel ^ mix))
-                    {
-                        fom_mask[fom_mask_len - 1] |= (1 << (fom_count % 8));
-                    }
+        out_count += end * enc.out_bpp;
 
-                    fom_count++;
-                }
+        read_line(line, in_bpp, width, end, pixels);
+        test_line(pixels, ypixels, mix, enc.last_pixel, end, flags);
 
-                out_uint8(temp_s, pixel & 0xff);
-                out_uint8(temp_s, (pixel >> 8) & 0xff);
-                out_uint8(temp_s, (pixel >> 16) & 0xff);
-                count++;
-                last_pixel = pixel;
-                last_ypixel = ypixel;
-            }
+        pack_line(pixels, enc.out_bpp, end, packed);
+        enc.packed_start = 0;
 
-            /* can't take fix, mix, or fom past first line */
-            if (last_line == 0)
+        for (i = 0; i < end; i = run)
+        {
+            enc.packed_pos = i;
+            add_pixel(&enc, pixels[i], flags[i]);
+            run = i + 1;
+            if (flags[i] & BC_COLOR)
             {
-                if (fill_count > 3 &&
-                        fill_count >= color_count &&
-                        fill_count >= bicolor_count &&
-                        fill_count >= mix_count &&
-                        fill_count >= fom_count)
+                while (run < end && flags[run] == flags[i])
                 {
-                    count -= fill_count;
-                    OUT_COPY_COUNT3(count, s, temp_s);
-                    OUT_FILL_COUNT3(fill_count, s);
-                    RESET_COUNTS;
+                    run++;
                 }
-
-                fill_count = 0;
-
-                if (mix_count > 3 &&
-                        mix_count >= fill_count &&
-                        mix_count >= bicolor_count &&
-                        mix_count >= color_count &&
-                        mix_count >= fom_count)
-                {
-                    count -= mix_count;
-                    OUT_COPY_COUNT3(count, s, temp_s);
-                    OUT_MIX_COUNT3(mix_count, s);
-                    RESET_COUNTS;
-                }
-
-                mix_count = 0;
-
-                if (fom_count > 3 &&
-                        fom_count >= fill_count &&
-                        fom_count >= color_count &&
-                        fom_count >= mix_count &&
-                        fom_count >= bicolor_count)
-                {
-                    count -= fom_count;
-                    OUT_COPY_COUNT3(count, s, temp_s);
-                    OUT_FOM_COUNT3(fom_count, s, fom_mask, fom_mask_len);
-                    RESET_COUNTS;
-                }
-
-                fom_count = 0;
-                fom_mask_len = 0;
+                add_repeats(&enc, run - i - 1, flags[i]);
             }
-
-            last_line = line;
-            line = line - width * 4;
-            start_line--;
-            lines_sent++;
         }
+        enc.packed_pos = end;
+        sync_temp_s(&enc);
 
-        if (fill_count > 3 &&
-                fill_count >= color_count &&
-                fill_count >= bicolor_count &&
-                fill_count >= mix_count &&
-                fill_count >= fom_count)
-        {
-            count -= fill_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_FILL_COUNT3(fill_count, s);
-        }
-        else if (mix_count > 3 &&
-                 mix_count >= color_count &&
-                 mix_count >= bicolor_count &&
-                 mix_count >= fill_count &&
-                 mix_count >= fom_count)
+        /* can't take fill, mix, or fom past first line */
+        if (first_line)
         {
-            count -= mix_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_MIX_COUNT3(mix_count, s);
+            end_first_line(&enc);
+            first_line = 0;
         }
-        else if (color_count > 3 &&
-                 color_count >= mix_count &&
-                 color_count >= bicolor_count &&
-                 color_count >= fill_count &&
-                 color_count >= fom_count)
-        {
-            count -= color_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_COLOR_COUNT3(color_count, s, last_pixel);
-        }
-        else if (bicolor_count > 3 &&
-                 bicolor_count >= mix_count &&
-                 bicolor_count >= color_count &&
-                 bicolor_count >= fill_count &&
-                 bicolor_count >= fom_count)
-        {
-            if ((bicolor_count % 2) == 0)
-            {
-                count -= bicolor_count;
-                OUT_COPY_COUNT3(count, s, temp_s);
-                OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor1, bicolor2);
-            }
-            else
-            {
-                bicolor_count--;
-                count -= bicolor_count;
-                OUT_COPY_COUNT3(count, s, temp_s);
-                OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor2, bicolor1);
-            }
 
-            count -= bicolor_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_BICOLOR_COUNT3(bicolor_count, s, bicolor1, bicolor2);
-        }
-        else if (fom_count > 3 &&
-                 fom_count >= mix_count &&
-                 fom_count >= color_count &&
-                 fom_count >= fill_count &&
-                 fom_count >= bicolor_count)
-        {
-            count -= fom_count;
-            OUT_COPY_COUNT3(count, s, temp_s);
-            OUT_FOM_COUNT3(fom_count, s, fom_mask, fom_mask_len);
-        }
-        else
-        {
-            OUT_COPY_COUNT3(count, s, temp_s);
-        }
+        swap = ypixels;
+        ypixels = pixels;
+        pixels = swap;
+        line = line - width * in_bpp;
+        start_line--;
+        lines_sent++;
     }
 
+    end_bitmap(&enc);
+
+    g_free(line_buf);
+    g_free(flags);
+    g_free(packed);
     return lines_sent;
 }
@@ -151,6 +151,24 @@ xrdp_fastpath_send(struct xrdp_fastpath *self, struct stream *s)
     return 0;
 }
 
+/*****************************************************************************/
+/* As xrdp_fastpath_send(), but the transport takes s, and frees it once
+ * it has been sent. Output which has to wait for the socket isn't
+ * copied */
+int
+xrdp_fastpath_send_owned(struct xrdp_fastpath *self, struct stream *s)
+{
+    if (trans_write_owned_s(self->trans, s) != 0)
+    {
+        return 1;
+    }
+    if (self->session->check_for_app_input)
+    {
+        xrdp_fastpath_session_callback(self, 0x5556, 0, 0, 0, 0);
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /**
  * Converts the fastpath keyboard event flags to slowpath event flags
@@ -447,14 +447,13 @@ xrdp_iso_send_cc(struct xrdp_iso *self)
               "length indicator %d, DST-REF 0, SRC-REF 0, CLASS OPTION 0",
               len_indicator);
 
-    if (trans_write_copy_s(self->trans, s) != 0)
+    /* The transport frees s */
+    if (trans_write_owned_s(self->trans, s) != 0)
     {
         LOG(LOG_LEVEL_ERROR, "Sending [ITU-T X.224] CC-TPDU (Connection Confirm) failed");
-        free_stream(s);
         return 1;
     }
 
-    free_stream(s);
     return 0;
 }
 /*****************************************************************************
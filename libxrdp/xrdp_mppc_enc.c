@@ -22,63 +22,44 @@
 #include <config_ac.h>
 #endif
 
+#include <string.h>
+
 #include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "ms-rdpegdi.h"
 
 /* local defines */
 
 #define RDP_40_HIST_BUF_LEN (1024 * 8) /* RDP 4.0 uses 8K history buf */
 #define RDP_50_HIST_BUF_LEN (1024 * 64) /* RDP 5.0 uses 64K history buf */
+/* lengths in RDP 6.1 match details are 16 bits */
+#define RDP_61_MAX_INPUT (RDP_50_HIST_BUF_LEN - 1)
 
 /* Compression Types */
 #define PACKET_COMPRESSED       0x20
 #define PACKET_AT_FRONT         0x40
 #define PACKET_FLUSHED          0x80
-#define PACKET_COMPR_TYPE_8K    0x00
-#define PACKET_COMPR_TYPE_64K   0x01
-#define PACKET_COMPR_TYPE_RDP6  0x02
-#define PACKET_COMPR_TYPE_RDP61 0x03
-#define CompressionTypeMask     0x0F
-
-#define CRC_INIT 0xFFFF
-#define CRC(_crcval, _newchar) _crcval = \
-    ((_crcval) >> 8) ^ g_crc_table[((_crcval) ^ (_newchar)) & 0x00ff]
-
-/* CRC16 defs */
-static const tui16 g_crc_table[256] =
-{
-    0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-    0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-    0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-    0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-    0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-    0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-    0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-    0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-    0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-    0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-    0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-    0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-    0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-    0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-    0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-    0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-    0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-    0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-    0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-    0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-    0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-    0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-    0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-    0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-    0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-    0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-    0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-    0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-    0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-    0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-    0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-    0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-};
+
+/* The hash table maps a hash of 3 bytes to the offset in the history
+ * buffer where those bytes were last seen. Offsets fit in a tui16 for
+ * both history sizes */
+#define MPPC_HASH_BITS 16
+#define MPPC_HASH_SIZE (1 << MPPC_HASH_BITS)
+
+/* Multiplicative (Fibonacci) hash of the 3 bytes at _p. The multiply
+ * moves every input bit into the top MPPC_HASH_BITS of the product,
+ * which spreads runs of similar pixels much better than the old CRC16,
+ * and needs no table lookups */
+#define MPPC_HASH(_p) \
+    (((((tui32)(tui8)(_p)[0]) | \
+       ((tui32)(tui8)(_p)[1] << 8) | \
+       ((tui32)(tui8)(_p)[2] << 16)) * 2654435761U) >> \
+     (32 - MPPC_HASH_BITS))
+
+/* Most bytes a single literal or copy tuple can add to the output. The
+ * output buffer is allocated with this much slack so the encoder only
+ * has to check for overrun once per tuple */
+#define MPPC_MAX_TUPLE_BYTES 8
 
 /*****************************************************************************
                      insert 2 bits into outputBuffer
@@ -415,10 +396,62 @@ static const tui16 g_crc_table[256] =
         bits_left = k; \
     } while (0)
 
+/*****************************************************************************
+                     insert a literal byte into outputBuffer
+******************************************************************************/
+#define insert_literal(_byte) \
+    do \
+    { \
+        data = (_byte); \
+        if (data < 0x80) \
+        { \
+            insert_8_bits(data); \
+        } \
+        else \
+        { \
+            insert_2_bits(0x02); \
+            data &= 0x7f; \
+            insert_7_bits(data); \
+        } \
+    } while (0)
+
+/**
+ * Initialize mppc_enc structure for RDP 6.1
+ *
+ * RDP 6.1 is a level 1 compressor with a 2,000,000 byte history,
+ * followed by an RDP 5.0 compressor (level 2)
+ *
+ * @param   enc   struct with protocol_type set
+ *
+ * @return  enc or nil on failure
+ */
+
+static struct xrdp_mppc_enc *
+mppc_enc_new_rdp_61(struct xrdp_mppc_enc *enc)
+{
+    enc->buf_len = RDP_61_MAX_INPUT;
+    /* client starts with an empty level 1 history anyway, but make sure */
+    enc->flagsHold = PACKET_FLUSHED;
+    /* 2 bytes for Level1ComprFlags and Level2ComprFlags */
+    enc->outputBufferPlus = (char *) g_malloc(enc->buf_len + 64 + 2, 0);
+    enc->xcrush = xcrush_enc_new();
+    enc->level2 = mppc_enc_new(PROTO_RDP_50);
+
+    if ((enc->outputBufferPlus == 0) || (enc->xcrush == 0) ||
+            (enc->level2 == 0))
+    {
+        mppc_enc_free(enc);
+        return 0;
+    }
+
+    enc->outputBuffer = enc->outputBufferPlus + 64;
+    return enc;
+}
+
 /**
  * Initialize mppc_enc structure
  *
- * @param   protocol_type   PROTO_RDP_40 or PROTO_RDP_50
+ * @param   protocol_type   PROTO_RDP_40, PROTO_RDP_50 or PROTO_RDP_61
  *
  * @return  struct xrdp_mppc_enc* or nil on failure
  */
@@ -447,6 +480,10 @@ mppc_enc_new(int protocol_type)
             enc->buf_len = RDP_50_HIST_BUF_LEN;
             break;
 
+        case PROTO_RDP_61:
+            enc->protocol_type = PROTO_RDP_61;
+            return mppc_enc_new_rdp_61(enc);
+
         default:
             g_free(enc);
             return 0;
@@ -461,7 +498,8 @@ mppc_enc_new(int protocol_type)
         return 0;
     }
 
-    enc->outputBufferPlus = (char *) g_malloc(enc->buf_len + 64, 1);
+    enc->outputBufferPlus = (char *) g_malloc(enc->buf_len + 64 +
+                            MPPC_MAX_TUPLE_BYTES, 1);
 
     if (enc->outputBufferPlus == 0)
     {
@@ -471,7 +509,7 @@ mppc_enc_new(int protocol_type)
     }
 
     enc->outputBuffer = enc->outputBufferPlus + 64;
-    enc->hash_table = (tui16 *) g_malloc(enc->buf_len * 2, 1);
+    enc->hash_table = (tui16 *) g_malloc(MPPC_HASH_SIZE * sizeof(tui16), 1);
 
     if (enc->hash_table == 0)
     {
@@ -500,28 +538,77 @@ mppc_enc_free(struct xrdp_mppc_enc *enc)
     g_free(enc->historyBuffer);
     g_free(enc->outputBufferPlus);
     g_free(enc->hash_table);
+    xcrush_enc_free(enc->xcrush);
+    mppc_enc_free(enc->level2);
     g_free(enc);
 }
 
 /**
- * encode (compress) data using RDP 4.0 protocol
+ * empty the history buffer. The next packet tells the client to do
+ * the same
  *
  * @param   enc           encoder state info
- * @param   srcData       uncompressed data
- * @param   len           length of srcData
+ */
+
+static void
+mppc_reset_history(struct xrdp_mppc_enc *enc)
+{
+    enc->historyOffset = 0;
+    g_memset(enc->hash_table, 0, MPPC_HASH_SIZE * sizeof(tui16));
+    g_memset(enc->historyBuffer, 0, enc->buf_len);
+    enc->flagsHold |= PACKET_AT_FRONT | PACKET_FLUSHED;
+}
+
+/**
+ * find how many bytes match at two places in the history buffer
  *
- * @return  TRUE on success, FALSE on failure
+ * Bytes are compared a machine word at a time. The first differing
+ * byte of a word is found from the XOR of the two words.
+ *
+ * @param   p1            first byte to compare
+ * @param   p2            first byte to compare against, must be before p1
+ * @param   end           stop comparing when p1 reaches this
+ *
+ * @return  number of matching bytes
  */
 
 static int
-compress_rdp_4(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+mppc_match_len(const char *p1, const char *p2, const char *end)
 {
-    /* RDP 4.0 encoding not yet implemented */
-    return 0;
+    const char *start = p1;
+    tui64 w1;
+    tui64 w2;
+
+    while (p1 + sizeof(tui64) <= end)
+    {
+        memcpy(&w1, p1, sizeof(w1));
+        memcpy(&w2, p2, sizeof(w2));
+        if (w1 != w2)
+        {
+#if defined(__GNUC__) && defined(L_ENDIAN)
+            return (int) (p1 - start) + (__builtin_ctzll(w1 ^ w2) >> 3);
+#elif defined(__GNUC__) && defined(B_ENDIAN)
+            return (int) (p1 - start) + (__builtin_clzll(w1 ^ w2) >> 3);
+#else
+            break;
+#endif
+        }
+        p1 += sizeof(tui64);
+        p2 += sizeof(tui64);
+    }
+    while ((p1 < end) && (*p1 == *p2))
+    {
+        p1++;
+        p2++;
+    }
+    return (int) (p1 - start);
 }
 
 /**
- * encode (compress) data using RDP 5.0 protocol using hash table
+ * encode (compress) data using the RDP 4.0 or RDP 5.0 protocol
+ *
+ * The two protocols differ only in the size of the history buffer and
+ * in how copy offsets are encoded. RDP 4.0 is the MPPC of RFC 2118.
  *
  * @param   enc           encoder state info
  * @param   srcData       uncompressed data
@@ -531,10 +618,10 @@ compress_rdp_4(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
  */
 
 static int
-compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+compress_mppc(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
 {
     char *outputBuffer;     /* points to enc->outputBuffer */
-    char *hptr_end;         /* points to end of history data */
+    char *hptr_end;         /* points past end of history data */
     char *historyPointer;   /* points to first byte of srcData in
                              * historyBuffer */
     char *hbuf_start;       /* points to start of history buffer */
@@ -544,198 +631,103 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
     int bits_left;          /* unused bits in current byte in outputBuffer */
     tui32 copy_offset;      /* pattern match starts here... */
     tui32 lom;              /* ...and matches this many bytes */
-    int last_crc_index;     /* don't compute CRC beyond this index */
+    int last_hash_index;    /* don't compute hash beyond this index */
     tui16 *hash_table;      /* hash table for pattern matching */
+    int rdp_40;
 
     tui32 i;
     tui32 j;
     tui32 k;
-    tui32 x;
     tui8 data;
     tui16 data16;
-    tui32 historyOffset;
-    tui16 crc;
+    tui32 hash;
     tui32 ctr;
     tui32 saved_ctr;
     tui32 data_end;
-    tui8 byte_val;
+    tui32 pos;
 
-    crc = 0;
     opb_index = 0;
     bits_left = 8;
-    copy_offset = 0;
     hash_table = enc->hash_table;
     hbuf_start = enc->historyBuffer;
     outputBuffer = enc->outputBuffer;
     g_memset(outputBuffer, 0, len);
-    enc->flags = PACKET_COMPR_TYPE_64K;
+    rdp_40 = (enc->protocol_type == PROTO_RDP_40);
+    enc->flags = rdp_40 ? PACKET_COMPR_TYPE_8K : PACKET_COMPR_TYPE_64K;
 
     if ((enc->historyOffset + len) >= enc->buf_len - 3)
     {
         /* historyBuffer cannot hold srcData - rewind it */
-        enc->historyOffset = 0;
-        g_memset(hash_table, 0, enc->buf_len * 2);
-        g_memset(enc->historyBuffer, 0, enc->buf_len); // added
-        enc->flagsHold |= PACKET_AT_FRONT | PACKET_FLUSHED;
+        mppc_reset_history(enc);
     }
 
-    /* point to next free byte in historyBuffer */
-    historyOffset = enc->historyOffset;
-
     /* add / append new data to historyBuffer */
-    g_memcpy(&(enc->historyBuffer[historyOffset]), srcData, len);
+    g_memcpy(&(enc->historyBuffer[enc->historyOffset]), srcData, len);
 
     /* point to start of data to be compressed */
-    historyPointer = &(enc->historyBuffer[historyOffset]);
-
-    ctr = copy_offset = lom = 0;
-
-    /* if we are at start of history buffer, do not attempt to compress */
-    /* first 2 bytes, because minimum LoM is 3                          */
-    if (historyOffset == 0)
-    {
-        /* encode first two bytes as literals */
-        for (x = 0; x < 2; x++)
-        {
-            data = *(historyPointer + x);
-            LOG_DEVEL(LOG_LEVEL_TRACE, "%.2x ", (tui8) data);
-            if (data & 0x80)
-            {
-                /* insert encoded literal */
-                insert_2_bits(0x02);
-                data &= 0x7f;
-                insert_7_bits(data);
-            }
-            else
-            {
-                /* insert literal */
-                insert_8_bits(data);
-            }
-        }
-
-        /* store hash for first two entries in historyBuffer */
-        crc = CRC_INIT;
-        byte_val = enc->historyBuffer[0];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[1];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[2];
-        CRC(crc, byte_val);
-        hash_table[crc] = 0;
-
-        crc = CRC_INIT;
-        byte_val = enc->historyBuffer[1];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[2];
-        CRC(crc, byte_val);
-        byte_val = enc->historyBuffer[3];
-        CRC(crc, byte_val);
-        hash_table[crc] = 1;
-
-        /* first two bytes have already been processed */
-        ctr = 2;
-    }
+    historyPointer = &(enc->historyBuffer[enc->historyOffset]);
 
     enc->historyOffset += len;
 
-    /* point to last byte in new data */
-    hptr_end = &(enc->historyBuffer[enc->historyOffset - 1]);
+    /* point past last byte in new data */
+    hptr_end = &(enc->historyBuffer[enc->historyOffset]);
 
-    /* do not compute CRC beyond this */
-    last_crc_index = enc->historyOffset - 3;
+    /* do not compute hash beyond this */
+    last_hash_index = enc->historyOffset - 3;
 
     /* do not search for pattern match beyond this */
     data_end = len - 2;
 
-    /* start compressing data */
-
-    while (ctr < data_end)
+    /* start compressing data. Stop early if the output is already as
+     * long as the input, as we're going to give up anyway */
+    ctr = 0;
+    while ((ctr < data_end) && (opb_index < len))
     {
         cptr1 = historyPointer + ctr;
+        pos = cptr1 - hbuf_start;
+        hash = MPPC_HASH(cptr1);
 
-        crc = CRC_INIT;
-        byte_val = *cptr1;
-        CRC(crc, byte_val);
-        byte_val = *(cptr1 + 1);
-        CRC(crc, byte_val);
-        byte_val = *(cptr1 + 2);
-        CRC(crc, byte_val);
-
-        /* cptr2 points to start of pattern match */
-        cptr2 = hbuf_start + hash_table[crc];
-        copy_offset = cptr1 - cptr2;
+        /* cptr2 points to start of possible pattern match */
+        cptr2 = hbuf_start + hash_table[hash];
 
         /* save current entry */
-        hash_table[crc] = cptr1 - hbuf_start;
-
-        /* double check that we have a pattern match */
-        if ((*cptr1 != *cptr2) ||
-                (*(cptr1 + 1) != *(cptr2 + 1)) ||
-                (*(cptr1 + 2) != *(cptr2 + 2)))
+        hash_table[hash] = pos;
+
+        /* check that we have a pattern match. Entries in the hash table
+         * are only ever before the current position, apart from empty
+         * entries which are zero */
+        if ((cptr2 >= cptr1) ||
+                (cptr1[0] != cptr2[0]) ||
+                (cptr1[1] != cptr2[1]) ||
+                (cptr1[2] != cptr2[2]))
         {
             /* no match found; encode literal byte */
-            data = *cptr1;
-
-            LOG_DEVEL(LOG_LEVEL_TRACE, "%.2x ", data);
-            if (data < 0x80)
-            {
-                /* literal byte < 0x80 */
-                insert_8_bits(data);
-            }
-            else
-            {
-                /* literal byte >= 0x80 */
-                insert_2_bits(0x02);
-                data &= 0x7f;
-                insert_7_bits(data);
-            }
+            LOG_DEVEL(LOG_LEVEL_TRACE, "%.2x ", (tui8) *cptr1);
+            insert_literal(*cptr1);
             ctr++;
             continue;
         }
 
         /* we have a match - compute Length of Match */
-        cptr1 += 3;
-        cptr2 += 3;
-        lom = 3;
-        while ((cptr1 <= hptr_end) && (*(cptr1++) == *(cptr2++)))
-        {
-            lom++;
-        }
+        copy_offset = cptr1 - cptr2;
+        lom = 3 + mppc_match_len(cptr1 + 3, cptr2 + 3, hptr_end);
         saved_ctr = ctr + lom;
-        LOG_DEVEL(LOG_LEVEL_TRACE, "<%ld: %u,%d> ",  (historyPointer + ctr) - hbuf_start,
-                  copy_offset, lom);
+        LOG_DEVEL(LOG_LEVEL_TRACE, "<%u: %u,%u> ", pos, copy_offset, lom);
 
-        /* compute CRC for matching segment and store in hash table */
-
-        cptr1 = historyPointer + ctr;
-        if (cptr1 + lom > hbuf_start + last_crc_index)
+        /* compute hash for rest of matching segment and store in hash
+         * table */
+        if (pos + lom - 1 > (tui32) last_hash_index)
         {
-            /* we have gone beyond last_crc_index - go back */
-            j = last_crc_index - (cptr1 - hbuf_start);
+            /* we have gone beyond last_hash_index - go back */
+            j = last_hash_index - pos;
         }
         else
         {
             j = lom - 1;
         }
-        ctr++;
-        for (i = 0; i < j; i++)
+        for (i = 1; i <= j; i++)
         {
-            cptr1 = historyPointer + ctr;
-
-            /* compute CRC on triplet */
-            crc = CRC_INIT;
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
-            byte_val = *(cptr1++);
-            CRC(crc, byte_val);
-
-            /* save current entry */
-            hash_table[crc] = (cptr1 - 3) - hbuf_start;
-
-            /* point to next triplet */
-            ctr++;
+            hash_table[MPPC_HASH(cptr1 + i)] = pos + i;
         }
         ctr = saved_ctr;
 
@@ -744,8 +736,16 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
         if (copy_offset <= 63) /* (copy_offset >= 0) is always true */
         {
             /* insert binary header */
-            data = 0x1f;
-            insert_5_bits(data);
+            if (rdp_40)
+            {
+                data = 0x0f;
+                insert_4_bits(data);
+            }
+            else
+            {
+                data = 0x1f;
+                insert_5_bits(data);
+            }
 
             /* insert 6 bits of copy_offset */
             data = (char) (copy_offset & 0x3f);
@@ -754,13 +754,33 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
         else if ((copy_offset >= 64) && (copy_offset <= 319))
         {
             /* insert binary header */
-            data = 0x1e;
-            insert_5_bits(data);
+            if (rdp_40)
+            {
+                data = 0x0e;
+                insert_4_bits(data);
+            }
+            else
+            {
+                data = 0x1e;
+                insert_5_bits(data);
+            }
 
             /* insert 8 bits of copy offset */
             data = (char) (copy_offset - 64);
             insert_8_bits(data);
         }
+        else if (rdp_40)
+        {
+            /* copy_offset is 320 - 8191 */
+
+            /* insert binary header */
+            data = 0x06;
+            insert_3_bits(data);
+
+            /* insert 13 bits of copy offset */
+            data16 = copy_offset - 320;
+            insert_13_bits(data16);
+        }
         else if ((copy_offset >= 320) && (copy_offset <= 2367))
         {
             /* insert binary header */
@@ -768,7 +788,7 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
             insert_4_bits(data);
 
             /* insert 11 bits of copy offset */
-            data16 = copy_offset - 320;;
+            data16 = copy_offset - 320;
             insert_11_bits(data16);
         }
         else
@@ -780,7 +800,7 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
             insert_3_bits(data);
 
             /* insert 16 bits of copy offset */
-            data16 = copy_offset - 2368;;
+            data16 = copy_offset - 2368;
             insert_16_bits(data16);
         }
 
@@ -940,22 +960,10 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
     } /* end while (ctr < data_end) */
 
     /* add remaining data to the output */
-    while (len - ctr > 0)
+    while ((ctr < (tui32) len) && (opb_index < len))
     {
-        data = srcData[ctr];
-        LOG_DEVEL(LOG_LEVEL_TRACE, "%.2x ", data);
-        if (data < 0x80)
-        {
-            /* literal byte < 0x80 */
-            insert_8_bits(data);
-        }
-        else
-        {
-            /* literal byte >= 0x80 */
-            insert_2_bits(0x02);
-            data &= 0x7f;
-            insert_7_bits(data);
-        }
+        LOG_DEVEL(LOG_LEVEL_TRACE, "%.2x ", srcData[ctr]);
+        insert_literal(srcData[ctr]);
         ctr++;
     }
 
@@ -965,18 +973,14 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
         opb_index++;
     }
 
-    if (opb_index > len)
+    if ((ctr < (tui32) len) || (opb_index > len))
     {
         /* compressed data longer than uncompressed data */
         /* give up */
         LOG_DEVEL(LOG_LEVEL_DEBUG, "Compression algorithim produced a compressed "
                   "buffer which is larger than the uncompressed buffer. "
-                  "compression ratio %f, flags 0x%x",
-                  (float) len / (float) opb_index, enc->flags);
-        enc->historyOffset = 0;
-        g_memset(hash_table, 0, enc->buf_len * 2);
-        g_memset(enc->historyBuffer, 0, enc->buf_len);
-        enc->flagsHold |= PACKET_AT_FRONT | PACKET_FLUSHED;
+                  "flags 0x%x", enc->flags);
+        mppc_reset_history(enc);
         return 0;
     }
 
@@ -993,6 +997,55 @@ compress_rdp_5(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
     return 1;
 }
 
+/**
+ * encode (compress) data using RDP 6.1 protocol
+ *
+ * The output is always sent compressed, even if neither level could
+ * make it smaller. This keeps the client's level 1 history in step
+ * with ours, at a cost of two bytes.
+ *
+ * @param   enc           encoder state info
+ * @param   srcData       uncompressed data
+ * @param   len           length of srcData
+ *
+ * @return  TRUE on success, FALSE on failure
+ */
+
+static int
+compress_rdp_61(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
+{
+    struct xrdp_mppc_enc *level2 = enc->level2;
+    const char *payload;
+    int payload_len;
+    int level1_flags;
+    int level2_flags;
+
+    level1_flags = xcrush_compress_l1(enc->xcrush, srcData, len,
+                                      &payload, &payload_len);
+    level2_flags = 0;
+    if (compress_rdp(level2, (tui8 *) payload, payload_len))
+    {
+        level1_flags |= L1_INNER_COMPRESSION;
+        level2_flags = level2->flags;
+        payload = level2->outputBuffer;
+        payload_len = level2->bytes_in_opb;
+    }
+
+    /* RDP61_COMPRESSED_DATA */
+    enc->outputBuffer[0] = (char) level1_flags;
+    enc->outputBuffer[1] = (char) level2_flags;
+    g_memcpy(enc->outputBuffer + 2, payload, payload_len);
+    enc->bytes_in_opb = payload_len + 2;
+
+    enc->flags = PACKET_COMPR_TYPE_RDP61 | PACKET_COMPRESSED | enc->flagsHold;
+    enc->flagsHold = 0;
+
+    LOG_DEVEL(LOG_LEVEL_TRACE, "compress_rdp_61: level1 flags 0x%x, "
+              "level2 flags 0x%x, bytes_in_opb %d, uncompressed len %d",
+              level1_flags, level2_flags, enc->bytes_in_opb, len);
+    return 1;
+}
+
 /**
  * encode (compress) data
  *
@@ -1014,12 +1067,11 @@ compress_rdp(struct xrdp_mppc_enc *enc, tui8 *srcData, int len)
     switch (enc->protocol_type)
     {
         case PROTO_RDP_40:
-            return compress_rdp_4(enc, srcData, len);
-            break;
-
         case PROTO_RDP_50:
-            return compress_rdp_5(enc, srcData, len);
-            break;
+            return compress_mppc(enc, srcData, len);
+
+        case PROTO_RDP_61:
+            return compress_rdp_61(enc, srcData, len);
     }
 
     return 0;
@@ -189,6 +189,10 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->tls_ciphers = g_strdup(value);
         }
+        else if (g_strcasecmp(item, "ktls") == 0)
+        {
+            client_info->use_ktls = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "security_layer") == 0)
         {
             if (g_strcasecmp(value, "rdp") == 0)
@@ -27,6 +27,10 @@
 #include "log.h"
 #include "string_calls.h"
 
+/* Largest TS_FP_UPDATE_PDU built from batched updates. The length
+   field has 15 bits, and FIPS adds up to 7 bytes of padding */
+#define FASTPATH_BATCH_MAX_BYTES (0x7fff - 8)
+
 /* some compilers need unsigned char to avoid warnings */
 static tui8 g_pad_54[40] =
 {
@@ -193,6 +197,7 @@ xrdp_sec_delete(struct xrdp_sec *self)
     ssl_hmac_info_delete(self->sign_fips_info);
     g_free(self->client_mcs_data.data);
     g_free(self->server_mcs_data.data);
+    free_stream(self->fp_batch);
     /* Crypto information must always be cleared */
     g_memset(self, 0, sizeof(struct xrdp_sec));
     g_free(self);
@@ -392,6 +397,7 @@ static int
 xrdp_sec_process_logon_info(struct xrdp_sec *self, struct stream *s)
 {
     int flags = 0;
+    int compression_type;
     unsigned int len_domain = 0;
     unsigned int len_user = 0;
     unsigned int len_password = 0;
@@ -450,15 +456,38 @@ xrdp_sec_process_logon_info(struct xrdp_sec *self, struct stream *s)
 
     if (flags & RDP_COMPRESSION)
     {
+        compression_type = (flags & RDP_COMPRESSION_TYPE_MASK) >>
+                           RDP_COMPRESSION_TYPE_SHIFT;
         LOG_DEVEL(LOG_LEVEL_DEBUG, "[MS-RDPBCGR] TS_INFO_PACKET flag INFO_COMPRESSION found, "
-                  "CompressionType 0x%1.1x", (flags & 0x00001E00) >> 9);
-        /* TODO: check the client's supported compression type vs the server
-           compression used */
+                  "CompressionType 0x%1.1x", compression_type);
         if (self->rdp_layer->client_info.use_bulk_comp)
         {
-
-            self->rdp_layer->client_info.rdp_compression = 1;
-            LOG(LOG_LEVEL_DEBUG, "Client requested compression enabled.");
+            /* clients supporting a compression type support all the
+               lower ones too */
+            if (compression_type == PACKET_COMPR_TYPE_8K)
+            {
+                mppc_enc_free(self->rdp_layer->mppc_enc);
+                self->rdp_layer->mppc_enc = mppc_enc_new(PROTO_RDP_40);
+                LOG(LOG_LEVEL_DEBUG, "Client only supports RDP 4.0 "
+                    "bulk compression.");
+            }
+            else if (compression_type == PACKET_COMPR_TYPE_RDP6)
+            {
+                /* No RDP 6.0 (NCRUSH) encoder - keep the default */
+                LOG(LOG_LEVEL_INFO, "RDP 6.0 bulk compression is not "
+                    "supported. Using RDP 5.0 bulk compression.");
+            }
+            else if (compression_type >= PACKET_COMPR_TYPE_RDP61)
+            {
+                mppc_enc_free(self->rdp_layer->mppc_enc);
+                self->rdp_layer->mppc_enc = mppc_enc_new(PROTO_RDP_61);
+                LOG(LOG_LEVEL_DEBUG, "Using RDP 6.1 bulk compression.");
+            }
+            if (self->rdp_layer->mppc_enc != NULL)
+            {
+                self->rdp_layer->client_info.rdp_compression = 1;
+                LOG(LOG_LEVEL_DEBUG, "Client requested compression enabled.");
+            }
         }
         else
         {
@@ -1282,6 +1311,12 @@ xrdp_sec_send(struct xrdp_sec *self, struct stream *s, int chan)
     int datalen;
     int pad;
 
+    /* Keep the output in order */
+    if (xrdp_sec_fastpath_batch_flush(self) != 0)
+    {
+        return 1;
+    }
+
     s_pop_layer(s, sec_hdr);
 
     if (self->crypt_level > CRYPT_LEVEL_NONE)
@@ -1378,8 +1413,10 @@ xrdp_sec_init_fastpath(struct xrdp_sec *self, struct stream *s)
 /* returns error */
 /* 2.2.9.1.2 Server Fast-Path Update PDU (TS_FP_UPDATE_PDU)
  * http://msdn.microsoft.com/en-us/library/cc240621.aspx */
-int
-xrdp_sec_send_fastpath(struct xrdp_sec *self, struct stream *s)
+/* If owned is set, s is passed on to the transport, which frees it */
+static int
+xrdp_sec_send_fastpath_pdu(struct xrdp_sec *self, struct stream *s,
+                           int owned)
 {
     int secFlags;
     int fpOutputHeader;
@@ -1418,8 +1455,15 @@ xrdp_sec_send_fastpath(struct xrdp_sec *self, struct stream *s)
                   "fipsInformation.padlen %d, dataSignature 0x%8.8x 0x%8.8x, ",
                   pdulen >> 4, pdulen & 0xff, pad,
                   *((uint32_t *) s->p), *((uint32_t *) (s->p + 4)));
-        error = xrdp_fastpath_send(self->fastpath_layer, s);
-        g_memcpy(s->p + 8 + datalen, save, pad);
+        if (owned)
+        {
+            error = xrdp_fastpath_send_owned(self->fastpath_layer, s);
+        }
+        else
+        {
+            error = xrdp_fastpath_send(self->fastpath_layer, s);
+            g_memcpy(s->p + 8 + datalen, save, pad);
+        }
     }
     else if (self->crypt_level > CRYPT_LEVEL_LOW)
     {
@@ -1439,7 +1483,8 @@ xrdp_sec_send_fastpath(struct xrdp_sec *self, struct stream *s)
                   "dataSignature 0x%8.8x 0x%8.8x, ",
                   pdulen >> 4, pdulen & 0xff,
                   *((uint32_t *) s->p), *((uint32_t *) (s->p + 4)));
-        error = xrdp_fastpath_send(self->fastpath_layer, s);
+        error = owned ? xrdp_fastpath_send_owned(self->fastpath_layer, s) :
+                xrdp_fastpath_send(self->fastpath_layer, s);
     }
     else
     {
@@ -1454,7 +1499,8 @@ xrdp_sec_send_fastpath(struct xrdp_sec *self, struct stream *s)
                   "fpOutputHeader.action 0, fpOutputHeader.reserved 0, "
                   "fpOutputHeader.flags 0, length1 0x%2.2x, length2 0x%2.2x",
                   pdulen >> 4, pdulen & 0xff);
-        error = xrdp_fastpath_send(self->fastpath_layer, s);
+        error = owned ? xrdp_fastpath_send_owned(self->fastpath_layer, s) :
+                xrdp_fastpath_send(self->fastpath_layer, s);
     }
     if (error != 0)
     {
@@ -1465,6 +1511,107 @@ xrdp_sec_send_fastpath(struct xrdp_sec *self, struct stream *s)
     return 0;
 }
 
+/*****************************************************************************/
+/* returns error */
+/* While batching, the TS_FP_UPDATE in s is added to a TS_FP_UPDATE_PDU
+   with the other updates sent since the last flush. Otherwise it is
+   sent in a PDU of its own */
+int
+xrdp_sec_send_fastpath(struct xrdp_sec *self, struct stream *s)
+{
+    char *update;
+    int update_bytes;
+
+    if (self->fp_batch_depth == 0)
+    {
+        return xrdp_sec_send_fastpath_pdu(self, s, 0);
+    }
+
+    update = s->sec_hdr + xrdp_sec_get_fastpath_bytes(self);
+    update_bytes = (int)(s->end - update);
+
+    if (self->fp_batch_count > 0 &&
+            (int)(self->fp_batch->p - self->fp_batch->sec_hdr) +
+            update_bytes > FASTPATH_BATCH_MAX_BYTES)
+    {
+        if (xrdp_sec_fastpath_batch_flush(self) != 0)
+        {
+            return 1;
+        }
+    }
+
+    if (self->fp_batch_count == 0)
+    {
+        if (self->fp_batch == NULL)
+        {
+            make_stream(self->fp_batch);
+        }
+        if (xrdp_sec_init_fastpath(self, self->fp_batch) != 0)
+        {
+            return 1;
+        }
+    }
+
+    if ((int)(self->fp_batch->p - self->fp_batch->sec_hdr) +
+            update_bytes > FASTPATH_BATCH_MAX_BYTES ||
+            !s_check_rem_out(self->fp_batch, update_bytes))
+    {
+        /* Too big to batch */
+        return xrdp_sec_send_fastpath_pdu(self, s, 0);
+    }
+
+    out_uint8a(self->fp_batch, update, update_bytes);
+    ++self->fp_batch_count;
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_sec_fastpath_batch_begin(struct xrdp_sec *self)
+{
+    ++self->fp_batch_depth;
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* Sends any batched fastpath updates. The batch stream is handed to the
+   transport, so it isn't copied if the socket can't take it all */
+int
+xrdp_sec_fastpath_batch_flush(struct xrdp_sec *self)
+{
+    struct stream *s;
+
+    if (self->fp_batch_count == 0)
+    {
+        return 0;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_sec_fastpath_batch_flush: "
+              "sending %d updates", self->fp_batch_count);
+    self->fp_batch_count = 0;
+    s = self->fp_batch;
+    self->fp_batch = NULL;
+    s_mark_end(s);
+    return xrdp_sec_send_fastpath_pdu(self, s, 1);
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_sec_fastpath_batch_end(struct xrdp_sec *self)
+{
+    if (self->fp_batch_depth > 0)
+    {
+        --self->fp_batch_depth;
+    }
+    if (self->fp_batch_depth == 0)
+    {
+        return xrdp_sec_fastpath_batch_flush(self);
+    }
+    return 0;
+}
+
 /*****************************************************************************/
 /* http://msdn.microsoft.com/en-us/library/cc240510.aspx
    2.2.1.3.2 Client Core Data (TS_UD_CS_CORE) */
@@ -2272,7 +2419,8 @@ xrdp_sec_incoming(struct xrdp_sec *self)
                                self->rdp_layer->client_info.key_file,
                                self->rdp_layer->client_info.certificate,
                                self->rdp_layer->client_info.ssl_protocols,
-                               self->rdp_layer->client_info.tls_ciphers) != 0)
+                               self->rdp_layer->client_info.tls_ciphers,
+                               self->rdp_layer->client_info.use_ktls) != 0)
         {
             LOG(LOG_LEVEL_ERROR, "xrdp_sec_incoming: trans_set_tls_mode failed");
             return 1;
@@ -0,0 +1,311 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * RDP 6.1 (XCRUSH) level 1 bulk compressor
+ *
+ * Level 1 finds long matches against a 2,000,000 byte history and
+ * describes them with RDP61_MATCH_DETAILS. Anything not matched is
+ * passed through as literals. The level 1 output is then compressed
+ * again with RDP 5.0 MPPC (level 2) by the caller.
+ *
+ * Match candidates are found with a gear hash. The hash at a byte
+ * depends only on the XCRUSH_WINDOW bytes which end there, so the
+ * same content produces the same hash wherever it appears. Positions
+ * where the low bits of the hash are zero are used as anchors, and
+ * only anchors are looked up and stored in the hash table. This keeps
+ * the table small enough to cover the whole history.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <string.h>
+
+#include "libxrdp.h"
+#include "ms-rdpegdi.h"
+
+#define XCRUSH_HISTORY_LEN 2000000 /* MS-RDPEGDI 3.1.8.2 */
+/* MatchOutputOffset and MatchLength are 16 bits */
+#define XCRUSH_MAX_INPUT 65535
+/* bytes covered by the gear hash */
+#define XCRUSH_WINDOW 32
+/* a match costs 8 bytes of match details, so short ones don't help */
+#define XCRUSH_MIN_MATCH XCRUSH_WINDOW
+#define XCRUSH_MAX_MATCHES (XCRUSH_MAX_INPUT / XCRUSH_MIN_MATCH + 1)
+/* an anchor every 64 bytes on average */
+#define XCRUSH_ANCHOR_MASK 0x3f
+#define XCRUSH_HASH_BITS 17
+#define XCRUSH_HASH_SIZE (1 << XCRUSH_HASH_BITS)
+/* size of MatchCount and each RDP61_MATCH_DETAILS */
+#define XCRUSH_MATCH_COUNT_BYTES 2
+#define XCRUSH_MATCH_DETAILS_BYTES 8
+
+struct xcrush_match
+{
+    int length;
+    int output_offset; /* in this packet */
+    int history_offset;
+};
+
+struct xrdp_xcrush_enc
+{
+    char *history;
+    int history_offset; /* next free byte in history */
+    int history_fill; /* bytes of history which have been written to */
+    tui32 *hash_table; /* anchor hash -> history offset + 1, 0 is empty */
+    tui32 gear[256];
+    int num_matches;
+    struct xcrush_match matches[XCRUSH_MAX_MATCHES];
+    char *output; /* level 1 output */
+};
+
+/*****************************************************************************/
+struct xrdp_xcrush_enc *
+xcrush_enc_new(void)
+{
+    struct xrdp_xcrush_enc *self;
+    tui32 seed;
+    int index;
+
+    self = g_new0(struct xrdp_xcrush_enc, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->history = (char *) g_malloc(XCRUSH_HISTORY_LEN, 1);
+    self->hash_table = g_new0(tui32, XCRUSH_HASH_SIZE);
+    self->output = (char *) g_malloc(XCRUSH_MAX_INPUT, 0);
+    if (self->history == NULL || self->hash_table == NULL ||
+            self->output == NULL)
+    {
+        xcrush_enc_free(self);
+        return NULL;
+    }
+    /* any fixed random values will do for the gear table */
+    seed = 0x2545F491;
+    for (index = 0; index < 256; index++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        self->gear[index] = seed;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xcrush_enc_free(struct xrdp_xcrush_enc *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    g_free(self->history);
+    g_free(self->hash_table);
+    g_free(self->output);
+    g_free(self);
+}
+
+/*****************************************************************************/
+void
+xcrush_enc_reset(struct xrdp_xcrush_enc *self)
+{
+    g_memset(self->history, 0, self->history_fill);
+    g_memset(self->hash_table, 0, XCRUSH_HASH_SIZE * sizeof(tui32));
+    self->history_offset = 0;
+    self->history_fill = 0;
+}
+
+/*****************************************************************************/
+/* Looks for a match for the window of new data starting at dest, given
+ * a candidate from the hash table. The match is extended in both
+ * directions. Returns the length, or 0 if the candidate is no good.
+ *
+ * The client decompresses into the history as it goes, so the source
+ * of a match must have been written before the match is copied. It
+ * must be either completely before the destination, or in the part of
+ * the history this packet doesn't write to */
+static int
+xcrush_find_match(struct xrdp_xcrush_enc *self, int cand, int dest,
+                  int out_start, int packet_end, int *match_start)
+{
+    const char *hist = self->history;
+    int src_min;
+    int src_max;
+    int fwd;
+    int back;
+    int limit;
+
+    if (cand < dest)
+    {
+        src_min = 0;
+        src_max = dest;
+    }
+    else if (cand >= packet_end)
+    {
+        src_min = packet_end;
+        src_max = self->history_fill;
+    }
+    else
+    {
+        return 0;
+    }
+
+    /* forwards, stopping at the end of the packet or the source area */
+    limit = MIN(packet_end - dest, src_max - cand);
+    fwd = 0;
+    while (fwd < limit && hist[cand + fwd] == hist[dest + fwd])
+    {
+        fwd++;
+    }
+    if (fwd < XCRUSH_WINDOW)
+    {
+        /* hash collision */
+        return 0;
+    }
+
+    /* backwards, but not into data we've already dealt with */
+    limit = MIN(dest - out_start, cand - src_min);
+    back = 0;
+    while (back < limit && hist[cand - back - 1] == hist[dest - back - 1])
+    {
+        back++;
+    }
+
+    *match_start = cand - back;
+    return back + fwd;
+}
+
+/*****************************************************************************/
+static void
+xcrush_out_uint16_le(char *p, int val)
+{
+    p[0] = (char) val;
+    p[1] = (char) (val >> 8);
+}
+
+/*****************************************************************************/
+int
+xcrush_compress_l1(struct xrdp_xcrush_enc *self, const tui8 *src, int len,
+                   const char **out, int *out_len)
+{
+    struct xcrush_match *match;
+    char *p;
+    int flags;
+    int base;
+    int index;
+    int out_start; /* first byte of the packet not yet covered */
+    int win_start;
+    int cand;
+    int match_start;
+    int match_len;
+    int literal_bytes;
+    int l1_bytes;
+    tui32 hash;
+    tui32 slot;
+
+    flags = 0;
+    if (self->history_offset + len >= XCRUSH_HISTORY_LEN)
+    {
+        /* client must start at the front again. The rest of the history
+         * is still valid */
+        self->history_offset = 0;
+        flags |= L1_PACKET_AT_FRONT;
+    }
+    base = self->history_offset;
+    g_memcpy(self->history + base, src, len);
+
+    self->num_matches = 0;
+    literal_bytes = 0;
+    out_start = 0;
+    hash = 0;
+    for (index = 0; index < len; index++)
+    {
+        hash = (hash << 1) + self->gear[src[index]];
+        if (index + 1 < XCRUSH_WINDOW || (hash & XCRUSH_ANCHOR_MASK) != 0)
+        {
+            continue;
+        }
+        win_start = index + 1 - XCRUSH_WINDOW;
+        /* the top bits of the hash depend on the whole window */
+        slot = hash >> (32 - XCRUSH_HASH_BITS);
+        cand = (int) self->hash_table[slot] - 1;
+        self->hash_table[slot] = base + win_start + 1;
+        if (cand < 0 || win_start < out_start)
+        {
+            continue;
+        }
+        match_len = xcrush_find_match(self, cand, base + win_start,
+                                      base + out_start, base + len,
+                                      &match_start);
+        if (match_len < XCRUSH_MIN_MATCH)
+        {
+            continue;
+        }
+        match = self->matches + self->num_matches;
+        match->length = match_len;
+        /* the match may have been extended backwards */
+        match->output_offset = win_start - (cand - match_start);
+        match->history_offset = match_start;
+        literal_bytes += match->output_offset - out_start;
+        out_start = match->output_offset + match_len;
+        self->num_matches++;
+    }
+    literal_bytes += len - out_start;
+
+    self->history_offset += len;
+    self->history_fill = MAX(self->history_fill, self->history_offset);
+
+    l1_bytes = XCRUSH_MATCH_COUNT_BYTES +
+               self->num_matches * XCRUSH_MATCH_DETAILS_BYTES + literal_bytes;
+    if (self->num_matches == 0 || l1_bytes >= len)
+    {
+        /* the client still adds the data to its history */
+        *out = (const char *) src;
+        *out_len = len;
+        return flags | L1_NO_COMPRESSION;
+    }
+
+    /* RDP61_COMPRESSED_DATA payload: MatchCount, MatchDetails, Literals */
+    p = self->output;
+    xcrush_out_uint16_le(p, self->num_matches);
+    p += XCRUSH_MATCH_COUNT_BYTES;
+    for (index = 0; index < self->num_matches; index++)
+    {
+        match = self->matches + index;
+        xcrush_out_uint16_le(p, match->length);
+        xcrush_out_uint16_le(p + 2, match->output_offset);
+        xcrush_out_uint16_le(p + 4, match->history_offset);
+        xcrush_out_uint16_le(p + 6, match->history_offset >> 16);
+        p += XCRUSH_MATCH_DETAILS_BYTES;
+    }
+    out_start = 0;
+    for (index = 0; index < self->num_matches; index++)
+    {
+        match = self->matches + index;
+        g_memcpy(p, src + out_start, match->output_offset - out_start);
+        p += match->output_offset - out_start;
+        out_start = match->output_offset + match->length;
+    }
+    g_memcpy(p, src + out_start, len - out_start);
+
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xcrush_compress_l1: len %d matches %d "
+              "literals %d", len, self->num_matches, literal_bytes);
+    *out = self->output;
+    *out_len = l1_bytes;
+    return flags | L1_COMPRESSED;
+}
@@ -30,6 +30,7 @@
 #include "string_calls.h"
 #include "thread_calls.h"
 #include "trans.h"
+#include "event_loop.h"
 #include "chansrv.h"
 #include "defines.h"
 #include "sound.h"
@@ -53,6 +54,10 @@ static struct trans *g_lis_trans = 0;
 static struct trans *g_con_trans = 0;
 static struct trans *g_api_lis_trans = 0;
 static struct list *g_api_con_trans_list = 0; /* list of apps using api functions */
+/* API transports and timeouts are waited for here, so that only the
+ * ones with something to do are looked at */
+static struct event_loop *g_event_loop = 0;
+static int g_api_reads_paused = 0;
 static struct chan_item g_chan_items[32];
 static int g_num_chan_items = 0;
 static int g_cliprdr_index = -1;
@@ -82,6 +87,12 @@ int g_exec_pid = 0;
 /* max total channel bytes size */
 #define MAX_CHANNEL_BYTES (1 * 1024 * 1024 * 1024) /* 1 GB */
 #define MAX_CHANNEL_FRAG_BYTES 1600
+/* fragments given to the transport at once, as header and data pairs */
+#define CHANNEL_FRAGS_PER_WRITE (G_SCK_MAX_IOV / 2)
+/* output queued for xrdp above which we stop reading from API
+ * connections, and below which we start again */
+#define CHANNEL_SEND_HIGH_WATER (4 * 1024 * 1024)
+#define CHANNEL_SEND_LOW_WATER (1 * 1024 * 1024)
 
 #define CHANSRV_DRDYNVC_STATUS_CLOSED       0
 #define CHANSRV_DRDYNVC_STATUS_OPEN_SENT    1
@@ -112,139 +123,62 @@ struct xrdp_api_data
 
 struct timeout_obj
 {
-    tui32 mstime;
-    void *data;
+    struct event_loop_timer *timer;
     void (*callback)(void *data);
-    struct timeout_obj *next;
+    void *data;
 };
 
-static struct timeout_obj *g_timeout_head = 0;
-static struct timeout_obj *g_timeout_tail = 0;
-
 /*****************************************************************************/
-int
-add_timeout(int msoffset, void (*callback)(void *data), void *data)
+static void
+timeout_expired(struct event_loop *loop, void *arg)
 {
-    struct timeout_obj *tobj;
-    tui32 now;
+    struct timeout_obj *tobj = (struct timeout_obj *)arg;
+    void (*callback)(void *data) = tobj->callback;
+    void *data = tobj->data;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "add_timeout:");
-    now = g_time3();
-    tobj = g_new0(struct timeout_obj, 1);
-    tobj->mstime = now + msoffset;
-    tobj->callback = callback;
-    tobj->data = data;
-    if (g_timeout_tail == 0)
-    {
-        g_timeout_head = tobj;
-        g_timeout_tail = tobj;
-    }
-    else
-    {
-        g_timeout_tail->next = tobj;
-        g_timeout_tail = tobj;
-    }
-    return 0;
+    /* the callback may add another timeout */
+    g_free(tobj);
+    callback(data);
 }
 
 /*****************************************************************************/
-static int
-get_timeout(int *timeout)
+struct timeout_obj *
+add_timeout(int msoffset, void (*callback)(void *data), void *data)
 {
     struct timeout_obj *tobj;
-    tui32 now;
-    int ltimeout;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "get_timeout:");
-    ltimeout = *timeout;
-    if (ltimeout < 1)
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "add_timeout: msoffset %d", msoffset);
+    if (g_event_loop == 0)
     {
-        ltimeout = 0;
+        LOG(LOG_LEVEL_ERROR, "add_timeout: channel thread is not running");
+        return NULL;
     }
-    tobj = g_timeout_head;
-    if (tobj != 0)
+    tobj = g_new0(struct timeout_obj, 1);
+    if (tobj == NULL)
     {
-        now = g_time3();
-        while (tobj != 0)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "  now %u tobj->mstime %u", now, tobj->mstime);
-            if (now < tobj->mstime)
-            {
-                ltimeout = tobj->mstime - now;
-            }
-            tobj = tobj->next;
-        }
+        return NULL;
     }
-    if (ltimeout > 0)
+    tobj->callback = callback;
+    tobj->data = data;
+    tobj->timer = event_loop_add_timer(g_event_loop, msoffset,
+                                       timeout_expired, tobj);
+    if (tobj->timer == NULL)
     {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "  ltimeout %d", ltimeout);
-        if (*timeout < 1)
-        {
-            *timeout = ltimeout;
-        }
-        else
-        {
-            if (*timeout > ltimeout)
-            {
-                *timeout = ltimeout;
-            }
-        }
+        g_free(tobj);
+        return NULL;
     }
-    return 0;
+    return tobj;
 }
 
 /*****************************************************************************/
-static int
-check_timeout(void)
+void
+cancel_timeout(struct timeout_obj *tobj)
 {
-    struct timeout_obj *tobj;
-    struct timeout_obj *last_tobj;
-    struct timeout_obj *temp_tobj;
-    int count;
-    tui32 now;
-    UNUSED_VAR(count);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "check_timeout:");
-    count = 0;
-    tobj = g_timeout_head;
-    if (tobj != 0)
-    {
-        last_tobj = 0;
-        while (tobj != 0)
-        {
-            count++;
-            now = g_time3();
-            if (now >= tobj->mstime)
-            {
-                tobj->callback(tobj->data);
-                if (last_tobj == 0)
-                {
-                    g_timeout_head = tobj->next;
-                    if (g_timeout_head == 0)
-                    {
-                        g_timeout_tail = 0;
-                    }
-                }
-                else
-                {
-                    last_tobj->next = tobj->next;
-                    if (g_timeout_tail == tobj)
-                    {
-                        g_timeout_tail = last_tobj;
-                    }
-                }
-                temp_tobj = tobj;
-                tobj = tobj->next;
-                g_free(temp_tobj);
-            }
-            else
-            {
-                last_tobj = tobj;
-                tobj = tobj->next;
-            }
-        }
+    if (tobj != NULL)
+    {
+        event_loop_cancel_timer(g_event_loop, tobj->timer);
+        g_free(tobj);
     }
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "  count %d", count);
-    return 0;
 }
 
 /*****************************************************************************/
@@ -254,19 +188,67 @@ g_is_term(void)
     return g_is_wait_obj_set(g_term_event);
 }
 
+/*****************************************************************************/
+int
+send_channel_queued_bytes(void)
+{
+    return (g_con_trans == NULL) ? 0 : g_con_trans->wait_bytes;
+}
+
+/*****************************************************************************/
+/* Stops reading from API connections while too much is waiting to go
+ * to xrdp, and starts again once it has drained */
+static void
+check_channel_send_queue(void)
+{
+    struct trans *ltran;
+    int queued;
+    int paused;
+    int index;
+
+    queued = send_channel_queued_bytes();
+    if (g_api_reads_paused)
+    {
+        paused = queued > CHANNEL_SEND_LOW_WATER;
+    }
+    else
+    {
+        paused = queued >= CHANNEL_SEND_HIGH_WATER;
+    }
+    if (paused == g_api_reads_paused)
+    {
+        return;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "check_channel_send_queue: %d bytes queued, "
+              "%s API connections", queued,
+              paused ? "pausing" : "resuming");
+    g_api_reads_paused = paused;
+    for (index = 0; index < g_api_con_trans_list->count; index++)
+    {
+        ltran = (struct trans *) list_get_item(g_api_con_trans_list, index);
+        trans_set_read_paused(ltran, paused);
+    }
+}
+
 /*****************************************************************************/
 /* send data to a static virtual channel
    size can be > MAX_CHANNEL_FRAG_BYTES, in which case, > 1 message
-   will be sent*/
+   will be sent. Each message header is sent along with the caller's
+   data, which is only copied if it can't all be sent straight away */
 /* returns error */
 int
 send_channel_data(int chan_id, const char *data, int size)
 {
+    char headers[CHANNEL_FRAGS_PER_WRITE][26];
+    const void *bufs[CHANNEL_FRAGS_PER_WRITE * 2];
+    unsigned int lens[CHANNEL_FRAGS_PER_WRITE * 2];
+    struct stream ls;
+    struct stream *s;
+    unsigned int count;
+    int frags;
     int sending_bytes;
     int chan_flags;
-    int error;
     int total_size;
-    struct stream *s;
 
     if ((chan_id < 0) || (chan_id > 31) ||
             (data == NULL) ||
@@ -275,39 +257,51 @@ send_channel_data(int chan_id, const char *data, int size)
         /* bad param */
         return 1;
     }
+    if (g_con_trans == NULL)
+    {
+        return 2;
+    }
+    g_memset(&ls, 0, sizeof(ls));
+    s = &ls;
     total_size = size;
     chan_flags = 1; /* first */
     while (size > 0)
     {
-        sending_bytes = MIN(MAX_CHANNEL_FRAG_BYTES, size);
-        if (sending_bytes >= size)
-        {
-            chan_flags |= 2; /* last */
-        }
-        s = trans_get_out_s(g_con_trans, 26 + sending_bytes);
-        if (s == NULL)
+        count = 0;
+        for (frags = 0; frags < CHANNEL_FRAGS_PER_WRITE && size > 0; frags++)
         {
-            return 2;
+            sending_bytes = MIN(MAX_CHANNEL_FRAG_BYTES, size);
+            if (sending_bytes >= size)
+            {
+                chan_flags |= 2; /* last */
+            }
+            ls.data = headers[frags];
+            ls.p = ls.data;
+            ls.size = sizeof(headers[frags]);
+            out_uint32_le(s, 0); /* version */
+            out_uint32_le(s, 26 + sending_bytes);
+            out_uint32_le(s, 8); /* msg id */
+            out_uint32_le(s, 18 + sending_bytes);
+            out_uint16_le(s, chan_id);
+            out_uint16_le(s, chan_flags);
+            out_uint16_le(s, sending_bytes);
+            out_uint32_le(s, total_size);
+            bufs[count] = headers[frags];
+            lens[count] = 26;
+            count++;
+            bufs[count] = data;
+            lens[count] = sending_bytes;
+            count++;
+            size -= sending_bytes;
+            data += sending_bytes;
+            chan_flags = 0;
         }
-        out_uint32_le(s, 0); /* version */
-        out_uint32_le(s, 26 + sending_bytes);
-        out_uint32_le(s, 8); /* msg id */
-        out_uint32_le(s, 18 + sending_bytes);
-        out_uint16_le(s, chan_id);
-        out_uint16_le(s, chan_flags);
-        out_uint16_le(s, sending_bytes);
-        out_uint32_le(s, total_size);
-        out_uint8a(s, data, sending_bytes);
-        s_mark_end(s);
-        size -= sending_bytes;
-        data += sending_bytes;
-        error = trans_write_copy(g_con_trans);
-        if (error != 0)
+        if (trans_write_iov(g_con_trans, bufs, lens, count) != 0)
         {
             return 3;
         }
-        chan_flags = 0;
     }
+    check_channel_send_queue();
     return 0;
 }
 
@@ -1304,6 +1298,63 @@ my_trans_conn_in(struct trans *trans, struct trans *new_trans)
     return 0;
 }
 
+/*****************************************************************************/
+/* Called by the event loop when an API listener is ready */
+static void
+api_lis_trans_ready(struct event_loop *loop, tintptr obj, int events,
+                    void *arg)
+{
+    if (trans_check_wait_objs(g_api_lis_trans) != 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "api_lis_trans_ready: "
+                  "trans_check_wait_objs failed");
+        if (g_api_lis_trans->status != TRANS_STATUS_UP)
+        {
+            trans_detach_event_loop(g_api_lis_trans);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Called by the event loop when an API connection is ready */
+static void
+api_con_trans_ready(struct event_loop *loop, tintptr obj, int events,
+                    void *arg)
+{
+    struct trans *ltran = (struct trans *) arg;
+    struct xrdp_api_data *ad;
+    int drdynvc_index;
+    int api_con_index;
+
+    if (trans_check_wait_objs(ltran) == 0)
+    {
+        return;
+    }
+
+    /* disconnect */
+    api_con_index = list_index_of(g_api_con_trans_list, (intptr_t) ltran);
+    if (api_con_index >= 0)
+    {
+        list_remove_item(g_api_con_trans_list, api_con_index);
+    }
+    ad = (struct xrdp_api_data *) (ltran->callback_data);
+    if (ad->chan_flags != 0)
+    {
+        chansrv_drdynvc_close(ad->chan_id);
+    }
+    for (drdynvc_index = 0;
+            drdynvc_index < (int) ARRAYSIZE(g_drdynvcs);
+            drdynvc_index++)
+    {
+        if (g_drdynvcs[drdynvc_index].xrdp_api_trans == ltran)
+        {
+            g_drdynvcs[drdynvc_index].xrdp_api_trans = NULL;
+        }
+    }
+    g_free(ad);
+    trans_delete(ltran);
+}
+
 /*
  * called when WTSVirtualChannelOpenEx is invoked in xrdpapi.c
  *
@@ -1329,6 +1380,13 @@ my_api_trans_conn_in(struct trans *trans, struct trans *new_trans)
         return 1;
     }
     new_trans->callback_data = ad;
+    if (trans_attach_event_loop(new_trans, g_event_loop,
+                                api_con_trans_ready, new_trans) != 0)
+    {
+        g_free(ad);
+        return 1;
+    }
+    trans_set_read_paused(new_trans, g_api_reads_paused);
     list_add_item(g_api_con_trans_list, (intptr_t) new_trans);
     return 0;
 }
@@ -1382,74 +1440,8 @@ setup_api_listen(void)
         return 1;
     }
 
-    return 0;
-}
-
-/*****************************************************************************/
-static int
-api_con_trans_list_get_wait_objs_rw(intptr_t *robjs, int *rcount,
-                                    intptr_t *wobjs, int *wcount,
-                                    int *timeout)
-{
-    int api_con_index;
-    struct trans *ltran;
-
-    for (api_con_index = g_api_con_trans_list->count - 1;
-            api_con_index >= 0;
-            api_con_index--)
-    {
-        ltran = (struct trans *)
-                list_get_item(g_api_con_trans_list, api_con_index);
-        if (ltran != NULL)
-        {
-            trans_get_wait_objs_rw(ltran, robjs, rcount, wobjs, wcount,
-                                   timeout);
-        }
-    }
-    return 0;
-}
-
-/*****************************************************************************/
-static int
-api_con_trans_list_check_wait_objs(void)
-{
-    int api_con_index;
-    int drdynvc_index;
-    struct trans *ltran;
-    struct xrdp_api_data *ad;
-
-    for (api_con_index = g_api_con_trans_list->count - 1;
-            api_con_index >= 0;
-            api_con_index--)
-    {
-        ltran = (struct trans *)
-                list_get_item(g_api_con_trans_list, api_con_index);
-        if (ltran != NULL)
-        {
-            if (trans_check_wait_objs(ltran) != 0)
-            {
-                /* disconnect */
-                list_remove_item(g_api_con_trans_list, api_con_index);
-                ad = (struct xrdp_api_data *) (ltran->callback_data);
-                if (ad->chan_flags != 0)
-                {
-                    chansrv_drdynvc_close(ad->chan_id);
-                }
-                for (drdynvc_index = 0;
-                        drdynvc_index < (int) ARRAYSIZE(g_drdynvcs);
-                        drdynvc_index++)
-                {
-                    if (g_drdynvcs[drdynvc_index].xrdp_api_trans == ltran)
-                    {
-                        g_drdynvcs[drdynvc_index].xrdp_api_trans = NULL;
-                    }
-                }
-                g_free(ad);
-                trans_delete(ltran);
-            }
-        }
-    }
-    return 0;
+    return trans_attach_event_loop(g_api_lis_trans, g_event_loop,
+                                   api_lis_trans_ready, NULL);
 }
 
 /*****************************************************************************/
@@ -1490,8 +1482,17 @@ channel_thread_loop(void *in_val)
     LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: thread start");
     rv = 0;
     g_api_con_trans_list = list_create();
-    setup_api_listen();
-    error = setup_listen();
+    g_event_loop = event_loop_create();
+    if (g_event_loop == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "channel_thread_loop: can't create event loop");
+        error = 1;
+    }
+    else
+    {
+        setup_api_listen();
+        error = setup_listen();
+    }
 
     if (error == 0)
     {
@@ -1501,12 +1502,12 @@ channel_thread_loop(void *in_val)
         objs[num_objs] = g_term_event;
         num_objs++;
         trans_get_wait_objs(g_lis_trans, objs, &num_objs);
-        trans_get_wait_objs(g_api_lis_trans, objs, &num_objs);
+        event_loop_get_wait_objs(g_event_loop, objs, &num_objs,
+                                 wobjs, &num_wobjs, &timeout);
 
         //g_writeln("timeout %d", timeout);
         while (g_obj_wait(objs, num_objs, wobjs, num_wobjs, timeout) == 0)
         {
-            check_timeout();
             if (g_is_wait_obj_set(g_term_event))
             {
                 LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: g_term_event set");
@@ -1547,17 +1548,11 @@ channel_thread_loop(void *in_val)
                         break;
                     }
                 }
+                check_channel_send_queue();
             }
 
-            if (g_api_lis_trans != 0)
-            {
-                if (trans_check_wait_objs(g_api_lis_trans) != 0)
-                {
-                    LOG_DEVEL(LOG_LEVEL_ERROR, "channel_thread_loop: trans_check_wait_objs failed");
-                }
-            }
-            /* check the wait_objs in g_api_con_trans_list */
-            api_con_trans_list_check_wait_objs();
+            /* the API listener and connections, and timeouts */
+            event_loop_check_wait_objs(g_event_loop);
             xcommon_check_wait_objs();
             sound_check_wait_objs();
             devredir_check_wait_objs();
@@ -1571,17 +1566,12 @@ channel_thread_loop(void *in_val)
                                    wobjs, &num_wobjs, &timeout);
             trans_get_wait_objs_rw(g_con_trans, objs, &num_objs,
                                    wobjs, &num_wobjs, &timeout);
-            trans_get_wait_objs_rw(g_api_lis_trans, objs, &num_objs,
-                                   wobjs, &num_wobjs, &timeout);
-            /* get the wait_objs from in g_api_con_trans_list */
-            api_con_trans_list_get_wait_objs_rw(objs, &num_objs,
-                                                wobjs, &num_wobjs,
-                                                &timeout);
+            event_loop_get_wait_objs(g_event_loop, objs, &num_objs,
+                                     wobjs, &num_wobjs, &timeout);
             xcommon_get_wait_objs(objs, &num_objs, &timeout);
             sound_get_wait_objs(objs, &num_objs, &timeout);
             devredir_get_wait_objs(objs, &num_objs, &timeout);
             xfuse_get_wait_objs(objs, &num_objs, &timeout);
-            get_timeout(&timeout);
         } /* end while (g_obj_wait(objs, num_objs, 0, 0, timeout) == 0) */
     }
 
@@ -1593,6 +1583,8 @@ channel_thread_loop(void *in_val)
     g_api_lis_trans = 0;
     api_con_trans_list_remove_all();
     list_delete(g_api_con_trans_list);
+    event_loop_delete(g_event_loop);
+    g_event_loop = 0;
     LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: thread stop");
     g_set_wait_obj(g_thread_done_event);
     return rv;
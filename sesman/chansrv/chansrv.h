@@ -35,9 +35,39 @@ int
 g_is_term(void);
 
 int send_channel_data(int chan_id, const char *data, int size);
+/**
+ * Get the number of bytes waiting to be sent to xrdp
+ *
+ * send_channel_data() queues anything xrdp can't take straight away.
+ * Code which produces bulk data without being asked for it should
+ * hold back while this is high. Reading from xrdpapi connections is
+ * paused automatically.
+ *
+ * @return bytes queued
+ */
+int send_channel_queued_bytes(void);
 int send_rail_drawing_orders(char *data, int size);
 int main_cleanup(void);
-int add_timeout(int msoffset, void (*callback)(void *data), void *data);
+
+struct timeout_obj;
+/**
+ * Call a function after a delay, from the channel thread
+ *
+ * @param msoffset Milliseconds until the callback is called
+ * @param callback Function to call
+ * @param data Argument for callback
+ * @return timeout, or NULL for an error. This is valid until the
+ *         callback is called, and can be passed to cancel_timeout()
+ */
+struct timeout_obj *
+add_timeout(int msoffset, void (*callback)(void *data), void *data);
+/**
+ * Cancel a timeout before its callback is called
+ *
+ * @param tobj Timeout from add_timeout() (may be NULL)
+ */
+void
+cancel_timeout(struct timeout_obj *tobj);
 
 #ifndef GSET_UINT8
 #define GSET_UINT8(_ptr, _offset, _data) \
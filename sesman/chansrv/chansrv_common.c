@@ -21,6 +21,8 @@
 #endif
 
 #include "chansrv_common.h"
+#include "log.h"
+#include "ms-rdpbcgr.h"
 
 /**
  * Assemble fragmented incoming packets into one stream
@@ -77,3 +79,53 @@ read_entire_packet(struct stream *src, struct stream **dest, int chan_flags,
     return 0;
 }
 
+
+/**
+ * Pass a fragment of an incoming message to a stream
+ *
+ * A message which arrives in one fragment is started and ended in
+ * the same call.
+ *
+ * @param  ops           stream callbacks
+ * @param  streaming     non-zero if a message is being streamed
+ * @param  s             stream that contains the fragment
+ * @param  chan_flags    fragmentation flags
+ * @param  length        bytes in this packet
+ * @param  total_length  total length of assembled packet
+ *
+ * @return 1 if the stream used the fragment, 0 if the caller should
+ *         assemble the message as usual
+ ****************************************************************************/
+int
+chan_stream_fragment(const struct chan_stream_ops *ops, int streaming,
+                     struct stream *s, int chan_flags, int length,
+                     int total_length)
+{
+    if (chan_flags & XR_CHANNEL_FLAG_FIRST)
+    {
+        if (streaming)
+        {
+            LOG(LOG_LEVEL_WARNING, "chan_stream_fragment: streamed message "
+                "was cut short");
+            ops->end();
+        }
+        if (!ops->start(s, length, total_length))
+        {
+            return 0;
+        }
+    }
+    else if (streaming)
+    {
+        ops->in(s->p, length);
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (chan_flags & XR_CHANNEL_FLAG_LAST)
+    {
+        ops->end();
+    }
+    return 1;
+}
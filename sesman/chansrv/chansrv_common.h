@@ -29,7 +29,22 @@
 #define CLIP_RESTRICT_IMAGE (1<<2)
 #define CLIP_RESTRICT_ALL 0x7fffffff
 
+/* Callbacks for a channel message which is used as it arrives, rather
+ * than being put together first */
+struct chan_stream_ops
+{
+    /* Offered the first fragment. Returns 1 if it takes the message */
+    int (*start)(struct stream *s, int length, int total_length);
+    /* Passed each later fragment */
+    void (*in)(const char *data, int data_bytes);
+    /* Called after the last fragment */
+    void (*end)(void);
+};
+
 int read_entire_packet(struct stream *src, struct stream **dest, int chan_flags, int length, int total_length);
+int chan_stream_fragment(const struct chan_stream_ops *ops, int streaming,
+                         struct stream *s, int chan_flags, int length,
+                         int total_length);
 
 #endif
 
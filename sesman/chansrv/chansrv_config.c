@@ -41,6 +41,9 @@
 #define DEFAULT_ENABLE_FUSE_MOUNT           1
 #define DEFAULT_FUSE_MOUNT_NAME             "xrdp-client"
 #define DEFAULT_FUSE_DIRECT_IO              0
+#define DEFAULT_FUSE_ATTR_CACHE_TIMEOUT     5
+#define DEFAULT_FUSE_DIR_CACHE_TIMEOUT      5
+#define DEFAULT_FUSE_NEGATIVE_CACHE_TIMEOUT 2
 #define DEFAULT_FILE_UMASK                  077
 #define DEFAULT_USE_NAUTILUS3_FLIST_FORMAT  0
 #define DEFAULT_NUM_SILENT_FRAMES_AAC       4
@@ -168,6 +171,18 @@ read_config_chansrv(log_func_t logmsg,
         {
             cfg->fuse_direct_io = g_text2bool(value);
         }
+        else if (g_strcasecmp(name, "FuseAttrCacheTimeout") == 0)
+        {
+            cfg->drive_cache.attr_timeout = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "FuseDirCacheTimeout") == 0)
+        {
+            cfg->drive_cache.dir_timeout = strtoul(value, NULL, 0);
+        }
+        else if (g_strcasecmp(name, "FuseNegativeCacheTimeout") == 0)
+        {
+            cfg->drive_cache.negative_timeout = strtoul(value, NULL, 0);
+        }
         else if (g_strcasecmp(name, "FileUmask") == 0)
         {
             cfg->file_umask = strtol(value, NULL, 0);
@@ -193,6 +208,82 @@ read_config_chansrv(log_func_t logmsg,
     return error;
 }
 
+/***************************************************************************//**
+ * Parses "<attr>,<dir>,<negative>" from [ChansrvDriveCache]
+ *
+ * Returns 0 for success
+ */
+static int
+parse_drive_cache(const char *value, struct chansrv_drive_cache *dc)
+{
+    char *p;
+
+    dc->attr_timeout = strtoul(value, &p, 0);
+    if (*p != ',')
+    {
+        return 1;
+    }
+    dc->dir_timeout = strtoul(p + 1, &p, 0);
+    if (*p != ',')
+    {
+        return 1;
+    }
+    dc->negative_timeout = strtoul(p + 1, &p, 0);
+    return (*p != '\0');
+}
+
+/***************************************************************************//**
+ * Reads the [ChansrvDriveCache] section
+ */
+static int
+read_config_drive_cache(log_func_t logmsg,
+                        struct list *names, struct list *values,
+                        struct config_chansrv *cfg)
+{
+    int error = 0;
+    int index;
+    struct chansrv_drive_cache *dc;
+
+    for (index = 0; index < names->count; ++index)
+    {
+        const char *name = (const char *)list_get_item(names, index);
+        const char *value = (const char *)list_get_item(values, index);
+
+        if ((dc = g_new0(struct chansrv_drive_cache, 1)) == NULL)
+        {
+            logmsg(LOG_LEVEL_ERROR, "Can't alloc drive cache timeouts");
+            error = 1;
+            break;
+        }
+        if (parse_drive_cache(value, dc) != 0)
+        {
+            logmsg(LOG_LEVEL_WARNING,
+                   "Ignoring cache timeouts '%s' for drive %s. Expected "
+                   "<attributes>,<directories>,<missing entries>",
+                   value, name);
+            g_free(dc);
+        }
+        else if (!list_add_strdup(cfg->drive_cache_names, name))
+        {
+            g_free(dc);
+            logmsg(LOG_LEVEL_ERROR, "Can't alloc drive cache timeouts");
+            error = 1;
+            break;
+        }
+        else if (!list_add_item(cfg->drive_cache_timeouts, (tintptr)dc))
+        {
+            g_free(dc);
+            list_remove_item(cfg->drive_cache_names,
+                             cfg->drive_cache_names->count - 1);
+            logmsg(LOG_LEVEL_ERROR, "Can't alloc drive cache timeouts");
+            error = 1;
+            break;
+        }
+    }
+
+    return error;
+}
+
 /***************************************************************************//**
  * @brief returns a config block with default values
  *
@@ -204,9 +295,14 @@ new_config(void)
     /* Do all the allocations at the beginning, then check them together */
     struct config_chansrv *cfg = g_new0(struct config_chansrv, 1);
     char *fuse_mount_name = g_strdup(DEFAULT_FUSE_MOUNT_NAME);
-    if (cfg == NULL || fuse_mount_name == NULL)
+    struct list *drive_cache_names = list_create();
+    struct list *drive_cache_timeouts = list_create();
+    if (cfg == NULL || fuse_mount_name == NULL ||
+            drive_cache_names == NULL || drive_cache_timeouts == NULL)
     {
         /* At least one memory allocation failed */
+        list_delete(drive_cache_names);
+        list_delete(drive_cache_timeouts);
         g_free(fuse_mount_name);
         g_free(cfg);
         cfg = NULL;
@@ -218,6 +314,14 @@ new_config(void)
         cfg->restrict_inbound_clipboard = DEFAULT_RESTRICT_INBOUND_CLIPBOARD;
         cfg->fuse_mount_name = fuse_mount_name;
         cfg->fuse_direct_io = DEFAULT_FUSE_DIRECT_IO;
+        cfg->drive_cache.attr_timeout = DEFAULT_FUSE_ATTR_CACHE_TIMEOUT;
+        cfg->drive_cache.dir_timeout = DEFAULT_FUSE_DIR_CACHE_TIMEOUT;
+        cfg->drive_cache.negative_timeout =
+            DEFAULT_FUSE_NEGATIVE_CACHE_TIMEOUT;
+        drive_cache_names->auto_free = 1;
+        drive_cache_timeouts->auto_free = 1;
+        cfg->drive_cache_names = drive_cache_names;
+        cfg->drive_cache_timeouts = drive_cache_timeouts;
         cfg->file_umask = DEFAULT_FILE_UMASK;
         cfg->use_nautilus3_flist_format = DEFAULT_USE_NAUTILUS3_FLIST_FORMAT;
         cfg->num_silent_frames_aac = DEFAULT_NUM_SILENT_FRAMES_AAC;
@@ -268,6 +372,13 @@ config_read(int use_logger, const char *sesman_ini)
                 error = read_config_chansrv(logmsg, names, values, cfg);
             }
 
+            if (!error &&
+                    file_read_section(fd, "ChansrvDriveCache",
+                                      names, values) == 0)
+            {
+                error = read_config_drive_cache(logmsg, names, values, cfg);
+            }
+
             list_delete(names);
             list_delete(values);
         }
@@ -285,9 +396,31 @@ config_read(int use_logger, const char *sesman_ini)
 }
 
 /******************************************************************************/
+const struct chansrv_drive_cache *
+config_get_drive_cache(const struct config_chansrv *config,
+                       const char *drive_name)
+{
+    int index;
+
+    for (index = 0; index < config->drive_cache_names->count; ++index)
+    {
+        const char *name =
+            (const char *)list_get_item(config->drive_cache_names, index);
+        if (g_strcasecmp(name, drive_name) == 0)
+        {
+            return (const struct chansrv_drive_cache *)
+                   list_get_item(config->drive_cache_timeouts, index);
+        }
+    }
+
+    return &config->drive_cache;
+}
+
 void
 config_dump(struct config_chansrv *config)
 {
+    int index;
+
     g_writeln("Global configuration:");
 
     char buf[256];
@@ -309,6 +442,22 @@ config_dump(struct config_chansrv *config)
     g_writeln("    FuseDirectIO:              %s",
               g_bool2text(config->fuse_direct_io));
     g_writeln("    FileMask:                  0%o", config->file_umask);
+    g_writeln("    FuseAttrCacheTimeout:      %u",
+              config->drive_cache.attr_timeout);
+    g_writeln("    FuseDirCacheTimeout:       %u",
+              config->drive_cache.dir_timeout);
+    g_writeln("    FuseNegativeCacheTimeout:  %u",
+              config->drive_cache.negative_timeout);
+    for (index = 0; index < config->drive_cache_names->count; ++index)
+    {
+        const struct chansrv_drive_cache *dc =
+            (const struct chansrv_drive_cache *)
+            list_get_item(config->drive_cache_timeouts, index);
+        g_writeln("    Cache timeouts (%s):     %u,%u,%u",
+                  (const char *)list_get_item(config->drive_cache_names,
+                                              index),
+                  dc->attr_timeout, dc->dir_timeout, dc->negative_timeout);
+    }
     g_writeln("    Nautilus 3 Flist Format:   %s",
               g_bool2text(config->use_nautilus3_flist_format));
 }
@@ -320,6 +469,8 @@ config_free(struct config_chansrv *cc)
     if (cc != NULL)
     {
         g_free(cc->fuse_mount_name);
+        list_delete(cc->drive_cache_names);
+        list_delete(cc->drive_cache_timeouts);
         g_free(cc);
     }
 }
@@ -21,6 +21,19 @@
 
 #include <sys/stat.h>
 
+struct list;
+
+/** Cache timeouts for a redirected drive, in seconds. 0 disables a cache */
+struct chansrv_drive_cache
+{
+    /** Attributes of files and directories, and entries which exist */
+    unsigned int attr_timeout;
+    /** Directory listings */
+    unsigned int dir_timeout;
+    /** Entries which don't exist */
+    unsigned int negative_timeout;
+};
+
 struct config_chansrv
 {
     /** Whether the FUSE mount is enabled or not */
@@ -29,6 +42,13 @@ struct config_chansrv
     /** Whether to use direct I/O to FUSE filesystems */
     int fuse_direct_io;
 
+    /** Cache timeouts for redirected drives, from [Chansrv] */
+    struct chansrv_drive_cache drive_cache;
+    /** Names of drives with their own timeouts, from [ChansrvDriveCache] */
+    struct list *drive_cache_names;
+    /** Timeouts for drive_cache_names (struct chansrv_drive_cache *) */
+    struct list *drive_cache_timeouts;
+
     /** RestrictOutboundClipboard setting from sesman.ini */
     int restrict_outbound_clipboard;
     /** RestrictInboundClipboard setting from sesman.ini */
@@ -65,6 +85,20 @@ struct config_chansrv
 struct config_chansrv *
 config_read(int use_logger, const char *sesman_ini);
 
+/**
+ *
+ * @brief Gets the cache timeouts for a redirected drive
+ * @param config Configuration
+ * @param drive_name Name of the drive, e.g. "C:"
+ *
+ * @return Timeouts from [ChansrvDriveCache] if the drive is listed there,
+ *         or the defaults from [Chansrv]
+ *
+ */
+const struct chansrv_drive_cache *
+config_get_drive_cache(const struct config_chansrv *config,
+                       const char *drive_name);
+
 /**
  *
  * @brief Dumps configuration to stdout
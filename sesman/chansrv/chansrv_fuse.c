@@ -126,6 +126,9 @@ void xfuse_devredir_cb_rename_file(struct state_rename *fip,
 {}
 void xfuse_devredir_cb_file_close(struct state_close *fip)
 {}
+void xfuse_devredir_cb_volume_attributes(tui32 device_id,
+                                         tui32 fs_attributes)
+{}
 
 int xfuse_path_in_xfuse_fs(const char *path)
 {
@@ -168,6 +171,7 @@ int xfuse_path_in_xfuse_fs(const char *path)
 #include "devredir.h"
 #include "list.h"
 #include "file.h"
+#include "ms-fscc.h"
 
 #ifndef EREMOTEIO
 #define EREMOTEIO EIO
@@ -176,6 +180,20 @@ int xfuse_path_in_xfuse_fs(const char *path)
 #define XFUSE_ATTR_TIMEOUT      5.0
 #define XFUSE_ENTRY_TIMEOUT     5.0
 
+/*
+ * Once a file on a redirected share is being read sequentially, it is
+ * read from the client in blocks, with several reads outstanding at
+ * once. FUSE reads are answered from these blocks.
+ *
+ * Sequential writes are collected, and sent to the client as one
+ * write when the buffer fills, or when the file is flushed, synced or
+ * released. An error from a collected write is returned by the next
+ * write, flush or fsync on the handle.
+ */
+#define XFUSE_RA_BLOCK_BYTES    (64 * 1024)
+#define XFUSE_RA_MAX_BLOCKS     16
+#define XFUSE_WB_BYTES          (256 * 1024)
+
 
 /* Type of buffer used for fuse_add_direntry() calls */
 struct dirbuf1
@@ -252,6 +270,7 @@ struct state_create
 struct state_read
 {
     fuse_req_t        req;        /* Original FUSE request from lookup  */
+    struct xfuse_ra_block *block; /* Read-ahead block, if req is NULL   */
 };
 
 /*
@@ -259,8 +278,11 @@ struct state_read
  */
 struct state_write
 {
-    fuse_req_t        req;        /* Original FUSE request from lookup  */
+    fuse_req_t        req;        /* Original FUSE request, or NULL for */
+    /* a write-behind write               */
     fuse_ino_t        inum;       /* inum of file we're writing         */
+    struct xfuse_handle *fh;      /* Handle the write was made on       */
+    size_t            size;       /* Bytes in a write-behind write      */
 };
 
 /*
@@ -270,6 +292,7 @@ struct state_remove
 {
     fuse_req_t        req;        /* Original FUSE request from lookup  */
     fuse_ino_t        inum;       /* inum of file we're removing        */
+    fuse_ino_t        pinum;      /* inum of its parent directory       */
 };
 
 /*
@@ -279,6 +302,7 @@ struct state_rename
 {
     fuse_req_t        req;        /* Original FUSE request from lookup  */
     fuse_ino_t        pinum;      /* inum of parent of file             */
+    fuse_ino_t        old_pinum;  /* inum of old parent of file         */
     fuse_ino_t        new_pinum;  /* inum of new parent of file         */
     char              name[XFS_MAXFILENAMELEN + 1];
     /* New name of file in new parent dir */
@@ -307,9 +331,52 @@ struct xfuse_handle
      *       fields of this structure contain invalid values.
      */
     struct xfs_dir_handle *dir_handle;
+
+    /* read-ahead and write-behind, for files on redirected shares */
+    fuse_ino_t inum;
+    int ra_active;          /* file is being read sequentially */
+    off_t seq_next;         /* offset after the last read */
+    struct xfuse_ra_block *ra_blocks[XFUSE_RA_MAX_BLOCKS]; /* by offset */
+    int ra_count;
+    struct list *waiting;   /* struct xfuse_wait *, oldest first */
+    char *wb_data;          /* writes not yet sent to the client */
+    off_t wb_off;
+    size_t wb_len;
+    int writes_in_flight;
+    int write_error;        /* errno from a write-behind write, or 0 */
+    struct state_close *close_pending; /* release waiting for writes */
+    int processing;         /* in xfuse_handle_process() */
+    int process_again;
 };
 typedef struct xfuse_handle XFUSE_HANDLE;
 
+/* A block of a file, read ahead from the client */
+struct xfuse_ra_block
+{
+    XFUSE_HANDLE *fh;       /* NULL once the block has been discarded */
+    off_t off;
+    size_t length;          /* bytes received */
+    int status;             /* XFUSE_RA_PENDING, etc */
+    char *data;
+};
+
+#define XFUSE_RA_PENDING 0
+#define XFUSE_RA_READY 1
+#define XFUSE_RA_FAILED 2
+
+/* A FUSE request waiting for I/O on its handle */
+struct xfuse_wait
+{
+    fuse_req_t req;
+    int type;               /* XFUSE_WAIT_* */
+    off_t off;
+    size_t size;
+};
+
+#define XFUSE_WAIT_READ 0           /* answered from read-ahead blocks */
+#define XFUSE_WAIT_DIRECT_READ 1    /* sent to the client as it is */
+#define XFUSE_WAIT_SYNC 2
+
 /* used for file data request sent to client */
 struct req_list_item
 {
@@ -322,7 +389,15 @@ struct req_list_item
 
 extern struct config_chansrv *g_cfg; /* in chansrv.c */
 
+/* Cache timeouts for a redirected drive */
+struct xfuse_share
+{
+    tui32 device_id;
+    const struct chansrv_drive_cache *timeouts;
+};
+
 static struct list *g_req_list = 0;
+static struct list *g_shares = 0;            /* struct xfuse_share *        */
 static struct xfs_fs *g_xfs;                 /* an inst of xrdp file system */
 static ino_t g_clipboard_inum;               /* inode of clipboard dir      */
 static char *g_mount_point = 0;              /* our FUSE mount point        */
@@ -337,6 +412,7 @@ static tintptr g_bufsize = 0;
 
 /* forward declarations for internal access */
 static int xfuse_init_xrdp_fs(void);
+static void xfuse_ra_discard(XFUSE_HANDLE *fh);
 static int xfuse_deinit_xrdp_fs(void);
 static int xfuse_init_lib(struct fuse_args *args);
 
@@ -386,10 +462,11 @@ static void xfuse_cb_create(fuse_req_t req, fuse_ino_t parent,
                             const char *name, mode_t mode,
                             struct fuse_file_info *fi);
 
-#if 0
+static void xfuse_cb_flush(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi);
+
 static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                            struct fuse_file_info *fi);
-#endif
 
 static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
                              int to_set, struct fuse_file_info *fi);
@@ -405,6 +482,8 @@ static void xfs_inode_to_fuse_entry_param(const XFS_INODE *xinode,
         struct fuse_entry_param *e);
 static void make_fuse_entry_reply(fuse_req_t req, const XFS_INODE *xinode);
 static void make_fuse_attr_reply(fuse_req_t req, const XFS_INODE *xinode);
+static void make_fuse_negative_entry_reply(fuse_req_t req,
+        unsigned int timeout);
 static const char *filename_on_device(const char *full_path);
 static void update_inode_file_attributes(const struct file_attr *fattr,
         tui32 change_mask, XFS_INODE *xinode);
@@ -423,7 +502,14 @@ load_fuse_config(void)
 static XFUSE_HANDLE *
 xfuse_handle_create()
 {
-    return g_new0(XFUSE_HANDLE, 1);
+    XFUSE_HANDLE *self = g_new0(XFUSE_HANDLE, 1);
+
+    if (self != NULL && (self->waiting = list_create()) == NULL)
+    {
+        free(self);
+        self = NULL;
+    }
+    return self;
 }
 
 /*****************************************************************************/
@@ -439,6 +525,20 @@ xfuse_handle_delete(XFUSE_HANDLE *self)
     {
         free(self->dir_handle);
     }
+    if (self->waiting != NULL)
+    {
+        while (self->waiting->count > 0)
+        {
+            struct xfuse_wait *w;
+            w = (struct xfuse_wait *) list_get_item(self->waiting, 0);
+            fuse_reply_err(w->req, EIO);
+            free(w);
+            list_remove_item(self->waiting, 0);
+        }
+        list_delete(self->waiting);
+    }
+    xfuse_ra_discard(self);
+    free(self->wb_data);
     free(self);
 }
 
@@ -456,6 +556,481 @@ xfuse_handle_from_fuse_handle(uint64_t handle)
     return (XFUSE_HANDLE *) (tintptr) handle;
 }
 
+/*****************************************************************************/
+/* Gets the cache timeouts for an entry on a redirected drive */
+static const struct chansrv_drive_cache *
+xfuse_get_drive_cache(tui32 device_id)
+{
+    int index;
+    const struct xfuse_share *share;
+
+    for (index = 0; g_shares != NULL && index < g_shares->count; ++index)
+    {
+        share = (const struct xfuse_share *) list_get_item(g_shares, index);
+        if (share->device_id == device_id)
+        {
+            return share->timeouts;
+        }
+    }
+    return &g_cfg->drive_cache;
+}
+
+/*****************************************************************************/
+/* Whether something fetched from the client at 'when' can still be used */
+static int
+xfuse_cache_fresh(tui64 when, unsigned int timeout)
+{
+    return when != 0 && g_time_us() - when < (tui64) timeout * 1000000;
+}
+
+/*****************************************************************************/
+/* Makes the next lookup of an entry go to the client */
+static void
+xfuse_cache_invalidate_attr(fuse_ino_t inum)
+{
+    XFS_INODE *xinode = xfs_get(g_xfs, inum);
+
+    if (xinode != NULL)
+    {
+        xinode->attr_time = 0;
+    }
+}
+
+/*****************************************************************************/
+/* Frees a read-ahead block, or arranges for it to be freed when its
+ * read completes */
+static void
+xfuse_ra_block_release(struct xfuse_ra_block *block)
+{
+    if (block->status == XFUSE_RA_PENDING)
+    {
+        block->fh = NULL;
+    }
+    else
+    {
+        free(block->data);
+        free(block);
+    }
+}
+
+/*****************************************************************************/
+/* Removes read-ahead blocks which end at or before an offset */
+static void
+xfuse_ra_drop_before(XFUSE_HANDLE *fh, off_t off)
+{
+    struct xfuse_ra_block *block;
+    int index;
+    int keep;
+
+    keep = 0;
+    for (index = 0; index < fh->ra_count; index++)
+    {
+        block = fh->ra_blocks[index];
+        if (block->off + XFUSE_RA_BLOCK_BYTES > off)
+        {
+            fh->ra_blocks[keep++] = block;
+        }
+        else
+        {
+            xfuse_ra_block_release(block);
+        }
+    }
+    fh->ra_count = keep;
+}
+
+/*****************************************************************************/
+/* Removes all the read-ahead blocks */
+static void
+xfuse_ra_discard(XFUSE_HANDLE *fh)
+{
+    int index;
+
+    for (index = 0; index < fh->ra_count; index++)
+    {
+        xfuse_ra_block_release(fh->ra_blocks[index]);
+    }
+    fh->ra_count = 0;
+}
+
+/*****************************************************************************/
+static struct xfuse_ra_block *
+xfuse_ra_find(XFUSE_HANDLE *fh, off_t off)
+{
+    struct xfuse_ra_block *block;
+    int index;
+
+    for (index = 0; index < fh->ra_count; index++)
+    {
+        block = fh->ra_blocks[index];
+        if (off >= block->off && off < block->off + XFUSE_RA_BLOCK_BYTES)
+        {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/* Asks the client for a block of the file. Returns non-zero if there's
+ * no memory */
+static int
+xfuse_ra_start_block(XFUSE_HANDLE *fh, off_t off)
+{
+    struct xfuse_ra_block *block;
+    struct state_read *fusep;
+    int index;
+
+    block = g_new0(struct xfuse_ra_block, 1);
+    fusep = g_new0(struct state_read, 1);
+    if (block == NULL || fusep == NULL ||
+            (block->data = (char *) malloc(XFUSE_RA_BLOCK_BYTES)) == NULL)
+    {
+        free(block);
+        free(fusep);
+        return 1;
+    }
+    block->fh = fh;
+    block->off = off;
+    block->status = XFUSE_RA_PENDING;
+    fusep->block = block;
+
+    /* keep the blocks in order */
+    for (index = fh->ra_count;
+            index > 0 && fh->ra_blocks[index - 1]->off > off;
+            index--)
+    {
+        fh->ra_blocks[index] = fh->ra_blocks[index - 1];
+    }
+    fh->ra_blocks[index] = block;
+    fh->ra_count++;
+
+    /*
+     * Further processing happens in xfuse_devredir_cb_read_file(),
+     * which may be called before this returns
+     */
+    devredir_file_read(fusep, fh->DeviceId, fh->FileId,
+                       XFUSE_RA_BLOCK_BYTES, off);
+    return 0;
+}
+
+/*****************************************************************************/
+/* Starts reads for the blocks needed by the oldest waiting read and,
+ * if the file is being read sequentially, the blocks after it */
+static void
+xfuse_ra_fill(XFUSE_HANDLE *fh)
+{
+    struct xfuse_ra_block *block;
+    struct xfuse_wait *w;
+    XFS_INODE *xinode;
+    off_t start;
+    off_t need_end;
+    off_t eof;
+    off_t off;
+
+    if (fh->writes_in_flight > 0 || fh->wb_len > 0)
+    {
+        /* reads wait for writes to complete */
+        return;
+    }
+    start = fh->seq_next;
+    need_end = 0;
+    if (fh->waiting->count > 0)
+    {
+        w = (struct xfuse_wait *) list_get_item(fh->waiting, 0);
+        if (w->type == XFUSE_WAIT_READ)
+        {
+            start = w->off;
+            need_end = w->off + (off_t) w->size;
+        }
+    }
+    if (!fh->ra_active && need_end == 0)
+    {
+        return;
+    }
+    start -= start % XFUSE_RA_BLOCK_BYTES;
+    xfuse_ra_drop_before(fh, start);
+    xinode = xfs_get(g_xfs, fh->inum);
+    eof = (xinode != NULL) ? xinode->size : 0;
+
+    for (off = start;
+            fh->ra_count < XFUSE_RA_MAX_BLOCKS;
+            off += XFUSE_RA_BLOCK_BYTES)
+    {
+        block = xfuse_ra_find(fh, off);
+        if (block == NULL)
+        {
+            if (off >= need_end && (!fh->ra_active || off >= eof))
+            {
+                break;
+            }
+            if (xfuse_ra_start_block(fh, off) != 0)
+            {
+                break;
+            }
+        }
+        else if (block->status == XFUSE_RA_FAILED ||
+                 (block->status == XFUSE_RA_READY &&
+                  block->length < XFUSE_RA_BLOCK_BYTES))
+        {
+            /* no point reading past an error, or the end of the file */
+            break;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Answers a waiting read from the read-ahead blocks. Returns 0 if
+ * a block it needs hasn't arrived yet */
+static int
+xfuse_ra_serve(XFUSE_HANDLE *fh, struct xfuse_wait *w)
+{
+    struct xfuse_ra_block *block;
+    char *buf;
+    off_t end;
+    off_t pos;
+    off_t bytes;
+
+    /* check everything needed is here first */
+    end = w->off + (off_t) w->size;
+    for (pos = w->off; pos < end; pos = block->off + XFUSE_RA_BLOCK_BYTES)
+    {
+        block = xfuse_ra_find(fh, pos);
+        if (block == NULL || block->status == XFUSE_RA_PENDING)
+        {
+            return 0;
+        }
+        if (block->status == XFUSE_RA_FAILED)
+        {
+            fuse_reply_err(w->req, EIO);
+            return 1;
+        }
+        if (block->length < XFUSE_RA_BLOCK_BYTES)
+        {
+            /* end of file */
+            if (end > block->off + (off_t) block->length)
+            {
+                end = block->off + (off_t) block->length;
+            }
+            break;
+        }
+    }
+
+    if (end <= w->off)
+    {
+        fuse_reply_buf(w->req, NULL, 0);
+        return 1;
+    }
+    block = xfuse_ra_find(fh, w->off);
+    if (end <= block->off + XFUSE_RA_BLOCK_BYTES)
+    {
+        /* all in one block */
+        fuse_reply_buf(w->req, block->data + (w->off - block->off),
+                       (size_t) (end - w->off));
+        return 1;
+    }
+
+    if ((buf = (char *) malloc((size_t) (end - w->off))) == NULL)
+    {
+        fuse_reply_err(w->req, ENOMEM);
+        return 1;
+    }
+    for (pos = w->off; pos < end; pos += bytes)
+    {
+        block = xfuse_ra_find(fh, pos);
+        bytes = block->off + XFUSE_RA_BLOCK_BYTES - pos;
+        if (bytes > end - pos)
+        {
+            bytes = end - pos;
+        }
+        g_memcpy(buf + (pos - w->off), block->data + (pos - block->off),
+                 (size_t) bytes);
+    }
+    fuse_reply_buf(w->req, buf, (size_t) (end - w->off));
+    free(buf);
+    return 1;
+}
+
+/*****************************************************************************/
+/* Sends any collected writes to the client */
+static void
+xfuse_wb_flush(XFUSE_HANDLE *fh)
+{
+    struct state_write *fusep;
+    size_t len;
+
+    if (fh->wb_len == 0)
+    {
+        return;
+    }
+    len = fh->wb_len;
+    fh->wb_len = 0;
+    if ((fusep = g_new0(struct state_write, 1)) == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        fh->write_error = ENOMEM;
+        return;
+    }
+    fusep->inum = fh->inum;
+    fusep->fh = fh;
+    fusep->size = len;
+    fh->writes_in_flight++;
+
+    /*
+     * Further processing happens in xfuse_devredir_cb_write_file(),
+     * which may be called before this returns. The data is copied
+     * before this returns.
+     */
+    devredir_file_write(fusep, fh->DeviceId, fh->FileId, fh->wb_data,
+                        (int) len, fh->wb_off);
+}
+
+/*****************************************************************************/
+/* Collects a write to send later. Returns non-zero if it can't be
+ * collected */
+static int
+xfuse_wb_add(XFUSE_HANDLE *fh, const char *buf, size_t size, off_t off)
+{
+    XFS_INODE *xinode;
+
+    if (fh->wb_len > 0 &&
+            (off != fh->wb_off + (off_t) fh->wb_len ||
+             fh->wb_len + size > XFUSE_WB_BYTES))
+    {
+        xfuse_wb_flush(fh);
+    }
+    if (size > XFUSE_WB_BYTES)
+    {
+        return 1;
+    }
+    if (fh->wb_data == NULL &&
+            (fh->wb_data = (char *) malloc(XFUSE_WB_BYTES)) == NULL)
+    {
+        return 1;
+    }
+    if (fh->wb_len == 0)
+    {
+        fh->wb_off = off;
+    }
+    g_memcpy(fh->wb_data + fh->wb_len, buf, size);
+    fh->wb_len += size;
+
+    /* update file size */
+    if ((xinode = xfs_get(g_xfs, fh->inum)) != NULL)
+    {
+        if (off + (off_t) size > xinode->size)
+        {
+            xinode->size = off + (off_t) size;
+        }
+        xinode->attr_time = 0;
+    }
+
+    if (fh->wb_len == XFUSE_WB_BYTES)
+    {
+        xfuse_wb_flush(fh);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Answers waiting requests, in order, as far as possible, and keeps
+ * the read-ahead going */
+static void
+xfuse_handle_process(XFUSE_HANDLE *fh)
+{
+    struct xfuse_wait *w;
+    struct state_read *fusep;
+
+    if (fh->processing)
+    {
+        /* called back from below */
+        fh->process_again = 1;
+        return;
+    }
+    fh->processing = 1;
+    do
+    {
+        fh->process_again = 0;
+        /* reads and syncs wait for earlier writes */
+        while (fh->waiting->count > 0 &&
+                fh->writes_in_flight == 0 && fh->wb_len == 0)
+        {
+            w = (struct xfuse_wait *) list_get_item(fh->waiting, 0);
+            if (w->type == XFUSE_WAIT_SYNC)
+            {
+                fuse_reply_err(w->req, fh->write_error);
+                fh->write_error = 0;
+            }
+            else if (w->type == XFUSE_WAIT_DIRECT_READ)
+            {
+                if ((fusep = g_new0(struct state_read, 1)) == NULL)
+                {
+                    fuse_reply_err(w->req, ENOMEM);
+                }
+                else
+                {
+                    fusep->req = w->req;
+                    devredir_file_read(fusep, fh->DeviceId, fh->FileId,
+                                       (tui32) w->size, w->off);
+                }
+            }
+            else if (!xfuse_ra_serve(fh, w))
+            {
+                break;
+            }
+            list_remove_item(fh->waiting, 0);
+            free(w);
+        }
+        xfuse_ra_fill(fh);
+    }
+    while (fh->process_again);
+    fh->processing = 0;
+}
+
+/*****************************************************************************/
+/* Queues a request until the I/O before it has completed. Returns
+ * non-zero if there's no memory */
+static int
+xfuse_handle_wait(XFUSE_HANDLE *fh, fuse_req_t req, int type,
+                  off_t off, size_t size)
+{
+    struct xfuse_wait *w;
+
+    if ((w = g_new0(struct xfuse_wait, 1)) == NULL)
+    {
+        return 1;
+    }
+    w->req = req;
+    w->type = type;
+    w->off = off;
+    w->size = size;
+    if (!list_add_item(fh->waiting, (tintptr) w))
+    {
+        free(w);
+        return 1;
+    }
+    xfuse_wb_flush(fh);
+    xfuse_handle_process(fh);
+    return 0;
+}
+
+/*****************************************************************************/
+/* Closes a file on a redirected share, and deletes its handle */
+static void
+xfuse_file_close(XFUSE_HANDLE *fh, struct state_close *fip)
+{
+    /*
+     * If this call succeeds, further request processing happens in
+     * xfuse_devredir_cb_file_close()
+     */
+    if (devredir_file_close(fip, fh->DeviceId, fh->FileId))
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "failed to send devredir_close_file() cmd");
+        fuse_reply_err(fip->req, EREMOTEIO);
+        free(fip);
+    }
+    xfuse_handle_delete(fh);
+}
+
 /*****************************************************************************
 **                                                                          **
 **         public functions - can be called from any code path              **
@@ -597,7 +1172,8 @@ xfuse_init(void)
     g_xfuse_ops.read        = xfuse_cb_read;
     g_xfuse_ops.write       = xfuse_cb_write;
     g_xfuse_ops.create      = xfuse_cb_create;
-    //g_xfuse_ops.fsync     = xfuse_cb_fsync; /* LK_TODO delete this */
+    g_xfuse_ops.flush       = xfuse_cb_flush;
+    g_xfuse_ops.fsync       = xfuse_cb_fsync;
     g_xfuse_ops.getattr     = xfuse_cb_getattr;
     g_xfuse_ops.setattr     = xfuse_cb_setattr;
     g_xfuse_ops.opendir     = xfuse_cb_opendir;
@@ -751,6 +1327,30 @@ int xfuse_create_share(tui32 device_id, const char *dirname)
         }
     }
 
+    if (result == 0)
+    {
+        struct xfuse_share *share = g_new0(struct xfuse_share, 1);
+
+        if (g_shares == NULL && (g_shares = list_create()) != NULL)
+        {
+            g_shares->auto_free = 1;
+        }
+        if (share != NULL && g_shares != NULL)
+        {
+            share->device_id = device_id;
+            share->timeouts = config_get_drive_cache(g_cfg, dirname);
+            if (!list_add_item(g_shares, (tintptr) share))
+            {
+                free(share);
+            }
+        }
+        else
+        {
+            /* The drive will use the default timeouts */
+            free(share);
+        }
+    }
+
     return result;
 }
 
@@ -762,7 +1362,20 @@ int xfuse_create_share(tui32 device_id, const char *dirname)
 
 void xfuse_delete_share(tui32 device_id)
 {
+    int index;
+    struct xfuse_share *share;
+
     xfs_delete_redirected_entries_with_device_id(g_xfs, device_id);
+
+    for (index = 0; g_shares != NULL && index < g_shares->count; ++index)
+    {
+        share = (struct xfuse_share *) list_get_item(g_shares, index);
+        if (share->device_id == device_id)
+        {
+            list_remove_item(g_shares, index);
+            break;
+        }
+    }
 }
 
 /**
@@ -993,6 +1606,8 @@ static int xfuse_deinit_xrdp_fs(void)
     xfs_delete_xfs_fs(g_xfs);
     g_xfs = NULL;
     g_clipboard_inum = 0;
+    list_delete(g_shares);
+    g_shares = NULL;
 
     return 0;
 }
@@ -1054,6 +1669,7 @@ void xfuse_devredir_cb_enum_dir_add_entry(
                 /* Initially, set the attribute change time to the file data
                    change time */
                 xinode->ctime = fattr->mtime;
+                xinode->attr_time = g_time_us();
 
                 /* device_id is inherited from parent */
             }
@@ -1069,6 +1685,8 @@ void xfuse_devredir_cb_enum_dir_add_entry(
 void xfuse_devredir_cb_enum_dir_done(struct state_dirscan *fip,
                                      enum NTSTATUS IoStatus)
 {
+    XFS_INODE *xinode;
+
     LOG_DEVEL(LOG_LEVEL_DEBUG, "fip=%p IoStatus=0x%x", fip, IoStatus);
 
     /*
@@ -1087,7 +1705,7 @@ void xfuse_devredir_cb_enum_dir_done(struct state_dirscan *fip,
         }
         fuse_reply_err(fip->req, status);
     }
-    else if (!xfs_get(g_xfs, fip->pinum))
+    else if ((xinode = xfs_get(g_xfs, fip->pinum)) == NULL)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is not valid", fip->pinum);
         fuse_reply_err(fip->req, ENOENT);
@@ -1097,6 +1715,8 @@ void xfuse_devredir_cb_enum_dir_done(struct state_dirscan *fip,
         struct fuse_file_info *fi = &fip->fi;
         XFUSE_HANDLE *xhandle = xfuse_handle_create();
 
+        xinode->dir_time = g_time_us();
+
         if (xhandle == NULL
                 || (xhandle->dir_handle = xfs_opendir(g_xfs, fip->pinum)) == NULL)
         {
@@ -1149,7 +1769,17 @@ void xfuse_devredir_cb_lookup_entry(struct state_lookup *fip,
                 {
                     xfs_remove_entry(g_xfs, fip->existing_inum);
                 }
-                fuse_reply_err(fip->req, ENOENT);
+                if ((xinode = xfs_get(g_xfs, fip->pinum)) != NULL)
+                {
+                    make_fuse_negative_entry_reply(
+                        fip->req,
+                        xfuse_get_drive_cache(xinode->device_id)->
+                        negative_timeout);
+                }
+                else
+                {
+                    fuse_reply_err(fip->req, ENOENT);
+                }
                 break;
 
             default:
@@ -1192,6 +1822,7 @@ void xfuse_devredir_cb_lookup_entry(struct state_lookup *fip,
                 {
                     LOG_DEVEL(LOG_LEVEL_DEBUG, "Updating attributes of inode=%ld", xinode->inum);
                     update_inode_file_attributes(file_info, TO_SET_ALL, xinode);
+                    xinode->attr_time = g_time_us();
                 }
             }
             else
@@ -1224,6 +1855,7 @@ void xfuse_devredir_cb_lookup_entry(struct state_lookup *fip,
                 /* Initially, set the attribute change time to the file data
                    change time */
                 xinode->ctime = file_info->mtime;
+                xinode->attr_time = g_time_us();
                 /* device_id is inherited from parent */
             }
         }
@@ -1279,6 +1911,8 @@ void xfuse_devredir_cb_setattr(struct state_setattr *fip,
     else
     {
         update_inode_file_attributes(&fip->fattr, fip->change_mask, xinode);
+        /* Let the client fill in anything it changed as a side effect */
+        xinode->attr_time = 0;
         make_fuse_attr_reply(fip->req, xinode);
     }
     free(fip);
@@ -1366,6 +2000,7 @@ void xfuse_devredir_cb_create_file(struct state_create *fip,
             }
             else
             {
+                xfuse_cache_invalidate_attr(fip->pinum);
 
                 if ((fip->mode & S_IFDIR) != 0)
                 {
@@ -1374,6 +2009,7 @@ void xfuse_devredir_cb_create_file(struct state_create *fip,
                 else
                 {
                     struct fuse_entry_param  e;
+                    fh->inum = xinode->inum;
                     xfs_inode_to_fuse_entry_param(xinode, &e);
                     fuse_reply_create(fip->req, &e, &fip->fi);
                     xfs_increment_file_open_count(g_xfs, xinode->inum);
@@ -1426,6 +2062,7 @@ void xfuse_devredir_cb_open_file(struct state_open *fip,
             /* save file handle for later use */
             fh->DeviceId = DeviceId;
             fh->FileId = FileId;
+            fh->inum = fip->inum;
 
             fip->fi.fh = xfuse_handle_to_fuse_handle(fh);
 
@@ -1447,6 +2084,35 @@ void xfuse_devredir_cb_read_file(struct state_read *fip,
                                  enum NTSTATUS IoStatus,
                                  const char *buf, size_t length)
 {
+    struct xfuse_ra_block *block = fip->block;
+
+    if (block != NULL)
+    {
+        /* a read-ahead block */
+        free(fip);
+        if (IoStatus != STATUS_SUCCESS || length > XFUSE_RA_BLOCK_BYTES)
+        {
+            LOG_DEVEL(LOG_LEVEL_ERROR, "Read NTSTATUS is %d", (int) IoStatus);
+            block->status = XFUSE_RA_FAILED;
+        }
+        else
+        {
+            g_memcpy(block->data, buf, length);
+            block->length = length;
+            block->status = XFUSE_RA_READY;
+        }
+        if (block->fh == NULL)
+        {
+            /* no longer wanted */
+            xfuse_ra_block_release(block);
+        }
+        else
+        {
+            xfuse_handle_process(block->fh);
+        }
+        return;
+    }
+
     if (IoStatus != STATUS_SUCCESS)
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "Read NTSTATUS is %d", (int) IoStatus);
@@ -1466,16 +2132,29 @@ void xfuse_devredir_cb_write_file(
     size_t length)
 {
     XFS_INODE   *xinode;
+    XFUSE_HANDLE *fh = fip->fh;
 
-    if (IoStatus != STATUS_SUCCESS)
+    if (IoStatus != STATUS_SUCCESS ||
+            (fip->req == NULL && length < fip->size))
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "Write NTSTATUS is %d", (int) IoStatus);
-        fuse_reply_err(fip->req, EIO);
+        if (fip->req != NULL)
+        {
+            fuse_reply_err(fip->req, EIO);
+        }
+        else
+        {
+            /* reported by the next write, flush or fsync */
+            fh->write_error = EIO;
+        }
     }
     else
     {
         off_t new_size = offset + length;
-        fuse_reply_write(fip->req, length);
+        if (fip->req != NULL)
+        {
+            fuse_reply_write(fip->req, length);
+        }
 
         /* update file size */
         if ((xinode = xfs_get(g_xfs, fip->inum)) != NULL)
@@ -1484,6 +2163,7 @@ void xfuse_devredir_cb_write_file(
             {
                 xinode->size = new_size;
             }
+            xinode->attr_time = 0;
         }
         else
         {
@@ -1492,6 +2172,19 @@ void xfuse_devredir_cb_write_file(
     }
 
     free(fip);
+
+    if (fh != NULL && --fh->writes_in_flight == 0)
+    {
+        if (fh->close_pending != NULL)
+        {
+            /* the file has been released */
+            xfuse_file_close(fh, fh->close_pending);
+        }
+        else
+        {
+            xfuse_handle_process(fh);
+        }
+    }
 }
 
 void xfuse_devredir_cb_rmdir_or_file(struct state_remove *fip,
@@ -1504,6 +2197,7 @@ void xfuse_devredir_cb_rmdir_or_file(struct state_remove *fip,
         case STATUS_SUCCESS:
         case STATUS_NO_SUCH_FILE:
             xfs_remove_entry(g_xfs, xinode->inum); /* Remove local copy */
+            xfuse_cache_invalidate_attr(fip->pinum);
             fuse_reply_err(fip->req, 0);
             break;
 
@@ -1536,6 +2230,10 @@ void xfuse_devredir_cb_rename_file(struct state_rename *fip,
     {
         status = xfs_move_entry(g_xfs, fip->pinum,
                                 fip->new_pinum, fip->name);
+        /* The client will have changed the times on all of these */
+        xfuse_cache_invalidate_attr(fip->pinum);
+        xfuse_cache_invalidate_attr(fip->old_pinum);
+        xfuse_cache_invalidate_attr(fip->new_pinum);
     }
 
     fuse_reply_err(fip->req, status);
@@ -1550,6 +2248,18 @@ void xfuse_devredir_cb_file_close(struct state_close *fip)
     free(fip);
 }
 
+void xfuse_devredir_cb_volume_attributes(tui32 device_id,
+                                         tui32 fs_attributes)
+{
+    int is_case_insensitive =
+        (fs_attributes & FILE_CASE_SENSITIVE_SEARCH) == 0;
+
+    LOG(LOG_LEVEL_INFO, "Redirected drive 0x%x is case-%ssensitive",
+        device_id, (is_case_insensitive) ? "in" : "");
+    xfs_set_redirected_case_insensitive(g_xfs, device_id,
+                                        is_case_insensitive);
+}
+
 /*
  * Determine is a file is in the FUSE filesystem
  *
@@ -1667,12 +2377,29 @@ static void xfuse_cb_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
         {
             /* specified file resides on redirected share
              *
-             * We always look these up, and relying on libfuse to do sane
-             * caching */
-            struct state_lookup *fip = g_new0(struct state_lookup, 1);
-            char *full_path = get_name_for_entry_in_parent(parent, name);
-
-            if (fip == NULL || full_path == NULL)
+             * We look these up unless we've heard about the entry, or
+             * listed the directory, recently */
+            const struct chansrv_drive_cache *dc =
+                xfuse_get_drive_cache(parent_xinode->device_id);
+            struct state_lookup *fip = NULL;
+            char *full_path = NULL;
+
+            xinode = xfs_lookup_in_dir(g_xfs, parent, name);
+            if (xinode != NULL &&
+                    xfuse_cache_fresh(xinode->attr_time, dc->attr_timeout))
+            {
+                make_fuse_entry_reply(req, xinode);
+            }
+            else if (xinode == NULL && dc->negative_timeout > 0 &&
+                     xfuse_cache_fresh(parent_xinode->dir_time,
+                                       dc->dir_timeout))
+            {
+                /* It wasn't there when the directory was listed */
+                make_fuse_negative_entry_reply(req, dc->negative_timeout);
+            }
+            else if ((fip = g_new0(struct state_lookup, 1)) == NULL ||
+                     (full_path = get_name_for_entry_in_parent(parent,
+                                  name)) == NULL)
             {
                 LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
                 fuse_reply_err(req, ENOMEM);
@@ -1694,7 +2421,7 @@ static void xfuse_cb_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
                  * and generation. If it's not remote any more this means we
                  * can remove it when we get the response
                  */
-                if ((xinode = xfs_lookup_in_dir(g_xfs, parent, name)) != NULL)
+                if (xinode != NULL)
                 {
                     fip->existing_inum = xinode->inum;
                     fip->existing_generation = xinode->generation;
@@ -1911,6 +2638,7 @@ static void xfuse_cb_unlink(fuse_req_t req, fuse_ino_t parent,
 
             fip->req = req;
             fip->inum = xinode->inum;
+            fip->pinum = parent;
 
             /* we want path minus 'root node of the share' */
             cptr = filename_on_device(full_path);
@@ -2003,6 +2731,7 @@ static void xfuse_cb_rename(fuse_req_t req,
 
             fip->req = req;
             fip->pinum = old_xinode->inum;
+            fip->old_pinum = old_parent;
             fip->new_pinum = new_parent;
             strcpy(fip->name, new_name);
 
@@ -2271,18 +3000,17 @@ static void xfuse_cb_release(fuse_req_t req, fuse_ino_t ino, struct
 
         fi->fh = xfuse_handle_to_fuse_handle(NULL);
 
-        /*
-         * If this call succeeds, further request processing happens in
-         * xfuse_devredir_cb_file_close()
-         */
-        if (devredir_file_close(fip, xinode->device_id, handle->FileId))
+        /* The file is closed once any collected writes have been sent */
+        xfuse_ra_discard(handle);
+        xfuse_wb_flush(handle);
+        if (handle->writes_in_flight > 0)
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "failed to send devredir_close_file() cmd");
-            fuse_reply_err(req, EREMOTEIO);
-            free(fip);
+            handle->close_pending = fip;
+        }
+        else
+        {
+            xfuse_file_close(handle, fip);
         }
-
-        xfuse_handle_delete(handle);
     }
 }
 
@@ -2299,6 +3027,7 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
     struct state_read *fusep;
     XFS_INODE            *xinode;
     struct req_list_item  *rli;
+    int                   sequential;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "want_bytes %zd bytes at off %lld", size, (long long) off);
 
@@ -2341,8 +3070,31 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
     {
         /* target file is on a remote device */
 
-        fusep = g_new0(struct state_read, 1);
-        if (fusep == NULL)
+        /* only read ahead for sequential reads */
+        sequential = (off == 0 || off == fh->seq_next) &&
+                     size <= XFUSE_RA_BLOCK_BYTES * (XFUSE_RA_MAX_BLOCKS / 2);
+        if (!sequential && fh->ra_active)
+        {
+            xfuse_ra_discard(fh);
+        }
+        fh->ra_active = sequential;
+        fh->seq_next = off + (off_t) size;
+
+        if (sequential || fh->waiting->count > 0 ||
+                fh->wb_len > 0 || fh->writes_in_flight > 0)
+        {
+            /* If this call succeeds, further request processing
+             * happens in xfuse_handle_process() */
+            if (xfuse_handle_wait(fh, req,
+                                  sequential ? XFUSE_WAIT_READ :
+                                  XFUSE_WAIT_DIRECT_READ,
+                                  off, size) != 0)
+            {
+                LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+                fuse_reply_err(req, ENOMEM);
+            }
+        }
+        else if ((fusep = g_new0(struct state_read, 1)) == NULL)
         {
             LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
             fuse_reply_err(req, ENOMEM);
@@ -2390,8 +3142,20 @@ static void xfuse_cb_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
     {
         /* target file is on a remote device */
 
-        fusep = g_new0(struct state_write, 1);
-        if (fusep == NULL)
+        /* anything read ahead may now be out of date */
+        xfuse_ra_discard(fh);
+
+        if (fh->write_error != 0)
+        {
+            /* an earlier write-behind write failed */
+            fuse_reply_err(req, fh->write_error);
+            fh->write_error = 0;
+        }
+        else if (xfuse_wb_add(fh, buf, size, off) == 0)
+        {
+            fuse_reply_write(req, size);
+        }
+        else if ((fusep = g_new0(struct state_write, 1)) == NULL)
         {
             LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
             fuse_reply_err(req, ENOMEM);
@@ -2400,6 +3164,8 @@ static void xfuse_cb_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
         {
             fusep->req = req;
             fusep->inum = ino;
+            fusep->fh = fh;
+            fh->writes_in_flight++;
 
             /*
              * If this call succeeds, further request processing happens in
@@ -2432,15 +3198,36 @@ static void xfuse_cb_create(fuse_req_t req, fuse_ino_t parent,
 /**
  *****************************************************************************/
 
-#if 0
+static void xfuse_cb_flush(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi)
+{
+    XFUSE_HANDLE *fh = xfuse_handle_from_fuse_handle(fi->fh);
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: ino=%ld", ino);
+
+    if (fh == NULL || fh->is_loc_resource || fh->dir_handle != NULL)
+    {
+        fuse_reply_err(req, 0);
+    }
+    /*
+     * If this call succeeds, the reply is sent by xfuse_handle_process()
+     * once collected writes have completed
+     */
+    else if (xfuse_handle_wait(fh, req, XFUSE_WAIT_SYNC, 0, 0) != 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
+        fuse_reply_err(req, ENOMEM);
+    }
+}
+
+/**
+ *****************************************************************************/
+
 static void xfuse_cb_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
                            struct fuse_file_info *fi)
 {
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "#################### entered: ino=%ld datasync=%d", ino, datasync);
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "function not required");
-    fuse_reply_err(req, EINVAL);
+    xfuse_cb_flush(req, ino, fi);
 }
-#endif
 
 /**
  * Sets attributes for a directory entry.
@@ -2524,6 +3311,16 @@ static void xfuse_cb_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
         {
             struct state_setattr *fip = g_new0(struct state_setattr, 1);
             char *full_path = xfs_get_full_path(g_xfs, ino);
+            XFUSE_HANDLE *fh;
+
+            if (fi != NULL && (change_mask & TO_SET_SIZE) != 0 &&
+                    (fh = xfuse_handle_from_fuse_handle(fi->fh)) != NULL &&
+                    !fh->is_loc_resource)
+            {
+                /* collected writes go before the size change */
+                xfuse_ra_discard(fh);
+                xfuse_wb_flush(fh);
+            }
             if (!full_path || !fip)
             {
                 LOG_DEVEL(LOG_LEVEL_ERROR, "system out of memory");
@@ -2581,8 +3378,12 @@ static void xfuse_cb_opendir(fuse_req_t req, fuse_ino_t ino,
         LOG_DEVEL(LOG_LEVEL_ERROR, "inode %ld is not valid", ino);
         fuse_reply_err(req, ENOENT);
     }
-    else if (!xinode->is_redirected)
+    else if (!xinode->is_redirected ||
+             xfuse_cache_fresh(xinode->dir_time,
+                               xfuse_get_drive_cache(xinode->device_id)->
+                               dir_timeout))
     {
+        /* We know what's in the directory */
         if ((xhandle = xfuse_handle_create()) == NULL)
         {
             fuse_reply_err(req, ENOMEM);
@@ -2669,8 +3470,17 @@ static void xfs_inode_to_fuse_entry_param(const XFS_INODE *xinode,
 {
     memset(e, 0, sizeof(*e));
     e->ino = xinode->inum;
-    e->attr_timeout = XFUSE_ATTR_TIMEOUT;
-    e->entry_timeout = XFUSE_ENTRY_TIMEOUT;
+    if (xinode->is_redirected)
+    {
+        e->attr_timeout =
+            xfuse_get_drive_cache(xinode->device_id)->attr_timeout;
+        e->entry_timeout = e->attr_timeout;
+    }
+    else
+    {
+        e->attr_timeout = XFUSE_ATTR_TIMEOUT;
+        e->entry_timeout = XFUSE_ENTRY_TIMEOUT;
+    }
     e->attr.st_ino = xinode->inum;
     e->attr.st_mode = xinode->mode & ~g_cfg->file_umask;
     e->attr.st_nlink = 1;
@@ -2705,7 +3515,32 @@ static void make_fuse_attr_reply(fuse_req_t req, const XFS_INODE *xinode)
     st.st_mtime = xinode->mtime;
     st.st_ctime = xinode->ctime;
 
-    fuse_reply_attr(req, &st, XFUSE_ATTR_TIMEOUT);
+    fuse_reply_attr(req, &st,
+                    xinode->is_redirected ?
+                    xfuse_get_drive_cache(xinode->device_id)->attr_timeout :
+                    XFUSE_ATTR_TIMEOUT);
+}
+
+/*
+ * Tells FUSE an entry doesn't exist, and that it can remember this for
+ * a while
+ */
+static void make_fuse_negative_entry_reply(fuse_req_t req,
+        unsigned int timeout)
+{
+    struct fuse_entry_param  e;
+
+    if (timeout == 0)
+    {
+        fuse_reply_err(req, ENOENT);
+    }
+    else
+    {
+        memset(&e, 0, sizeof(e));
+        e.ino = 0; /* no such entry */
+        e.entry_timeout = timeout;
+        fuse_reply_entry(req, &e);
+    }
 }
 
 /*
@@ -114,6 +114,11 @@ void xfuse_devredir_cb_rename_file(struct state_rename *fip,
 
 void xfuse_devredir_cb_file_close(struct state_close *fip);
 
+/* FileSystemAttributes from [MS-FSCC] FileFsAttributeInformation for
+ * a redirected drive */
+void xfuse_devredir_cb_volume_attributes(tui32 device_id,
+                                         tui32 fs_attributes);
+
 /*
  * Returns true if a filesystem path lies in the FUSE filesystem
  *
@@ -39,7 +39,10 @@
 #ifdef XRDP_FUSE
 
 #define INODE_TABLE_ALLOCATION_INITIAL     4096
-#define INODE_TABLE_ALLOCATION_GRANULARITY 100
+
+/* Directories with this many entries get a hash index */
+#define DIR_HASH_MIN_ENTRIES               16
+#define DIR_HASH_INITIAL_BUCKETS           64
 
 /* inum of the delete pending directory */
 #define DELETE_PENDING_ID 2
@@ -50,12 +53,19 @@
  * The elements in the list are sorted in increasing inum order, as this
  * allows a directory enumeration to be easily resumed if elements
  * are removed or added. See xfs_readdir() for details on this.
+ *
+ * Once a list is big enough, it also gets a hash index of the names
+ * so that lookups don't need to walk the list. The hash ignores ASCII
+ * case, so it can also be used for case-insensitive lookups.
  */
 typedef struct xfs_inode_all XFS_INODE_ALL;
 typedef struct xfs_list
 {
     XFS_INODE_ALL *begin;
     XFS_INODE_ALL *end;
+    unsigned int count;                /* Elements in the list             */
+    unsigned int hash_size;            /* Buckets in hash (power of 2)     */
+    XFS_INODE_ALL **hash;              /* Hash index, or NULL              */
 } XFS_LIST;
 
 /*
@@ -74,6 +84,8 @@ typedef struct xfs_inode_all
     struct xfs_inode_all *parent;      /* Parent inode                     */
     struct xfs_inode_all *next;        /* Next entry in parent             */
     struct xfs_inode_all *previous;    /* Previous entry in parent         */
+    struct xfs_inode_all *hash_next;   /* Next entry in parent hash bucket */
+    tui32                name_hash;    /* Hash of name (see name_hash())   */
     XFS_LIST             dir;          /* Directory only - children        */
     /*
      * Other private elements
@@ -159,6 +171,120 @@ grow_xfs(struct xfs_fs *xfs, unsigned int extra_inodes)
     return result;
 }
 
+/*  ------------------------------------------------------------------------ */
+static int
+fold_ascii_case(int c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/*  ------------------------------------------------------------------------ */
+/* FNV-1a hash of a name, ignoring ASCII case */
+static tui32
+name_hash(const char *name)
+{
+    tui32 hash = 2166136261U;
+
+    while (*name != '\0')
+    {
+        hash ^= (unsigned char) fold_ascii_case((unsigned char) *name++);
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/*  ------------------------------------------------------------------------ */
+/*
+ * Compares names as the directory does.
+ *
+ * A redirected drive which the client says is case-insensitive has its
+ * names compared without regard to (ASCII) case. This matches the name
+ * the client will find for a lookup. Everything else is compared
+ * exactly.
+ */
+static int
+names_match(const XFS_INODE_ALL *dinode, const char *a, const char *b)
+{
+    if (!dinode->pub.is_case_insensitive)
+    {
+        return strcmp(a, b) == 0;
+    }
+
+    while (*a != '\0' &&
+            fold_ascii_case((unsigned char) *a) ==
+            fold_ascii_case((unsigned char) *b))
+    {
+        ++a;
+        ++b;
+    }
+
+    return *a == *b;
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+add_inode_to_hash(XFS_LIST *list, XFS_INODE_ALL *xino)
+{
+    XFS_INODE_ALL **bucket =
+        &list->hash[xino->name_hash & (list->hash_size - 1)];
+
+    xino->hash_next = *bucket;
+    *bucket = xino;
+}
+
+/*  ------------------------------------------------------------------------ */
+/*
+ * Builds or grows the hash index of a list to suit its size
+ *
+ * If memory is short, the list just carries on as it is. The index is
+ * never needed for correctness.
+ */
+static void
+resize_list_hash(XFS_LIST *list)
+{
+    unsigned int new_size;
+    XFS_INODE_ALL **new_hash;
+    XFS_INODE_ALL *p;
+
+    if (list->count < DIR_HASH_MIN_ENTRIES || list->count <= list->hash_size)
+    {
+        return;
+    }
+
+    new_size = (list->hash_size == 0) ?
+               DIR_HASH_INITIAL_BUCKETS : list->hash_size * 2;
+    new_hash = g_new0(XFS_INODE_ALL *, new_size);
+    if (new_hash != NULL)
+    {
+        free(list->hash);
+        list->hash = new_hash;
+        list->hash_size = new_size;
+        for (p = list->begin ; p != NULL ; p = p->next)
+        {
+            add_inode_to_hash(list, p);
+        }
+    }
+}
+
+/*  ------------------------------------------------------------------------ */
+static void
+remove_inode_from_hash(XFS_LIST *list, XFS_INODE_ALL *xino)
+{
+    XFS_INODE_ALL **pp = &list->hash[xino->name_hash & (list->hash_size - 1)];
+
+    while (*pp != NULL)
+    {
+        if (*pp == xino)
+        {
+            *pp = xino->hash_next;
+            break;
+        }
+        pp = &(*pp)->hash_next;
+    }
+    xino->hash_next = NULL;
+}
+
 /*  ------------------------------------------------------------------------ */
 static void
 add_inode_to_list(XFS_LIST *list, XFS_INODE_ALL *xino)
@@ -210,6 +336,13 @@ add_inode_to_list(XFS_LIST *list, XFS_INODE_ALL *xino)
         /* Set up forward-link to node */
         predecessor->next = xino;
     }
+
+    ++list->count;
+    if (list->hash != NULL)
+    {
+        add_inode_to_hash(list, xino);
+    }
+    resize_list_hash(list);
 }
 
 /*  ------------------------------------------------------------------------ */
@@ -236,6 +369,17 @@ remove_inode_from_list(XFS_LIST *list, XFS_INODE_ALL *xino)
         xino->next->previous = xino->previous;
     }
 
+    --list->count;
+    if (list->hash != NULL)
+    {
+        remove_inode_from_hash(list, xino);
+        if (list->count == 0)
+        {
+            free(list->hash);
+            list->hash = NULL;
+            list->hash_size = 0;
+        }
+    }
 }
 
 /*  ------------------------------------------------------------------------ */
@@ -243,6 +387,7 @@ static void
 link_inode_into_directory_node(XFS_INODE_ALL *dinode, XFS_INODE_ALL *xino)
 {
     xino->parent = dinode;
+    xino->name_hash = name_hash(xino->pub.name);
     add_inode_to_list(&dinode->dir, xino);
 }
 
@@ -316,6 +461,7 @@ xfs_create_xfs_fs(mode_t umask, uid_t uid, gid_t gid)
             xino1->pub.generation = xfs->generation;
             xino1->pub.is_redirected = 0;
             xino1->pub.device_id = 0;
+            xino1->pub.is_case_insensitive = 0;
 
             /*
              * FUSE_ROOT_ID has no parent rather than being a parent
@@ -338,6 +484,7 @@ xfs_create_xfs_fs(mode_t umask, uid_t uid, gid_t gid)
             xino2->pub.generation = xfs->generation;
             xino2->pub.is_redirected = 0;
             xino2->pub.device_id = 0;
+            xino2->pub.is_case_insensitive = 0;
 
             xino2->parent = NULL;
             xino2->next = NULL;
@@ -361,6 +508,7 @@ xfs_free_inode(XFS_INODE_ALL *xino)
 {
     if (xino != NULL)
     {
+        free(xino->dir.hash);
         free(xino->pub.name);
         free(xino);
     }
@@ -421,8 +569,9 @@ xfs_add_entry(struct xfs_fs *xfs, fuse_ino_t parent_inum,
         }
 
         /* Space for a new entry? */
-        if (xfs->free_count > 0 ||
-                grow_xfs(xfs, INODE_TABLE_ALLOCATION_GRANULARITY))
+        /* Grow the table geometrically, so adding lots of entries
+         * doesn't lead to lots of copying */
+        if (xfs->free_count > 0 || grow_xfs(xfs, xfs->inode_count))
         {
             XFS_INODE_ALL *xino = g_new0(XFS_INODE_ALL, 1);
             char *cpyname = strdup(name);
@@ -459,6 +608,8 @@ xfs_add_entry(struct xfs_fs *xfs, fuse_ino_t parent_inum,
                 xino->pub.generation = xfs->generation;
                 xino->pub.is_redirected = parent->pub.is_redirected;
                 xino->pub.device_id = parent->pub.device_id;
+                xino->pub.is_case_insensitive =
+                    parent->pub.is_case_insensitive;
                 xino->pub.lindex = 0;
 
                 xino->parent = NULL;
@@ -592,12 +743,29 @@ xfs_lookup_in_dir(struct xfs_fs *xfs, fuse_ino_t inum, const char *name)
             (xino->pub.mode & S_IFDIR) != 0)
     {
         XFS_INODE_ALL *p;
-        for (p = xino->dir.begin ; p != NULL; p = p->next)
+        if (xino->dir.hash != NULL)
+        {
+            tui32 hash = name_hash(name);
+            for (p = xino->dir.hash[hash & (xino->dir.hash_size - 1)] ;
+                    p != NULL; p = p->hash_next)
+            {
+                if (p->name_hash == hash &&
+                        names_match(xino, p->pub.name, name))
+                {
+                    result = &p->pub;
+                    break;
+                }
+            }
+        }
+        else
         {
-            if (strcmp(p->pub.name, name) == 0)
+            for (p = xino->dir.begin ; p != NULL; p = p->next)
             {
-                result = &p->pub;
-                break;
+                if (names_match(xino, p->pub.name, name))
+                {
+                    result = &p->pub;
+                    break;
+                }
             }
         }
     }
@@ -803,6 +971,27 @@ xfs_get_file_open_count(struct xfs_fs *xfs, fuse_ino_t inum)
     return result;
 }
 
+/*  ------------------------------------------------------------------------ */
+void
+xfs_set_redirected_case_insensitive(struct xfs_fs *xfs, tui32 device_id,
+                                    int is_case_insensitive)
+{
+    fuse_ino_t inum;
+    XFS_INODE_ALL *xino;
+
+    /* The name hashes ignore case already, so the directory indexes
+     * are good for either setting */
+    for (inum = FUSE_ROOT_ID; inum < xfs->inode_count; ++inum)
+    {
+        if ((xino = xfs->inode_table[inum]) != NULL &&
+                xino->pub.is_redirected != 0 &&
+                xino->pub.device_id == device_id)
+        {
+            xino->pub.is_case_insensitive = (is_case_insensitive != 0);
+        }
+    }
+}
+
 /*  ------------------------------------------------------------------------ */
 void
 xfs_delete_redirected_entries_with_device_id(struct xfs_fs *xfs,
@@ -879,39 +1068,29 @@ xfs_move_entry(struct xfs_fs *xfs, fuse_ino_t inum,
         xino = xfs->inode_table[inum];
         parent = xfs->inode_table[new_parent_inum];
 
-        if (xino->parent != parent)
+        if (xino->parent != parent || strcmp(xino->pub.name, name) != 0)
         {
-            /* We're moving between directories */
-
-            /* Does the target name already exist in the destination? */
-            if ((dest = xfs_lookup_in_dir(xfs, new_parent_inum, name)) != NULL)
+            /* Does the target name already exist in the destination?
+             * On a case-insensitive drive, this could be us if we're
+             * only changing the case of the name */
+            if ((dest = xfs_lookup_in_dir(xfs, new_parent_inum, name)) != NULL
+                    && dest != &xino->pub)
             {
+                /* Name collision - remove destination entry */
                 xfs_remove_entry(xfs, dest->inum);
             }
 
+            /* The name is part of the parent's index, so unlink before
+             * changing it */
             unlink_inode_from_parent(xino);
-            link_inode_into_directory_node(parent, xino);
 
             /* Swap the copy name and the inode name so we end up with the
              * right name, and the old one gets freed */
             char *t = xino->pub.name;
             xino->pub.name = cpyname;
             cpyname = t;
-        }
-        else if (strcmp(xino->pub.name, name) != 0)
-        {
-            /* Same directory, but name has changed */
-            if ((dest = xfs_lookup_in_dir(xfs, new_parent_inum, name)) != NULL)
-            {
-                /* Name collision - remove destination entry */
-                xfs_remove_entry(xfs, dest->inum);
-            }
 
-            /* Swap the copy name and the inode name so we end up with the
-             * right name, and the old one gets freed */
-            char *t = xino->pub.name;
-            xino->pub.name = cpyname;
-            cpyname = t;
+            link_inode_into_directory_node(parent, xino);
         }
         result = 0;
     }
@@ -57,8 +57,11 @@ typedef struct xfs_inode
     char            *name;             /* Short name (dynamically allocated) */
     tui32           generation;        /* Changes if inode is reused        */
     char            is_redirected;     /* file is on redirected device      */
+    char            is_case_insensitive; /* names on device ignore case     */
     tui32           device_id;         /* device ID of redirected device    */
     int             lindex;            /* used in clipboard operations      */
+    tui64           attr_time;         /* when attributes were fetched      */
+    tui64           dir_time;          /* when directory was listed         */
 } XFS_INODE;
 
 /*
@@ -276,6 +279,20 @@ xfs_decrement_file_open_count(struct xfs_fs *xfs, fuse_ino_t inum);
 unsigned int
 xfs_get_file_open_count(struct xfs_fs *xfs, fuse_ino_t inum);
 
+/*
+ * Sets whether names on a redirected device are matched without regard
+ * to case
+ *
+ * Names are matched exactly until this is called, as the drive may be
+ * case-sensitive.
+ *
+ * @param device_id Device ID
+ * @param is_case_insensitive != 0 if names on the device ignore case
+ */
+void
+xfs_set_redirected_case_insensitive(struct xfs_fs *xfs, tui32 device_id,
+                                    int is_case_insensitive);
+
 /*
  * Deletes all redirected entries with the matching device id
  *
@@ -170,6 +170,7 @@ x-special/gnome-copied-files
 #include "parse.h"
 #include "os_calls.h"
 #include "string_calls.h"
+#include "unicode_defines.h"
 #include "chansrv.h"
 #include "chansrv_common.h"
 #include "chansrv_config.h"
@@ -184,6 +185,14 @@ x-special/gnome-copied-files
 #define BMPFILEHEADER_LEN       14
 #define BMPINFOHEADER_LEN       40
 
+/* an INCR transfer which makes no progress for this many milliseconds
+ * is abandoned, as the window at the other end has probably gone */
+#define CLIPBOARD_INCR_TIMEOUT  10000
+
+/* largest clipboard data we put together, the same as the largest
+ * channel message */
+#define CLIPBOARD_MAX_DATA_BYTES (1024 * 1024 * 1024)
+
 extern int g_cliprdr_chan_id;   /* in chansrv.c */
 
 extern Display *g_display;      /* in xcommon.c */
@@ -493,10 +502,19 @@ clipboard_deinit(void)
 
     xfuse_deinit();
 
+    cancel_timeout(g_clip_c2s.incr_timeout);
+    g_clip_c2s.incr_timeout = 0;
+    g_clip_c2s.incr_in_progress = 0;
+    cancel_timeout(g_clip_s2c.incr_timeout);
+    g_clip_s2c.incr_timeout = 0;
+    g_clip_s2c.incr_in_progress = 0;
+    g_clip_c2s.streaming = 0;
     g_free(g_clip_c2s.data);
     g_clip_c2s.data = 0;
+    g_clip_c2s.alloc_bytes = 0;
     g_free(g_clip_s2c.data);
     g_clip_s2c.data = 0;
+    g_clip_s2c.alloc_bytes = 0;
 
     free_stream(g_ins);
     g_ins = 0;
@@ -827,12 +845,186 @@ clipboard_set_selection_owner(void)
 }
 
 /*****************************************************************************/
+/* (Re)starts the timeout for an INCR transfer */
+static void
+clipboard_incr_timeout_start(struct timeout_obj **tobj,
+                             void (*callback)(void *data))
+{
+    cancel_timeout(*tobj);
+    *tobj = add_timeout(CLIPBOARD_INCR_TIMEOUT, callback, 0);
+}
+
+/*****************************************************************************/
+static void
+clipboard_incr_timeout_stop(struct timeout_obj **tobj)
+{
+    cancel_timeout(*tobj);
+    *tobj = 0;
+}
+
+/*****************************************************************************/
+/* called when an INCR transfer to another app has stalled */
+static void
+clipboard_c2s_incr_timeout(void *data)
+{
+    g_clip_c2s.incr_timeout = 0;
+    LOG(LOG_LEVEL_WARNING, "clipboard_c2s_incr_timeout: abandoning "
+        "INCR transfer to window 0x%lx", g_clip_c2s.window);
+    g_clip_c2s.incr_in_progress = 0;
+    XSelectInput(g_display, g_clip_c2s.window, NoEventMask);
+}
+
+/*****************************************************************************/
+/* Makes room for 'bytes' more bytes after the first 'used' bytes of a
+ * buffer. The buffer grows geometrically, so data which arrives in
+ * chunks isn't copied again for every chunk. returns error */
 static int
-clipboard_provide_selection_c2s(XSelectionRequestEvent *req, Atom type)
+clipboard_reserve(char **data, int *alloc_bytes, int used, int bytes)
+{
+    char *new_data;
+    int new_size;
+
+    if (bytes <= *alloc_bytes - used)
+    {
+        return 0;
+    }
+    if (bytes > CLIPBOARD_MAX_DATA_BYTES - used)
+    {
+        LOG(LOG_LEVEL_ERROR, "Clipboard data is larger than %d bytes",
+            CLIPBOARD_MAX_DATA_BYTES);
+        return 1;
+    }
+    new_size = MAX(*alloc_bytes, 64 * 1024);
+    while (new_size - used < bytes)
+    {
+        new_size = (new_size > CLIPBOARD_MAX_DATA_BYTES / 2) ?
+                   CLIPBOARD_MAX_DATA_BYTES : new_size * 2;
+    }
+    new_data = (char *) realloc(*data, new_size);
+    if (new_data == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't allocate %d bytes for clipboard data",
+            new_size);
+        return 1;
+    }
+    *data = new_data;
+    *alloc_bytes = new_size;
+    return 0;
+}
+
+/*****************************************************************************/
+/* Starts an INCR transfer of g_clip_c2s.data to the requestor */
+static void
+clipboard_start_incr_c2s(XSelectionRequestEvent *req, Atom type,
+                         int size_hint)
 {
     XEvent xev;
     long val1[2];
 
+    g_clip_c2s.incr_in_progress = 1;
+    g_clip_c2s.incr_bytes_done = 0;
+    g_clip_c2s.incr_waiting = 0;
+    clipboard_incr_timeout_start(&g_clip_c2s.incr_timeout,
+                                 clipboard_c2s_incr_timeout);
+    g_clip_c2s.type = type;
+    g_clip_c2s.property = req->property;
+    g_clip_c2s.window = req->requestor;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_start_incr_c2s: start INCR property %s "
+              "type %s", get_atom_text(req->property),
+              get_atom_text(type));
+    val1[0] = size_hint;
+    val1[1] = 0;
+    XChangeProperty(g_display, req->requestor, req->property,
+                    g_incr_atom, 32, PropModeReplace, (tui8 *)val1, 1);
+    /* we need events from that other window */
+    XSelectInput(g_display, req->requestor, PropertyChangeMask);
+    g_memset(&xev, 0, sizeof(xev));
+    xev.xselection.type = SelectionNotify;
+    xev.xselection.send_event = True;
+    xev.xselection.display = req->display;
+    xev.xselection.requestor = req->requestor;
+    xev.xselection.selection = req->selection;
+    xev.xselection.target = req->target;
+    xev.xselection.property = req->property;
+    xev.xselection.time = req->time;
+    XSendEvent(g_display, req->requestor, False, NoEventMask, &xev);
+}
+
+/*****************************************************************************/
+/* Drops data the requestor already has once it is half the buffer, so
+ * a streamed transfer only holds on to what hasn't been sent yet */
+static void
+clipboard_c2s_stream_compact(void)
+{
+    int sent = g_clip_c2s.incr_bytes_done - g_clip_c2s.discarded_bytes;
+
+    if (sent > 0 && sent >= g_clip_c2s.alloc_bytes / 2)
+    {
+        g_memmove(g_clip_c2s.data, g_clip_c2s.data + sent,
+                  g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done);
+        g_clip_c2s.discarded_bytes = g_clip_c2s.incr_bytes_done;
+    }
+}
+
+/*****************************************************************************/
+/* Writes the next INCR chunk to the requestor. While the data is still
+ * arriving from the client, this waits until there is a full chunk */
+static void
+clipboard_c2s_incr_send(void)
+{
+    char *data;
+    int data_bytes;
+
+    if (g_clip_c2s.data == 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_incr_send: INCR error");
+        return;
+    }
+    data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
+    if (g_clip_c2s.streaming && data_bytes < g_incr_max_req_size)
+    {
+        g_clip_c2s.incr_waiting = 1;
+        return;
+    }
+    g_clip_c2s.incr_waiting = 0;
+    if (data_bytes > g_incr_max_req_size)
+    {
+        data_bytes = g_incr_max_req_size;
+    }
+    data = g_clip_c2s.data +
+           (g_clip_c2s.incr_bytes_done - g_clip_c2s.discarded_bytes);
+    g_clip_c2s.incr_bytes_done += data_bytes;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_incr_send: data_bytes %d", data_bytes);
+    XChangeProperty(g_display, g_clip_c2s.window, g_clip_c2s.property,
+                    g_clip_c2s.type, 8, PropModeReplace,
+                    (tui8 *)data, data_bytes);
+    if (data_bytes < 1)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_incr_send: INCR done");
+        g_clip_c2s.incr_in_progress = 0;
+        clipboard_incr_timeout_stop(&g_clip_c2s.incr_timeout);
+        /* we no longer need property notify */
+        XSelectInput(g_display, g_clip_c2s.window, NoEventMask);
+        /* if any data was dropped, the client is asked for it again */
+        g_clip_c2s.converted = (g_clip_c2s.discarded_bytes == 0);
+    }
+    else
+    {
+        clipboard_incr_timeout_start(&g_clip_c2s.incr_timeout,
+                                     clipboard_c2s_incr_timeout);
+        if (g_clip_c2s.streaming)
+        {
+            clipboard_c2s_stream_compact();
+        }
+    }
+}
+
+/*****************************************************************************/
+static int
+clipboard_provide_selection_c2s(XSelectionRequestEvent *req, Atom type)
+{
+    XEvent xev;
+
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_provide_selection_c2s: bytes %d",
               g_clip_c2s.total_bytes);
     if (g_clip_c2s.total_bytes < g_incr_max_req_size)
@@ -854,30 +1046,7 @@ clipboard_provide_selection_c2s(XSelectionRequestEvent *req, Atom type)
     else
     {
         /* start the INCR process */
-        g_clip_c2s.incr_in_progress = 1;
-        g_clip_c2s.incr_bytes_done = 0;
-        g_clip_c2s.type = type;
-        g_clip_c2s.property = req->property;
-        g_clip_c2s.window = req->requestor;
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_provide_selection_c2s: start INCR property %s "
-                  "type %s", get_atom_text(req->property),
-                  get_atom_text(type));
-        val1[0] = g_clip_c2s.total_bytes;
-        val1[1] = 0;
-        XChangeProperty(g_display, req->requestor, req->property,
-                        g_incr_atom, 32, PropModeReplace, (tui8 *)val1, 1);
-        /* we need events from that other window */
-        XSelectInput(g_display, req->requestor, PropertyChangeMask);
-        g_memset(&xev, 0, sizeof(xev));
-        xev.xselection.type = SelectionNotify;
-        xev.xselection.send_event = True;
-        xev.xselection.display = req->display;
-        xev.xselection.requestor = req->requestor;
-        xev.xselection.selection = req->selection;
-        xev.xselection.target = req->target;
-        xev.xselection.property = req->property;
-        xev.xselection.time = req->time;
-        XSendEvent(g_display, req->requestor, False, NoEventMask, &xev);
+        clipboard_start_incr_c2s(req, type, g_clip_c2s.total_bytes);
     }
     return 0;
 }
@@ -1039,6 +1208,22 @@ clipboard_send_data_response_failed(void)
     return rv;
 }
 
+/*****************************************************************************/
+/* called when an INCR transfer from another app has stalled */
+static void
+clipboard_s2c_incr_timeout(void *data)
+{
+    g_clip_s2c.incr_timeout = 0;
+    LOG(LOG_LEVEL_WARNING, "clipboard_s2c_incr_timeout: abandoning "
+        "INCR transfer from selection owner");
+    g_clip_s2c.incr_in_progress = 0;
+    g_free(g_clip_s2c.data);
+    g_clip_s2c.data = 0;
+    g_clip_s2c.total_bytes = 0;
+    XDeleteProperty(g_display, g_wnd, g_clip_s2c.property);
+    clipboard_send_data_response_failed();
+}
+
 /*****************************************************************************/
 /* sent from server to client
  * sent by recipient of CB_FORMAT_LIST; used to request data for one
@@ -1113,6 +1298,26 @@ clipboard_process_data_request(struct stream *s, int clip_msg_status,
     return 0;
 }
 
+/*****************************************************************************/
+/* Writes a bitmap file header to the start of a buffer
+ * https://en.wikipedia.org/wiki/BMP_file_format#Bitmap_file_header */
+static void
+clipboard_out_bmp_file_header(char *data, int file_size)
+{
+    struct stream ls;
+
+    g_memset(&ls, 0, sizeof(ls));
+    ls.data = data;
+    ls.p = data;
+    ls.size = BMPFILEHEADER_LEN;
+    out_uint8(&ls, 'B');
+    out_uint8(&ls, 'M');
+    out_uint32_le(&ls, file_size);
+    out_uint16_le(&ls, 0);
+    out_uint16_le(&ls, 0);
+    out_uint32_le(&ls, BMPFILEHEADER_LEN + BMPINFOHEADER_LEN);
+}
+
 /**************************************************************************//**
  * Process a CB_FORMAT_DATA_RESPONSE for an X client requesting an image
  *
@@ -1129,7 +1334,6 @@ clipboard_process_data_response_for_image(struct stream *s,
 {
     XSelectionRequestEvent *lxev;
     int len;
-    struct stream *bmp_hs;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_data_response_for_image: "
               "CLIPRDR_DATA_RESPONSE_FOR_IMAGE");
@@ -1145,39 +1349,21 @@ clipboard_process_data_response_for_image(struct stream *s,
     }
 
     g_free(g_clip_c2s.data);
+    g_clip_c2s.alloc_bytes = 0;
     g_clip_c2s.data = (char *) g_malloc(len + BMPFILEHEADER_LEN, 0);
     if (g_clip_c2s.data == 0)
     {
         g_clip_c2s.total_bytes = 0;
         return 0;
     }
+    g_clip_c2s.alloc_bytes = len + BMPFILEHEADER_LEN;
     g_clip_c2s.total_bytes = len + BMPFILEHEADER_LEN;
     g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
 
-    /*
-     * Assemble bitmap file header
-     * https://en.wikipedia.org/wiki/BMP_file_format#Bitmap_file_header
-     */
-    make_stream(bmp_hs);
-    if (bmp_hs == 0)
-    {
-        g_free(g_clip_c2s.data);
-        g_clip_c2s.total_bytes = 0;
-        return 0;
-    }
-    init_stream(bmp_hs, BMPFILEHEADER_LEN);
-    out_uint8(bmp_hs, 'B');
-    out_uint8(bmp_hs, 'M');
-    out_uint32_le(bmp_hs, g_clip_c2s.total_bytes);
-    out_uint16_le(bmp_hs, 0);
-    out_uint16_le(bmp_hs, 0);
-    out_uint32_le(bmp_hs, BMPFILEHEADER_LEN + BMPINFOHEADER_LEN);
-
     /* Copy header and data to output stream */
-    g_memcpy(g_clip_c2s.data, bmp_hs->data, BMPFILEHEADER_LEN);
+    clipboard_out_bmp_file_header(g_clip_c2s.data, g_clip_c2s.total_bytes);
     in_uint8a(s, g_clip_c2s.data + BMPFILEHEADER_LEN, len);
 
-    free_stream(bmp_hs);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_data_response_for_image: calling "
               "clipboard_provide_selection_c2s");
     clipboard_provide_selection_c2s(lxev, lxev->target);
@@ -1208,6 +1394,7 @@ clipboard_process_data_response_for_file(struct stream *s,
     const int flist_size = 1024 * 1024;
     g_free(g_clip_c2s.data);
     g_clip_c2s.data = (char *)g_malloc(flist_size, 0);
+    g_clip_c2s.alloc_bytes = (g_clip_c2s.data == NULL) ? 0 : flist_size;
     if (g_clip_c2s.data == NULL)
     {
         LOG(LOG_LEVEL_ERROR, "clipboard_process_data_response_for_file: "
@@ -1298,8 +1485,10 @@ clipboard_process_data_response_for_text(struct stream *s,
 
     g_free(g_clip_c2s.data);
     g_clip_c2s.total_bytes = 0;
+    g_clip_c2s.alloc_bytes = byte_count;
     if ((g_clip_c2s.data = (char *)g_malloc(byte_count, 0)) == NULL)
     {
+        g_clip_c2s.alloc_bytes = 0;
         LOG(LOG_LEVEL_ERROR, "Can't allocate %u bytes for text clip response",
             byte_count);
 
@@ -1335,6 +1524,7 @@ clipboard_process_data_response(struct stream *s, int clip_msg_status,
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_data_response:");
     g_clip_c2s.in_request = 0;
+    g_clip_c2s.discarded_bytes = 0;
 
     if ((clip_msg_status & CB_RESPONSE_FAIL) != 0)
     {
@@ -1368,6 +1558,239 @@ clipboard_process_data_response(struct stream *s, int clip_msg_status,
     return rv;
 }
 
+/*****************************************************************************/
+/* Converts whole UTF-16 words of a streamed text data response to UTF-8,
+ * up to the terminator. returns error */
+static int
+clipboard_c2s_stream_text(const char *data, int data_bytes)
+{
+    struct stream ls;
+    int used = g_clip_c2s.read_bytes_done - g_clip_c2s.discarded_bytes;
+    unsigned int rv;
+
+    /* A UTF-16 word is at most 3 bytes of UTF-8. Add a terminator */
+    if (clipboard_reserve(&g_clip_c2s.data, &g_clip_c2s.alloc_bytes, used,
+                          data_bytes / 2 * 3 + 1) != 0)
+    {
+        return 1;
+    }
+    g_memset(&ls, 0, sizeof(ls));
+    ls.data = (char *)data;
+    ls.p = ls.data;
+    ls.end = ls.data + data_bytes;
+    ls.size = data_bytes;
+    rv = in_utf16_le_terminated_as_utf8(&ls, g_clip_c2s.data + used,
+                                        g_clip_c2s.alloc_bytes - used);
+    g_clip_c2s.read_bytes_done += rv - 1;
+    if (ls.p > ls.data && ls.p[-1] == 0 && ls.p[-2] == 0)
+    {
+        g_clip_c2s.text_done = 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Adds a fragment of a streamed text data response. A UTF-16 word or
+ * surrogate pair split between fragments is kept back. returns error */
+static int
+clipboard_c2s_stream_text_in(const char *data, int data_bytes)
+{
+    const unsigned char *p;
+    int whole;
+    int need;
+
+    /* Finish anything split over the last fragment */
+    while (g_clip_c2s.partial_bytes > 0 && data_bytes > 0 &&
+            !g_clip_c2s.text_done)
+    {
+        g_clip_c2s.partial[g_clip_c2s.partial_bytes++] = *data++;
+        --data_bytes;
+        p = (const unsigned char *)g_clip_c2s.partial;
+        need = 2;
+        if (g_clip_c2s.partial_bytes >= 2 &&
+                IS_HIGH_SURROGATE(p[0] | (p[1] << 8)))
+        {
+            need = 4;
+        }
+        if (g_clip_c2s.partial_bytes == need)
+        {
+            g_clip_c2s.partial_bytes = 0;
+            if (clipboard_c2s_stream_text(g_clip_c2s.partial, need) != 0)
+            {
+                return 1;
+            }
+        }
+    }
+    if (g_clip_c2s.text_done || data_bytes < 1)
+    {
+        return 0;
+    }
+
+    whole = data_bytes & ~1;
+    p = (const unsigned char *)data + whole - 2;
+    if (whole >= 2 && IS_HIGH_SURROGATE(p[0] | (p[1] << 8)))
+    {
+        whole -= 2;
+    }
+    if (whole > 0 && clipboard_c2s_stream_text(data, whole) != 0)
+    {
+        return 1;
+    }
+    g_clip_c2s.partial_bytes = data_bytes - whole;
+    g_memcpy(g_clip_c2s.partial, data + whole, g_clip_c2s.partial_bytes);
+    return 0;
+}
+
+/*****************************************************************************/
+/* Adds a fragment of a streamed data response, and passes it on if the
+ * requestor is waiting for it */
+static void
+clipboard_c2s_stream_in(const char *data, int data_bytes)
+{
+    int used;
+    int error;
+
+    data_bytes = MIN(data_bytes, g_clip_c2s.stream_bytes_left);
+    g_clip_c2s.stream_bytes_left -= data_bytes;
+    if (!g_clip_c2s.incr_in_progress || g_clip_c2s.data == NULL)
+    {
+        /* transfer abandoned - drop the rest */
+        return;
+    }
+
+    if (g_clip_c2s.xrdp_clip_type == XRDP_CB_BITMAP)
+    {
+        used = g_clip_c2s.read_bytes_done - g_clip_c2s.discarded_bytes;
+        error = clipboard_reserve(&g_clip_c2s.data, &g_clip_c2s.alloc_bytes,
+                                  used, data_bytes);
+        if (error == 0)
+        {
+            g_memcpy(g_clip_c2s.data + used, data, data_bytes);
+            g_clip_c2s.read_bytes_done += data_bytes;
+        }
+    }
+    else
+    {
+        error = clipboard_c2s_stream_text_in(data, data_bytes);
+    }
+
+    if (error != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "clipboard_c2s_stream_in: abandoning INCR "
+            "transfer to window 0x%lx", g_clip_c2s.window);
+        clipboard_incr_timeout_stop(&g_clip_c2s.incr_timeout);
+        g_clip_c2s.incr_in_progress = 0;
+        XSelectInput(g_display, g_clip_c2s.window, NoEventMask);
+    }
+    else if (g_clip_c2s.incr_waiting)
+    {
+        clipboard_c2s_incr_send();
+    }
+    else
+    {
+        /* the requestor isn't stalled, we are */
+        clipboard_incr_timeout_start(&g_clip_c2s.incr_timeout,
+                                     clipboard_c2s_incr_timeout);
+    }
+}
+
+/*****************************************************************************/
+/* Called with the first fragment of a message from the client.
+ *
+ * A text or image data response too big for one X property is
+ * converted as it arrives, and passed on to the requestor with INCR.
+ * Only what the requestor hasn't had yet is kept, rather than the whole
+ * message and a converted copy.
+ *
+ * returns 1 if the message is being streamed */
+static int
+clipboard_c2s_stream_start(struct stream *s, int length, int total_length)
+{
+    XSelectionRequestEvent *lxev = &g_saved_selection_req_event;
+    char *holdp = s->p;
+    int clip_msg_id;
+    int clip_msg_status;
+    int clip_msg_len;
+    int size_hint;
+
+    if (length < 8 || total_length < g_incr_max_req_size ||
+            !g_clip_c2s.in_request || g_clip_c2s.incr_in_progress)
+    {
+        return 0;
+    }
+    if (g_clip_c2s.xrdp_clip_type != XRDP_CB_TEXT &&
+            (g_clip_c2s.xrdp_clip_type != XRDP_CB_BITMAP ||
+             g_clip_c2s.type != g_image_bmp_atom))
+    {
+        return 0;
+    }
+    in_uint16_le(s, clip_msg_id);
+    in_uint16_le(s, clip_msg_status);
+    in_uint32_le(s, clip_msg_len);
+    if (clip_msg_id != CB_FORMAT_DATA_RESPONSE ||
+            (clip_msg_status & CB_RESPONSE_OK) == 0 ||
+            (clip_msg_status & CB_RESPONSE_FAIL) != 0)
+    {
+        s->p = holdp;
+        return 0;
+    }
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_stream_start: clip_msg_len %d",
+              clip_msg_len);
+    g_clip_c2s.in_request = 0;
+    g_clip_c2s.streaming = 1;
+    g_clip_c2s.stream_bytes_left = MIN(clip_msg_len, total_length - 8);
+    g_clip_c2s.text_done = 0;
+    g_clip_c2s.partial_bytes = 0;
+    g_clip_c2s.read_bytes_done = 0;
+    g_clip_c2s.discarded_bytes = 0;
+    g_free(g_clip_c2s.data);
+    g_clip_c2s.data = NULL;
+    g_clip_c2s.alloc_bytes = 0;
+    if (clipboard_reserve(&g_clip_c2s.data, &g_clip_c2s.alloc_bytes, 0,
+                          BMPFILEHEADER_LEN) != 0)
+    {
+        clipboard_refuse_selection(lxev);
+        return 1;
+    }
+
+    if (g_clip_c2s.xrdp_clip_type == XRDP_CB_BITMAP)
+    {
+        size_hint = g_clip_c2s.stream_bytes_left + BMPFILEHEADER_LEN;
+        clipboard_out_bmp_file_header(g_clip_c2s.data, size_hint);
+        g_clip_c2s.read_bytes_done = BMPFILEHEADER_LEN;
+    }
+    else
+    {
+        /* a lower bound - each UTF-16 word is at least a byte */
+        size_hint = g_clip_c2s.stream_bytes_left / 2;
+    }
+    clipboard_start_incr_c2s(lxev, lxev->target, size_hint);
+    clipboard_c2s_stream_in(s->p, length - 8);
+    return 1;
+}
+
+/*****************************************************************************/
+/* Called after the last fragment of a streamed data response */
+static void
+clipboard_c2s_stream_end(void)
+{
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_stream_end: %d bytes",
+              g_clip_c2s.read_bytes_done);
+    g_clip_c2s.streaming = 0;
+    g_clip_c2s.total_bytes = g_clip_c2s.read_bytes_done;
+    if (g_clip_c2s.incr_in_progress && g_clip_c2s.incr_waiting)
+    {
+        clipboard_c2s_incr_send();
+    }
+}
+
+static const struct chan_stream_ops g_clip_c2s_stream_ops =
+{
+    clipboard_c2s_stream_start,
+    clipboard_c2s_stream_in,
+    clipboard_c2s_stream_end
+};
 
 /*****************************************************************************/
 static int
@@ -1442,6 +1865,13 @@ clipboard_data_in(struct stream *s, int chan_id, int chan_flags, int length,
               chan_id, chan_flags, length, total_length,
               g_clip_c2s.in_request, g_ins->size);
 
+    if (chan_stream_fragment(&g_clip_c2s_stream_ops, g_clip_c2s.streaming,
+                             s, chan_flags, length, total_length))
+    {
+        XFlush(g_display);
+        return 0;
+    }
+
     if ((chan_flags & 3) == 3)
     {
         ls = s;
@@ -1668,6 +2098,195 @@ clipboard_get_window_property(Window wnd, Atom prop, Atom *type, int *fmt,
     return 0;
 }
 
+/*****************************************************************************/
+/* Starts a CLIPRDR_DATA_RESPONSE for an INCR transfer from another app.
+ *
+ * Each chunk is converted as it arrives, so only the response itself is
+ * held. It can't be sent before the transfer is complete, as the
+ * response starts with its length. */
+static void
+clipboard_s2c_incr_start(void)
+{
+    g_free(g_clip_s2c.data);
+    g_clip_s2c.data = NULL;
+    g_clip_s2c.alloc_bytes = 0;
+    g_clip_s2c.total_bytes = 0;
+    g_clip_s2c.partial_bytes = 0;
+    /* image/bmp is sent as a DIB, without the file header */
+    g_clip_s2c.skip_bytes = BMPFILEHEADER_LEN;
+    if ((g_clip_s2c.type == g_image_bmp_atom) ||
+            (g_clip_s2c.type == XA_STRING) ||
+            (g_clip_s2c.type == g_utf8_atom))
+    {
+        /* leave room for the header */
+        if (clipboard_reserve(&g_clip_s2c.data, &g_clip_s2c.alloc_bytes,
+                              0, 8) == 0)
+        {
+            g_clip_s2c.total_bytes = 8;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* Adds a chunk of UTF-8 to the response as UTF-16. A character split
+ * between chunks is kept back. returns error */
+static int
+clipboard_s2c_append_text(const char *data, int data_bytes)
+{
+    struct stream ls;
+    char joined[2 * MAXLEN_UTF8_CHAR];
+    const char *p;
+    unsigned int len;
+    unsigned int rem;
+    unsigned int whole;
+
+    /* A UTF-8 byte is at most one UTF-16 word. The character kept back
+     * from last time may be two */
+    if (clipboard_reserve(&g_clip_s2c.data, &g_clip_s2c.alloc_bytes,
+                          g_clip_s2c.total_bytes, data_bytes * 2 + 4) != 0)
+    {
+        return 1;
+    }
+    g_memset(&ls, 0, sizeof(ls));
+    ls.data = g_clip_s2c.data;
+    ls.p = ls.data + g_clip_s2c.total_bytes;
+    ls.size = g_clip_s2c.alloc_bytes;
+    ls.end = ls.data + ls.size;
+
+    if (g_clip_s2c.partial_bytes > 0)
+    {
+        /* Finish the character split over the last chunk */
+        len = g_clip_s2c.partial_bytes;
+        g_memcpy(joined, g_clip_s2c.partial, len);
+        rem = MIN(data_bytes, MAXLEN_UTF8_CHAR - 1);
+        g_memcpy(joined + len, data, rem);
+        len += rem;
+        if (utf8_whole_chars_len(joined, len) == 0)
+        {
+            /* still not there */
+            g_memcpy(g_clip_s2c.partial, joined, len);
+            g_clip_s2c.partial_bytes = len;
+            return 0;
+        }
+        p = joined;
+        rem = len;
+        utf8_get_next_char(&p, &rem);
+        len = (unsigned int)(p - joined);
+        out_utf8_as_utf16_le(&ls, joined, len);
+        data += len - g_clip_s2c.partial_bytes;
+        data_bytes -= len - g_clip_s2c.partial_bytes;
+        g_clip_s2c.partial_bytes = 0;
+    }
+
+    whole = utf8_whole_chars_len(data, data_bytes);
+    out_utf8_as_utf16_le(&ls, data, whole);
+    g_clip_s2c.partial_bytes = data_bytes - whole;
+    g_memcpy(g_clip_s2c.partial, data + whole, g_clip_s2c.partial_bytes);
+    g_clip_s2c.total_bytes = (int)(ls.p - ls.data);
+    return 0;
+}
+
+/*****************************************************************************/
+/* Adds a chunk of an INCR transfer to the response */
+static void
+clipboard_s2c_incr_append(const char *data, int data_bytes)
+{
+    int skip;
+    int error;
+
+    if (g_clip_s2c.data == NULL)
+    {
+        /* not wanted, or we've run out of memory */
+        return;
+    }
+    if (g_clip_s2c.type == g_image_bmp_atom)
+    {
+        skip = MIN(g_clip_s2c.skip_bytes, data_bytes);
+        g_clip_s2c.skip_bytes -= skip;
+        data += skip;
+        data_bytes -= skip;
+        error = clipboard_reserve(&g_clip_s2c.data, &g_clip_s2c.alloc_bytes,
+                                  g_clip_s2c.total_bytes, data_bytes);
+        if (error == 0)
+        {
+            g_memcpy(g_clip_s2c.data + g_clip_s2c.total_bytes, data,
+                     data_bytes);
+            g_clip_s2c.total_bytes += data_bytes;
+        }
+    }
+    else
+    {
+        error = clipboard_s2c_append_text(data, data_bytes);
+    }
+    if (error != 0)
+    {
+        g_free(g_clip_s2c.data);
+        g_clip_s2c.data = NULL;
+        g_clip_s2c.alloc_bytes = 0;
+        g_clip_s2c.total_bytes = 0;
+    }
+}
+
+/*****************************************************************************/
+/* Sends the response for a completed INCR transfer */
+static void
+clipboard_s2c_incr_done(void)
+{
+    struct stream ls;
+    int is_text = (g_clip_s2c.type != g_image_bmp_atom);
+    int data_len;
+
+    /* Room for a bad character at the end, a terminator and padding */
+    if (g_clip_s2c.data != NULL &&
+            clipboard_reserve(&g_clip_s2c.data, &g_clip_s2c.alloc_bytes,
+                              g_clip_s2c.total_bytes,
+                              g_clip_s2c.partial_bytes * 2 + 2 + 4) != 0)
+    {
+        g_free(g_clip_s2c.data);
+        g_clip_s2c.data = NULL;
+    }
+
+    if (g_clip_s2c.data == NULL ||
+            (g_clip_s2c.total_bytes <= 8 && g_clip_s2c.partial_bytes == 0))
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_s2c_incr_done: no data");
+        clipboard_send_data_response_failed();
+    }
+    else
+    {
+        g_memset(&ls, 0, sizeof(ls));
+        ls.data = g_clip_s2c.data;
+        ls.p = ls.data + g_clip_s2c.total_bytes;
+        ls.size = g_clip_s2c.alloc_bytes;
+        ls.end = ls.data + ls.size;
+        if (is_text)
+        {
+            out_utf8_as_utf16_le(&ls, g_clip_s2c.partial,
+                                 g_clip_s2c.partial_bytes);
+            out_uint16_le(&ls, 0); /* nil for string */
+        }
+        data_len = (int)(ls.p - ls.data) - 8;
+        out_uint32_le(&ls, 0);
+        g_clip_s2c.total_bytes = (int)(ls.p - ls.data);
+
+        ls.p = ls.data;
+        out_uint16_le(&ls, CB_FORMAT_DATA_RESPONSE); /* 5 CLIPRDR_DATA_RESPONSE */
+        out_uint16_le(&ls, CB_RESPONSE_OK); /* 1 status */
+        out_uint32_le(&ls, data_len); /* length */
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_s2c_incr_done: data out, "
+                  "sending CLIPRDR_DATA_RESPONSE (clip_msg_id = 5) "
+                  "length %d", data_len);
+        send_channel_data(g_cliprdr_chan_id, g_clip_s2c.data,
+                          g_clip_s2c.total_bytes);
+    }
+
+    g_free(g_clip_s2c.data);
+    g_clip_s2c.data = NULL;
+    g_clip_s2c.alloc_bytes = 0;
+    g_clip_s2c.total_bytes = 0;
+    g_clip_s2c.partial_bytes = 0;
+}
+
 /*****************************************************************************/
 /* returns error
    process the SelectionNotify X event, uses XSelectionEvent
@@ -1747,11 +2366,11 @@ clipboard_event_selection_notify(XEvent *xevent)
                       get_atom_text(lxevent->property),
                       get_atom_text(lxevent->type));
             g_clip_s2c.incr_in_progress = 1;
+            clipboard_incr_timeout_start(&g_clip_s2c.incr_timeout,
+                                         clipboard_s2c_incr_timeout);
             g_clip_s2c.property = lxevent->property;
             g_clip_s2c.type = lxevent->target;
-            g_clip_s2c.total_bytes = 0;
-            g_free(g_clip_s2c.data);
-            g_clip_s2c.data = 0;
+            clipboard_s2c_incr_start();
             //LOG_DEVEL_HEXDUMP(LOG_LEVEL_TRACE, "", data, sizeof(long));
             g_free(data);
             return 0;
@@ -2386,8 +3005,6 @@ clipboard_event_property_notify(XEvent *xevent)
     int rv;
     int format_in_bytes;
     int new_data_len;
-    int data_bytes;
-    char *cptr;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: PropertyNotify .window %ld "
               ".state %d .atom %ld %s", xevent->xproperty.window,
@@ -2402,38 +3019,7 @@ clipboard_event_property_notify(XEvent *xevent)
         LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR PropertyDelete");
         /* this is used for when copying a large clipboard to the other app,
            it will delete the property so we know to send the next one */
-
-        if ((g_clip_c2s.data == 0) || (g_clip_c2s.total_bytes < 1))
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR error");
-            return 0;
-        }
-        data = (tui8 *)(g_clip_c2s.data + g_clip_c2s.incr_bytes_done);
-        data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-        if ((data_bytes < 1) &&
-                (g_clip_c2s.read_bytes_done < g_clip_c2s.total_bytes))
-        {
-            g_clip_c2s.incr_in_progress = 0;
-            return 0;
-        }
-        if (data_bytes > g_incr_max_req_size)
-        {
-            data_bytes = g_incr_max_req_size;
-        }
-        g_clip_c2s.incr_bytes_done += data_bytes;
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: data_bytes %d", data_bytes);
-        XChangeProperty(xevent->xproperty.display, xevent->xproperty.window,
-                        xevent->xproperty.atom, g_clip_c2s.type, 8,
-                        PropModeReplace, data, data_bytes);
-        if (data_bytes < 1)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR done");
-            g_clip_c2s.incr_in_progress = 0;
-            /* we no longer need property notify */
-            XSelectInput(xevent->xproperty.display, xevent->xproperty.window,
-                         NoEventMask);
-            g_clip_c2s.converted = 1;
-        }
+        clipboard_c2s_incr_send();
     }
     if (g_clip_s2c.incr_in_progress &&
             (xevent->xproperty.window == g_wnd) &&
@@ -2461,29 +3047,22 @@ clipboard_event_property_notify(XEvent *xevent)
             LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR done");
             /* clipboard INCR cycle has completed */
             g_clip_s2c.incr_in_progress = 0;
+            clipboard_incr_timeout_stop(&g_clip_s2c.incr_timeout);
             if (g_clip_s2c.type == g_image_bmp_atom)
             {
                 g_clip_s2c.xrdp_clip_type = XRDP_CB_BITMAP;
-                //LOG_DEVEL_HEXDUMP(LOG_LEVEL_TRACE, "", g_last_clip_data, 64);
-                /* skip header */
-                clipboard_send_data_response(g_clip_s2c.xrdp_clip_type,
-                                             g_clip_s2c.data + 14,
-                                             g_clip_s2c.total_bytes - 14);
             }
             else if ((g_clip_s2c.type == XA_STRING) ||
                      (g_clip_s2c.type == g_utf8_atom))
             {
                 g_clip_s2c.xrdp_clip_type = XRDP_CB_TEXT;
-                clipboard_send_data_response(g_clip_s2c.xrdp_clip_type,
-                                             g_clip_s2c.data,
-                                             g_clip_s2c.total_bytes);
             }
             else
             {
                 LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_event_property_notify: error unknown type %ld",
                           g_clip_s2c.type);
-                clipboard_send_data_response_failed();
             }
+            clipboard_s2c_incr_done();
 
             XDeleteProperty(g_display, g_wnd, g_clip_s2c.property);
         }
@@ -2500,34 +3079,16 @@ clipboard_event_property_notify(XEvent *xevent)
 
             format_in_bytes = FORMAT_TO_BYTES(actual_format_return);
             new_data_len = nitems_returned * format_in_bytes;
-            cptr = (char *) g_malloc(g_clip_s2c.total_bytes + new_data_len, 0);
-            if (cptr == NULL)
-            {
-                /* cannot add any more data */
-                g_free(g_clip_s2c.data);
-                g_clip_s2c.data = 0;
-
-                if (data != 0)
-                {
-                    XFree(data);
-                }
-
-                XDeleteProperty(g_display, g_wnd, g_clip_s2c.property);
-                return 0;
-            }
-            g_memcpy(cptr, g_clip_s2c.data, g_clip_s2c.total_bytes);
-            g_free(g_clip_s2c.data);
-
             LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: new_data_len %d", new_data_len);
-            g_clip_s2c.data = cptr;
             if (data)
             {
-                g_memcpy(g_clip_s2c.data + g_clip_s2c.total_bytes, data, new_data_len);
-                g_clip_s2c.total_bytes += new_data_len;
+                clipboard_s2c_incr_append((const char *)data, new_data_len);
                 XFree(data);
             }
 
             XDeleteProperty(g_display, g_wnd, g_clip_s2c.property);
+            clipboard_incr_timeout_start(&g_clip_s2c.incr_timeout,
+                                         clipboard_s2c_incr_timeout);
         }
     }
 
@@ -27,11 +27,18 @@
 #define XRDP_CB_BITMAP 2
 #define XRDP_CB_FILE   3
 
+struct timeout_obj;
+
 struct clip_s2c /* server to client, pasting from linux app to mstsc */
 {
     int incr_in_progress;
+    struct timeout_obj *incr_timeout; /* abandons a stalled INCR transfer */
     int total_bytes;
     char *data;
+    int alloc_bytes; /* INCR - size of data */
+    int skip_bytes; /* INCR - bytes still to drop from the front */
+    int partial_bytes; /* INCR - UTF-8 character split between chunks */
+    char partial[4];
     Atom type; /* UTF8_STRING, image/bmp, ... */
     Atom property; /* XRDP_CLIP_PROPERTY_ATOM, _QT_SELECTION, ... */
     int xrdp_clip_type; /* XRDP_CB_TEXT, XRDP_CB_BITMAP, XRDP_CB_FILE, ... */
@@ -42,10 +49,19 @@ struct clip_s2c /* server to client, pasting from linux app to mstsc */
 struct clip_c2s /* client to server, pasting from mstsc to linux app */
 {
     int incr_in_progress;
+    struct timeout_obj *incr_timeout; /* abandons a stalled INCR transfer */
     int incr_bytes_done;
     int read_bytes_done;
     int total_bytes;
     char *data;
+    int alloc_bytes; /* streaming - size of data */
+    int discarded_bytes; /* streaming - bytes sent and dropped from data */
+    int streaming; /* data response is converted as it arrives */
+    int stream_bytes_left; /* streaming - of the data response */
+    int incr_waiting; /* streaming - requestor waits for more data */
+    int text_done; /* streaming - text terminator seen */
+    int partial_bytes; /* streaming - UTF-16 split between fragments */
+    char partial[4];
     Atom type; /* UTF8_STRING, image/bmp, ... */
     Atom property; /* XRDP_CLIP_PROPERTY_ATOM, _QT_SELECTION, ... */
     Window window; /* Window used in INCR transfer */
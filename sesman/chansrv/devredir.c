@@ -93,7 +93,9 @@ enum COMPLETION_TYPE
     CID_RENAME_FILE,
     CID_RENAME_FILE_RESP,
     CID_LOOKUP,
-    CID_SETATTR
+    CID_SETATTR,
+    CID_QUERY_VOLUME_OPEN,
+    CID_QUERY_VOLUME
 };
 
 
@@ -135,6 +137,12 @@ static void devredir_proc_cid_lookup(  IRP *irp,
 static void devredir_proc_cid_setattr( IRP *irp,
                                        struct stream *s_in,
                                        enum NTSTATUS IoStatus);
+static void devredir_proc_cid_query_volume_open(IRP *irp,
+        enum NTSTATUS IoStatus);
+static void devredir_proc_cid_query_volume(IRP *irp,
+        struct stream *s_in,
+        enum NTSTATUS IoStatus);
+static void devredir_query_volume_attributes(tui32 device_id);
 /* Other local functions */
 static void devredir_send_server_core_cap_req(void);
 static void devredir_send_server_clientID_confirm(void);
@@ -213,6 +221,8 @@ static const char *completion_type_to_str(enum COMPLETION_TYPE cid)
         (cid == CID_RENAME_FILE_RESP)   ?  "CID_RENAME_FILE_RESP" :
         (cid == CID_LOOKUP)             ?  "CID_LOOKUP" :
         (cid == CID_SETATTR)            ?  "CID_SETATTR" :
+        (cid == CID_QUERY_VOLUME_OPEN)  ?  "CID_QUERY_VOLUME_OPEN" :
+        (cid == CID_QUERY_VOLUME)       ?  "CID_QUERY_VOLUME" :
         /* default */                      "<unknown>";
 };
 #endif
@@ -890,6 +900,7 @@ devredir_proc_client_devlist_announce_req(struct stream *s)
     tui32 device_data_len;
     char  preferred_dos_name[9];
     enum NTSTATUS response_status;
+    int query_volume;
 
     /* get number of devices being announced */
     if (!s_check_rem_and_log(s, 4, "Parsing [MS-RDPEFS] DR_CORE_DEVICELIST_ANNOUNCE_REQ"))
@@ -920,6 +931,7 @@ devredir_proc_client_devlist_announce_req(struct stream *s)
 
         /* Assume this device isn't supported by us */
         response_status = STATUS_NOT_SUPPORTED;
+        query_volume = 0;
 
         /* Read the device data length from the stream */
         xstream_rd_u32_le(s, device_data_len);
@@ -950,7 +962,10 @@ devredir_proc_client_devlist_announce_req(struct stream *s)
 
                 /* create share directory in xrdp file system;    */
                 /* think of this as the mount point for this share */
-                xfuse_create_share(g_device_id, preferred_dos_name);
+                if (xfuse_create_share(g_device_id, preferred_dos_name) == 0)
+                {
+                    query_volume = 1;
+                }
                 break;
 
             case RDPDR_DTYP_SMARTCARD:
@@ -990,6 +1005,12 @@ devredir_proc_client_devlist_announce_req(struct stream *s)
         /* Tell the client wheth or not we're supporting this one */
         devredir_send_server_device_announce_resp(g_device_id,
                 response_status);
+
+        /* The drive can't be used until it's been accepted */
+        if (query_volume)
+        {
+            devredir_query_volume_attributes(g_device_id);
+        }
     }
 
     return 0;
@@ -1206,6 +1227,19 @@ devredir_proc_device_iocompletion(struct stream *s)
                 devredir_proc_cid_setattr(irp, s, IoStatus);
                 break;
 
+            case CID_QUERY_VOLUME_OPEN:
+                if (!s_check_rem_and_log(s, 4, "Parsing [MS-RDPEFS] DR_CREATE_RSP"))
+                {
+                    return -1;
+                }
+                xstream_rd_u32_le(s, irp->FileId);
+                devredir_proc_cid_query_volume_open(irp, IoStatus);
+                break;
+
+            case CID_QUERY_VOLUME:
+                devredir_proc_cid_query_volume(irp, s, IoStatus);
+                break;
+
             default:
                 LOG_DEVEL(LOG_LEVEL_ERROR, "got unknown CompletionID: DeviceId=0x%x "
                           "CompletionId=0x%x IoStatus=0x%x",
@@ -1967,6 +2001,110 @@ devredir_string_ends_with(const char *string, char c)
     return (len > 0 && string[len - 1] == c) ? 1 : 0;
 }
 
+/**
+ * Asks the client for the attributes of a drive it has just announced
+ *
+ * The root of the drive is opened, and the reply to the open is
+ * handled by devredir_proc_cid_query_volume_open()
+ *****************************************************************************/
+static void
+devredir_query_volume_attributes(tui32 device_id)
+{
+    IRP *irp;
+
+    if ((irp = devredir_irp_with_pathname_new("\\")) != NULL)
+    {
+        irp->CompletionId = g_completion_id++;
+        irp->completion_type = CID_QUERY_VOLUME_OPEN;
+        irp->DeviceId = device_id;
+
+        devredir_send_drive_create_request(device_id, irp->pathname,
+                                           DA_FILE_READ_ATTRIBUTES |
+                                           DA_SYNCHRONIZE,
+                                           CO_FILE_DIRECTORY_FILE,
+                                           0, CD_FILE_OPEN,
+                                           irp->CompletionId);
+    }
+}
+
+/**
+ * Queries the attributes of a drive, once its root has been opened
+ *
+ * See [MS-RDPEFS] 2.2.3.3.6 (DR_DRIVE_QUERY_VOLUME_INFORMATION_REQ)
+ *****************************************************************************/
+static void
+devredir_proc_cid_query_volume_open(IRP *irp, enum NTSTATUS IoStatus)
+{
+    struct stream *s;
+    int            bytes;
+
+    if (IoStatus != STATUS_SUCCESS)
+    {
+        /* Names on the drive will be matched exactly */
+        LOG(LOG_LEVEL_WARNING, "Can't open root of redirected drive 0x%x "
+            "[status 0x%08x]", irp->DeviceId, IoStatus);
+        devredir_irp_delete(irp);
+        return;
+    }
+
+    xstream_new(s, 1024);
+
+    irp->completion_type = CID_QUERY_VOLUME;
+    devredir_insert_DeviceIoRequest(s, irp->DeviceId, irp->FileId,
+                                    irp->CompletionId,
+                                    IRP_MJ_QUERY_VOLUME_INFORMATION,
+                                    IRP_MN_NONE);
+
+    xstream_wr_u32_le(s, FileFsAttributeInformation);
+    xstream_wr_u32_le(s, 0); /* length is zero */
+    xstream_seek(s, 24);     /* padding        */
+
+    /* send to client */
+    bytes = xstream_len(s);
+    send_channel_data(g_rdpdr_chan_id, s->data, bytes);
+    xstream_free(s);
+}
+
+/**
+ * Handles the attributes of a drive, and closes its root
+ *
+ * See :-
+ * - [MS-RDPEFS] 2.2.3.4.6 (DR_DRIVE_QUERY_VOLUME_INFORMATION_RSP)
+ * - [MS-FSCC] 2.5.1 (FileFsAttributeInformation)
+ *****************************************************************************/
+static void
+devredir_proc_cid_query_volume(IRP *irp, struct stream *s_in,
+                               enum NTSTATUS IoStatus)
+{
+    tui32 Length;
+    tui32 FileSystemAttributes;
+
+    if (IoStatus != STATUS_SUCCESS)
+    {
+        LOG(LOG_LEVEL_WARNING, "Can't get attributes of redirected drive "
+            "0x%x [status 0x%08x]", irp->DeviceId, IoStatus);
+    }
+    else if (s_check_rem_and_log(s_in, 4 + 4, "Parsing [MS-RDPEFS] "
+                                 "DR_DRIVE_QUERY_VOLUME_INFORMATION_RSP"))
+    {
+        xstream_rd_u32_le(s_in, Length);
+        xstream_rd_u32_le(s_in, FileSystemAttributes);
+        if (Length >= 4)
+        {
+            xfuse_devredir_cb_volume_attributes(irp->DeviceId,
+                                                FileSystemAttributes);
+        }
+    }
+
+    irp->completion_type = CID_CLOSE;
+    devredir_send_drive_close_request(RDPDR_CTYP_CORE,
+                                      PAKID_CORE_DEVICE_IOREQUEST,
+                                      irp->DeviceId,
+                                      irp->FileId,
+                                      irp->CompletionId,
+                                      IRP_MJ_CLOSE, IRP_MN_NONE, 32);
+}
+
 static void
 devredir_proc_cid_rmdir_or_file(IRP *irp, enum NTSTATUS IoStatus)
 {
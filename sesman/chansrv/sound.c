@@ -31,6 +31,7 @@
 #include "thread_calls.h"
 #include "defines.h"
 #include "fifo.h"
+#include "spsc_ring.h"
 #include "xrdp_constants.h"
 #include "xrdp_sockets.h"
 #include "chansrv_common.h"
@@ -83,13 +84,89 @@ static int    g_best_time_diff = 0;
 static struct stream *g_stream_inp = NULL;
 static struct stream *g_stream_incoming_packet = NULL;
 
+/* Audio from the sink is encoded on a separate thread, so a slow codec
+ * can't hold up the main loop. PCM goes to the encoder thread on one
+ * ring, and encoded blocks come back on another. Sending stays on the
+ * main thread. Each ring has a backlog for when it is full.
+ *
+ * The backlogs are limited. Once one is full, the oldest audio in it
+ * is dropped, so a slow encoder or a busy main loop can't add latency
+ * and memory without limit */
+#define SOUND_RING_ITEMS 64
+#define SOUND_BACKLOG_ITEMS 16
+
+enum sound_item_type
+{
+    SOUND_ITEM_PCM,     /* to encoder - PCM from the sink */
+    SOUND_ITEM_CLOSE,   /* both ways - end of stream */
+    SOUND_ITEM_LATENCY, /* to encoder - client lag in ms */
+    SOUND_ITEM_WAVE     /* from encoder - block to send */
+};
+
+enum sound_codec
+{
+    SOUND_CODEC_PCM,
+    SOUND_CODEC_FDK_AAC,
+    SOUND_CODEC_OPUS,
+    SOUND_CODEC_MP3LAME
+};
+
+struct sound_item
+{
+    enum sound_item_type type;
+    enum sound_codec codec;
+    int codec_index;  /* client format index for codec */
+    int format_index; /* client format index for PCM, or of WAVE */
+    int value;        /* CLOSE - silent blocks first, LATENCY - lag */
+    int bytes;
+    char *data;       /* follows struct */
+};
+
+static struct spsc_ring *g_ring_to_enc = NULL;
+static struct fifo *g_backlog_to_enc = NULL;
+static int g_backlog_to_enc_items = 0; /* main thread only */
+static struct spsc_ring *g_ring_encoded = NULL;
+static struct fifo *g_backlog_encoded = NULL;
+static int g_backlog_encoded_items = 0; /* encoder thread only */
+static tbus g_event_to_enc = 0;
+static tbus g_event_encoded = 0;
+static tbus g_enc_term_request = 0;
+static tbus g_enc_term_done = 0;
+
+/* Only used by the encoder thread, once started */
 #define MAX_BBUF_SIZE (1024 * 16)
 static char g_buffer[MAX_BBUF_SIZE];
 static int g_buf_index = 0;
-static int g_sent_time[256];
-
 static int g_bbuf_size = 1024 * 8; /* may change later */
 
+/* Client lag above the best seen that we put up with. Beyond it, the
+ * audio is played slightly faster until the client catches up */
+#define SOUND_LAG_TOLERANCE_MS 100
+#define SOUND_MAX_SPEEDUP_PERMILLE 100
+static int g_enc_lag = 0;
+static int g_resample_active = 0;
+static tui32 g_resample_pos = 0; /* 16.16 fixed point */
+static short g_resample_last[2];
+
+/* Opus bitrate and frame size follow the client lag. While the client
+ * keeps up, the bitrate is raised, and then the frame size is lowered
+ * towards 20ms for less latency. When the client falls behind, the
+ * bitrate is lowered, and the frame size goes back to 60ms, as
+ * fewer, larger packets cost less to send */
+#define SOUND_OPUS_FRAME_BYTES(ms) (48 * 4 * (ms))
+#define SOUND_OPUS_MIN_BITRATE 24000
+#define SOUND_OPUS_START_BITRATE 96000
+#define SOUND_OPUS_MAX_BITRATE 160000
+#define SOUND_OPUS_ADAPT_INTERVAL_MS 2000
+static int g_opus_bitrate = SOUND_OPUS_START_BITRATE;
+#if defined(XRDP_OPUS)
+static int g_opus_bitrate_set = 0;
+#endif
+static int g_opus_frame_bytes = SOUND_OPUS_FRAME_BYTES(60);
+static int g_opus_adapt_time = 0;
+
+static int g_sent_time[256];
+
 static struct list *g_ack_time_diff = 0;
 
 struct xr_wave_format_ex
@@ -488,7 +565,8 @@ sound_process_output_formats(struct stream *s, int size)
 
 /*****************************************************************************/
 static int
-sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
+sound_wave_compress_fdk_aac(char *data, int data_bytes, int codec_index,
+                            int *format_index)
 {
     int rv;
     int cdata_bytes;
@@ -517,11 +595,6 @@ sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
 
     rv = data_bytes;
 
-    if (g_client_does_fdk_aac == 0)
-    {
-        return rv;
-    }
-
     if (g_fdk_aac_encoder == 0)
     {
         /* init fdk aac encoder */
@@ -669,7 +742,7 @@ sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
         cdata_bytes = out_args.numOutBytes;
         LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_wave_compress_fdk_aac: aacEncEncode ok "
                   "cdata_bytes %d", cdata_bytes);
-        *format_index = g_client_fdk_aac_index;
+        *format_index = codec_index;
         g_memcpy(data, cdata, cdata_bytes);
         rv = cdata_bytes;
     }
@@ -686,7 +759,8 @@ sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
 
 /*****************************************************************************/
 static int
-sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
+sound_wave_compress_fdk_aac(char *data, int data_bytes, int codec_index,
+                            int *format_index)
 {
     return data_bytes;
 }
@@ -697,7 +771,8 @@ sound_wave_compress_fdk_aac(char *data, int data_bytes, int *format_index)
 
 /*****************************************************************************/
 static int
-sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
+sound_wave_compress_opus(char *data, int data_bytes, int codec_index,
+                         int *format_index)
 {
     unsigned char *cdata;
     int cdata_bytes;
@@ -706,10 +781,6 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
     int data_bytes_org;
     opus_int16 *os16;
 
-    if (g_client_does_opus == 0)
-    {
-        return data_bytes;
-    }
     if (g_opus_encoder == 0)
     {
         /* NB (narrowband)       8 kHz
@@ -725,6 +796,12 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
             LOG_DEVEL(LOG_LEVEL_ERROR, "sound_wave_compress_opus: opus_encoder_create failed");
             return data_bytes;
         }
+        g_opus_bitrate_set = 0;
+    }
+    if (g_opus_bitrate_set != g_opus_bitrate)
+    {
+        opus_encoder_ctl(g_opus_encoder, OPUS_SET_BITRATE(g_opus_bitrate));
+        g_opus_bitrate_set = g_opus_bitrate;
     }
     data_bytes_org = data_bytes;
     rv = data_bytes;
@@ -747,7 +824,7 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
                               cdata, cdata_bytes);
     if ((cdata_bytes > 0) && (cdata_bytes < data_bytes_org))
     {
-        *format_index = g_client_opus_index;
+        *format_index = codec_index;
         g_memcpy(data, cdata, cdata_bytes);
         rv = cdata_bytes;
     }
@@ -759,7 +836,8 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
 
 /*****************************************************************************/
 static int
-sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
+sound_wave_compress_opus(char *data, int data_bytes, int codec_index,
+                         int *format_index)
 {
     return data_bytes;
 }
@@ -770,7 +848,8 @@ sound_wave_compress_opus(char *data, int data_bytes, int *format_index)
 
 /*****************************************************************************/
 static int
-sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
+sound_wave_compress_mp3lame(char *data, int data_bytes, int codec_index,
+                            int *format_index)
 {
     int rv;
     int cdata_bytes;
@@ -780,11 +859,6 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
     cdata = NULL;
     rv = data_bytes;
 
-    if (g_client_does_mp3lame == 0)
-    {
-        return rv;
-    }
-
     if (g_lame_encoder == 0)
     {
         /* init mp3 lame encoder */
@@ -836,7 +910,7 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
     }
     if ((cdata_bytes > 0) && (cdata_bytes < odata_bytes))
     {
-        *format_index = g_client_mp3lame_index;
+        *format_index = codec_index;
         g_memcpy(data, cdata, cdata_bytes);
         rv = cdata_bytes;
     }
@@ -849,7 +923,8 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
 
 /*****************************************************************************/
 static int
-sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
+sound_wave_compress_mp3lame(char *data, int data_bytes, int codec_index,
+                            int *format_index)
 {
     return data_bytes;
 }
@@ -857,118 +932,291 @@ sound_wave_compress_mp3lame(char *data, int data_bytes, int *format_index)
 #endif
 
 /*****************************************************************************/
+/* worker thread */
 static int
-sound_wave_compress(char *data, int data_bytes, int *format_index)
+sound_wave_compress(const struct sound_item *params, char *data,
+                    int data_bytes, int *format_index)
 {
-    if (g_client_does_fdk_aac)
+    switch (params->codec)
+    {
+        case SOUND_CODEC_FDK_AAC:
+            return sound_wave_compress_fdk_aac(data, data_bytes,
+                                               params->codec_index,
+                                               format_index);
+        case SOUND_CODEC_OPUS:
+            return sound_wave_compress_opus(data, data_bytes,
+                                            params->codec_index,
+                                            format_index);
+        case SOUND_CODEC_MP3LAME:
+            return sound_wave_compress_mp3lame(data, data_bytes,
+                                               params->codec_index,
+                                               format_index);
+        default:
+            break;
+    }
+    return data_bytes;
+}
+
+/*****************************************************************************/
+/* worker thread. Bytes in a block passed to sound_wave_compress() */
+static int
+sound_block_bytes(enum sound_codec codec)
+{
+    switch (codec)
+    {
+        case SOUND_CODEC_FDK_AAC:
+            return 4096;
+        case SOUND_CODEC_OPUS:
+            return g_opus_frame_bytes;
+        case SOUND_CODEC_MP3LAME:
+            return 11520;
+        default:
+            break;
+    }
+    return 1024 * 8;
+}
+
+/*****************************************************************************/
+static struct sound_item *
+sound_item_create(enum sound_item_type type, const char *data, int bytes)
+{
+    struct sound_item *item;
+
+    item = (struct sound_item *) g_malloc(sizeof(struct sound_item) + bytes,
+                                          1);
+    if (item != NULL)
     {
-        g_bbuf_size = 4096;
-        return sound_wave_compress_fdk_aac(data, data_bytes, format_index);
+        item->type = type;
+        item->data = (char *) (item + 1);
+        item->bytes = bytes;
+        if (data != NULL)
+        {
+            g_memcpy(item->data, data, bytes);
+        }
     }
-    else if (g_client_does_opus)
+    return item;
+}
+
+/*****************************************************************************/
+static void
+sound_item_destructor(void *item, void *closure)
+{
+    g_free(item);
+}
+
+/*****************************************************************************/
+/* Drops the oldest audio from a backlog. Other items are kept, in
+ * order */
+static void
+sound_backlog_drop_oldest(struct fifo *backlog, int *backlog_items)
+{
+    struct sound_item *item;
+    int count = *backlog_items;
+    int dropped = 0;
+
+    while (count-- > 0)
     {
-        g_bbuf_size = 11520;
-        return sound_wave_compress_opus(data, data_bytes, format_index);
+        item = (struct sound_item *) fifo_remove_item(backlog);
+        if (!dropped &&
+                (item->type == SOUND_ITEM_PCM || item->type == SOUND_ITEM_WAVE))
+        {
+            LOG(LOG_LEVEL_DEBUG, "sound_backlog_drop_oldest: dropping "
+                "%d bytes of audio", item->bytes);
+            g_free(item);
+            --*backlog_items;
+            dropped = 1;
+        }
+        else if (!fifo_add_item(backlog, item))
+        {
+            g_free(item);
+            --*backlog_items;
+        }
     }
-    else if (g_client_does_mp3lame)
+}
+
+/*****************************************************************************/
+/* Adds an item to a ring. If the ring is full, the item is kept in
+ * the backlog instead. Anything already in the backlog is moved to the
+ * ring first, so the order of items is kept. If the backlog is full,
+ * the oldest audio in it is dropped.
+ *
+ * Only the producer for the ring may call this.
+ *
+ * @param item Item to add, or NULL just to move items from the backlog
+ * @return 1 for success, 0 for no memory */
+static int
+sound_ring_add(struct spsc_ring *ring, struct fifo *backlog,
+               int *backlog_items, struct sound_item *item)
+{
+    while (!fifo_is_empty(backlog) && !spsc_ring_is_full(ring))
     {
-        g_bbuf_size = 11520;
-        return sound_wave_compress_mp3lame(data, data_bytes, format_index);
+        spsc_ring_add_item(ring, fifo_remove_item(backlog));
+        --*backlog_items;
     }
-    return data_bytes;
+    if (item == NULL)
+    {
+        return 1;
+    }
+    if (fifo_is_empty(backlog) && spsc_ring_add_item(ring, item))
+    {
+        return 1;
+    }
+    if (*backlog_items >= SOUND_BACKLOG_ITEMS)
+    {
+        sound_backlog_drop_oldest(backlog, backlog_items);
+    }
+    if (!fifo_add_item(backlog, item))
+    {
+        return 0;
+    }
+    ++*backlog_items;
+    return 1;
+}
+
+/*****************************************************************************/
+/* worker thread. Passes an item back to the main thread */
+static void
+sound_enc_output(struct sound_item *item)
+{
+    if (!sound_ring_add(g_ring_encoded, g_backlog_encoded,
+                        &g_backlog_encoded_items, item))
+    {
+        LOG(LOG_LEVEL_ERROR, "sound_enc_output: out of memory");
+        g_free(item);
+    }
+    g_set_wait_obj(g_event_encoded);
 }
 
 /*****************************************************************************/
-/* send wave message to client */
+/* worker thread. Compresses a block and passes it to the main thread */
 static int
-sound_send_wave_data_chunk(char *data, int data_bytes)
+sound_encode_block(const struct sound_item *params, char *data,
+                   int data_bytes)
 {
-    struct stream *s;
-    int bytes;
-    int time;
+    struct sound_item *wave;
     int format_index;
-    char *size_ptr;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data_chunk: data_bytes %d", data_bytes);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_encode_block: data_bytes %d", data_bytes);
 
     if ((data_bytes < 4) || (data_bytes > 128 * 1024))
     {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_send_wave_data_chunk: bad data_bytes %d", data_bytes);
+        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_encode_block: bad data_bytes %d", data_bytes);
         return 1;
     }
 
     /* compress, if available */
-    format_index = g_current_client_format_index;
-    data_bytes = sound_wave_compress(data, data_bytes, &format_index);
-
-    LOG(LOG_LEVEL_TRACE, "sound_send_wave_data_chunk: wFormatNo %d", format_index);
+    format_index = params->format_index;
+    data_bytes = sound_wave_compress(params, data, data_bytes, &format_index);
 
-    /* part one of 2 PDU wave info */
+    LOG(LOG_LEVEL_TRACE, "sound_encode_block: wFormatNo %d", format_index);
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data_chunk: sending %d bytes", data_bytes);
+    wave = sound_item_create(SOUND_ITEM_WAVE, data, data_bytes);
+    if (wave == NULL)
+    {
+        return 1;
+    }
+    wave->format_index = format_index;
+    sound_enc_output(wave);
+    return 0;
+}
 
-    make_stream(s);
-    init_stream(s, 16 + data_bytes); /* some extra space */
-    out_uint16_le(s, SNDC_WAVE);
-    size_ptr = s->p;
-    out_uint16_le(s, 0); /* size, set later */
-    time = g_time3();
-    out_uint16_le(s, time);
-    out_uint16_le(s, format_index); /* wFormatNo */
-    g_cBlockNo++;
-    out_uint8(s, g_cBlockNo);
-    g_sent_time[g_cBlockNo & 0xff] = time;
+/*****************************************************************************/
+/* worker thread.
+ *
+ * Plays PCM (16-bit stereo) 'permille' parts per thousand faster, by
+ * linear interpolation between frames. The position carries over from
+ * one block to the next, so there are no steps at the block edges.
+ *
+ * Returns the number of bytes written to 'out', which must be as big
+ * as 'data' */
+static int
+sound_resample(const char *data, int data_bytes, char *out, int permille)
+{
+    const short *in = (const short *) data;
+    short *o = (short *) out;
+    int in_frames = data_bytes / 4;
+    int out_frames = 0;
+    tui32 step = (tui32) (65536 * (1000 + permille) / 1000);
+    tui32 pos;
+    int index;
+    int frac;
+    int chan;
+    int a;
+    int b;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data_chunk: sending time %d, g_cBlockNo %d",
-              time & 0xffff, g_cBlockNo & 0xff);
+    if (!g_resample_active)
+    {
+        /* Start on the first frame of this block */
+        g_resample_pos = 65536;
+        g_resample_active = 1;
+    }
 
-    out_uint8s(s, 3);
-    out_uint8a(s, data, 4);
-    s_mark_end(s);
-    bytes = (int)((s->end - s->data) - 4);
-    bytes += data_bytes;
-    bytes -= 4;
-    size_ptr[0] = bytes;
-    size_ptr[1] = bytes >> 8;
-    bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    /* Frame n of this block is at position (n + 1) << 16. Position 0
+     * is the last frame of the previous block */
+    for (pos = g_resample_pos; (int) (pos >> 16) < in_frames; pos += step)
+    {
+        index = (int) (pos >> 16);
+        frac = (int) (pos & 0xffff);
+        for (chan = 0; chan < 2; ++chan)
+        {
+            a = (index == 0) ? g_resample_last[chan] :
+                in[(index - 1) * 2 + chan];
+            b = in[index * 2 + chan];
+            o[out_frames * 2 + chan] = (short) (a + (((b - a) * frac) >> 16));
+        }
+        ++out_frames;
+    }
 
-    /* part two of 2 PDU wave info
-       even is zero, we have to send this */
-    init_stream(s, data_bytes);
-    out_uint32_le(s, 0);
-    out_uint8a(s, data + 4, data_bytes - 4);
-    s_mark_end(s);
-    bytes = (int)(s->end - s->data);
-    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+    if (in_frames > 0)
+    {
+        g_resample_pos = pos - ((tui32) in_frames << 16);
+        g_resample_last[0] = in[(in_frames - 1) * 2];
+        g_resample_last[1] = in[(in_frames - 1) * 2 + 1];
+    }
 
-    free_stream(s);
-    return 0;
+    return out_frames * 4;
 }
 
 /*****************************************************************************/
-/* send wave message to client, buffer first */
+/* worker thread. Buffers PCM, and sends it on in blocks */
 static int
-sound_send_wave_data(char *data, int data_bytes)
+sound_send_wave_data(const struct sound_item *item)
 {
+    char *data = item->data;
+    char *resampled = NULL;
+    int data_bytes = item->bytes & ~3;
     int space_left;
     int chunk_bytes;
     int data_index;
     int error;
-    int res;
+    int permille;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data: sending %d bytes", data_bytes);
-    if (g_time_diff > g_best_time_diff + 250)
+
+    permille = (g_enc_lag - SOUND_LAG_TOLERANCE_MS) / 4;
+    if (permille > 0)
     {
-        data_bytes = data_bytes / 4;
-        data_bytes = data_bytes & ~3;
-        g_memset(data, 0, data_bytes);
-        g_time_diff = 0;
+        permille = MIN(permille, SOUND_MAX_SPEEDUP_PERMILLE);
+        resampled = (char *) g_malloc(data_bytes, 0);
+        if (resampled != NULL)
+        {
+            data_bytes = sound_resample(data, data_bytes, resampled, permille);
+            data = resampled;
+        }
     }
+    else
+    {
+        g_resample_active = 0;
+    }
+
     data_index = 0;
     error = 0;
     while (data_bytes > 0)
     {
+        if (g_buf_index == 0)
+        {
+            g_bbuf_size = sound_block_bytes(item->codec);
+        }
         space_left = g_bbuf_size - g_buf_index;
         chunk_bytes = MIN(space_left, data_bytes);
         if (chunk_bytes < 1)
@@ -982,14 +1230,7 @@ sound_send_wave_data(char *data, int data_bytes)
         if (g_buf_index >= g_bbuf_size)
         {
             g_buf_index = 0;
-            res = sound_send_wave_data_chunk(g_buffer, g_bbuf_size);
-            if (res == 2)
-            {
-                /* don't need to error on this */
-                LOG_DEVEL(LOG_LEVEL_ERROR, "sound_send_wave_data: dropped, no room");
-                break;
-            }
-            else if (res != 0)
+            if (sound_encode_block(item, g_buffer, g_bbuf_size) != 0)
             {
                 LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_data: error");
                 error = 1;
@@ -1000,11 +1241,344 @@ sound_send_wave_data(char *data, int data_bytes)
         data_index += chunk_bytes;
     }
 
+    g_free(resampled);
     return error;
 }
 
 /*****************************************************************************/
-/* send close message to client */
+/* worker thread. Follows the client lag (see SOUND_OPUS_* above) */
+static void
+sound_adapt_to_lag(int lag)
+{
+    int now = g_time3();
+
+    g_enc_lag = lag;
+    if (now - g_opus_adapt_time < SOUND_OPUS_ADAPT_INTERVAL_MS)
+    {
+        return;
+    }
+    g_opus_adapt_time = now;
+
+    if (lag > SOUND_LAG_TOLERANCE_MS)
+    {
+        g_opus_bitrate = MAX(g_opus_bitrate * 3 / 4, SOUND_OPUS_MIN_BITRATE);
+        g_opus_frame_bytes = SOUND_OPUS_FRAME_BYTES(60);
+    }
+    else if (lag < SOUND_LAG_TOLERANCE_MS / 2)
+    {
+        if (g_opus_bitrate < SOUND_OPUS_MAX_BITRATE)
+        {
+            g_opus_bitrate = MIN(g_opus_bitrate * 5 / 4,
+                                 SOUND_OPUS_MAX_BITRATE);
+        }
+        else if (g_opus_frame_bytes > SOUND_OPUS_FRAME_BYTES(20))
+        {
+            g_opus_frame_bytes -= SOUND_OPUS_FRAME_BYTES(20);
+        }
+    }
+    LOG(LOG_LEVEL_TRACE, "sound_adapt_to_lag: lag %d opus bitrate %d "
+        "frame bytes %d", lag, g_opus_bitrate, g_opus_frame_bytes);
+}
+
+/*****************************************************************************/
+/* worker thread. Ends the stream. The close is passed back to the main
+ * thread after any silent blocks the client needs first */
+static void
+sound_enc_close(struct sound_item *item)
+{
+    int index;
+
+    g_buf_index = 0;
+    g_enc_lag = 0;
+    g_resample_active = 0;
+
+    if (item->value > 0)
+    {
+        /* workaround for mstsc.exe. send silence data before send close */
+        g_bbuf_size = sound_block_bytes(item->codec);
+        for (index = 0; index < item->value; index++)
+        {
+            g_memset(g_buffer, 0, g_bbuf_size);
+            sound_encode_block(item, g_buffer, g_bbuf_size);
+        }
+    }
+    sound_enc_output(item);
+}
+
+/*****************************************************************************/
+/* Audio encoder thread */
+static THREAD_RV THREAD_CC
+sound_enc_thread(void *arg)
+{
+    tbus robjs[2];
+    struct sound_item *item;
+    int timeout;
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_enc_thread: started");
+    robjs[0] = g_enc_term_request;
+    robjs[1] = g_event_to_enc;
+
+    while (1)
+    {
+        /* poll until the main thread has made room for our backlog */
+        timeout = fifo_is_empty(g_backlog_encoded) ? -1 : 1;
+        if (g_obj_wait(robjs, 2, NULL, 0, timeout) != 0)
+        {
+            /* error, should not get here */
+            g_sleep(100);
+        }
+
+        if (g_is_wait_obj_set(g_enc_term_request))
+        {
+            break;
+        }
+
+        if (!fifo_is_empty(g_backlog_encoded))
+        {
+            sound_ring_add(g_ring_encoded, g_backlog_encoded,
+                           &g_backlog_encoded_items, NULL);
+            g_set_wait_obj(g_event_encoded);
+        }
+
+        if (g_is_wait_obj_set(g_event_to_enc))
+        {
+            g_reset_wait_obj(g_event_to_enc);
+            while ((item = (struct sound_item *)
+                           spsc_ring_remove_item(g_ring_to_enc)) != NULL)
+            {
+                switch (item->type)
+                {
+                    case SOUND_ITEM_PCM:
+                        sound_send_wave_data(item);
+                        g_free(item);
+                        break;
+                    case SOUND_ITEM_CLOSE:
+                        sound_enc_close(item);
+                        break;
+                    case SOUND_ITEM_LATENCY:
+                        sound_adapt_to_lag(item->value);
+                        g_free(item);
+                        break;
+                    default:
+                        g_free(item);
+                        break;
+                }
+            }
+        }
+    }
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_enc_thread: exit");
+    g_set_wait_obj(g_enc_term_done);
+    return 0;
+}
+
+/*****************************************************************************/
+/* main thread. Passes an item to the worker thread. The codec is
+ * decided here, as the client formats are only known to this thread */
+static int
+sound_enc_queue(enum sound_item_type type, const char *data, int bytes,
+                int value)
+{
+    struct sound_item *item;
+
+    if (g_ring_to_enc == NULL)
+    {
+        return 1;
+    }
+    item = sound_item_create(type, data, bytes);
+    if (item == NULL)
+    {
+        return 1;
+    }
+    item->value = value;
+    item->format_index = g_current_client_format_index;
+    if (g_client_does_fdk_aac)
+    {
+        item->codec = SOUND_CODEC_FDK_AAC;
+        item->codec_index = g_client_fdk_aac_index;
+    }
+    else if (g_client_does_opus)
+    {
+        item->codec = SOUND_CODEC_OPUS;
+        item->codec_index = g_client_opus_index;
+    }
+    else if (g_client_does_mp3lame)
+    {
+        item->codec = SOUND_CODEC_MP3LAME;
+        item->codec_index = g_client_mp3lame_index;
+    }
+    else
+    {
+        item->codec = SOUND_CODEC_PCM;
+    }
+
+    if (!sound_ring_add(g_ring_to_enc, g_backlog_to_enc,
+                        &g_backlog_to_enc_items, item))
+    {
+        g_free(item);
+        return 1;
+    }
+    g_set_wait_obj(g_event_to_enc);
+    return 0;
+}
+
+/*****************************************************************************/
+/* main thread. Frees the encoder thread resources, which must not be
+ * in use */
+static void
+sound_enc_free(void)
+{
+    g_delete_wait_obj(g_event_to_enc);
+    g_delete_wait_obj(g_event_encoded);
+    g_delete_wait_obj(g_enc_term_request);
+    g_delete_wait_obj(g_enc_term_done);
+    g_event_to_enc = 0;
+    g_event_encoded = 0;
+    g_enc_term_request = 0;
+    g_enc_term_done = 0;
+    spsc_ring_delete(g_ring_to_enc, NULL);
+    fifo_delete(g_backlog_to_enc, NULL);
+    spsc_ring_delete(g_ring_encoded, NULL);
+    fifo_delete(g_backlog_encoded, NULL);
+    g_ring_to_enc = NULL;
+    g_backlog_to_enc = NULL;
+    g_backlog_to_enc_items = 0;
+    g_ring_encoded = NULL;
+    g_backlog_encoded = NULL;
+    g_backlog_encoded_items = 0;
+}
+
+/*****************************************************************************/
+/* main thread. Starts the encoder thread */
+static int
+sound_enc_start(void)
+{
+    char buf[64];
+    int pid;
+
+    if (g_ring_to_enc != NULL)
+    {
+        return 0;
+    }
+
+    /* The thread isn't running, so we can reset its state */
+    g_buf_index = 0;
+    g_enc_lag = 0;
+    g_resample_active = 0;
+    g_opus_bitrate = SOUND_OPUS_START_BITRATE;
+    g_opus_frame_bytes = SOUND_OPUS_FRAME_BYTES(60);
+    g_opus_adapt_time = g_time3();
+
+    pid = g_getpid();
+    g_ring_to_enc = spsc_ring_create(SOUND_RING_ITEMS, sound_item_destructor);
+    g_backlog_to_enc = fifo_create(sound_item_destructor);
+    g_ring_encoded = spsc_ring_create(SOUND_RING_ITEMS, sound_item_destructor);
+    g_backlog_encoded = fifo_create(sound_item_destructor);
+    g_snprintf(buf, sizeof(buf), "xrdp_%8.8x_sound_to_enc", pid);
+    g_event_to_enc = g_create_wait_obj(buf);
+    g_snprintf(buf, sizeof(buf), "xrdp_%8.8x_sound_encoded", pid);
+    g_event_encoded = g_create_wait_obj(buf);
+    g_snprintf(buf, sizeof(buf), "xrdp_%8.8x_sound_enc_term_req", pid);
+    g_enc_term_request = g_create_wait_obj(buf);
+    g_snprintf(buf, sizeof(buf), "xrdp_%8.8x_sound_enc_term_done", pid);
+    g_enc_term_done = g_create_wait_obj(buf);
+
+    if (g_ring_to_enc == NULL || g_backlog_to_enc == NULL ||
+            g_ring_encoded == NULL || g_backlog_encoded == NULL ||
+            g_event_to_enc == 0 || g_event_encoded == 0 ||
+            g_enc_term_request == 0 || g_enc_term_done == 0 ||
+            tc_thread_create(sound_enc_thread, NULL) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "sound_enc_start: can't start the audio "
+            "encoder thread");
+        sound_enc_free();
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* main thread. Stops the encoder thread, dropping anything queued */
+static void
+sound_enc_stop(void)
+{
+    if (g_ring_to_enc == NULL)
+    {
+        return;
+    }
+
+    g_set_wait_obj(g_enc_term_request);
+    g_obj_wait(&g_enc_term_done, 1, NULL, 0, 5000);
+    if (!g_is_wait_obj_set(g_enc_term_done))
+    {
+        /* We can't free anything the thread may still be using */
+        LOG(LOG_LEVEL_WARNING, "Audio encoder failed to shut down cleanly");
+        return;
+    }
+    sound_enc_free();
+}
+
+/*****************************************************************************/
+/* main thread. send wave message to client */
+static int
+sound_send_wave_pdu(int format_index, const char *data, int data_bytes)
+{
+    struct stream *s;
+    int bytes;
+    int time;
+    char *size_ptr;
+
+    if (data_bytes < 4)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "sound_send_wave_pdu: bad data_bytes %d", data_bytes);
+        return 1;
+    }
+
+    /* part one of 2 PDU wave info */
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_pdu: sending %d bytes", data_bytes);
+
+    make_stream(s);
+    init_stream(s, 16 + data_bytes); /* some extra space */
+    out_uint16_le(s, SNDC_WAVE);
+    size_ptr = s->p;
+    out_uint16_le(s, 0); /* size, set later */
+    time = g_time3();
+    out_uint16_le(s, time);
+    out_uint16_le(s, format_index); /* wFormatNo */
+    g_cBlockNo++;
+    out_uint8(s, g_cBlockNo);
+    g_sent_time[g_cBlockNo & 0xff] = time;
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_wave_pdu: sending time %d, g_cBlockNo %d",
+              time & 0xffff, g_cBlockNo & 0xff);
+
+    out_uint8s(s, 3);
+    out_uint8a(s, data, 4);
+    s_mark_end(s);
+    bytes = (int)((s->end - s->data) - 4);
+    bytes += data_bytes;
+    bytes -= 4;
+    size_ptr[0] = bytes;
+    size_ptr[1] = bytes >> 8;
+    bytes = (int)(s->end - s->data);
+    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+
+    /* part two of 2 PDU wave info
+       even is zero, we have to send this */
+    init_stream(s, data_bytes);
+    out_uint32_le(s, 0);
+    out_uint8a(s, data + 4, data_bytes - 4);
+    s_mark_end(s);
+    bytes = (int)(s->end - s->data);
+    send_channel_data(g_rdpsnd_chan_id, s->data, bytes);
+
+    free_stream(s);
+    return 0;
+}
+
+/*****************************************************************************/
+/* main thread. send close message to client */
 static int
 sound_send_close(void)
 {
@@ -1015,7 +1589,6 @@ sound_send_close(void)
     LOG_DEVEL(LOG_LEVEL_DEBUG, "sound_send_close:");
 
     g_best_time_diff = 0;
-    g_buf_index = 0;
 
     /* send close msg */
     make_stream(s);
@@ -1033,6 +1606,28 @@ sound_send_close(void)
     return 0;
 }
 
+/*****************************************************************************/
+/* main thread. Sends what the encoder thread has finished with */
+static void
+sound_send_encoded(void)
+{
+    struct sound_item *item;
+
+    while ((item = (struct sound_item *)
+                   spsc_ring_remove_item(g_ring_encoded)) != NULL)
+    {
+        if (item->type == SOUND_ITEM_WAVE)
+        {
+            sound_send_wave_pdu(item->format_index, item->data, item->bytes);
+        }
+        else if (item->type == SOUND_ITEM_CLOSE)
+        {
+            sound_send_close();
+        }
+        g_free(item);
+    }
+}
+
 /*****************************************************************************/
 /* from client */
 static int
@@ -1085,6 +1680,11 @@ sound_process_wave_confirm(struct stream *s, int size)
         }
     }
     g_time_diff = acc;
+    if (acc > 0)
+    {
+        sound_enc_queue(SOUND_ITEM_LATENCY, NULL, 0,
+                        g_time_diff - g_best_time_diff);
+    }
     return 0;
 }
 
@@ -1096,6 +1696,7 @@ process_pcm_message(int id, int size, struct stream *s)
 {
     static int sending_silence = 0;
     static int silence_start_time = 0;
+    int send_silence_times = 0;
     switch (id)
     {
         case 0:
@@ -1108,29 +1709,20 @@ process_pcm_message(int id, int size, struct stream *s)
                 }
                 sending_silence = 0;
             }
-            return sound_send_wave_data(s->p, size);
+            return sound_enc_queue(SOUND_ITEM_PCM, s->p, size, 0);
             break;
         case 1:
             if ((g_client_does_fdk_aac || g_client_does_mp3lame) && sending_silence == 0)
             {
-                /* workaround for mstsc.exe. send silence data before send close */
-                int send_silence_times = g_client_does_fdk_aac ? g_cfg->num_silent_frames_aac : g_cfg->num_silent_frames_mp3;  /* setting from sesman.ini */
-                char *buf = (char *) g_malloc(g_bbuf_size, 0);
-                if (buf != NULL)
-                {
-                    int i;
-                    silence_start_time = g_time3();
-                    sending_silence = 1;
-                    for (i = 0; i < send_silence_times; i++)
-                    {
-                        g_memset(buf, 0, g_bbuf_size);
-                        sound_send_wave_data_chunk(buf, g_bbuf_size);
-                    }
-                    free(buf);
-                    g_time_diff = 0;
-                }
+                /* workaround for mstsc.exe. send silence data before send close.
+                   The encoder thread sends the silence */
+                send_silence_times = g_client_does_fdk_aac ? g_cfg->num_silent_frames_aac : g_cfg->num_silent_frames_mp3;  /* setting from sesman.ini */
+                silence_start_time = g_time3();
+                sending_silence = 1;
+                g_time_diff = 0;
             }
-            return sound_send_close();
+            return sound_enc_queue(SOUND_ITEM_CLOSE, NULL, 0,
+                                   send_silence_times);
             break;
         default:
             LOG_DEVEL(LOG_LEVEL_ERROR, "process_pcm_message: unknown id %d", id);
@@ -1303,6 +1895,8 @@ sound_init(void)
     }
     list_clear(g_ack_time_diff);
 
+    sound_enc_start();
+
 #if defined(XRDP_FDK_AAC) || defined(XRDP_MP3LAME)
     LOG(LOG_LEVEL_INFO, "num_silent_frames_aac: %d", g_cfg->num_silent_frames_aac);
     LOG(LOG_LEVEL_INFO, "num_silent_frames_mp3: %d", g_cfg->num_silent_frames_mp3);
@@ -1341,6 +1935,9 @@ sound_deinit(void)
         g_audio_c_trans_in = 0;
     }
 
+    /* The encoders below mustn't be in use when they are freed */
+    sound_enc_stop();
+
 #if defined(XRDP_MP3LAME)
     if (g_lame_encoder)
     {
@@ -1446,6 +2043,18 @@ sound_get_wait_objs(tbus *objs, int *count, int *timeout)
         lcount++;
     }
 
+    if (g_event_encoded != 0)
+    {
+        objs[lcount] = g_event_encoded;
+        lcount++;
+        /* poll until the encoder thread has made room for our backlog */
+        if (timeout != NULL && !fifo_is_empty(g_backlog_to_enc) &&
+                (*timeout < 0 || *timeout > 1))
+        {
+            *timeout = 1;
+        }
+    }
+
     *count = lcount;
     return 0;
 }
@@ -1496,6 +2105,21 @@ sound_check_wait_objs(void)
         }
     }
 
+    if (g_ring_to_enc != NULL)
+    {
+        if (!fifo_is_empty(g_backlog_to_enc))
+        {
+            sound_ring_add(g_ring_to_enc, g_backlog_to_enc,
+                           &g_backlog_to_enc_items, NULL);
+            g_set_wait_obj(g_event_to_enc);
+        }
+        if (g_is_wait_obj_set(g_event_encoded))
+        {
+            g_reset_wait_obj(g_event_encoded);
+        }
+        sound_send_encoded();
+    }
+
     return 0;
 }
 
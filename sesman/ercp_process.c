@@ -42,10 +42,11 @@ process_session_announce_event(struct session_item *si)
 {
     int rv;
     const char *start_ip_addr;
+    uid_t uid;
 
     rv = ercp_get_session_announce_event(si->sesexec_trans,
                                          NULL,
-                                         &si->uid,
+                                         &uid,
                                          &si->type,
                                          &si->start_width,
                                          &si->start_height,
@@ -57,6 +58,7 @@ process_session_announce_event(struct session_item *si)
     {
         snprintf(si->start_ip_addr, sizeof(si->start_ip_addr),
                  "%s", start_ip_addr);
+        session_list_set_uid(si, uid);
         si->state = E_SESSION_RUNNING;
     }
 
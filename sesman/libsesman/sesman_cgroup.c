@@ -0,0 +1,302 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file sesman_cgroup.c
+ * @brief Per-session cgroups
+ *
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdlib.h>
+
+#include "arch.h"
+#include "list.h"
+#include "log.h"
+#include "os_calls.h"
+#include "sesman_cgroup.h"
+#include "sesman_config.h"
+#include "string_calls.h"
+
+/* Sessions whose cgroups couldn't be removed, as they weren't empty */
+static struct list *g_stale_cgroups = NULL;
+
+/******************************************************************************/
+static void
+get_session_cgroup(const struct config_sessions *cfg, int sid,
+                   char *path, unsigned int path_size)
+{
+    g_snprintf(path, path_size, "%s/session-%d", cfg->cgroup_path, sid);
+}
+
+/******************************************************************************/
+/**
+ * Writes a value to a cgroup interface file
+ *
+ * @return 0 for success
+ */
+static int
+write_cgroup_file(const char *dir, const char *name, const char *value)
+{
+    char path[512];
+    int fd;
+    int len = g_strlen(value);
+    int rv = 1;
+
+    g_snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((fd = g_file_open_ex(path, 0, 1, 0, 0)) < 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "Can't open %s [%s]", path, g_get_strerror());
+    }
+    else
+    {
+        if (g_file_write(fd, value, len) == len)
+        {
+            rv = 0;
+        }
+        else
+        {
+            LOG(LOG_LEVEL_WARNING, "Can't write '%s' to %s [%s]",
+                value, path, g_get_strerror());
+        }
+        g_file_close(fd);
+    }
+
+    return rv;
+}
+
+/******************************************************************************/
+/**
+ * Reads a cgroup interface file
+ *
+ * @return 0 for success. The result is always terminated
+ */
+static int
+read_cgroup_file(const char *dir, const char *name,
+                 char *buff, unsigned int buff_size)
+{
+    char path[512];
+    int fd;
+    int len = -1;
+
+    g_snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((fd = g_file_open_ro(path)) >= 0)
+    {
+        len = g_file_read(fd, buff, buff_size - 1);
+        g_file_close(fd);
+    }
+    buff[(len > 0) ? len : 0] = '\0';
+
+    return (len > 0) ? 0 : 1;
+}
+
+/******************************************************************************/
+/**
+ * Sets the limits from the configuration on a new session cgroup
+ */
+static void
+set_session_limits(const struct config_sessions *cfg, const char *dir)
+{
+    char value[64];
+
+    if (cfg->cpu_weight > 0)
+    {
+        g_snprintf(value, sizeof(value), "%u", cfg->cpu_weight);
+        (void)write_cgroup_file(dir, "cpu.weight", value);
+    }
+    if (cfg->memory_high > 0)
+    {
+        g_snprintf(value, sizeof(value), "%llu",
+                   (unsigned long long)cfg->memory_high * 1024 * 1024);
+        (void)write_cgroup_file(dir, "memory.high", value);
+    }
+    if (cfg->memory_max > 0)
+    {
+        g_snprintf(value, sizeof(value), "%llu",
+                   (unsigned long long)cfg->memory_max * 1024 * 1024);
+        (void)write_cgroup_file(dir, "memory.max", value);
+    }
+}
+
+/******************************************************************************/
+int
+sesman_cgroup_init(const struct config_sessions *cfg)
+{
+    if (cfg->cgroup_path == NULL)
+    {
+        return 0;
+    }
+
+    if (!g_directory_exist(cfg->cgroup_path) &&
+            !g_create_dir(cfg->cgroup_path))
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't create cgroup %s [%s]",
+            cfg->cgroup_path, g_get_strerror());
+        return 1;
+    }
+
+    /* Make the controllers available to the session cgroups. These are
+     * written separately, as one may not be available to us */
+    (void)write_cgroup_file(cfg->cgroup_path, "cgroup.subtree_control",
+                            "+cpu");
+    (void)write_cgroup_file(cfg->cgroup_path, "cgroup.subtree_control",
+                            "+memory");
+
+    return 0;
+}
+
+/******************************************************************************/
+int
+sesman_cgroup_add_process(const struct config_sessions *cfg,
+                          int sid, int pid)
+{
+    char dir[512];
+    char value[32];
+
+    if (cfg->cgroup_path == NULL)
+    {
+        return 0;
+    }
+
+    get_session_cgroup(cfg, sid, dir, sizeof(dir));
+    if (!g_directory_exist(dir))
+    {
+        if (!g_create_dir(dir))
+        {
+            LOG(LOG_LEVEL_ERROR, "Can't create cgroup %s [%s]",
+                dir, g_get_strerror());
+            return 1;
+        }
+        set_session_limits(cfg, dir);
+    }
+
+    g_snprintf(value, sizeof(value), "%d", pid);
+    if (write_cgroup_file(dir, "cgroup.procs", value) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't move process %d to cgroup %s",
+            pid, dir);
+        return 1;
+    }
+
+    LOG(LOG_LEVEL_DEBUG, "Moved process %d to cgroup %s", pid, dir);
+    return 0;
+}
+
+/******************************************************************************/
+int
+sesman_cgroup_get_usage(const struct config_sessions *cfg, int sid,
+                        struct sesman_cgroup_usage *usage)
+{
+    char dir[512];
+    char buff[1024];
+    const char *p;
+
+    usage->cpu_usec = 0;
+    usage->memory_bytes = 0;
+
+    if (cfg->cgroup_path == NULL)
+    {
+        return 1;
+    }
+
+    get_session_cgroup(cfg, sid, dir, sizeof(dir));
+
+    /* cpu.stat is always present, whether or not the cpu controller
+     * is enabled */
+    if (read_cgroup_file(dir, "cpu.stat", buff, sizeof(buff)) != 0)
+    {
+        return 1;
+    }
+    if ((p = g_strstr(buff, "usage_usec ")) != NULL)
+    {
+        usage->cpu_usec = strtoull(p + 11, NULL, 10);
+    }
+
+    /* memory.current needs the memory controller */
+    if (read_cgroup_file(dir, "memory.current", buff, sizeof(buff)) == 0)
+    {
+        usage->memory_bytes = strtoull(buff, NULL, 10);
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/**
+ * Tries to remove the cgroup for a session
+ *
+ * @return 0 if the cgroup has gone, or never existed
+ */
+static int
+remove_session_cgroup(const struct config_sessions *cfg, int sid)
+{
+    char dir[512];
+
+    get_session_cgroup(cfg, sid, dir, sizeof(dir));
+    if (!g_directory_exist(dir))
+    {
+        return 0;
+    }
+    if (!g_remove_dir(dir))
+    {
+        /* There are still processes in the cgroup */
+        LOG(LOG_LEVEL_DEBUG, "Can't remove cgroup %s yet [%s]",
+            dir, g_get_strerror());
+        return 1;
+    }
+    LOG(LOG_LEVEL_DEBUG, "Removed cgroup %s", dir);
+    return 0;
+}
+
+/******************************************************************************/
+void
+sesman_cgroup_process_child_exit(const struct config_sessions *cfg, int pid)
+{
+    int i;
+
+    if (cfg->cgroup_path == NULL)
+    {
+        return;
+    }
+
+    if (g_stale_cgroups != NULL)
+    {
+        for (i = g_stale_cgroups->count - 1 ; i >= 0 ; --i)
+        {
+            int sid = (int)list_get_item(g_stale_cgroups, i);
+            if (remove_session_cgroup(cfg, sid) == 0)
+            {
+                list_remove_item(g_stale_cgroups, i);
+            }
+        }
+    }
+
+    if (remove_session_cgroup(cfg, pid) != 0)
+    {
+        if (g_stale_cgroups == NULL)
+        {
+            g_stale_cgroups = list_create();
+        }
+        if (g_stale_cgroups != NULL)
+        {
+            list_add_item(g_stale_cgroups, (tintptr)pid);
+        }
+    }
+}
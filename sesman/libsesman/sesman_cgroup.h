@@ -0,0 +1,98 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file sesman_cgroup.h
+ * @brief Per-session cgroups
+ *
+ * If CgroupPath is set in sesman.ini, each session is given a cgroup v2
+ * directory under that path. The cgroup is named after the session ID
+ * (the PID of the sesexec process for the session). The CPU and memory
+ * limits for the session are set on the cgroup, and the kernel
+ * accounts the resources used by the session to it.
+ *
+ */
+
+#ifndef SESMAN_CGROUP_H
+#define SESMAN_CGROUP_H
+
+#include <stdint.h>
+
+struct config_sessions;
+
+/**
+ * Resources used by a session
+ */
+struct sesman_cgroup_usage
+{
+    uint64_t cpu_usec; ///< CPU time used
+    uint64_t memory_bytes; ///< Memory currently in use
+};
+
+/**
+ * Creates the directory for the session cgroups
+ *
+ * @param cfg Session configuration
+ * @return 0 for success, or if cgroups are not configured
+ *
+ * Errors are logged
+ */
+int
+sesman_cgroup_init(const struct config_sessions *cfg);
+
+/**
+ * Moves a process into the cgroup for a session
+ *
+ * The cgroup is created, and its limits set, if it doesn't exist.
+ *
+ * @param cfg Session configuration
+ * @param sid Session ID
+ * @param pid Process to move
+ * @return 0 for success, or if cgroups are not configured
+ *
+ * Errors are logged
+ */
+int
+sesman_cgroup_add_process(const struct config_sessions *cfg,
+                          int sid, int pid);
+
+/**
+ * Gets the resources used by a session
+ *
+ * @param cfg Session configuration
+ * @param sid Session ID
+ * @param[out] usage Resources used
+ * @return 0 for success
+ */
+int
+sesman_cgroup_get_usage(const struct config_sessions *cfg, int sid,
+                        struct sesman_cgroup_usage *usage);
+
+/**
+ * Processes the exit of a child process of sesman
+ *
+ * If the child is a sesexec process, the cgroup for its session is
+ * removed. Cgroups which still contained processes the last time this
+ * was called are tried again.
+ *
+ * @param cfg Session configuration
+ * @param pid PID of the child
+ */
+void
+sesman_cgroup_process_child_exit(const struct config_sessions *cfg, int pid);
+
+#endif /* SESMAN_CGROUP_H */
@@ -80,6 +80,13 @@
 #define SESMAN_CFG_SESS_DISC_LIMIT   "DisconnectedTimeLimit"
 #define SESMAN_CFG_SESS_X11DISPLAYOFFSET "X11DisplayOffset"
 #define SESMAN_CFG_SESS_MAX_DISPLAY  "MaxDisplayNumber"
+#define SESMAN_CFG_SESS_XORG_POOL_SIZE "XorgPoolSize"
+#define SESMAN_CFG_SESS_XORG_POOL_USERS "XorgPoolUsers"
+#define SESMAN_CFG_SESS_XORG_POOL_IDLE "XorgPoolIdleTimeout"
+#define SESMAN_CFG_SESS_CGROUP_PATH "CgroupPath"
+#define SESMAN_CFG_SESS_CPU_WEIGHT "SessionCpuWeight"
+#define SESMAN_CFG_SESS_MEMORY_HIGH "SessionMemoryHigh"
+#define SESMAN_CFG_SESS_MEMORY_MAX "SessionMemoryMax"
 
 #define SESMAN_CFG_SESS_POLICY_S "Policy"
 #define SESMAN_CFG_SESS_POLICY_DFLT_S "Default"
@@ -422,6 +429,13 @@ config_read_sessions(int file, struct config_sessions *se, struct list *param_n,
     se->max_disc_time = 0;
     se->kill_disconnected = 0;
     se->policy = SESMAN_CFG_SESS_POLICY_DEFAULT;
+    se->xorg_pool_size = 0;
+    se->xorg_pool_users = NULL;
+    se->xorg_pool_idle_timeout = 0;
+    se->cgroup_path = NULL;
+    se->cpu_weight = 0;
+    se->memory_high = 0;
+    se->memory_max = 0;
 
     file_read_section(file, SESMAN_CFG_SESSIONS, param_n, param_v);
 
@@ -476,6 +490,72 @@ config_read_sessions(int file, struct config_sessions *se, struct list *param_n,
         {
             se->policy = parse_policy_string(value);
         }
+
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_XORG_POOL_SIZE))
+        {
+            int ps = g_atoi(value);
+            if (ps >= 0)
+            {
+                se->xorg_pool_size = ps;
+            }
+        }
+
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_XORG_POOL_USERS))
+        {
+            list_delete(se->xorg_pool_users);
+            se->xorg_pool_users = split_string_into_list(value, ',');
+            if (se->xorg_pool_users != NULL)
+            {
+                int j;
+                for (j = 0 ; j < se->xorg_pool_users->count ; ++j)
+                {
+                    g_strtrim((char *)list_get_item(se->xorg_pool_users, j), 3);
+                }
+            }
+        }
+
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_XORG_POOL_IDLE))
+        {
+            int it = g_atoi(value);
+            if (it >= 0)
+            {
+                se->xorg_pool_idle_timeout = it;
+            }
+        }
+
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_CGROUP_PATH))
+        {
+            g_free(se->cgroup_path);
+            se->cgroup_path = (value[0] == '\0') ? NULL : g_strdup(value);
+        }
+
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_CPU_WEIGHT))
+        {
+            /* See the cgroup v2 documentation for the range */
+            int cw = g_atoi(value);
+            if (cw >= 1 && cw <= 10000)
+            {
+                se->cpu_weight = cw;
+            }
+        }
+
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_MEMORY_HIGH))
+        {
+            int mh = g_atoi(value);
+            if (mh >= 0)
+            {
+                se->memory_high = mh;
+            }
+        }
+
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_MEMORY_MAX))
+        {
+            int mm = g_atoi(value);
+            if (mm >= 0)
+            {
+                se->memory_max = mm;
+            }
+        }
     }
 
     return 0;
@@ -667,6 +747,25 @@ config_dump(struct config_sesman *config)
     g_writeln("    IdleTimeLimit:            %d", se->max_idle_time);
     g_writeln("    DisconnectedTimeLimit:    %d", se->max_disc_time);
     g_writeln("    Policy:                   %s", policy_s);
+    g_writeln("    XorgPoolSize:             %d", se->xorg_pool_size);
+    if (se->xorg_pool_users == NULL || se->xorg_pool_users->count == 0)
+    {
+        g_writeln("    XorgPoolUsers:            (none)");
+    }
+    else
+    {
+        for (i = 0; i < se->xorg_pool_users->count; i++)
+        {
+            g_writeln("    XorgPoolUser %02d:          %s", i,
+                      (char *) list_get_item(se->xorg_pool_users, i));
+        }
+    }
+    g_writeln("    XorgPoolIdleTimeout:      %d", se->xorg_pool_idle_timeout);
+    g_writeln("    CgroupPath:               %s",
+              (se->cgroup_path ? se->cgroup_path : "(none)"));
+    g_writeln("    SessionCpuWeight:         %u", se->cpu_weight);
+    g_writeln("    SessionMemoryHigh:        %u", se->memory_high);
+    g_writeln("    SessionMemoryMax:         %u", se->memory_max);
 
     /* Security configuration */
     g_writeln("Security configuration:");
@@ -745,6 +844,8 @@ config_free(struct config_sesman *cs)
         g_free(cs->sec.ts_users);
         g_free(cs->sec.ts_admins);
         g_free(cs->sec.session_sockdir_group);
+        list_delete(cs->sess.xorg_pool_users);
+        g_free(cs->sess.cgroup_path);
         g_free(cs);
     }
 }
@@ -158,6 +158,41 @@ struct config_sessions
      * @brief session allocation policy
      */
     unsigned int policy;
+    /**
+     * @var xorg_pool_size
+     * @brief number of idle Xorg servers to keep started. 0 for none
+     */
+    unsigned int xorg_pool_size;
+    /**
+     * @var xorg_pool_users
+     * @brief users the pooled Xorg servers run as, one per server
+     */
+    struct list *xorg_pool_users;
+    /**
+     * @var xorg_pool_idle_timeout
+     * @brief seconds an unused pooled server is kept. 0 for no limit
+     */
+    int xorg_pool_idle_timeout;
+    /**
+     * @var cgroup_path
+     * @brief cgroup v2 directory for session cgroups. NULL for none
+     */
+    char *cgroup_path;
+    /**
+     * @var cpu_weight
+     * @brief cpu.weight for each session cgroup. 0 for the default
+     */
+    unsigned int cpu_weight;
+    /**
+     * @var memory_high
+     * @brief memory.high for each session cgroup in MiB. 0 for no limit
+     */
+    unsigned int memory_high;
+    /**
+     * @var memory_max
+     * @brief memory.max for each session cgroup in MiB. 0 for no limit
+     */
+    unsigned int memory_max;
 };
 
 /**
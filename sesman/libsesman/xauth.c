@@ -34,18 +34,55 @@
 #include "string_calls.h"
 
 
+/******************************************************************************/
+/* Checks a cookie is a hex string of the right length */
+static int
+is_valid_cookie(const char *cookie_str)
+{
+    unsigned int i;
+
+    for (i = 0 ; i < XAUTH_COOKIE_STR_SIZE - 1 ; ++i)
+    {
+        char c = cookie_str[i];
+        if ((c < '0' || c > '9') && (c < 'a' || c > 'f'))
+        {
+            return 0;
+        }
+    }
+
+    return cookie_str[i] == '\0';
+}
+
+/******************************************************************************/
+void
+make_xauth_cookie(char cookie_str[XAUTH_COOKIE_STR_SIZE])
+{
+    char cookie_bin[16];
+
+    g_random(cookie_bin, 16);
+    g_bytes_to_hexstr(cookie_bin, 16, cookie_str, XAUTH_COOKIE_STR_SIZE);
+}
+
 /******************************************************************************/
 int
-add_xauth_cookie(int display, const char *file)
+add_xauth_cookie(int display, const char *file, const char *cookie_str)
 {
     FILE *dp;
-    char cookie_str[33];
-    char cookie_bin[16];
+    char new_cookie_str[XAUTH_COOKIE_STR_SIZE];
     char xauth_str[256];
     int ret;
 
-    g_random(cookie_bin, 16);
-    g_bytes_to_hexstr(cookie_bin, 16, cookie_str, 33);
+    if (cookie_str == NULL)
+    {
+        make_xauth_cookie(new_cookie_str);
+        cookie_str = new_cookie_str;
+    }
+    else if (!is_valid_cookie(cookie_str))
+    {
+        /* The cookie goes on a command line */
+        LOG(LOG_LEVEL_ERROR, "Invalid xauth cookie for display %d", display);
+        return 1;
+    }
 
     g_sprintf(xauth_str, "xauth -q -f %s add :%d . %s",
               file, display, cookie_str);
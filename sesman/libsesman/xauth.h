@@ -26,16 +26,28 @@
 #ifndef XAUTH_H
 #define XAUTH_H
 
+/** Size of a cookie as a hex string, including the terminator */
+#define XAUTH_COOKIE_STR_SIZE 33
+
+/**
+ *
+ * @brief create a new random MIT-MAGIC-COOKIE-1 value
+ * @param[out] cookie_str The cookie as a hex string
+ */
+void
+make_xauth_cookie(char cookie_str[XAUTH_COOKIE_STR_SIZE]);
+
 /**
  *
  * @brief create the XAUTHORITY file for the user according to the display and the cookie
  *        xauth uses XAUTHORITY if defined, ~/.Xauthority otherwise
  * @param display The session display
  * @param file If not NULL, write the authorization in the file instead of default location
+ * @param cookie_str Cookie from make_xauth_cookie(), or NULL for a new one
  * @return 0 if adding the cookie is ok
  */
 
 int
-add_xauth_cookie(int display, const char *file);
+add_xauth_cookie(int display, const char *file, const char *cookie_str);
 
 #endif
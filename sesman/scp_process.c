@@ -45,6 +45,7 @@
 #include "sesexec_control.h"
 #include "string_calls.h"
 #include "xrdp_sockets.h"
+#include "xserver_pool.h"
 
 /******************************************************************************/
 
@@ -328,7 +329,7 @@ process_logout_request(struct pre_session_item *psi)
  *
  * Errors are logged so the caller doesn't have to
  */
-static int
+int
 create_xrdp_socket_path(uid_t uid)
 {
     // Owner all permissions, group read+execute
@@ -379,6 +380,39 @@ create_xrdp_socket_path(uid_t uid)
 #undef RWX_PERMS
 }
 
+/******************************************************************************/
+/**
+ * Allocate a display for a new session
+ *
+ * A pooled X server is used for an Xorg session if one is ready.
+ *
+ * @param uid UID of session
+ * @param type Session type
+ * @param[out] x_server_pid PID of pooled X server, or 0
+ * @param[out] xauth_cookie Cookie for pooled X server, or ""
+ * @return display, or -1 if none is available
+ */
+static int
+allocate_display(uid_t uid, enum scp_session_type type,
+                 int *x_server_pid, char *xauth_cookie)
+{
+    int display = -1;
+
+    *x_server_pid = 0;
+    xauth_cookie[0] = '\0';
+    if (type == SCP_SESSION_TYPE_XORG)
+    {
+        display = xserver_pool_take(uid, x_server_pid, xauth_cookie);
+    }
+
+    if (display < 0)
+    {
+        display = session_list_get_available_display();
+    }
+
+    return display;
+}
+
 /******************************************************************************/
 
 static int
@@ -397,6 +431,8 @@ process_create_session_request(struct pre_session_item *psi)
     int display = 0;
     struct session_item *s_item = NULL;
     int send_client_reply = 1;
+    int x_server_pid = 0;
+    char xauth_cookie[XAUTH_COOKIE_STR_SIZE] = {0};
 
     enum scp_screate_status status = E_SCP_SCREATE_OK;
 
@@ -453,7 +489,15 @@ process_create_session_request(struct pre_session_item *psi)
             {
                 status = E_SCP_SCREATE_MAX_REACHED;
             }
-            else if ((display = session_list_get_available_display()) < 0)
+            // Create a socket dir for this user. This is needed
+            // before a pooled X server can be handed over
+            else if (create_xrdp_socket_path(psi->uid) != 0)
+            {
+                status = E_SCP_SCREATE_GENERAL_ERROR;
+            }
+            else if ((display = allocate_display(psi->uid, type,
+                                                 &x_server_pid,
+                                                 xauth_cookie)) < 0)
             {
                 status = E_SCP_SCREATE_NO_DISPLAY;
             }
@@ -462,11 +506,6 @@ process_create_session_request(struct pre_session_item *psi)
             {
                 status = E_SCP_SCREATE_NO_MEMORY;
             }
-            // Create a socket dir for this user
-            else if (create_xrdp_socket_path(psi->uid) != 0)
-            {
-                status = E_SCP_SCREATE_GENERAL_ERROR;
-            }
             // Create a sesexec process if we don't have one (UDS login)
             else if (psi->sesexec_trans == NULL && sesexec_start(psi) != 0)
             {
@@ -483,7 +522,8 @@ process_create_session_request(struct pre_session_item *psi)
                                 psi->client_trans->sck,
                                 display,
                                 type, width, height,
-                                bpp, shell, directory);
+                                bpp, shell, directory,
+                                x_server_pid, xauth_cookie);
 
                 if (eicp_stat != 0)
                 {
@@ -504,16 +544,28 @@ process_create_session_request(struct pre_session_item *psi)
                                                (void *)s_item);
 
                     // Move the transport over to the session list item
-                    s_item->sesexec_trans = psi->sesexec_trans;
+                    (void)session_list_set_sesexec_trans(s_item,
+                                                         psi->sesexec_trans);
                     s_item->sesexec_pid = psi->sesexec_pid;
                     psi->sesexec_trans = NULL;
                     psi->sesexec_pid = 0;
 
                     // Add the display to the session item so we don't try
                     // to allocate it to another session
-                    s_item->display = display;
+                    (void)session_list_set_display(s_item, display);
                 }
             }
+
+            if (x_server_pid > 0)
+            {
+                if (status != E_SCP_SCREATE_OK)
+                {
+                    // Nobody else can use the pooled X server now
+                    g_sigterm(x_server_pid);
+                }
+                // Replace the pooled X server we've used
+                xserver_pool_fill();
+            }
         }
 
         // Currently a create session request is the last thing on a
@@ -578,6 +630,50 @@ process_list_sessions_request(struct pre_session_item *psi)
 
 /******************************************************************************/
 
+static int
+process_session_usage_request(struct pre_session_item *psi)
+{
+    int rv = 0;
+
+    struct scp_session_usage *usage = NULL;
+    unsigned int cnt = 0;
+    unsigned int i;
+
+    if (psi->login_state == E_PS_LOGIN_NOT_LOGGED_IN)
+    {
+        rv = scp_send_session_usage_response(psi->client_trans,
+                                             E_SCP_LS_NOT_LOGGED_IN,
+                                             NULL);
+    }
+    else
+    {
+        LOG(LOG_LEVEL_INFO,
+            "Received request from %s for session usage for user %s",
+            psi->peername, psi->username);
+
+        usage = session_list_get_usage(psi->uid, &cnt);
+
+        for (i = 0; rv == 0 && i < cnt; ++i)
+        {
+            rv = scp_send_session_usage_response(psi->client_trans,
+                                                 E_SCP_LS_SESSION_INFO,
+                                                 &usage[i]);
+        }
+        g_free(usage);
+
+        if (rv == 0)
+        {
+            rv = scp_send_session_usage_response(psi->client_trans,
+                                                 E_SCP_LS_END_OF_LIST,
+                                                 NULL);
+        }
+    }
+
+    return rv;
+}
+
+/******************************************************************************/
+
 static int
 process_close_connection_request(struct pre_session_item *psi)
 {
@@ -629,6 +725,10 @@ scp_process(struct pre_session_item *psi)
             rv = process_close_connection_request(psi);
             break;
 
+        case E_SCP_SESSION_USAGE_REQUEST:
+            rv = process_session_usage_request(psi);
+            break;
+
         default:
         {
             char buff[64];
@@ -27,8 +27,21 @@
 #ifndef SCP_PROCESS_H
 #define SCP_PROCESS_H
 
+#include <sys/types.h>
+
 struct pre_session_item;
 
+/**
+ * Create xrdp socket path for a user
+ *
+ * @param uid UID of user
+ * @return 0 for success
+ *
+ * Errors are logged so the caller doesn't have to
+ */
+int
+create_xrdp_socket_path(uid_t uid);
+
 /**
  *
  * @brief Processes an SCP message
@@ -99,12 +99,15 @@ handle_create_session_request(struct trans *self)
     int scp_fd;
     struct session_parameters sp = {0};
     int rv;
+    int x_server_pid;
 
     rv = eicp_get_create_session_request(self, &scp_fd, &sp.display,
                                          &sp.type, &sp.width, &sp.height,
-                                         &sp.bpp, &sp.shell, &sp.directory);
+                                         &sp.bpp, &sp.shell, &sp.directory,
+                                         &x_server_pid, &sp.xauth_cookie);
     if (rv == 0)
     {
+        sp.x_server_pid = x_server_pid;
         // Need to talk to the SCP client
         struct trans *scp_trans;
         scp_trans = scp_init_trans_from_fd(scp_fd, TRANS_TYPE_SERVER,
@@ -160,6 +163,12 @@ handle_create_session_request(struct trans *self)
             }
             else
             {
+                if (sp.x_server_pid > 0)
+                {
+                    /* Nobody else can use a pooled X server once it's
+                     * been handed to us */
+                    g_sigterm(sp.x_server_pid);
+                }
                 rv = ercp_send_session_finished_event(self);
                 sesexec_terminate_main_loop(1);
             }
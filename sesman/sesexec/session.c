@@ -39,6 +39,7 @@
 #include "session.h"
 
 #include "sesman_auth.h"
+#include "sesman_cgroup.h"
 #include "sesman_config.h"
 #include "env.h"
 #include "guid.h"
@@ -53,6 +54,10 @@
 #include "xwait.h"
 #include "xrdp_sockets.h"
 
+/* Write end of the -displayfd pipe for an Xorg server we're starting.
+ * It's passed here as start_x_server() runs in a forked child */
+static int g_displayfd = -1;
+
 struct session_data
 {
     pid_t x_server; ///< PID of X server
@@ -82,6 +87,7 @@ session_data_new(const struct session_parameters *sp)
     // What string length do we need?
     string_length += g_strlen(sp->shell) + 1;
     string_length += g_strlen(sp->directory) + 1;
+    string_length += g_strlen(sp->xauth_cookie) + 1;
 
     struct session_data *sd = (struct session_data *)g_malloc(sizeof(*sd) + string_length, 0);
 
@@ -109,6 +115,7 @@ session_data_new(const struct session_parameters *sp)
 
         COPY_STRING(sd->params.shell, sp->shell);
         COPY_STRING(sd->params.directory, sp->directory);
+        COPY_STRING(sd->params.xauth_cookie, sp->xauth_cookie);
 
 #undef COPY_STRING
     }
@@ -380,6 +387,13 @@ prepare_xorg_xserver_params(const struct session_parameters *s,
                               "-auth", authfile,
                               NULL);
 
+        /* The X server tells us when it's ready on this */
+        if (g_displayfd >= 0)
+        {
+            g_snprintf(text, sizeof(text), "%d", g_displayfd);
+            list_add_strdup_multi(params, "-displayfd", text, NULL);
+        }
+
         /* additional parameters from sesman.ini file */
         list_append_list_strdup(g_cfg->xorg_params, params, 1);
     }
@@ -431,6 +445,22 @@ prepare_xvnc_xserver_params(const struct session_parameters *s,
     return params;
 }
 
+/******************************************************************************/
+/* Gets the file to store xauth information in, once env_set_user() has
+ * been called */
+static void
+get_xauth_file(char *authfile, int authfile_size)
+{
+    if (g_getenv("XAUTHORITY") != NULL)
+    {
+        g_snprintf(authfile, authfile_size, "%s", g_getenv("XAUTHORITY"));
+    }
+    else
+    {
+        g_snprintf(authfile, authfile_size, "%s", ".Xauthority");
+    }
+}
+
 /******************************************************************************/
 /* Either execs the X server, or returns */
 static void
@@ -461,18 +491,10 @@ start_x_server(struct login_info *login_info,
     }
 
     /* prepare the Xauthority stuff */
-    if (g_getenv("XAUTHORITY") != NULL)
-    {
-        g_snprintf(authfile, sizeof(authfile), "%s",
-                   g_getenv("XAUTHORITY"));
-    }
-    else
-    {
-        g_snprintf(authfile, sizeof(authfile), "%s", ".Xauthority");
-    }
+    get_xauth_file(authfile, sizeof(authfile));
 
     /* Add the entry in XAUTHORITY file or exit if error */
-    if (add_xauth_cookie(s->display, authfile) != 0)
+    if (add_xauth_cookie(s->display, authfile, NULL) != 0)
     {
         LOG(LOG_LEVEL_ERROR,
             "Error setting the xauth cookie for display %u in file %s",
@@ -526,6 +548,33 @@ start_x_server(struct login_info *login_info,
         s->display);
 }
 
+/******************************************************************************/
+/* Gives the user the cookie for a pooled X server. Exits on error */
+static void
+add_pooled_xauth_cookie(struct login_info *login_info,
+                        const struct session_parameters *s)
+{
+    char authfile[256];
+
+    if (env_set_user(login_info->uid,
+                     0,
+                     s->display,
+                     g_cfg->env_names,
+                     g_cfg->env_values) != 0)
+    {
+        g_exit(1);
+    }
+
+    get_xauth_file(authfile, sizeof(authfile));
+    if (add_xauth_cookie(s->display, authfile, s->xauth_cookie) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR,
+            "Error setting the xauth cookie for display %u in file %s",
+            s->display, authfile);
+        g_exit(1);
+    }
+}
+
 /******************************************************************************/
 /*
  * Simple helper process to fork a child and log errors */
@@ -556,6 +605,143 @@ fork_child(
     return pid;
 }
 
+/******************************************************************************/
+/**
+ * Starts the X server for a session, and waits for it to be ready
+ *
+ * @param login_info info for logged in user
+ * @param s Session parameters
+ * @param[out] display_pid PID of the X server
+ * @return status
+ */
+static enum scp_screate_status
+run_x_server(struct login_info *login_info,
+             const struct session_parameters *s,
+             int *display_pid)
+{
+    enum scp_screate_status status = E_SCP_SCREATE_GENERAL_ERROR;
+    int displayfd[2] = {-1, -1};
+
+    /* Xorg can tell us when it's ready, rather than us polling it */
+    if (s->type == SCP_SESSION_TYPE_XORG)
+    {
+        if (g_pipe(displayfd) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "Can't create pipe for -displayfd [%s]",
+                g_get_strerror());
+            displayfd[0] = -1;
+            displayfd[1] = -1;
+        }
+        else
+        {
+            g_file_set_cloexec(displayfd[0], 1);
+        }
+    }
+
+    /* start the X server in a new process group.
+     *
+     * We group the X server, window manager and chansrv in a single
+     * process group, as it allows signals to be sent to the user session
+     * without affecting sesexec (and vice-versa). This is particularly
+     * important when debugging sesexec as we don't want a SIGINT in
+     * the debugger to be passed to the children */
+    g_displayfd = displayfd[1];
+    *display_pid = fork_child(start_x_server, login_info, s, 0);
+    g_displayfd = -1;
+    if (displayfd[1] >= 0)
+    {
+        /* Only the X server should have this open */
+        g_file_close(displayfd[1]);
+    }
+
+    if (*display_pid > 0)
+    {
+        enum xwait_status xws;
+        xws = wait_for_xserver(login_info->uid,
+                               g_cfg->env_names,
+                               g_cfg->env_values,
+                               s->display,
+                               displayfd[0]);
+
+        if (xws != XW_STATUS_OK)
+        {
+            switch (xws)
+            {
+                case XW_STATUS_TIMED_OUT:
+                    LOG(LOG_LEVEL_ERROR, "Timed out waiting for X server");
+                    break;
+                case XW_STATUS_FAILED_TO_START:
+                    LOG(LOG_LEVEL_ERROR, "X server failed to start");
+                    break;
+                default:
+                    LOG(LOG_LEVEL_ERROR,
+                        "An error occurred waiting for the X server");
+            }
+            status = E_SCP_SCREATE_X_SERVER_FAIL;
+            /* Kill it anyway in case it did start and we just failed to
+             * pick up on it */
+            g_sigterm(*display_pid);
+            g_waitpid(*display_pid);
+        }
+        else
+        {
+            LOG(LOG_LEVEL_INFO, "X server :%d is working", s->display);
+            status = E_SCP_SCREATE_OK;
+        }
+    }
+
+    if (displayfd[0] >= 0)
+    {
+        g_file_close(displayfd[0]);
+    }
+
+    return status;
+}
+
+/******************************************************************************/
+/**
+ * Takes over an X server started by sesman from its pool
+ *
+ * The X server is already running as the pool user, so all that's
+ * needed is to give the user the cookie for it. sesman has already
+ * moved the xorgxrdp sockets into the user's socket directory.
+ *
+ * @param login_info info for logged in user
+ * @param s Session parameters
+ * @param[out] display_pid PID of the X server
+ * @return status
+ */
+static enum scp_screate_status
+adopt_pooled_x_server(struct login_info *login_info,
+                      const struct session_parameters *s,
+                      int *display_pid)
+{
+    enum scp_screate_status status = E_SCP_SCREATE_X_SERVER_FAIL;
+    int pid;
+
+    pid = fork_child(add_pooled_xauth_cookie, login_info, s, -1);
+    if (pid > 0)
+    {
+        struct proc_exit_status e = g_waitpid_status(pid);
+        if (e.reason != E_PXR_STATUS_CODE || e.val != 0)
+        {
+            LOG(LOG_LEVEL_ERROR,
+                "Can't pass pooled X server :%d to the user", s->display);
+        }
+        else
+        {
+            LOG(LOG_LEVEL_INFO, "Using pooled X server (pid %d) on display :%d",
+                (int)s->x_server_pid, s->display);
+            *display_pid = s->x_server_pid;
+            (void)sesman_cgroup_add_process(&g_cfg->sess, g_getpid(),
+                                            s->x_server_pid);
+            status = E_SCP_SCREATE_OK;
+        }
+    }
+
+    return status;
+}
+
 /******************************************************************************/
 static enum scp_screate_status
 session_start_wrapped(struct login_info *login_info,
@@ -563,9 +749,10 @@ session_start_wrapped(struct login_info *login_info,
                       struct session_data *sd)
 {
     int chansrv_pid;
-    int display_pid;
+    int display_pid = -1;
     int window_manager_pid;
-    enum scp_screate_status status = E_SCP_SCREATE_GENERAL_ERROR;
+    int group_pid;
+    enum scp_screate_status status;
 
     if (auth_start_session(login_info->auth_info, s->display) != 0)
     {
@@ -606,77 +793,62 @@ session_start_wrapped(struct login_info *login_info,
     }
 #endif
 
-    /* start the X server in a new process group.
-     *
-     * We group the X server, window manager and chansrv in a single
-     * process group, as it allows signals to be sent to the user session
-     * without affecting sesexec (and vice-versa). This is particularly
-     * important when debugging sesexec as we don't want a SIGINT in
-     * the debugger to be passed to the children */
-    display_pid = fork_child(start_x_server, login_info, s, 0);
-    if (display_pid > 0)
+    /* Everything we start from now on is part of the session */
+    (void)sesman_cgroup_add_process(&g_cfg->sess, g_getpid(), g_getpid());
+
+    if (s->x_server_pid > 0)
     {
-        enum xwait_status xws;
-        xws = wait_for_xserver(login_info->uid,
-                               g_cfg->env_names,
-                               g_cfg->env_values,
-                               s->display);
+        status = adopt_pooled_x_server(login_info, s, &display_pid);
+        /* The pooled X server isn't our child, so it can't lead the
+         * process group for the session */
+        group_pid = 0;
+    }
+    else
+    {
+        status = run_x_server(login_info, s, &display_pid);
+        group_pid = display_pid;
+    }
 
-        if (xws != XW_STATUS_OK)
+    if (status == E_SCP_SCREATE_OK)
+    {
+        LOG(LOG_LEVEL_INFO, "Starting window manager for display :%d",
+            s->display);
+
+        window_manager_pid = fork_child(start_window_manager,
+                                        login_info, s, group_pid);
+        if (window_manager_pid < 0)
         {
-            switch (xws)
+            g_sigterm(display_pid);
+            if (s->x_server_pid <= 0)
             {
-                case XW_STATUS_TIMED_OUT:
-                    LOG(LOG_LEVEL_ERROR, "Timed out waiting for X server");
-                    break;
-                case XW_STATUS_FAILED_TO_START:
-                    LOG(LOG_LEVEL_ERROR, "X server failed to start");
-                    break;
-                default:
-                    LOG(LOG_LEVEL_ERROR,
-                        "An error occurred waiting for the X server");
+                g_waitpid(display_pid);
             }
-            status = E_SCP_SCREATE_X_SERVER_FAIL;
-            /* Kill it anyway in case it did start and we just failed to
-             * pick up on it */
-            g_sigterm(display_pid);
-            g_waitpid(display_pid);
+            status = E_SCP_SCREATE_GENERAL_ERROR;
         }
         else
         {
-            LOG(LOG_LEVEL_INFO, "X server :%d is working", s->display);
-            LOG(LOG_LEVEL_INFO, "Starting window manager for display :%d",
-                s->display);
-
-            window_manager_pid = fork_child(start_window_manager,
-                                            login_info, s, display_pid);
-            if (window_manager_pid < 0)
+            if (group_pid == 0)
             {
-                g_sigterm(display_pid);
-                g_waitpid(display_pid);
+                group_pid = window_manager_pid;
             }
-            else
-            {
-                utmp_login(window_manager_pid, s->display, login_info);
-                LOG(LOG_LEVEL_INFO,
-                    "Starting the xrdp channel server for display :%d",
-                    s->display);
+            utmp_login(window_manager_pid, s->display, login_info);
+            LOG(LOG_LEVEL_INFO,
+                "Starting the xrdp channel server for display :%d",
+                s->display);
 
-                chansrv_pid = fork_child(start_chansrv, login_info,
-                                         s, display_pid);
+            chansrv_pid = fork_child(start_chansrv, login_info,
+                                     s, group_pid);
 
-                // Tell the caller we've started
-                LOG(LOG_LEVEL_INFO,
-                    "Session in progress on display :%d. Waiting until the "
-                    "window manager (pid %d) exits to end the session",
-                    s->display, window_manager_pid);
-
-                sd->win_mgr = window_manager_pid;
-                sd->x_server = display_pid;
-                sd->chansrv = chansrv_pid;
-                sd->start_time = g_time1();
-                status = E_SCP_SCREATE_OK;
-            }
+            // Tell the caller we've started
+            LOG(LOG_LEVEL_INFO,
+                "Session in progress on display :%d. Waiting until the "
+                "window manager (pid %d) exits to end the session",
+                s->display, window_manager_pid);
+
+            sd->win_mgr = window_manager_pid;
+            sd->x_server = display_pid;
+            sd->chansrv = chansrv_pid;
+            sd->start_time = g_time1();
         }
     }
 
@@ -896,6 +1068,11 @@ session_process_child_exit(struct session_data *sd,
             LOG(LOG_LEVEL_INFO, "Terminating X server (pid %d) on display :%d",
                 sd->x_server, sd->params.display);
             g_sigterm(sd->x_server);
+            if (sd->params.x_server_pid > 0)
+            {
+                /* A pooled X server is reaped by sesman, not us */
+                sd->x_server = -1;
+            }
         }
 
         if (sd->chansrv > 0)
@@ -977,8 +1154,11 @@ void
 session_reconnect(struct login_info *login_info,
                   struct session_data *sd)
 {
+    pid_t group_pid;
+
+    group_pid = (sd->params.x_server_pid > 0) ? sd->win_mgr : sd->x_server;
     if (fork_child(start_reconnect_script,
-                   login_info, &sd->params, sd->x_server) < 0)
+                   login_info, &sd->params, group_pid) < 0)
     {
         LOG(LOG_LEVEL_ERROR, "Failed to fork for session reconnection script");
     }
@@ -28,6 +28,7 @@
 #ifndef SESSION_H
 #define SESSION_H
 
+#include <sys/types.h>
 #include <time.h>
 
 #include "guid.h"
@@ -50,6 +51,8 @@ struct session_parameters
     struct guid guid;
     const char *shell;  // Must not be NULL
     const char *directory;  // Must not be NULL
+    pid_t x_server_pid; // Pooled X server already on display, or 0
+    const char *xauth_cookie; // Cookie for pooled X server. Must not be NULL
 };
 
 
@@ -11,6 +11,9 @@
 #include <stdio.h>
 #include <string.h>
 
+/* Time we'll wait for an X server to notify us with -displayfd */
+#define DISPLAYFD_WAIT 30000
+
 /******************************************************************************/
 static void
 log_waitforx_messages(FILE *dp)
@@ -78,11 +81,45 @@ make_xwait_command(int display)
 }
 
 /******************************************************************************/
-enum xwait_status
-wait_for_xserver(uid_t uid,
-                 struct list *env_names,
-                 struct list *env_values,
-                 int display)
+/**
+ * Wait for the X server to write its display number to -displayfd
+ *
+ * The X server does this once it's accepting connections.
+ */
+static enum xwait_status
+wait_for_displayfd(int displayfd, int display)
+{
+    enum xwait_status rv = XW_STATUS_TIMED_OUT;
+    char buff[32];
+
+    LOG(LOG_LEVEL_DEBUG,
+        "Waiting for X server to start on display :%d", display);
+
+    if (g_sck_can_recv(displayfd, DISPLAYFD_WAIT))
+    {
+        if (g_file_read(displayfd, buff, sizeof(buff)) > 0)
+        {
+            rv = XW_STATUS_OK;
+        }
+        else
+        {
+            /* Pipe has been closed without a write */
+            rv = XW_STATUS_FAILED_TO_START;
+        }
+    }
+
+    return rv;
+}
+
+/******************************************************************************/
+/**
+ * Runs waitforx to check the display
+ */
+static enum xwait_status
+run_waitforx(uid_t uid,
+             struct list *env_names,
+             struct list *env_values,
+             int display)
 {
     enum xwait_status rv = XW_STATUS_MISC_ERROR;
     int fd[2] = {-1, -1};
@@ -130,8 +167,7 @@ wait_for_xserver(uid_t uid,
         else
         {
             LOG(LOG_LEVEL_DEBUG,
-                "Waiting for X server to start on display :%d",
-                display);
+                "Checking X server on display :%d", display);
 
             g_file_close(fd[1]);
             fd[1] = -1;
@@ -184,3 +220,45 @@ wait_for_xserver(uid_t uid,
 
     return rv;
 }
+
+/******************************************************************************/
+enum xwait_status
+wait_for_xserver(uid_t uid,
+                 struct list *env_names,
+                 struct list *env_values,
+                 int display,
+                 int displayfd)
+{
+    enum xwait_status rv = XW_STATUS_OK;
+    tui64 start_time = g_time_us();
+    unsigned int ready_ms = 0;
+    unsigned int total_ms;
+
+    if (displayfd >= 0)
+    {
+        rv = wait_for_displayfd(displayfd, display);
+        ready_ms = (unsigned int)((g_time_us() - start_time) / 1000);
+    }
+
+    if (rv == XW_STATUS_OK)
+    {
+        rv = run_waitforx(uid, env_names, env_values, display);
+    }
+
+    /* Logged in a fixed form so startup times can be collected from
+     * the log */
+    total_ms = (unsigned int)((g_time_us() - start_time) / 1000);
+    if (displayfd >= 0)
+    {
+        LOG(LOG_LEVEL_INFO, "wait_for_xserver: display :%d status %d "
+            "after %u ms (accepting connections after %u ms)",
+            display, (int)rv, total_ms, ready_ms);
+    }
+    else
+    {
+        LOG(LOG_LEVEL_INFO, "wait_for_xserver: display :%d status %d "
+            "after %u ms", display, (int)rv, total_ms);
+    }
+
+    return rv;
+}
@@ -18,12 +18,18 @@ enum xwait_status
  * @param env_names Environment to set for user (names)
  * @param env_values Environment to set for user (values)
  * @param display number
+ * @param displayfd Read end of a pipe passed to the X server with
+ *                  -displayfd, or -1
  * @return status
  *
+ * If displayfd is given, we wait for the X server to write to it
+ * before checking the display. If the X server exits first, we find
+ * out straight away.
  */
 enum xwait_status
 wait_for_xserver(uid_t uid,
                  struct list *env_names,
                  struct list *env_values,
-                 int display);
+                 int display,
+                 int displayfd);
 #endif
@@ -39,6 +39,7 @@
 #include "eicp_process.h"
 #include "ercp.h"
 #include "ercp_process.h"
+#include "event_loop.h"
 #include "pre_session_list.h"
 #include "session_list.h"
 #include "lock_uds.h"
@@ -46,11 +47,13 @@
 #include "scp.h"
 #include "scp_process.h"
 #include "sesexec_control.h"
+#include "sesman_cgroup.h"
 #include "sig.h"
 #include "string_calls.h"
 #include "trans.h"
 #include "xrdp_configure_options.h"
 #include "xrdp_sockets.h"
+#include "xserver_pool.h"
 
 /**
  * Maximum number of pre-session items
@@ -78,6 +81,7 @@ struct sesman_startup_params
 };
 
 struct config_sesman *g_cfg;
+struct event_loop *g_event_loop;
 static tintptr g_term_event = 0;
 static tintptr g_sigchld_event = 0;
 static tintptr g_reload_event = 0;
@@ -209,6 +213,9 @@ sesman_close_all(void)
 
     pre_session_list_cleanup();
     session_list_cleanup();
+    xserver_pool_cleanup();
+    event_loop_delete(g_event_loop);
+    g_event_loop = NULL;
 
     g_delete_wait_obj(g_reload_event);
     g_delete_wait_obj(g_sigchld_event);
@@ -458,6 +465,11 @@ sesman_main_loop(void)
     int error;
     int robjs_count;
     intptr_t robjs[1024];
+    int wobjs_count;
+    intptr_t wobjs[1024];
+    int timeout;
+    int pid;
+    struct proc_exit_status e;
 
     g_con_list = list_create();
     if (g_con_list == NULL)
@@ -465,6 +477,13 @@ sesman_main_loop(void)
         LOG(LOG_LEVEL_ERROR, "sesman_main_loop: list_create failed");
         return 1;
     }
+    g_event_loop = event_loop_create();
+    if (g_event_loop == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "sesman_main_loop: event_loop_create failed");
+        list_delete(g_con_list);
+        return 1;
+    }
     if (sesman_create_listening_transport(g_cfg) != 0)
     {
         LOG(LOG_LEVEL_ERROR,
@@ -474,10 +493,22 @@ sesman_main_loop(void)
     }
     LOG(LOG_LEVEL_INFO, "Sesman now listening on %s", g_cfg->listen_port);
 
+    if (xserver_pool_init() != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "sesman_main_loop: xserver_pool_init failed");
+        list_delete(g_con_list);
+        return 1;
+    }
+
+    /* Errors are logged. Sessions can run without cgroups */
+    (void)sesman_cgroup_init(&g_cfg->sess);
+
     error = 0;
     while (!error)
     {
         robjs_count = 0;
+        wobjs_count = 0;
+        timeout = -1;
         robjs[robjs_count++] = g_term_event;
         robjs[robjs_count++] = g_sigchld_event;
         robjs[robjs_count++] = g_reload_event;
@@ -503,15 +534,17 @@ sesman_main_loop(void)
             break;
         }
 
-        error = session_list_get_wait_objs(robjs, &robjs_count);
+        /* Session transports are registered with the event loop */
+        error = event_loop_get_wait_objs(g_event_loop, robjs, &robjs_count,
+                                         wobjs, &wobjs_count, &timeout);
         if (error != 0)
         {
             LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
-                "session_list_get_wait_objs failed");
+                "event_loop_get_wait_objs failed");
             break;
         }
 
-        if (g_obj_wait(robjs, robjs_count, NULL, 0, -1) != 0)
+        if (g_obj_wait(robjs, robjs_count, wobjs, wobjs_count, timeout) != 0)
         {
             /* should not get here */
             LOG(LOG_LEVEL_WARNING, "sesman_main_loop: "
@@ -530,9 +563,10 @@ sesman_main_loop(void)
         {
             g_reset_wait_obj(g_sigchld_event);
             // Prevent any zombies from hanging around
-            while (g_waitchild(NULL) > 0)
+            while ((pid = g_waitchild(&e)) > 0)
             {
-                ;
+                xserver_pool_process_child_exit(pid, &e);
+                sesman_cgroup_process_child_exit(&g_cfg->sess, pid);
             }
         }
 
@@ -561,11 +595,19 @@ sesman_main_loop(void)
             break;
         }
 
-        error = session_list_check_wait_objs();
+        error = event_loop_check_wait_objs(g_event_loop);
+        if (error != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
+                "event_loop_check_wait_objs failed");
+            break;
+        }
+
+        error = session_list_remove_unused();
         if (error != 0)
         {
             LOG(LOG_LEVEL_ERROR, "sesman_main_loop: "
-                "session_list_check_wait_objs failed");
+                "session_list_remove_unused failed");
             break;
         }
     }
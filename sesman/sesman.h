@@ -28,10 +28,12 @@
 #define SESMAN_H
 
 struct config_sesman;
+struct event_loop;
 struct trans;
 
 /* Globals */
 extern struct config_sesman *g_cfg;
+extern struct event_loop *g_event_loop; /* for session transports */
 
 /**
  * Close all file descriptors used by sesman.
@@ -41,7 +43,7 @@ extern struct config_sesman *g_cfg;
  *
  * This call will also :-
  * - release all trans objects held by sesman
- * - Delete sesman wait objects
+ * - Delete sesman wait objects and the event loop
  * - Call sesman_delete_listening_transport()
  */
 int
@@ -33,10 +33,14 @@
 #include "config_ac.h"
 #endif
 
+#include <stdlib.h>
+
 #include "arch.h"
 #include "session_list.h"
 #include "trans.h"
+#include "event_loop.h"
 
+#include "sesman_cgroup.h"
 #include "sesman_config.h"
 #include "list.h"
 #include "log.h"
@@ -44,14 +48,84 @@
 #include "sesman.h"
 #include "string_calls.h"
 #include "xrdp_sockets.h"
+#include "xserver_pool.h"
 
 static struct list *g_session_list = NULL;
 
+/* Bitmap of the displays reserved by sessions on the list */
+static unsigned int *g_display_map = NULL;
+static unsigned int g_display_map_words = 0;
+
+#define DISPLAY_MAP_WORD_BITS (sizeof(unsigned int) * 8)
+#define DISPLAY_MAP_WORD(d) ((d) / DISPLAY_MAP_WORD_BITS)
+#define DISPLAY_MAP_BIT(d) (1U << ((d) % DISPLAY_MAP_WORD_BITS))
+
+/* Hash chains of sessions with a known UID */
+#define UID_HASH_SIZE 256
+static struct session_item *g_uid_hash[UID_HASH_SIZE];
+
+#define UID_HASH(uid) ((unsigned int)(uid) % UID_HASH_SIZE)
+
 #define SESSION_IN_USE(si) \
     ((si) != NULL && \
      (si)->sesexec_trans != NULL && \
      (si)->sesexec_trans->status == TRANS_STATUS_UP)
 
+/******************************************************************************/
+/**
+ * Makes sure the display bitmap covers a display
+ *
+ * @param display Display number
+ * @return 0 for success
+ */
+static int
+display_map_extend(unsigned int display)
+{
+    unsigned int words = DISPLAY_MAP_WORD(display) + 1;
+
+    if (words > g_display_map_words)
+    {
+        unsigned int *map;
+        map = (unsigned int *)realloc(g_display_map,
+                                      words * sizeof(unsigned int));
+        if (map == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "Can't allocate memory for display map");
+            return 1;
+        }
+        g_memset(map + g_display_map_words, 0,
+                 (words - g_display_map_words) * sizeof(unsigned int));
+        g_display_map = map;
+        g_display_map_words = words;
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/**
+ * Removes a session from the UID hash chains
+ */
+static void
+uid_hash_remove(struct session_item *si)
+{
+    if (si->uid_indexed)
+    {
+        struct session_item **pp = &g_uid_hash[UID_HASH(si->uid)];
+        while (*pp != NULL)
+        {
+            if (*pp == si)
+            {
+                *pp = si->uid_next;
+                break;
+            }
+            pp = &(*pp)->uid_next;
+        }
+        si->uid_next = NULL;
+        si->uid_indexed = 0;
+    }
+}
+
 /******************************************************************************/
 int
 session_list_init(void)
@@ -89,6 +163,14 @@ free_session(struct session_item *si)
 {
     if (si != NULL)
     {
+        uid_hash_remove(si);
+        if (si->display >= 0 &&
+                (unsigned int)si->display < g_display_map_words *
+                DISPLAY_MAP_WORD_BITS)
+        {
+            g_display_map[DISPLAY_MAP_WORD(si->display)] &=
+                ~DISPLAY_MAP_BIT(si->display);
+        }
         if (si->sesexec_trans != NULL)
         {
             trans_delete(si->sesexec_trans);
@@ -113,6 +195,53 @@ session_list_cleanup(void)
         list_delete(g_session_list);
         g_session_list = NULL;
     }
+    g_free(g_display_map);
+    g_display_map = NULL;
+    g_display_map_words = 0;
+}
+
+/******************************************************************************/
+/**
+ * Called by the event loop when a sesexec transport is ready
+ */
+static void
+sesexec_trans_ready(struct event_loop *loop, tintptr obj, int events,
+                    void *arg)
+{
+    struct session_item *si = (struct session_item *)arg;
+    int i;
+
+    if (trans_check_wait_objs(si->sesexec_trans) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "sesexec_trans_ready: "
+            "trans_check_wait_objs failed, removing trans");
+        si->sesexec_trans->status = TRANS_STATUS_DOWN;
+    }
+
+    if (!SESSION_IN_USE(si))
+    {
+        i = list_index_of(g_session_list, (tintptr)si);
+        if (i >= 0)
+        {
+            list_remove_item(g_session_list, i);
+        }
+        free_session(si);
+    }
+}
+
+/******************************************************************************/
+int
+session_list_set_sesexec_trans(struct session_item *si, struct trans *t)
+{
+    si->sesexec_trans = t;
+    if (trans_attach_event_loop(t, g_event_loop,
+                                sesexec_trans_ready, si) != 0)
+    {
+        /* session_list_remove_unused() will tidy up */
+        t->status = TRANS_STATUS_DOWN;
+        return 1;
+    }
+    return 0;
 }
 
 /******************************************************************************/
@@ -130,6 +259,7 @@ session_list_new(void)
     if (result != NULL)
     {
         result->state = E_SESSION_STARTING;
+        result->display = -1;
         if (!list_add_item(g_session_list, (tintptr)result))
         {
             g_free(result);
@@ -206,97 +336,45 @@ x_server_running_check_ports(int display)
     return x_running;
 }
 
-/******************************************************************************/
-/* Helper function for get_sorted_display_list():qsort() */
-static int
-icmp(const void *v1, const void *v2)
-{
-    // Pointers point to unsigned ints
-    unsigned int i1 = *(unsigned int *)v1;
-    unsigned int i2 = *(unsigned int *)v2;
-    return (i1 < i2) ? -1 : (i1 > i2) ? 1 : 0;
-}
-
-/******************************************************************************/
-/**
- * Get a sorted array of all the displays allocated to sessions
- * @param[out] cnt Count of displays in list
- * @return Allocated array of displays or NULL for no memory
- *
- * Result must always be freed, even if cnt == 0
- */
-
-static unsigned int *
-get_sorted_session_displays(unsigned int *cnt)
-{
-    unsigned int *displays;
-
-    *cnt = 0;
-    displays = g_new(unsigned int, session_list_get_count() + 1);
-    if (displays == NULL)
-    {
-        LOG(LOG_LEVEL_ERROR, "Can't allocate memory for display list");
-    }
-    else if (g_session_list != NULL)
-    {
-        int i;
-
-        for (i = 0 ; i < g_session_list->count ; ++i)
-        {
-            const struct session_item *si;
-            si = (const struct session_item *)list_get_item(g_session_list, i);
-            if (SESSION_IN_USE(si) && si->display >= 0)
-            {
-                displays[(*cnt)++] = si->display;
-            }
-        }
-        qsort(displays, *cnt, sizeof(displays[0]), icmp);
-    }
-
-    return displays;
-}
-
 /******************************************************************************/
 int
 session_list_get_available_display(void)
 {
     int rv = -1;
-    unsigned int max_alloc = 0;
-
-    // Find all displays already allocated. We do this to prevent
-    // unnecessary file system accesses, and also to prevent us allocating
-    // the same display number to two callers who call in quick
-    // succession  i.e. if the first caller has not created its X server
-    // by the time we service the second request
-    unsigned int *allocated_displays = get_sorted_session_displays(&max_alloc);
-    if (allocated_displays != NULL)
-    {
-        unsigned int i = 0;
-        unsigned int display;
-
-        for (display = g_cfg->sess.x11_display_offset;
-                display <= g_cfg->sess.max_display_number;
-                ++display)
+    unsigned int display = g_cfg->sess.x11_display_offset;
+    unsigned int max_display = g_cfg->sess.max_display_number;
+
+    // Displays already allocated to sessions are marked in the display
+    // map. We skip these to prevent unnecessary file system accesses,
+    // and also to prevent us allocating the same display number to two
+    // callers who call in quick succession i.e. if the first caller has
+    // not created its X server by the time we service the second request
+    if (display_map_extend(max_display) == 0)
+    {
+        while (display <= max_display)
         {
-            // Have we already allocated this one?
-            while (i < max_alloc && display > allocated_displays[i])
-            {
-                ++i;
-            }
-            if (i < max_alloc && display == allocated_displays[i])
+            unsigned int word = g_display_map[DISPLAY_MAP_WORD(display)];
+
+            if (word == ~0U)
             {
-                continue; // Already allocated
+                // All allocated - move to the start of the next word
+                display = (DISPLAY_MAP_WORD(display) + 1) *
+                          DISPLAY_MAP_WORD_BITS;
+                continue;
             }
 
-            if (!x_server_running_check_ports(display))
+            // Displays which aren't allocated to a session may still be
+            // in use by another X server
+            if ((word & DISPLAY_MAP_BIT(display)) == 0 &&
+                    !xserver_pool_has_display(display) &&
+                    !x_server_running_check_ports(display))
             {
                 break;
             }
+            ++display;
         }
 
-        g_free(allocated_displays);
-
-        if (display > g_cfg->sess.max_display_number)
+        if (display > max_display)
         {
             LOG(LOG_LEVEL_ERROR,
                 "X server -- no display in range (%d to %d) is available",
@@ -312,6 +390,110 @@ session_list_get_available_display(void)
     return rv;
 }
 
+/******************************************************************************/
+int
+session_list_set_display(struct session_item *si, int display)
+{
+    si->display = display;
+    if (display < 0 || display_map_extend(display) != 0)
+    {
+        return 1;
+    }
+    g_display_map[DISPLAY_MAP_WORD(display)] |= DISPLAY_MAP_BIT(display);
+    return 0;
+}
+
+/******************************************************************************/
+void
+session_list_set_uid(struct session_item *si, uid_t uid)
+{
+    struct session_item **pp;
+
+    uid_hash_remove(si);
+    si->uid = uid;
+
+    // Add to the end of the chain, so sessions are found in the order
+    // they were started
+    pp = &g_uid_hash[UID_HASH(uid)];
+    while (*pp != NULL)
+    {
+        pp = &(*pp)->uid_next;
+    }
+    *pp = si;
+    si->uid_next = NULL;
+    si->uid_indexed = 1;
+}
+
+/******************************************************************************/
+/**
+ * Checks a session against the parameters for session_list_get_bydata()
+ *
+ * @return != 0 if the session matches
+ */
+static int
+session_matches(const struct session_item *si,
+                int policy,
+                uid_t uid,
+                enum scp_session_type type,
+                unsigned short width,
+                unsigned short height,
+                unsigned char  bpp,
+                const char *ip_addr)
+{
+    if (!SESSION_IN_USE(si))
+    {
+        return 0;
+    }
+
+    LOG(LOG_LEVEL_DEBUG,
+        "%s: try %p type=%s U=%d B=%d D=(%dx%d) I=%s",
+        __func__,
+        si,
+        SCP_SESSION_TYPE_TO_STR(si->type),
+        si->uid, si->bpp,
+        si->start_width, si->start_height,
+        si->start_ip_addr);
+
+    if (si->type != type)
+    {
+        LOG(LOG_LEVEL_DEBUG, "%s: Type doesn't match", __func__);
+        return 0;
+    }
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_U) && uid != si->uid)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: UID doesn't match for 'U' policy", __func__);
+        return 0;
+    }
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_B) && si->bpp != bpp)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: bpp doesn't match for 'B' policy", __func__);
+        return 0;
+    }
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_D) &&
+            (si->start_width != width ||
+             si->start_height != height))
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: Dimensions don't match for 'D' policy", __func__);
+        return 0;
+    }
+
+    if ((policy & SESMAN_CFG_SESS_POLICY_I) &&
+            g_strcmp(si->start_ip_addr, ip_addr) != 0)
+    {
+        LOG(LOG_LEVEL_DEBUG,
+            "%s: IPs don't match for 'I' policy", __func__);
+        return 0;
+    }
+
+    return 1;
+}
+
 /******************************************************************************/
 struct session_item *
 session_list_get_bydata(uid_t uid,
@@ -323,6 +505,7 @@ session_list_get_bydata(uid_t uid,
 {
     char policy_str[64];
     int policy = g_cfg->sess.policy;
+    struct session_item *si;
     int i;
 
     if (ip_addr == NULL)
@@ -354,64 +537,33 @@ session_list_get_bydata(uid_t uid,
         return NULL;
     }
 
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    if (policy & SESMAN_CFG_SESS_POLICY_U)
     {
-        struct session_item *si;
-        si = (struct session_item *)list_get_item(g_session_list, i);
-        if (!SESSION_IN_USE(si))
-        {
-            continue;
-        }
-
-        LOG(LOG_LEVEL_DEBUG,
-            "%s: try %p type=%s U=%d B=%d D=(%dx%d) I=%s",
-            __func__,
-            si,
-            SCP_SESSION_TYPE_TO_STR(si->type),
-            si->uid, si->bpp,
-            si->start_width, si->start_height,
-            si->start_ip_addr);
-
-        if (si->type != type)
-        {
-            LOG(LOG_LEVEL_DEBUG, "%s: Type doesn't match", __func__);
-            continue;
-        }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_U) && uid != si->uid)
+        /* Only the user's own sessions can match */
+        for (si = g_uid_hash[UID_HASH(uid)] ; si != NULL ; si = si->uid_next)
         {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: UID doesn't match for 'U' policy", __func__);
-            continue;
-        }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_B) && si->bpp != bpp)
-        {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: bpp doesn't match for 'B' policy", __func__);
-            continue;
-        }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_D) &&
-                (si->start_width != width ||
-                 si->start_height != height))
-        {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: Dimensions don't match for 'D' policy", __func__);
-            continue;
+            if (session_matches(si, policy, uid, type, width, height, bpp,
+                                ip_addr))
+            {
+                LOG(LOG_LEVEL_DEBUG,
+                    "%s: Got match, display=%d", __func__, si->display);
+                return si;
+            }
         }
-
-        if ((policy & SESMAN_CFG_SESS_POLICY_I) &&
-                g_strcmp(si->start_ip_addr, ip_addr) != 0)
+    }
+    else
+    {
+        for (i = 0 ; i < g_session_list->count ; ++i)
         {
-            LOG(LOG_LEVEL_DEBUG,
-                "%s: IPs don't match for 'I' policy", __func__);
-            continue;
+            si = (struct session_item *)list_get_item(g_session_list, i);
+            if (session_matches(si, policy, uid, type, width, height, bpp,
+                                ip_addr))
+            {
+                LOG(LOG_LEVEL_DEBUG,
+                    "%s: Got match, display=%d", __func__, si->display);
+                return si;
+            }
         }
-
-        LOG(LOG_LEVEL_DEBUG,
-            "%s: Got match, display=%d", __func__, si->display);
-        return si;
     }
 
     LOG(LOG_LEVEL_DEBUG, "%s: No matches found", __func__);
@@ -422,7 +574,7 @@ session_list_get_bydata(uid_t uid,
 struct scp_session_info *
 session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
 {
-    int i;
+    const struct session_item *si;
     struct scp_session_info *sess;
     int count;
     int index;
@@ -431,10 +583,8 @@ session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
 
     LOG(LOG_LEVEL_DEBUG, "searching for session by UID: %d", uid);
 
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    for (si = g_uid_hash[UID_HASH(uid)] ; si != NULL ; si = si->uid_next)
     {
-        const struct session_item *si;
-        si = (const struct session_item *)list_get_item(g_session_list, i);
         if (SESSION_IN_USE(si) && uid == si->uid)
         {
             count++;
@@ -457,11 +607,8 @@ session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
     }
 
     index = 0;
-    for (i = 0 ; i < g_session_list->count ; ++i)
+    for (si = g_uid_hash[UID_HASH(uid)] ; si != NULL ; si = si->uid_next)
     {
-        const struct session_item *si;
-        si = (const struct session_item *)list_get_item(g_session_list, i);
-
         if (SESSION_IN_USE(si) && uid == si->uid)
         {
             (sess[index]).sid = si->sesexec_pid;
@@ -490,43 +637,87 @@ session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags)
 }
 
 /******************************************************************************/
-void
-free_session_info_list(struct scp_session_info *sesslist, unsigned int cnt)
+/**
+ * Fills in a session usage record
+ */
+static void
+get_session_usage(const struct session_item *si,
+                  struct scp_session_usage *usage)
 {
-    if (sesslist != NULL && cnt > 0)
+    struct sesman_cgroup_usage cg_usage;
+
+    usage->sid = si->sesexec_pid;
+    usage->display = si->display;
+    usage->uid = si->uid;
+    usage->available = (sesman_cgroup_get_usage(&g_cfg->sess,
+                        si->sesexec_pid, &cg_usage) == 0);
+    usage->cpu_usec = usage->available ? cg_usage.cpu_usec : 0;
+    usage->memory_bytes = usage->available ? cg_usage.memory_bytes : 0;
+}
+
+/******************************************************************************/
+struct scp_session_usage *
+session_list_get_usage(uid_t uid, unsigned int *cnt)
+{
+    const struct session_item *si;
+    struct scp_session_usage *usage;
+    unsigned int count = 0;
+    int i;
+
+    *cnt = 0;
+
+    /* Allocate for the worst case. This isn't called often */
+    usage = g_new0(struct scp_session_usage, g_session_list->count + 1);
+    if (usage == NULL)
     {
-        unsigned int i;
-        for (i = 0 ; i < cnt ; ++i)
+        return NULL;
+    }
+
+    if (uid == 0)
+    {
+        for (i = 0 ; i < g_session_list->count ; ++i)
         {
-            g_free(sesslist[i].start_ip_addr);
+            si = (const struct session_item *)list_get_item(g_session_list, i);
+            if (SESSION_IN_USE(si) && si->state == E_SESSION_RUNNING)
+            {
+                get_session_usage(si, &usage[count++]);
+            }
+        }
+    }
+    else
+    {
+        for (si = g_uid_hash[UID_HASH(uid)] ; si != NULL ; si = si->uid_next)
+        {
+            if (SESSION_IN_USE(si) && uid == si->uid)
+            {
+                get_session_usage(si, &usage[count++]);
+            }
         }
     }
 
-    g_free(sesslist);
+    *cnt = count;
+    return usage;
 }
 
 /******************************************************************************/
-int
-session_list_get_wait_objs(tbus robjs[], int *robjs_count)
+void
+free_session_info_list(struct scp_session_info *sesslist, unsigned int cnt)
 {
-    int i;
-
-    for (i = 0 ; i < g_session_list->count; ++i)
+    if (sesslist != NULL && cnt > 0)
     {
-        const struct session_item *si;
-        si = (const struct session_item *)list_get_item(g_session_list, i);
-        if (SESSION_IN_USE(si))
+        unsigned int i;
+        for (i = 0 ; i < cnt ; ++i)
         {
-            robjs[(*robjs_count)++] = si->sesexec_trans->sck;
+            g_free(sesslist[i].start_ip_addr);
         }
     }
 
-    return 0;
+    g_free(sesslist);
 }
 
 /******************************************************************************/
 int
-session_list_check_wait_objs(void)
+session_list_remove_unused(void)
 {
     int i = 0;
 
@@ -534,16 +725,6 @@ session_list_check_wait_objs(void)
     {
         struct session_item *si;
         si = (struct session_item *)list_get_item(g_session_list, i);
-        if (SESSION_IN_USE(si))
-        {
-            if (trans_check_wait_objs(si->sesexec_trans) != 0)
-            {
-                LOG(LOG_LEVEL_ERROR, "sesman_check_wait_objs: "
-                    "trans_check_wait_objs failed, removing trans");
-                si->sesexec_trans->status = TRANS_STATUS_DOWN;
-            }
-        }
-
         if (SESSION_IN_USE(si))
         {
             ++i;
@@ -66,6 +66,10 @@ struct session_item
     struct guid guid;
     char start_ip_addr[MAX_PEER_ADDRSTRLEN];
     time_t start_time;
+
+    /* Private to session_list.c */
+    struct session_item *uid_next; // Next session on the UID hash chain
+    int uid_indexed; // Is the session on the UID hash chain?
 };
 
 /**
@@ -99,23 +103,61 @@ session_list_get_count(void);
  * @return pointer to new session object or NULL for no memory
  *
  * After allocating the session, you must initialise the sesexec_trans field
- * with a valid transport.
+ * with a valid transport using session_list_set_sesexec_trans().
  *
- * The session is removed by session_check_wait_objs() when the transport
- * goes down (or wasn't allocated in the first place).
+ * The session is removed when the transport goes down (or by
+ * session_list_remove_unused() if it wasn't allocated in the first place).
  */
 struct session_item *
 session_list_new(void);
 
+/**
+ * Give a session its sesexec transport
+ *
+ * The transport is waited for by the sesman event loop from now on.
+ *
+ * @param si Session item
+ * @param t Transport. This is owned by the session item after the call,
+ *          whatever the result
+ * @return 0 for success
+ */
+int
+session_list_set_sesexec_trans(struct session_item *si, struct trans *t);
+
 /**
  * Get the next available display
  *
  * The display isn't reserved until the caller has allocated a new session
- * (with session_list_new()) and put the new display in it.
+ * (with session_list_new()) and given it the new display with
+ * session_list_set_display().
  */
 int
 session_list_get_available_display(void);
 
+/**
+ * Give a session its display
+ *
+ * The display is reserved until the session is removed from the list
+ *
+ * @param si Session item
+ * @param display Display for the session
+ * @return 0 for success
+ */
+int
+session_list_set_display(struct session_item *si, int display);
+
+/**
+ * Give a session its UID
+ *
+ * The session can be found by session_list_get_bydata() and
+ * session_list_get_byuid() after this call.
+ *
+ * @param si Session item
+ * @param uid UID for the session
+ */
+void
+session_list_set_uid(struct session_item *si, uid_t uid);
+
 /**
  *
  * @brief finds a session matching the supplied parameters
@@ -143,6 +185,17 @@ session_list_get_bydata(uid_t uid,
 struct scp_session_info *
 session_list_get_byuid(uid_t uid, unsigned int *cnt, unsigned int flags);
 
+/**
+ * @brief retrieves the resources used by sessions
+ * @param uid the UID for the sessions. 0 (root) for all sessions
+ * @param[out] cnt The number of sessions returned
+ * @return An array of session usage records, or NULL
+ *
+ * Pass the return result to g_free() after use
+ */
+struct scp_session_usage *
+session_list_get_usage(uid_t uid, unsigned int *cnt);
+
 /**
  *
  * @brief Frees the result of session_get_byuser()
@@ -153,20 +206,14 @@ void
 free_session_info_list(struct scp_session_info *sesslist, unsigned int cnt);
 
 /**
- * @brief Get the wait objs for the session list module
- * @param @robjs Objects array to update
- * @param robjs_count Elements in robjs (by reference)
- * @return 0 for success
- */
-int
-session_list_get_wait_objs(tbus robjs[], int *robjs_count);
-
-
-/**
- * @brief Check the wait objs for the session list module
+ * @brief Remove sessions which are no longer in use
+ *
+ * Sessions are normally removed as soon as the event loop finds their
+ * transport has gone down. This catches sessions which never got a
+ * transport, or whose transport went down while sending.
  * @return 0 for success
  */
 int
-session_list_check_wait_objs(void);
+session_list_remove_unused(void);
 
 #endif // SESSION_LIST_H
@@ -31,12 +31,14 @@
 #include "arch.h"
 #include "sig.h"
 
+#include "sesman_cgroup.h"
 #include "sesman_config.h"
 #include "log.h"
 #include "os_calls.h"
 #include "sesman.h"
 #include "session_list.h"
 #include "string_calls.h"
+#include "xserver_pool.h"
 
 /******************************************************************************/
 void
@@ -94,4 +96,10 @@ sig_sesman_reload_cfg(void)
     }
 
     LOG(LOG_LEVEL_INFO, "configuration reloaded, log subsystem restarted");
+
+    /* The pool size may have changed */
+    xserver_pool_fill();
+
+    /* So may the cgroup path */
+    (void)sesman_cgroup_init(&g_cfg->sess);
 }
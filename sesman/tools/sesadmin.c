@@ -36,6 +36,7 @@ char port[257];
 
 static int cmndList(struct trans *t);
 static int cmndKill(struct trans *t);
+static int cmndUsage(struct trans *t);
 static void cmndHelp(void);
 
 
@@ -120,6 +121,10 @@ int main(int argc, char **argv)
         {
             rv = cmndKill(t);
         }
+        else if (0 == g_strncmp(cmnd, "usage", 6))
+        {
+            rv = cmndUsage(t);
+        }
     }
 
     if (rv == 0)
@@ -142,6 +147,7 @@ cmndHelp(void)
     fprintf(stderr, "               it can be one of those:\n");
     fprintf(stderr, "               list\n");
     fprintf(stderr, "               kill:<sid>\n");
+    fprintf(stderr, "               usage\n");
 }
 
 static void
@@ -236,3 +242,80 @@ cmndKill(struct trans *t)
     fprintf(stderr, "not yet implemented\n");
     return 1;
 }
+
+static void
+print_usage(const struct scp_session_usage *u)
+{
+    char *username;
+    const char *uptr;
+    g_getuser_info_by_uid(u->uid, &username, NULL, NULL, NULL, NULL);
+    uptr = (username == NULL) ? "<unknown>" : username;
+
+    printf("Session ID: %d\n", u->sid);
+    printf("\tDisplay: :%u\n", u->display);
+    printf("\tUser: %s\n", uptr);
+    if (!u->available)
+    {
+        printf("\tUsage: not available\n");
+    }
+    else
+    {
+        printf("\tCPU time: %llu.%02us\n",
+               (unsigned long long)(u->cpu_usec / 1000000),
+               (unsigned int)(u->cpu_usec % 1000000 / 10000));
+        printf("\tMemory: %llu KiB\n",
+               (unsigned long long)(u->memory_bytes / 1024));
+    }
+    g_free(username);
+}
+
+static int
+cmndUsage(struct trans *t)
+{
+    struct scp_session_usage usage;
+    unsigned int count = 0;
+    int end_of_list = 0;
+
+    enum scp_list_sessions_status status;
+
+    int rv = scp_send_session_usage_request(t);
+
+    while (rv == 0 && !end_of_list)
+    {
+        rv = wait_for_sesman_reply(t, E_SCP_SESSION_USAGE_RESPONSE);
+        if (rv != 0)
+        {
+            break;
+        }
+
+        rv = scp_get_session_usage_response(t, &status, &usage);
+        if (rv != 0)
+        {
+            break;
+        }
+
+        switch (status)
+        {
+            case E_SCP_LS_SESSION_INFO:
+                print_usage(&usage);
+                ++count;
+                break;
+
+            case E_SCP_LS_END_OF_LIST:
+                end_of_list = 1;
+                break;
+
+            default:
+                printf("Unexpected return code %d\n", status);
+                rv = 1;
+        }
+        scp_msg_in_reset(t);
+    }
+
+    if (rv == 0 && count == 0)
+    {
+        printf("No sessions.\n");
+    }
+
+    return rv;
+}
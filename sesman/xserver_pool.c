@@ -0,0 +1,727 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2023
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file xserver_pool.c
+ * @brief Pool of Xorg servers started ahead of logins
+ *
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "arch.h"
+#include "xserver_pool.h"
+
+#include "defines.h"
+#include "event_loop.h"
+#include "list.h"
+#include "log.h"
+#include "os_calls.h"
+#include "scp_process.h"
+#include "sesman.h"
+#include "sesman_config.h"
+#include "session_list.h"
+#include "string_calls.h"
+#include "xauth.h"
+#include "xrdp_sockets.h"
+
+/* Geometry a pooled server starts with. xorgxrdp resizes the screen
+ * to suit the client when it connects */
+#define POOL_START_WIDTH 1024
+#define POOL_START_HEIGHT 768
+
+/* Longest idle timeout, so the timer doesn't overflow */
+#define POOL_MAX_IDLE_TIMEOUT (24 * 60 * 60)
+
+enum pool_state
+{
+    E_POOL_STARTING, ///< Waiting for the X server to come up
+    E_POOL_READY, ///< Waiting to be handed to a session
+    E_POOL_IN_USE, ///< Handed to a session
+    E_POOL_STOPPING ///< Terminated, but not yet reaped
+};
+
+struct pool_item
+{
+    enum pool_state state;
+    int display;
+    int uid; ///< UID the X server runs as
+    pid_t x_server;
+    pid_t waiter; ///< PID of waitforx while starting, or -1
+    struct event_loop_timer *idle_timer;
+    char cookie[XAUTH_COOKIE_STR_SIZE];
+    char authfile[XRDP_SOCKETS_MAXPATH];
+};
+
+static struct list *g_pool = NULL;
+
+/******************************************************************************/
+int
+xserver_pool_init(void)
+{
+    int rv = 1;
+
+    if (g_pool == NULL)
+    {
+        g_pool = list_create();
+    }
+
+    if (g_pool == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't allocate X server pool");
+    }
+    else
+    {
+        g_pool->auto_free = 0;
+        xserver_pool_fill();
+        rv = 0;
+    }
+
+    return rv;
+}
+
+/******************************************************************************/
+/**
+ * Removes an item from the pool, and frees it
+ *
+ * @param index Index of item in the pool
+ */
+static void
+remove_item(int index)
+{
+    struct pool_item *pi;
+    char file[XRDP_SOCKETS_MAXPATH];
+
+    pi = (struct pool_item *)list_get_item(g_pool, index);
+    event_loop_cancel_timer(g_event_loop, pi->idle_timer);
+    /* X servers only read the file when they start or reset */
+    g_file_delete(pi->authfile);
+    if (pi->state != E_POOL_IN_USE)
+    {
+        /* In case xorgxrdp didn't get to remove these */
+        g_snprintf(file, sizeof(file), XRDP_X11RDP_STR,
+                   pi->uid, pi->display);
+        g_file_delete(file);
+        g_snprintf(file, sizeof(file), XRDP_DISCONNECT_STR,
+                   pi->uid, pi->display);
+        g_file_delete(file);
+    }
+    list_remove_item(g_pool, index);
+    g_free(pi);
+}
+
+/******************************************************************************/
+void
+xserver_pool_cleanup(void)
+{
+    if (g_pool != NULL)
+    {
+        while (g_pool->count > 0)
+        {
+            struct pool_item *pi;
+            pi = (struct pool_item *)list_get_item(g_pool, 0);
+            if (pi->state != E_POOL_IN_USE)
+            {
+                if (pi->waiter > 0)
+                {
+                    g_sigterm(pi->waiter);
+                }
+                g_sigterm(pi->x_server);
+                remove_item(0);
+            }
+            else
+            {
+                /* The session owns the server now */
+                list_remove_item(g_pool, 0);
+                g_free(pi);
+            }
+        }
+        list_delete(g_pool);
+        g_pool = NULL;
+    }
+}
+
+/******************************************************************************/
+/**
+ * Stops a server which hasn't been handed to a session
+ */
+static void
+stop_item(struct pool_item *pi)
+{
+    event_loop_cancel_timer(g_event_loop, pi->idle_timer);
+    pi->idle_timer = NULL;
+    if (pi->waiter > 0)
+    {
+        g_sigterm(pi->waiter);
+    }
+    g_sigterm(pi->x_server);
+    pi->state = E_POOL_STOPPING;
+}
+
+/******************************************************************************/
+/**
+ * Called by the event loop when a ready server has not been used
+ * for the idle timeout
+ */
+static void
+idle_timeout(struct event_loop *loop, void *arg)
+{
+    struct pool_item *pi = (struct pool_item *)arg;
+
+    pi->idle_timer = NULL;
+    LOG(LOG_LEVEL_INFO, "Stopping pooled X server on display :%d "
+        "which has not been used for %d seconds",
+        pi->display, g_cfg->sess.xorg_pool_idle_timeout);
+    stop_item(pi);
+}
+
+/******************************************************************************/
+/**
+ * Moves a process into the pool user's context
+ *
+ * @param pi Pool item
+ * @param gid Primary GID of the pool user
+ * @return 0 for success
+ *
+ * Only to be called in a child process
+ */
+static int
+become_pool_user(const struct pool_item *pi, int gid)
+{
+    int error;
+    char *pw_username = NULL;
+    char *pw_shell = NULL;
+    char *pw_dir = NULL;
+    char text[256];
+
+    error = g_getuser_info_by_uid(pi->uid, &pw_username, NULL, &pw_shell,
+                                  &pw_dir, NULL);
+    if (error == 0)
+    {
+        g_clearenv();
+#ifdef HAVE_SETUSERCONTEXT
+        error = g_set_allusercontext(pi->uid);
+#else
+        if ((error = g_initgroups(pw_username)) == 0 &&
+                (error = g_setgid(gid)) == 0 &&
+                (error = g_setuid(pi->uid)) == 0)
+        {
+            g_setenv("PATH", "/sbin:/bin:/usr/bin:/usr/local/bin", 1);
+        }
+#endif
+        if (error == 0)
+        {
+            g_setenv("SHELL", pw_shell, 1);
+            g_setenv("USER", pw_username, 1);
+            g_setenv("LOGNAME", pw_username, 1);
+            g_setenv("HOME", pw_dir, 1);
+            g_set_current_dir(pw_dir);
+            g_snprintf(text, sizeof(text), ":%d.0", pi->display);
+            g_setenv("DISPLAY", text, 1);
+            g_setenv("XAUTHORITY", pi->authfile, 1);
+            g_snprintf(text, sizeof(text), XRDP_SOCKET_PATH, pi->uid);
+            g_setenv("XRDP_SOCKET_PATH", text, 1);
+        }
+        else
+        {
+            LOG(LOG_LEVEL_ERROR, "Can't become X server pool user %s [%s]",
+                pw_username, g_get_strerror());
+        }
+        g_free(pw_username);
+        g_free(pw_shell);
+        g_free(pw_dir);
+    }
+
+    return error;
+}
+
+/******************************************************************************/
+/**
+ * Runs the X server for a pool item
+ *
+ * Only to be called in a child process. Doesn't return.
+ */
+static void
+run_x_server(const struct pool_item *pi, int gid)
+{
+    char screen[32];
+    char text[32];
+    struct list *params;
+
+    /* Keep signals for sesman away from the X server */
+    (void)g_setpgid(0, 0);
+
+    if (become_pool_user(pi, gid) != 0)
+    {
+        g_exit(1);
+    }
+
+    if (g_cfg->sec.xorg_no_new_privileges && g_no_new_privs() != 0)
+    {
+        LOG(LOG_LEVEL_WARNING,
+            "Failed to disable setuid on pooled X server :%d: %s",
+            pi->display, g_get_strerror());
+    }
+
+    if (add_xauth_cookie(pi->display, pi->authfile, pi->cookie) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR,
+            "Error setting the xauth cookie for display %d in file %s",
+            pi->display, pi->authfile);
+        g_exit(1);
+    }
+
+    g_snprintf(text, sizeof(text), "%d", POOL_START_WIDTH);
+    g_setenv("XRDP_START_WIDTH", text, 1);
+    g_snprintf(text, sizeof(text), "%d", POOL_START_HEIGHT);
+    g_setenv("XRDP_START_HEIGHT", text, 1);
+    g_snprintf(text, sizeof(text), "%d", g_cfg->sess.max_idle_time);
+    g_setenv("XRDP_SESMAN_MAX_IDLE_TIME", text, 1);
+    g_snprintf(text, sizeof(text), "%d", g_cfg->sess.max_disc_time);
+    g_setenv("XRDP_SESMAN_MAX_DISC_TIME", text, 1);
+    g_snprintf(text, sizeof(text), "%d", g_cfg->sess.kill_disconnected);
+    g_setenv("XRDP_SESMAN_KILL_DISCONNECTED", text, 1);
+
+    g_snprintf(screen, sizeof(screen), ":%d", pi->display);
+    params = list_create();
+    if (params != NULL)
+    {
+        params->auto_free = 1;
+        list_add_strdup_multi(params,
+                              (const char *)list_get_item(g_cfg->xorg_params,
+                                      0),
+                              screen,
+                              "-auth", pi->authfile,
+                              NULL);
+        list_append_list_strdup(g_cfg->xorg_params, params, 1);
+
+        LOG(LOG_LEVEL_INFO, "Starting pooled X server on display %d",
+            pi->display);
+        g_execvp_list((const char *)params->items[0], params);
+        list_delete(params);
+    }
+
+    LOG(LOG_LEVEL_ERROR, "Can't start pooled X server on display %d",
+        pi->display);
+    g_exit(1);
+}
+
+/******************************************************************************/
+/**
+ * Runs waitforx for a pool item
+ *
+ * Only to be called in a child process. Doesn't return.
+ */
+static void
+run_waiter(const struct pool_item *pi, int gid)
+{
+    const char exe[] = XRDP_LIBEXEC_PATH "/waitforx";
+    char displaystr[64];
+    struct list *cmd;
+
+    if (become_pool_user(pi, gid) == 0 && (cmd = list_create()) != NULL)
+    {
+        cmd->auto_free = 1;
+        g_snprintf(displaystr, sizeof(displaystr), ":%d", pi->display);
+        if (list_add_strdup_multi(cmd, exe, "-d", displaystr, NULL))
+        {
+            g_execvp_list(exe, cmd);
+        }
+        LOG(LOG_LEVEL_ERROR, "Can't run %s - %s", exe, g_get_strerror());
+        list_delete(cmd);
+    }
+    g_exit(1);
+}
+
+/******************************************************************************/
+/**
+ * Starts a new server for the pool
+ *
+ * @param uid UID of the pool user
+ * @param gid GID of the pool user
+ * @return 0 for success
+ */
+static int
+start_item(int uid, int gid)
+{
+    struct pool_item *pi;
+    int display;
+
+    if ((display = session_list_get_available_display()) < 0)
+    {
+        return 1;
+    }
+
+    if ((pi = g_new0(struct pool_item, 1)) == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "Out of memory starting pooled X server");
+        return 1;
+    }
+
+    pi->state = E_POOL_STARTING;
+    pi->display = display;
+    pi->uid = uid;
+    pi->waiter = -1;
+    make_xauth_cookie(pi->cookie);
+    g_snprintf(pi->authfile, sizeof(pi->authfile),
+               XRDP_SOCKET_PATH "/xauth_display_%d", uid, display);
+
+    if (!list_add_item(g_pool, (tintptr)pi))
+    {
+        LOG(LOG_LEVEL_ERROR, "Out of memory starting pooled X server");
+        g_free(pi);
+        return 1;
+    }
+
+    pi->x_server = g_fork();
+    if (pi->x_server == 0)
+    {
+        run_x_server(pi, gid);
+    }
+    if (pi->x_server > 0)
+    {
+        pi->waiter = g_fork();
+        if (pi->waiter == 0)
+        {
+            run_waiter(pi, gid);
+        }
+        if (pi->waiter < 0)
+        {
+            g_sigterm(pi->x_server);
+            pi->state = E_POOL_STOPPING;
+        }
+    }
+    if (pi->x_server < 0)
+    {
+        remove_item(list_index_of(g_pool, (tintptr)pi));
+        return 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/**
+ * Is -noreset one of the Xorg parameters?
+ *
+ * The pool authfile is deleted when a server is handed to a session.
+ * An X server which reset would read it again.
+ */
+static int
+xorg_params_have_noreset(void)
+{
+    int i;
+
+    for (i = 1 ; i < g_cfg->xorg_params->count ; ++i)
+    {
+        const char *param;
+        param = (const char *)list_get_item(g_cfg->xorg_params, i);
+        if (g_strcmp(param, "-noreset") == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/**
+ * Is a UID in use by a pooled server?
+ *
+ * A UID isn't used again until its server has gone, even if the
+ * server has been handed to a session.
+ */
+static int
+uid_in_use(int uid)
+{
+    int i;
+
+    for (i = 0 ; i < g_pool->count ; ++i)
+    {
+        const struct pool_item *pi;
+        pi = (const struct pool_item *)list_get_item(g_pool, i);
+        if (pi->uid == uid)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+/**
+ * Finds a pool user which isn't running a server
+ *
+ * @param[out] uid UID of the user
+ * @param[out] gid GID of the user
+ * @return 0 for success
+ */
+static int
+find_free_pool_user(int *uid, int *gid)
+{
+    const struct list *users = g_cfg->sess.xorg_pool_users;
+    int i;
+
+    for (i = 0 ; i < users->count ; ++i)
+    {
+        const char *user = (const char *)list_get_item(users, i);
+        if (user[0] == '\0')
+        {
+            continue;
+        }
+        if (g_getuser_info_by_name(user, uid, gid, NULL, NULL, NULL) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "Can't find X server pool user %s", user);
+        }
+        else if (*uid == 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "X server pool can't be run as root");
+        }
+        else if (!uid_in_use(*uid))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/******************************************************************************/
+void
+xserver_pool_fill(void)
+{
+    unsigned int count = 0;
+    int uid;
+    int gid;
+    int i;
+
+    if (g_pool == NULL || g_cfg->sess.xorg_pool_size == 0)
+    {
+        return;
+    }
+
+    if (g_cfg->sess.xorg_pool_users == NULL ||
+            g_cfg->sess.xorg_pool_users->count == 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "XorgPoolUsers is not set - "
+            "X server pool is disabled");
+        return;
+    }
+
+    if (!xorg_params_have_noreset())
+    {
+        LOG(LOG_LEVEL_WARNING, "The Xorg parameters don't include "
+            "-noreset - X server pool is disabled");
+        return;
+    }
+
+    for (i = 0 ; i < g_pool->count ; ++i)
+    {
+        const struct pool_item *pi;
+        pi = (const struct pool_item *)list_get_item(g_pool, i);
+        if (pi->state == E_POOL_STARTING || pi->state == E_POOL_READY)
+        {
+            ++count;
+        }
+    }
+
+    while (count < g_cfg->sess.xorg_pool_size &&
+            find_free_pool_user(&uid, &gid) == 0 &&
+            create_xrdp_socket_path(uid) == 0 &&
+            start_item(uid, gid) == 0)
+    {
+        ++count;
+    }
+}
+
+/******************************************************************************/
+/**
+ * Moves an xorgxrdp socket from the pool user to the session user
+ *
+ * @param format Format of the socket name
+ * @param pi Pool item
+ * @param uid UID of the session user
+ * @return 0 for success
+ */
+static int
+move_socket(const char *format, const struct pool_item *pi, uid_t uid)
+{
+    char from[XRDP_SOCKETS_MAXPATH];
+    char to[XRDP_SOCKETS_MAXPATH];
+
+    g_snprintf(from, sizeof(from), format, pi->uid, pi->display);
+    g_snprintf(to, sizeof(to), format, (int)uid, pi->display);
+
+    if (!g_file_rename(from, to))
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't move %s to %s [%s]",
+            from, to, g_get_strerror());
+        return 1;
+    }
+    if (g_chown(to, uid, -1) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't set owner of %s to %d [%s]",
+            to, (int)uid, g_get_strerror());
+        return 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+int
+xserver_pool_take(uid_t uid, int *x_server_pid,
+                  char xauth_cookie[XAUTH_COOKIE_STR_SIZE])
+{
+    int i;
+
+    if (g_pool == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0 ; i < g_pool->count ; ++i)
+    {
+        struct pool_item *pi;
+        pi = (struct pool_item *)list_get_item(g_pool, i);
+        if (pi->state != E_POOL_READY)
+        {
+            continue;
+        }
+
+        if (move_socket(XRDP_X11RDP_STR, pi, uid) != 0 ||
+                move_socket(XRDP_DISCONNECT_STR, pi, uid) != 0)
+        {
+            /* The server's no use to anyone now */
+            stop_item(pi);
+            continue;
+        }
+
+        event_loop_cancel_timer(g_event_loop, pi->idle_timer);
+        pi->idle_timer = NULL;
+        /* The X server has read this, and with -noreset won't read it
+         * again. It's the only copy of the cookie outside the session */
+        g_file_delete(pi->authfile);
+        pi->state = E_POOL_IN_USE;
+        *x_server_pid = pi->x_server;
+        g_strncpy(xauth_cookie, pi->cookie, XAUTH_COOKIE_STR_SIZE - 1);
+        LOG(LOG_LEVEL_INFO, "Using pooled X server on display :%d",
+            pi->display);
+        return pi->display;
+    }
+
+    return -1;
+}
+
+/******************************************************************************/
+int
+xserver_pool_has_display(int display)
+{
+    int i;
+
+    if (g_pool != NULL)
+    {
+        for (i = 0 ; i < g_pool->count ; ++i)
+        {
+            const struct pool_item *pi;
+            pi = (const struct pool_item *)list_get_item(g_pool, i);
+            if (pi->display == display)
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+void
+xserver_pool_process_child_exit(int pid, const struct proc_exit_status *e)
+{
+    int i;
+
+    if (g_pool == NULL)
+    {
+        return;
+    }
+
+    for (i = 0 ; i < g_pool->count ; ++i)
+    {
+        struct pool_item *pi;
+        pi = (struct pool_item *)list_get_item(g_pool, i);
+        if (pid == pi->waiter)
+        {
+            pi->waiter = -1;
+            if (pi->state != E_POOL_STARTING)
+            {
+                /* Already stopping */
+            }
+            else if (e->reason != E_PXR_STATUS_CODE || e->val != 0)
+            {
+                LOG(LOG_LEVEL_ERROR,
+                    "Pooled X server on display :%d failed to start",
+                    pi->display);
+                stop_item(pi);
+            }
+            else
+            {
+                LOG(LOG_LEVEL_INFO, "Pooled X server on display :%d is ready",
+                    pi->display);
+                pi->state = E_POOL_READY;
+                if (g_cfg->sess.xorg_pool_idle_timeout > 0)
+                {
+                    int timeout = MIN(g_cfg->sess.xorg_pool_idle_timeout,
+                                      POOL_MAX_IDLE_TIMEOUT);
+                    pi->idle_timer = event_loop_add_timer(g_event_loop,
+                                                          timeout * 1000,
+                                                          idle_timeout, pi);
+                }
+            }
+            break;
+        }
+
+        if (pid == pi->x_server)
+        {
+            if (pi->state == E_POOL_STARTING || pi->state == E_POOL_READY)
+            {
+                /* Not replaced until the next session starts, so a
+                 * broken X server doesn't restart in a loop */
+                LOG(LOG_LEVEL_WARNING,
+                    "Pooled X server on display :%d exited unexpectedly",
+                    pi->display);
+            }
+            else
+            {
+                LOG(LOG_LEVEL_INFO,
+                    "Pooled X server on display :%d finished", pi->display);
+            }
+            if (pi->waiter > 0)
+            {
+                g_sigterm(pi->waiter);
+            }
+            remove_item(i);
+            break;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2023
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file xserver_pool.h
+ * @brief Pool of Xorg servers started ahead of logins
+ *
+ * Starting an Xorg server and waiting for it to come up takes a
+ * noticeable time. sesman can keep a few Xorg servers running ahead of
+ * the logins that need them. Each of these runs as an unprivileged pool
+ * user of its own. When a server is handed to a new session, the user
+ * of the session is given the cookie for the server, the xorgxrdp
+ * sockets are moved into the user's socket directory, and the pool's
+ * copy of the cookie is deleted.
+ *
+ * A pooled server is only used by one session, and is stopped when
+ * that session ends. Its pool user isn't given another server until
+ * then. The server keeps running as the pool user, and not as the user
+ * of the session.
+ *
+ */
+
+#ifndef XSERVER_POOL_H
+#define XSERVER_POOL_H
+
+#include <sys/types.h>
+
+#include "xauth.h"
+
+struct proc_exit_status;
+
+/**
+ * Initialise the module, and start the pooled servers
+ * @return 0 for success
+ *
+ * Errors are logged
+ */
+int
+xserver_pool_init(void);
+
+/**
+ * Stops the servers which are not in use, and frees the pool
+ */
+void
+xserver_pool_cleanup(void);
+
+/**
+ * Starts new servers until the pool is the configured size
+ *
+ * Errors are logged
+ */
+void
+xserver_pool_fill(void);
+
+/**
+ * Hands a ready server over to a new session
+ *
+ * @param uid UID of the user for the session
+ * @param[out] x_server_pid PID of the X server
+ * @param[out] xauth_cookie Cookie for the X server
+ * @return display of the X server, or -1 if none is ready
+ *
+ * The caller should call xserver_pool_fill() once the session has
+ * been started, to replace the server.
+ */
+int
+xserver_pool_take(uid_t uid, int *x_server_pid,
+                  char xauth_cookie[XAUTH_COOKIE_STR_SIZE]);
+
+/**
+ * Is a display in use by the pool?
+ *
+ * @param display Display number
+ * @return != 0 if the pool is using the display
+ */
+int
+xserver_pool_has_display(int display);
+
+/**
+ * Processes the exit of a child process of sesman
+ *
+ * @param pid PID of the child
+ * @param e Exit status of the child
+ */
+void
+xserver_pool_process_child_exit(int pid, const struct proc_exit_status *e);
+
+#endif
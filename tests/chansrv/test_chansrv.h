@@ -0,0 +1,9 @@
+#ifndef TEST_CHANSRV_H
+#define TEST_CHANSRV_H
+
+#include <check.h>
+
+Suite *make_suite_test_chansrv_xfs(void);
+Suite *make_suite_test_chansrv_common(void);
+
+#endif /* TEST_CHANSRV_H */
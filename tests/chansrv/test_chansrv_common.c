@@ -0,0 +1,151 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "parse.h"
+#include "chansrv_common.h"
+
+#include "test_chansrv.h"
+
+/* What the stream callbacks have seen */
+static int g_started;
+static int g_ended;
+static int g_streaming;
+static int g_bytes_in;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_started = 0;
+    g_ended = 0;
+    g_streaming = 0;
+    g_bytes_in = 0;
+}
+
+/******************************************************************************/
+/* Takes any message of 16 bytes or more */
+static int
+test_start(struct stream *s, int length, int total_length)
+{
+    if (total_length < 16)
+    {
+        return 0;
+    }
+    ++g_started;
+    g_streaming = 1;
+    g_bytes_in += length;
+    return 1;
+}
+
+/******************************************************************************/
+static void
+test_in(const char *data, int data_bytes)
+{
+    g_bytes_in += data_bytes;
+}
+
+/******************************************************************************/
+static void
+test_end(void)
+{
+    ++g_ended;
+    g_streaming = 0;
+}
+
+static const struct chan_stream_ops g_ops =
+{
+    test_start,
+    test_in,
+    test_end
+};
+
+/******************************************************************************/
+/* Passes a fragment of length bytes to the stream */
+static int
+fragment(int chan_flags, int length, int total_length)
+{
+    struct stream *s;
+    int rv;
+
+    make_stream(s);
+    init_stream(s, length);
+    out_uint8s(s, length);
+    s_mark_end(s);
+    s->p = s->data;
+    rv = chan_stream_fragment(&g_ops, g_streaming, s, chan_flags, length,
+                              total_length);
+    free_stream(s);
+    return rv;
+}
+
+/******************************************************************************/
+START_TEST(test_chan_stream__single_fragment)
+{
+    ck_assert_int_eq(fragment(3, 100, 100), 1);
+    ck_assert_int_eq(g_started, 1);
+    ck_assert_int_eq(g_ended, 1);
+    ck_assert_int_eq(g_streaming, 0);
+    ck_assert_int_eq(g_bytes_in, 100);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_chan_stream__fragments)
+{
+    ck_assert_int_eq(fragment(1, 40, 100), 1);
+    ck_assert_int_eq(fragment(0, 40, 100), 1);
+    ck_assert_int_eq(g_ended, 0);
+    ck_assert_int_eq(fragment(2, 20, 100), 1);
+    ck_assert_int_eq(g_started, 1);
+    ck_assert_int_eq(g_ended, 1);
+    ck_assert_int_eq(g_bytes_in, 100);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_chan_stream__cut_short)
+{
+    ck_assert_int_eq(fragment(1, 40, 100), 1);
+    /* A new message starts before the last one ended */
+    ck_assert_int_eq(fragment(3, 50, 50), 1);
+    ck_assert_int_eq(g_started, 2);
+    ck_assert_int_eq(g_ended, 2);
+    ck_assert_int_eq(g_streaming, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_chan_stream__declined)
+{
+    /* Too small to stream - the caller puts it together */
+    ck_assert_int_eq(fragment(3, 8, 8), 0);
+    ck_assert_int_eq(fragment(1, 4, 8), 0);
+    ck_assert_int_eq(fragment(2, 4, 8), 0);
+    ck_assert_int_eq(g_started, 0);
+    ck_assert_int_eq(g_ended, 0);
+    ck_assert_int_eq(g_bytes_in, 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_chansrv_common(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("chansrv_common");
+
+    tc = tcase_create("chan_stream");
+    tcase_add_checked_fixture(tc, setup, NULL);
+    suite_add_tcase(s, tc);
+
+    tcase_add_test(tc, test_chan_stream__single_fragment);
+    tcase_add_test(tc, test_chan_stream__fragments);
+    tcase_add_test(tc, test_chan_stream__cut_short);
+    tcase_add_test(tc, test_chan_stream__declined);
+
+    return s;
+}
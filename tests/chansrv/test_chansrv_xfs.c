@@ -0,0 +1,253 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "os_calls.h"
+#include "log.h"
+#include "chansrv_xfs.h"
+
+#include "test_chansrv.h"
+
+/* Size of directory used for the lookup timings */
+#define BIG_DIR_ENTRIES 50000
+
+static struct xfs_fs *g_xfs;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    g_xfs = xfs_create_xfs_fs(0, 0, 0);
+    ck_assert_ptr_ne(g_xfs, NULL);
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    xfs_delete_xfs_fs(g_xfs);
+    g_xfs = NULL;
+}
+
+/******************************************************************************/
+/* Makes a directory in the root. A non-zero device_id marks it as a
+ * redirected drive */
+static fuse_ino_t
+make_dir(const char *name, tui32 device_id)
+{
+    XFS_INODE *xinode = xfs_add_entry(g_xfs, FUSE_ROOT_ID, name,
+                                      S_IFDIR | 0755);
+    ck_assert_ptr_ne(xinode, NULL);
+    xinode->is_redirected = (device_id != 0);
+    xinode->device_id = device_id;
+    return xinode->inum;
+}
+
+/******************************************************************************/
+/* Fills a directory with 'count' files, named f0, f1, ... */
+static void
+fill_dir(fuse_ino_t dir, unsigned int count)
+{
+    unsigned int i;
+    char name[32];
+
+    for (i = 0; i < count; ++i)
+    {
+        g_snprintf(name, sizeof(name), "f%u", i);
+        ck_assert_ptr_ne(xfs_add_entry(g_xfs, dir, name, S_IFREG | 0644),
+                         NULL);
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_xfs__lookup)
+{
+    fuse_ino_t dir = make_dir("local", 0);
+    unsigned int count = _i;
+    unsigned int i;
+    XFS_INODE *xinode;
+    char name[32];
+
+    fill_dir(dir, count);
+
+    for (i = 0; i < count; ++i)
+    {
+        g_snprintf(name, sizeof(name), "f%u", i);
+        xinode = xfs_lookup_in_dir(g_xfs, dir, name);
+        ck_assert_ptr_ne(xinode, NULL);
+        ck_assert_str_eq(xinode->name, name);
+    }
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, dir, "F1"), NULL);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, dir, "missing"), NULL);
+
+    /* Remove every other entry */
+    for (i = 0; i < count; i += 2)
+    {
+        g_snprintf(name, sizeof(name), "f%u", i);
+        xinode = xfs_lookup_in_dir(g_xfs, dir, name);
+        ck_assert_ptr_ne(xinode, NULL);
+        xfs_remove_entry(g_xfs, xinode->inum);
+    }
+    for (i = 0; i < count; ++i)
+    {
+        g_snprintf(name, sizeof(name), "f%u", i);
+        xinode = xfs_lookup_in_dir(g_xfs, dir, name);
+        if ((i % 2) == 0)
+        {
+            ck_assert_ptr_eq(xinode, NULL);
+        }
+        else
+        {
+            ck_assert_ptr_ne(xinode, NULL);
+        }
+    }
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xfs__lookup_redirected_case)
+{
+    fuse_ino_t idir = make_dir("C:", 1);
+    fuse_ino_t sdir = make_dir("D:", 2);
+    unsigned int count = _i;
+    XFS_INODE *xinode;
+    XFS_INODE *xinode2;
+
+    fill_dir(idir, count);
+    fill_dir(sdir, count);
+
+    /* Until the client says otherwise, names are matched exactly */
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, idir, "F2"), NULL);
+
+    /* Drive 1 is case-insensitive, drive 2 is case-sensitive */
+    xfs_set_redirected_case_insensitive(g_xfs, 1, 1);
+    xfs_set_redirected_case_insensitive(g_xfs, 2, 0);
+
+    xinode = xfs_lookup_in_dir(g_xfs, idir, "F2");
+    ck_assert_ptr_ne(xinode, NULL);
+    ck_assert_str_eq(xinode->name, "f2");
+
+    /* A name differing only in case is the same file */
+    ck_assert_ptr_eq(xfs_add_entry(g_xfs, idir, "F2", S_IFREG | 0644), NULL);
+
+    /* ...unless the drive is case-sensitive */
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, sdir, "F2"), NULL);
+    xinode = xfs_add_entry(g_xfs, sdir, "F2", S_IFREG | 0644);
+    ck_assert_ptr_ne(xinode, NULL);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, sdir, "F2"), xinode);
+    xinode2 = xfs_lookup_in_dir(g_xfs, sdir, "f2");
+    ck_assert_ptr_ne(xinode2, NULL);
+    ck_assert_ptr_ne(xinode2, xinode);
+    ck_assert_str_eq(xinode2->name, "f2");
+
+    /* New entries on a drive take its setting */
+    ck_assert_ptr_ne(xfs_add_entry(g_xfs, idir, "New", S_IFREG | 0644), NULL);
+    ck_assert_ptr_ne(xfs_lookup_in_dir(g_xfs, idir, "NEW"), NULL);
+    ck_assert_ptr_ne(xfs_add_entry(g_xfs, sdir, "New", S_IFREG | 0644), NULL);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, sdir, "NEW"), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xfs__move_entry)
+{
+    fuse_ino_t dir = make_dir("C:", 1);
+    fuse_ino_t dir2 = make_dir("D:", 2);
+    XFS_INODE *xinode;
+    XFS_INODE *xinode2;
+    fuse_ino_t inum;
+
+    xfs_set_redirected_case_insensitive(g_xfs, 1, 1);
+    xfs_set_redirected_case_insensitive(g_xfs, 2, 1);
+
+    fill_dir(dir, 100);
+    xinode = xfs_lookup_in_dir(g_xfs, dir, "f1");
+    ck_assert_ptr_ne(xinode, NULL);
+    inum = xinode->inum;
+
+    /* Change of case in the same directory */
+    ck_assert_int_eq(xfs_move_entry(g_xfs, inum, dir, "F1"), 0);
+    xinode = xfs_lookup_in_dir(g_xfs, dir, "f1");
+    ck_assert_ptr_ne(xinode, NULL);
+    ck_assert_int_eq(xinode->inum, inum);
+    ck_assert_str_eq(xinode->name, "F1");
+
+    /* Rename over an existing entry */
+    ck_assert_int_eq(xfs_move_entry(g_xfs, inum, dir, "f2"), 0);
+    xinode = xfs_lookup_in_dir(g_xfs, dir, "f2");
+    ck_assert_ptr_ne(xinode, NULL);
+    ck_assert_int_eq(xinode->inum, inum);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, dir, "f1"), NULL);
+
+    /* Move to another directory */
+    ck_assert_int_eq(xfs_move_entry(g_xfs, inum, dir2, "moved"), 0);
+    ck_assert_ptr_eq(xfs_lookup_in_dir(g_xfs, dir, "f2"), NULL);
+    xinode2 = xfs_lookup_in_dir(g_xfs, dir2, "MOVED");
+    ck_assert_ptr_ne(xinode2, NULL);
+    ck_assert_int_eq(xinode2->inum, inum);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xfs__big_directory)
+{
+    fuse_ino_t dir = make_dir("C:", 1);
+    unsigned int i;
+    char name[32];
+    tui64 start;
+    tui64 add_time;
+    tui64 lookup_time;
+
+    xfs_set_redirected_case_insensitive(g_xfs, 1, 1);
+
+    start = g_time_us();
+    fill_dir(dir, BIG_DIR_ENTRIES);
+    add_time = g_time_us() - start;
+
+    start = g_time_us();
+    for (i = 0; i < BIG_DIR_ENTRIES; ++i)
+    {
+        g_snprintf(name, sizeof(name), "F%u", i);
+        ck_assert_ptr_ne(xfs_lookup_in_dir(g_xfs, dir, name), NULL);
+    }
+    lookup_time = g_time_us() - start;
+
+    LOG(LOG_LEVEL_INFO, "%u entries: add %llu us, lookup %llu us "
+        "(%llu ns per lookup)",
+        BIG_DIR_ENTRIES,
+        (unsigned long long) add_time,
+        (unsigned long long) lookup_time,
+        (unsigned long long) (lookup_time * 1000 / BIG_DIR_ENTRIES));
+
+    xfs_remove_directory_contents(g_xfs, dir);
+    ck_assert_int_eq(xfs_is_dir_empty(g_xfs, dir), 1);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_chansrv_xfs(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("chansrv_xfs");
+
+    tc = tcase_create("chansrv_xfs");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    /* Directory sizes either side of the one which gets a hash index */
+    tcase_add_loop_test(tc, test_xfs__lookup, 1, 4);
+    tcase_add_loop_test(tc, test_xfs__lookup, 15, 18);
+    tcase_add_loop_test(tc, test_xfs__lookup, 1000, 1001);
+    tcase_add_loop_test(tc, test_xfs__lookup_redirected_case, 3, 4);
+    tcase_add_loop_test(tc, test_xfs__lookup_redirected_case, 100, 101);
+    tcase_add_test(tc, test_xfs__move_entry);
+    tcase_add_test(tc, test_xfs__big_directory);
+    tcase_set_timeout(tc, 60);
+
+    return s;
+}
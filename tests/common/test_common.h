@@ -7,7 +7,10 @@
 char *
 bin_to_hex(const char *input, int length);
 
+Suite *make_suite_test_event_loop(void);
 Suite *make_suite_test_fifo(void);
+Suite *make_suite_test_spsc_ring(void);
+Suite *make_suite_test_histogram(void);
 Suite *make_suite_test_list(void);
 Suite *make_suite_test_parse(void);
 Suite *make_suite_test_string(void);
@@ -17,6 +20,8 @@ Suite *make_suite_test_ssl_calls(void);
 Suite *make_suite_test_base64(void);
 Suite *make_suite_test_guid(void);
 Suite *make_suite_test_scancode(void);
+Suite *make_suite_test_trans(void);
+Suite *make_suite_test_xxhash64(void);
 
 TCase *make_tcase_test_os_calls_signals(void);
 
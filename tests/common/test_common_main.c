@@ -47,6 +47,9 @@ int main (void)
     SRunner *sr;
 
     sr = srunner_create (make_suite_test_fifo());
+    srunner_add_suite(sr, make_suite_test_event_loop());
+    srunner_add_suite(sr, make_suite_test_spsc_ring());
+    srunner_add_suite(sr, make_suite_test_histogram());
     srunner_add_suite(sr, make_suite_test_list());
     srunner_add_suite(sr, make_suite_test_parse());
     srunner_add_suite(sr, make_suite_test_string());
@@ -56,6 +59,8 @@ int main (void)
     srunner_add_suite(sr, make_suite_test_base64());
     srunner_add_suite(sr, make_suite_test_guid());
     srunner_add_suite(sr, make_suite_test_scancode());
+    srunner_add_suite(sr, make_suite_test_trans());
+    srunner_add_suite(sr, make_suite_test_xxhash64());
 
     srunner_set_tap(sr, "-");
     /*
@@ -0,0 +1,343 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "event_loop.h"
+#include "trans.h"
+
+#include "test_common.h"
+
+#define MAX_CALLS 16
+
+static struct event_loop *loop;
+static int sck[2][2];
+
+/* record of callbacks, in the order they were made */
+static int calls[MAX_CALLS];
+static int call_events[MAX_CALLS];
+static int call_count;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    int i;
+
+    loop = event_loop_create();
+    ck_assert_ptr_ne(loop, NULL);
+    for (i = 0; i < 2; i++)
+    {
+        ck_assert_int_eq(g_sck_local_socketpair(sck[i]), 0);
+        g_sck_set_non_blocking(sck[i][0]);
+        g_sck_set_non_blocking(sck[i][1]);
+    }
+    call_count = 0;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    int i;
+
+    event_loop_delete(loop);
+    for (i = 0; i < 2; i++)
+    {
+        g_sck_close(sck[i][0]);
+        g_sck_close(sck[i][1]);
+    }
+}
+
+/******************************************************************************/
+static void
+record_call(int id, int events)
+{
+    ck_assert_int_lt(call_count, MAX_CALLS);
+    calls[call_count] = id;
+    call_events[call_count] = events;
+    call_count++;
+}
+
+/******************************************************************************/
+static void
+obj_ready(struct event_loop *l, tintptr obj, int events, void *arg)
+{
+    ck_assert_ptr_eq(l, loop);
+    record_call((int)(tintptr)arg, events);
+}
+
+/******************************************************************************/
+/* Removes both sockets, whichever is called first */
+static void
+obj_ready_remove_all(struct event_loop *l, tintptr obj, int events,
+                     void *arg)
+{
+    record_call((int)(tintptr)arg, events);
+    event_loop_remove(l, sck[0][0]);
+    event_loop_remove(l, sck[1][0]);
+}
+
+/******************************************************************************/
+static void
+timer_expired(struct event_loop *l, void *arg)
+{
+    ck_assert_ptr_eq(l, loop);
+    record_call((int)(tintptr)arg, 0);
+}
+
+/******************************************************************************/
+/* Re-adds itself with no delay */
+static void
+timer_expired_again(struct event_loop *l, void *arg)
+{
+    record_call((int)(tintptr)arg, 0);
+    ck_assert_ptr_ne(event_loop_add_timer(l, 0, timer_expired_again, arg),
+                     NULL);
+}
+
+/******************************************************************************/
+START_TEST(test_event_loop__read_write)
+{
+    ck_assert_int_eq(event_loop_add(loop, sck[0][0], EVENT_LOOP_READ,
+                                    obj_ready, (void *)1), 0);
+
+    /* nothing to read yet */
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 0);
+
+    ck_assert_int_eq(g_sck_send(sck[0][1], "x", 1, 0), 1);
+    ck_assert_int_eq(event_loop_run_once(loop, 1000), 0);
+    ck_assert_int_eq(call_count, 1);
+    ck_assert_int_eq(calls[0], 1);
+    ck_assert_int_eq(call_events[0], EVENT_LOOP_READ);
+
+    /* A socket with room in its buffer is always writeable */
+    ck_assert_int_eq(event_loop_modify(loop, sck[0][0],
+                                       EVENT_LOOP_READ | EVENT_LOOP_WRITE), 0);
+    ck_assert_int_eq(event_loop_run_once(loop, 1000), 0);
+    ck_assert_int_eq(call_count, 2);
+    ck_assert_int_eq(call_events[1], EVENT_LOOP_READ | EVENT_LOOP_WRITE);
+
+    /* Not interested in anything */
+    ck_assert_int_eq(event_loop_modify(loop, sck[0][0], 0), 0);
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 2);
+
+    /* Removed */
+    ck_assert_int_eq(event_loop_modify(loop, sck[0][0], EVENT_LOOP_READ), 0);
+    event_loop_remove(loop, sck[0][0]);
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 2);
+    ck_assert_int_ne(event_loop_modify(loop, sck[0][0], EVENT_LOOP_READ), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_event_loop__remove_in_callback)
+{
+    ck_assert_int_eq(event_loop_add(loop, sck[0][0], EVENT_LOOP_READ,
+                                    obj_ready_remove_all, (void *)1), 0);
+    ck_assert_int_eq(event_loop_add(loop, sck[1][0], EVENT_LOOP_READ,
+                                    obj_ready_remove_all, (void *)2), 0);
+    ck_assert_int_eq(g_sck_send(sck[0][1], "x", 1, 0), 1);
+    ck_assert_int_eq(g_sck_send(sck[1][1], "x", 1, 0), 1);
+    g_sleep(10);
+
+    /* Both are ready, but only one is called */
+    ck_assert_int_eq(event_loop_run_once(loop, 1000), 0);
+    ck_assert_int_eq(call_count, 1);
+
+    /* A new registration doesn't get an old event */
+    ck_assert_int_eq(event_loop_add(loop, sck[0][0], EVENT_LOOP_WRITE,
+                                    obj_ready, (void *)3), 0);
+    ck_assert_int_eq(event_loop_run_once(loop, 1000), 0);
+    ck_assert_int_eq(call_count, 2);
+    ck_assert_int_eq(calls[1], 3);
+    ck_assert_int_eq(call_events[1], EVENT_LOOP_WRITE);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_event_loop__wait_obj)
+{
+    tintptr obj;
+
+    obj = g_create_wait_obj("test_event_loop");
+    ck_assert_int_ne(obj, 0);
+    ck_assert_int_eq(event_loop_add(loop, obj, EVENT_LOOP_READ,
+                                    obj_ready, (void *)1), 0);
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 0);
+
+    g_set_wait_obj(obj);
+    ck_assert_int_eq(event_loop_run_once(loop, 1000), 0);
+    ck_assert_int_eq(call_count, 1);
+
+    event_loop_remove(loop, obj);
+    g_delete_wait_obj(obj);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_event_loop__timers)
+{
+    struct event_loop_timer *cancelled;
+    tui64 start;
+    int i;
+
+    start = g_time_us();
+    ck_assert_ptr_ne(event_loop_add_timer(loop, 60, timer_expired,
+                                          (void *)4), NULL);
+    ck_assert_ptr_ne(event_loop_add_timer(loop, 20, timer_expired,
+                                          (void *)1), NULL);
+    cancelled = event_loop_add_timer(loop, 30, timer_expired, (void *)9);
+    ck_assert_ptr_ne(cancelled, NULL);
+    ck_assert_ptr_ne(event_loop_add_timer(loop, 40, timer_expired,
+                                          (void *)3), NULL);
+    ck_assert_ptr_ne(event_loop_add_timer(loop, 20, timer_expired,
+                                          (void *)2), NULL);
+    event_loop_cancel_timer(loop, cancelled);
+
+    /* Not due yet */
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 0);
+
+    for (i = 0; i < 20 && call_count < 4; i++)
+    {
+        ck_assert_int_eq(event_loop_run_once(loop, -1), 0);
+    }
+    ck_assert_int_eq(call_count, 4);
+    ck_assert_int_eq(calls[0], 1);
+    ck_assert_int_eq(calls[1], 2);
+    ck_assert_int_eq(calls[2], 3);
+    ck_assert_int_eq(calls[3], 4);
+    ck_assert_int_ge(g_time_us() - start, 59000);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_event_loop__timer_readds_itself)
+{
+    ck_assert_ptr_ne(event_loop_add_timer(loop, 0, timer_expired_again,
+                                          (void *)1), NULL);
+
+    /* Each pass only calls it once */
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 1);
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 2);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_event_loop__get_wait_objs)
+{
+    tintptr robjs[8];
+    tintptr wobjs[8];
+    int rcount = 0;
+    int wcount = 0;
+    int timeout = -1;
+
+    ck_assert_int_eq(event_loop_add(loop, sck[0][0], EVENT_LOOP_READ,
+                                    obj_ready, (void *)1), 0);
+    ck_assert_ptr_ne(event_loop_add_timer(loop, 5000, timer_expired,
+                                          (void *)2), NULL);
+    ck_assert_int_eq(event_loop_get_wait_objs(loop, robjs, &rcount,
+                     wobjs, &wcount, &timeout), 0);
+    ck_assert_int_gt(rcount, 0);
+    ck_assert_int_gt(timeout, 4000);
+    ck_assert_int_le(timeout, 5000);
+
+    /* The loop can be waited for along with other objects */
+    ck_assert_int_eq(g_sck_send(sck[0][1], "x", 1, 0), 1);
+    ck_assert_int_eq(g_obj_wait(robjs, rcount, wobjs, wcount, timeout), 0);
+    ck_assert_int_eq(event_loop_check_wait_objs(loop), 0);
+    ck_assert_int_eq(call_count, 1);
+    ck_assert_int_eq(calls[0], 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_event_loop__trans_write_interest)
+{
+    struct trans *t;
+    struct stream *s;
+    char buf[65536];
+    int sent;
+    int i;
+
+    t = trans_create(TRANS_MODE_UNIX, 8192, 8192);
+    ck_assert_ptr_ne(t, NULL);
+    t->sck = sck[0][0];
+    t->type1 = TRANS_TYPE_CLIENT;
+    t->status = TRANS_STATUS_UP;
+    ck_assert_int_eq(trans_attach_event_loop(t, loop, obj_ready,
+                     (void *)1), 0);
+
+    /* Nothing queued, so no need to wait for writes */
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 0);
+
+    /* Fill the socket buffer, and queue more */
+    for (sent = 0; sent < 1024 * 1024; sent += sizeof(buf))
+    {
+        make_stream(s);
+        init_stream(s, sizeof(buf));
+        out_uint8s(s, sizeof(buf));
+        s_mark_end(s);
+        ck_assert_int_eq(trans_write_owned_s(t, s), 0);
+    }
+    ck_assert_ptr_ne(t->wait_s, NULL);
+
+    /* Once the peer reads some, we're told we can write */
+    while (g_sck_recv(sck[0][1], buf, sizeof(buf), 0) > 0)
+    {
+    }
+    ck_assert_int_eq(event_loop_run_once(loop, 1000), 0);
+    ck_assert_int_eq(call_count, 1);
+    ck_assert_int_eq(call_events[0], EVENT_LOOP_WRITE);
+
+    /* Sending everything stops the write events */
+    for (i = 0; i < 1000 && t->wait_s != NULL; i++)
+    {
+        while (g_sck_recv(sck[0][1], buf, sizeof(buf), 0) > 0)
+        {
+        }
+        ck_assert_int_eq(trans_check_wait_objs(t), 0);
+    }
+    ck_assert_ptr_eq(t->wait_s, NULL);
+    call_count = 0;
+    ck_assert_int_eq(event_loop_run_once(loop, 0), 0);
+    ck_assert_int_eq(call_count, 0);
+
+    /* Deleting the transport removes it from the loop */
+    trans_delete(t);
+    ck_assert_int_ne(event_loop_modify(loop, sck[0][0], EVENT_LOOP_READ), 0);
+    /* The transport closed the socket */
+    sck[0][0] = g_sck_local_socket();
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_event_loop(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("EventLoop");
+
+    tc = tcase_create("event_loop");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_event_loop__read_write);
+    tcase_add_test(tc, test_event_loop__remove_in_callback);
+    tcase_add_test(tc, test_event_loop__wait_obj);
+    tcase_add_test(tc, test_event_loop__timers);
+    tcase_add_test(tc, test_event_loop__timer_readds_itself);
+    tcase_add_test(tc, test_event_loop__get_wait_objs);
+    tcase_add_test(tc, test_event_loop__trans_write_interest);
+
+    return s;
+}
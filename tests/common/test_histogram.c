@@ -0,0 +1,120 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "histogram.h"
+
+#include "test_common.h"
+
+/******************************************************************************/
+START_TEST(test_histogram__empty)
+{
+    struct histogram h;
+
+    histogram_init(&h);
+    ck_assert_int_eq(h.count, 0);
+    ck_assert_int_eq(histogram_mean(&h), 0);
+    ck_assert_int_eq(histogram_percentile(&h, 0), 0);
+    ck_assert_int_eq(histogram_percentile(&h, 50), 0);
+    ck_assert_int_eq(histogram_percentile(&h, 100), 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_histogram__small_values)
+{
+    struct histogram h;
+    unsigned int i;
+
+    /* Values below 16 are counted exactly */
+    histogram_init(&h);
+    for (i = 0; i < 16; ++i)
+    {
+        histogram_record(&h, i);
+    }
+    ck_assert_int_eq(h.count, 16);
+    ck_assert_int_eq(h.min, 0);
+    ck_assert_int_eq(h.max, 15);
+    ck_assert_int_eq(h.sum, 120);
+    ck_assert_int_eq(histogram_mean(&h), 7);
+    ck_assert_int_eq(histogram_percentile(&h, 0), 0);
+    ck_assert_int_eq(histogram_percentile(&h, 25), 3);
+    ck_assert_int_eq(histogram_percentile(&h, 50), 7);
+    ck_assert_int_eq(histogram_percentile(&h, 100), 15);
+    /* Out-of-range percentile is clamped */
+    ck_assert_int_eq(histogram_percentile(&h, 101), 15);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_histogram__accuracy)
+{
+    struct histogram h;
+    unsigned int i;
+    unsigned int pct;
+    unsigned int expected;
+    unsigned int actual;
+
+    histogram_init(&h);
+    for (i = 1; i <= 100000; ++i)
+    {
+        histogram_record(&h, i);
+    }
+    ck_assert_int_eq(h.min, 1);
+    ck_assert_int_eq(h.max, 100000);
+    ck_assert_int_eq(histogram_mean(&h), 50000);
+
+    for (pct = 1; pct <= 100; ++pct)
+    {
+        expected = pct * 1000;
+        actual = histogram_percentile(&h, pct);
+        /* Never under-reported, and never more than 1/8 over */
+        ck_assert_uint_ge(actual, expected);
+        ck_assert_uint_le(actual, expected + expected / 8);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_histogram__extremes)
+{
+    struct histogram h;
+
+    histogram_init(&h);
+    histogram_record(&h, 0xffffffff);
+    histogram_record(&h, 0x80000000);
+    ck_assert_uint_eq(h.min, 0x80000000);
+    ck_assert_uint_eq(h.max, 0xffffffff);
+    ck_assert_uint_eq(h.buckets[HISTOGRAM_BUCKETS - 1], 1);
+    ck_assert_uint_eq(histogram_percentile(&h, 100), 0xffffffff);
+    /* Top of the 0x80000000 bucket */
+    ck_assert_uint_eq(histogram_percentile(&h, 50), 0x8fffffff);
+
+    /* Re-initialising resets everything */
+    histogram_init(&h);
+    histogram_record(&h, 42);
+    ck_assert_int_eq(h.count, 1);
+    ck_assert_int_eq(h.min, 42);
+    ck_assert_int_eq(h.max, 42);
+    ck_assert_int_eq(histogram_percentile(&h, 99), 42);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_histogram(void)
+{
+    Suite *s;
+    TCase *tc_simple;
+
+    s = suite_create("Histogram");
+
+    tc_simple = tcase_create("simple");
+    suite_add_tcase(s, tc_simple);
+    tcase_add_test(tc_simple, test_histogram__empty);
+    tcase_add_test(tc_simple, test_histogram__small_values);
+    tcase_add_test(tc_simple, test_histogram__accuracy);
+    tcase_add_test(tc_simple, test_histogram__extremes);
+
+    return s;
+}
@@ -0,0 +1,257 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "spsc_ring.h"
+
+#include "os_calls.h"
+#include "test_common.h"
+#include "thread_calls.h"
+
+static const char *strings[] =
+{
+    "one",
+    "two",
+    "three",
+    "four",
+    "five",
+    "six",
+    "seven",
+    "eight",
+    "nine",
+    "ten",
+    "eleven",
+    "twelve",
+    NULL
+};
+
+#define THREADED_TEST_SIZE 1000000
+#define THREADED_TEST_RING_SIZE 64
+
+/******************************************************************************/
+/* Item destructor function for ring tests involving allocated strings */
+static void
+string_item_destructor(void *item, void *closure)
+{
+    free(item);
+
+    if (closure != NULL)
+    {
+        /* Count the free operation */
+        int *c = (int *)closure;
+        ++(*c);
+    }
+}
+
+/******************************************************************************/
+/* Producer thread for test_spsc_ring__threaded. Items are the
+ * numbers 1..THREADED_TEST_SIZE cast to pointers */
+static THREAD_RV THREAD_CC
+producer_thread(void *arg)
+{
+    struct spsc_ring *r = (struct spsc_ring *)arg;
+    tintptr i;
+
+    for (i = 1 ; i <= THREADED_TEST_SIZE ; ++i)
+    {
+        while (!spsc_ring_add_item(r, (void *)i))
+        {
+            /* ring is full - wait for the consumer */
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************/
+
+START_TEST(test_spsc_ring__null)
+{
+    struct spsc_ring *r = NULL;
+    void *vp;
+    int status;
+
+    // These calls should not crash!
+    spsc_ring_delete(r, NULL);
+    spsc_ring_clear(r, NULL);
+
+    status = spsc_ring_add_item(r, NULL);
+    ck_assert_int_eq(status, 0);
+
+    vp = spsc_ring_remove_item(r);
+    ck_assert_ptr_eq(vp, NULL);
+
+    status = spsc_ring_is_empty(r);
+    ck_assert_int_eq(status, 1);
+
+    status = spsc_ring_is_full(r);
+    ck_assert_int_eq(status, 0);
+}
+END_TEST
+
+START_TEST(test_spsc_ring__simple)
+{
+    struct spsc_ring *r = spsc_ring_create(32, NULL);
+    ck_assert_ptr_ne(r, NULL);
+
+    int empty = spsc_ring_is_empty(r);
+    ck_assert_int_eq(empty, 1);
+
+    // Check we can't add NULL to the ring
+    int success = spsc_ring_add_item(r, NULL);
+    ck_assert_int_eq(success, 0);
+
+    // Check we can't remove anything from an empty ring
+    void *vp = spsc_ring_remove_item(r);
+    ck_assert_ptr_eq(vp, NULL);
+
+    // Add some static strings to the ring
+    const char **s;
+    unsigned int n = 0;
+    for (s = &strings[0] ; *s != NULL; ++s)
+    {
+        spsc_ring_add_item(r, (void *)*s);
+        ++n;
+    }
+
+    empty = spsc_ring_is_empty(r);
+    ck_assert_int_eq(empty, 0);
+
+    unsigned int i;
+    for (i = 0 ; i < n ; ++i)
+    {
+        const char *p = (const char *)spsc_ring_remove_item(r);
+        ck_assert_ptr_eq(p, strings[i]);
+    }
+
+    empty = spsc_ring_is_empty(r);
+    ck_assert_int_eq(empty, 1);
+
+    spsc_ring_delete(r, NULL);
+}
+END_TEST
+
+START_TEST(test_spsc_ring__full)
+{
+    // Size is rounded up to a power of 2
+    struct spsc_ring *r = spsc_ring_create(5, string_item_destructor);
+    ck_assert_ptr_ne(r, NULL);
+
+    int i;
+    for (i = 0; i < 8; ++i)
+    {
+        ck_assert_int_eq(spsc_ring_is_full(r), 0);
+        int ok = spsc_ring_add_item(r, (void *)strdup(strings[i]));
+        ck_assert_int_eq(ok, 1);
+    }
+
+    ck_assert_int_eq(spsc_ring_is_full(r), 1);
+    char *extra = strdup(strings[8]);
+    ck_assert_int_eq(spsc_ring_add_item(r, extra), 0);
+
+    // Make space by removing the first item, then wrap round the end
+    char *p = (char *)spsc_ring_remove_item(r);
+    ck_assert_str_eq(p, strings[0]);
+    free(p);
+    ck_assert_int_eq(spsc_ring_is_full(r), 0);
+    ck_assert_int_eq(spsc_ring_add_item(r, extra), 1);
+    ck_assert_int_eq(spsc_ring_is_full(r), 1);
+
+    for (i = 1; i <= 8; ++i)
+    {
+        p = (char *)spsc_ring_remove_item(r);
+        ck_assert_str_eq(p, strings[i]);
+        free(p);
+    }
+    ck_assert_int_eq(spsc_ring_is_empty(r), 1);
+
+    int c = 0;
+    spsc_ring_delete(r, &c);
+    ck_assert_int_eq(c, 0);
+}
+END_TEST
+
+START_TEST(test_spsc_ring__clear)
+{
+    struct spsc_ring *r = spsc_ring_create(16, string_item_destructor);
+    ck_assert_ptr_ne(r, NULL);
+
+    // Move the indexes away from zero
+    int i;
+    for (i = 0; i < 10; ++i)
+    {
+        spsc_ring_add_item(r, (void *)strdup("test item"));
+        free(spsc_ring_remove_item(r));
+    }
+
+    for (i = 0; i < 16; ++i)
+    {
+        int ok = spsc_ring_add_item(r, (void *)strdup("test item"));
+        ck_assert_int_eq(ok, 1);
+    }
+
+    // Clear the ring, checking free is called the expected number of times
+    int c = 0;
+    spsc_ring_clear(r, &c);
+    ck_assert_int_eq(c, 16);
+    ck_assert_int_eq(spsc_ring_is_empty(r), 1);
+    ck_assert_int_eq(spsc_ring_is_full(r), 0);
+
+    // Delete the ring with some items in it
+    for (i = 0; i < 3; ++i)
+    {
+        spsc_ring_add_item(r, (void *)strdup("test item"));
+    }
+    c = 0;
+    spsc_ring_delete(r, &c);
+    ck_assert_int_eq(c, 3);
+}
+END_TEST
+
+START_TEST(test_spsc_ring__threaded)
+{
+    struct spsc_ring *r = spsc_ring_create(THREADED_TEST_RING_SIZE, NULL);
+    ck_assert_ptr_ne(r, NULL);
+
+    int status = tc_thread_create(producer_thread, r);
+    ck_assert_int_eq(status, 0);
+
+    // Items must arrive in order, without gaps
+    tintptr expected = 1;
+    while (expected <= THREADED_TEST_SIZE)
+    {
+        void *vp = spsc_ring_remove_item(r);
+        if (vp != NULL)
+        {
+            ck_assert_int_eq((tintptr)vp, expected);
+            ++expected;
+        }
+    }
+
+    ck_assert_int_eq(spsc_ring_is_empty(r), 1);
+    spsc_ring_delete(r, NULL);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_spsc_ring(void)
+{
+    Suite *s;
+    TCase *tc_simple;
+    TCase *tc_threaded;
+
+    s = suite_create("SpscRing");
+
+    tc_simple = tcase_create("simple");
+    suite_add_tcase(s, tc_simple);
+    tcase_add_test(tc_simple, test_spsc_ring__null);
+    tcase_add_test(tc_simple, test_spsc_ring__simple);
+    tcase_add_test(tc_simple, test_spsc_ring__full);
+    tcase_add_test(tc_simple, test_spsc_ring__clear);
+
+    tc_threaded = tcase_create("threaded");
+    suite_add_tcase(s, tc_threaded);
+    tcase_add_test(tc_threaded, test_spsc_ring__threaded);
+
+    return s;
+}
@@ -677,6 +677,38 @@ START_TEST(test_utf8_as_utf16_word_count)
 }
 END_TEST
 
+/******************************************************************************/
+START_TEST(test_utf8_whole_chars_len)
+{
+    unsigned int len = strlen(simple_test_with_emoji);
+    unsigned int i;
+
+    ck_assert_int_eq(utf8_whole_chars_len("", 0), 0);
+    ck_assert_int_eq(utf8_whole_chars_len("abc", 3), 3);
+
+    // The emoji is the last 4 bytes of the string. Cutting it short
+    // anywhere leaves it out
+    ck_assert_int_eq(utf8_whole_chars_len(simple_test_with_emoji, len), len);
+    for (i = 1; i < 4; ++i)
+    {
+        ck_assert_int_eq(utf8_whole_chars_len(simple_test_with_emoji,
+                                              len - i), len - 4);
+    }
+
+    // 'e' with an acute accent, on its own and cut short
+    ck_assert_int_eq(utf8_whole_chars_len("a\xc3\xa9", 3), 3);
+    ck_assert_int_eq(utf8_whole_chars_len("a\xc3\xa9", 2), 1);
+
+    // Euro sign, cut short
+    ck_assert_int_eq(utf8_whole_chars_len("\xe2\x82\xac", 2), 0);
+    ck_assert_int_eq(utf8_whole_chars_len("\xe2\x82\xac", 1), 0);
+
+    // Stray continuation characters are left to the decoder
+    ck_assert_int_eq(utf8_whole_chars_len("\x80\x80", 2), 2);
+    ck_assert_int_eq(utf8_whole_chars_len("\x80\x80\x80\x80\x80", 5), 5);
+}
+END_TEST
+
 /******************************************************************************/
 START_TEST(test_utf8_add_char_at)
 {
@@ -828,6 +860,7 @@ make_suite_test_string_unicode(void)
     tcase_add_test(tc_unicode, test_utf_char32_to_utf8);
     tcase_add_test(tc_unicode, test_utf8_char_count);
     tcase_add_test(tc_unicode, test_utf8_as_utf16_word_count);
+    tcase_add_test(tc_unicode, test_utf8_whole_chars_len);
     tcase_add_test(tc_unicode, test_utf8_add_char_at);
     tcase_add_test(tc_unicode, test_utf8_remove_char_at);
 
@@ -0,0 +1,270 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "trans.h"
+
+#include "test_common.h"
+
+#define NUM_PDUS 200
+#define MAX_PDU_BYTES 40000
+
+static struct trans *t;
+static int peer;
+static char *received;
+static int received_bytes;
+static int total_bytes;
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    int sck[2];
+
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    g_sck_set_non_blocking(sck[0]);
+    g_sck_set_non_blocking(sck[1]);
+    t = trans_create(TRANS_MODE_UNIX, 8192, 8192);
+    ck_assert_ptr_ne(t, NULL);
+    t->sck = sck[0];
+    t->type1 = TRANS_TYPE_CLIENT;
+    t->status = TRANS_STATUS_UP;
+    peer = sck[1];
+    received = (char *) g_malloc(NUM_PDUS * MAX_PDU_BYTES, 0);
+    received_bytes = 0;
+    total_bytes = 0;
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    trans_delete(t);
+    g_sck_close(peer);
+    g_free(received);
+}
+
+/******************************************************************************/
+static int
+pdu_bytes(int pdu)
+{
+    return 1 + (pdu * 7919) % MAX_PDU_BYTES;
+}
+
+/******************************************************************************/
+static char
+pdu_byte(int pdu, int offset)
+{
+    return (char) (pdu * 31 + offset);
+}
+
+/******************************************************************************/
+/* Sends a PDU, alternating between copied and owned streams */
+static void
+send_pdu(int pdu)
+{
+    struct stream *s;
+    int bytes;
+    int index;
+
+    bytes = pdu_bytes(pdu);
+    make_stream(s);
+    init_stream(s, bytes);
+    for (index = 0; index < bytes; index++)
+    {
+        out_uint8(s, pdu_byte(pdu, index));
+    }
+    s_mark_end(s);
+    total_bytes += bytes;
+    if (pdu & 1)
+    {
+        ck_assert_int_eq(trans_write_owned_s(t, s), 0);
+    }
+    else
+    {
+        ck_assert_int_eq(trans_write_copy_s(t, s), 0);
+        free_stream(s);
+    }
+}
+
+/******************************************************************************/
+/* Sends a PDU from three buffers in one call */
+static void
+send_pdu_iov(int pdu)
+{
+    char *data;
+    const void *bufs[3];
+    unsigned int lens[3];
+    int bytes;
+    int index;
+
+    bytes = pdu_bytes(pdu);
+    data = (char *) g_malloc(bytes, 0);
+    for (index = 0; index < bytes; index++)
+    {
+        data[index] = pdu_byte(pdu, index);
+    }
+    bufs[0] = data;
+    lens[0] = bytes / 3;
+    bufs[1] = data + lens[0];
+    lens[1] = bytes / 2 - lens[0];
+    bufs[2] = data + lens[0] + lens[1];
+    lens[2] = bytes - lens[0] - lens[1];
+    total_bytes += bytes;
+    ck_assert_int_eq(trans_write_iov(t, bufs, lens, 3), 0);
+    g_free(data);
+}
+
+/******************************************************************************/
+/* Reads from the peer, and sends queued output, until everything
+ * has arrived */
+static void
+drain(void)
+{
+    int bytes;
+
+    while (received_bytes < total_bytes)
+    {
+        bytes = g_sck_recv(peer, received + received_bytes,
+                           total_bytes - received_bytes, 0);
+        if (bytes > 0)
+        {
+            received_bytes += bytes;
+        }
+        else
+        {
+            ck_assert(g_sck_last_error_would_block(peer));
+        }
+        ck_assert_int_eq(trans_check_wait_objs(t), 0);
+    }
+}
+
+/******************************************************************************/
+static void
+check_received(void)
+{
+    int pdu;
+    int offset;
+    int index;
+    const char *p;
+
+    ck_assert_int_eq(received_bytes, total_bytes);
+    p = received;
+    for (pdu = 0; pdu < NUM_PDUS; pdu++)
+    {
+        for (index = 0, offset = 0; offset < pdu_bytes(pdu); offset++)
+        {
+            index += *p++ != pdu_byte(pdu, offset);
+        }
+        ck_assert_msg(index == 0, "PDU %d corrupt", pdu);
+    }
+}
+
+/******************************************************************************/
+START_TEST(test_trans__queue_in_order)
+{
+    int pdu;
+
+    /* far more than the socket buffer will take */
+    for (pdu = 0; pdu < NUM_PDUS; pdu++)
+    {
+        send_pdu(pdu);
+    }
+    ck_assert_ptr_ne(t->wait_s, NULL);
+    drain();
+    check_received();
+    ck_assert_ptr_eq(t->wait_s, NULL);
+    ck_assert_ptr_eq(t->wait_s_tail, NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__queue_while_draining)
+{
+    int pdu;
+    int bytes;
+
+    /* keep adding to the queue as it empties */
+    for (pdu = 0; pdu < NUM_PDUS; pdu++)
+    {
+        send_pdu(pdu);
+        bytes = g_sck_recv(peer, received + received_bytes,
+                           total_bytes - received_bytes, 0);
+        if (bytes > 0)
+        {
+            received_bytes += bytes;
+        }
+    }
+    drain();
+    check_received();
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__write_iov)
+{
+    int pdu;
+
+    for (pdu = 0; pdu < NUM_PDUS; pdu++)
+    {
+        send_pdu_iov(pdu);
+    }
+    ck_assert_int_gt(t->wait_bytes, 0);
+    ck_assert_int_lt(t->wait_bytes, total_bytes);
+    drain();
+    check_received();
+    ck_assert_int_eq(t->wait_bytes, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__source_accounting)
+{
+    struct source_info si;
+    int pdu;
+
+    g_memset(&si, 0, sizeof(si));
+    si.cur_source = XRDP_SOURCE_CLIENT;
+    t->si = &si;
+    t->my_source = XRDP_SOURCE_MOD;
+
+    for (pdu = 0; pdu < NUM_PDUS; pdu++)
+    {
+        send_pdu(pdu);
+    }
+    ck_assert_int_gt(si.source[XRDP_SOURCE_CLIENT], 0);
+    drain();
+    ck_assert_int_eq(si.source[XRDP_SOURCE_CLIENT], 0);
+
+    /* Deleting the transport gives back anything still queued */
+    for (pdu = 0; pdu < NUM_PDUS; pdu++)
+    {
+        send_pdu(pdu);
+    }
+    ck_assert_int_gt(si.source[XRDP_SOURCE_CLIENT], 0);
+    trans_delete(t);
+    t = NULL;
+    ck_assert_int_eq(si.source[XRDP_SOURCE_CLIENT], 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_trans(void)
+{
+    Suite *s;
+    TCase *tc_queue;
+
+    s = suite_create("Trans");
+
+    tc_queue = tcase_create("trans_queue");
+    tcase_add_checked_fixture(tc_queue, setup, teardown);
+    suite_add_tcase(s, tc_queue);
+    tcase_add_test(tc_queue, test_trans__queue_in_order);
+    tcase_add_test(tc_queue, test_trans__queue_while_draining);
+    tcase_add_test(tc_queue, test_trans__write_iov);
+    tcase_add_test(tc_queue, test_trans__source_accounting);
+
+    return s;
+}
@@ -0,0 +1,91 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <string.h>
+
+#include "xxhash64.h"
+
+#include "test_common.h"
+
+struct hash_test
+{
+    const char *input;
+    tui64 seed;
+    tui64 expected;
+};
+
+/* Results from the reference implementation */
+static const struct hash_test tests[] =
+{
+    { "", 0, 0xEF46DB3751D8E999ULL },
+    { "a", 0, 0xD24EC4F1A98C6E5BULL },
+    { "abc", 0, 0x44BC2CF5AD770999ULL },
+    /* Long enough to use the 32-byte stripes, plus a tail of 7 */
+    { "Nobody inspects the spammish repetition", 0, 0xFBCEA83C8A378BF1ULL },
+    { NULL, 0, 0 }
+};
+
+/******************************************************************************/
+START_TEST(test_xxhash64__reference)
+{
+    const struct hash_test *t;
+
+    for (t = tests; t->input != NULL; ++t)
+    {
+        ck_assert_msg(xxhash64(t->input, strlen(t->input), t->seed) ==
+                      t->expected, "Bad hash for '%s'", t->input);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xxhash64__seed)
+{
+    const char *s = "abc";
+
+    ck_assert_msg(xxhash64(s, 3, 0) != xxhash64(s, 3, 1),
+                  "Seed doesn't change hash");
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xxhash64__unaligned)
+{
+    char buff[128 + 8];
+    unsigned int i;
+    tui64 expected;
+
+    for (i = 0; i < 128; ++i)
+    {
+        buff[i] = (char)(i * 7);
+    }
+    expected = xxhash64(buff, 128, 42);
+
+    /* Same data at every alignment should give the same result */
+    for (i = 1; i < 8; ++i)
+    {
+        memmove(buff + i, buff + i - 1, 128);
+        ck_assert_msg(xxhash64(buff + i, 128, 42) == expected,
+                      "Bad hash at offset %u", i);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xxhash64(void)
+{
+    Suite *s;
+    TCase *tc_simple;
+
+    s = suite_create("xxhash64");
+
+    tc_simple = tcase_create("simple");
+    suite_add_tcase(s, tc_simple);
+    tcase_add_test(tc_simple, test_xxhash64__reference);
+    tcase_add_test(tc_simple, test_xxhash64__seed);
+    tcase_add_test(tc_simple, test_xxhash64__unaligned);
+
+    return s;
+}
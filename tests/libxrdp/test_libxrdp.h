@@ -4,6 +4,10 @@
 #include <check.h>
 
 Suite *make_suite_test_xrdp_sec_process_mcs_data_monitors(void);
+Suite *make_suite_test_xrdp_sec_fastpath_batch(void);
 Suite *make_suite_test_monitor_processing(void);
+Suite *make_suite_test_xrdp_mppc_enc(void);
+Suite *make_suite_test_xrdp_bitmap_compress(void);
+Suite *make_suite_test_xrdp_bitmap32_compress(void);
 
 #endif /* TEST_LIBXRDP_H */
@@ -13,7 +13,11 @@ int main (void)
     SRunner *sr;
 
     sr = srunner_create(make_suite_test_xrdp_sec_process_mcs_data_monitors());
+    srunner_add_suite(sr, make_suite_test_xrdp_sec_fastpath_batch());
     srunner_add_suite(sr, make_suite_test_monitor_processing());
+    srunner_add_suite(sr, make_suite_test_xrdp_mppc_enc());
+    srunner_add_suite(sr, make_suite_test_xrdp_bitmap_compress());
+    srunner_add_suite(sr, make_suite_test_xrdp_bitmap32_compress());
 
     srunner_set_tap(sr, "-");
 
@@ -0,0 +1,167 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "xxhash64.h"
+
+#include "test_libxrdp.h"
+
+#define FLAGS_RLE     0x10
+#define FLAGS_NOALPHA 0x20
+
+#define MAX_WIDTH 64
+#define MAX_HEIGHT 64
+#define STREAM_SIZE (64 * 1024)
+
+struct compress_test
+{
+    int width;
+    int height;
+    int flags;
+    int byte_limit;
+    /* output from the original scalar implementation */
+    int lines;
+    int bytes;
+    tui64 hash;
+};
+
+/******************************************************************************/
+static unsigned int
+next_rand(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/******************************************************************************/
+/* Areas of flat colour, gradients and noise, with some alpha */
+static void
+make_bitmap(tui32 *data, int width, int height)
+{
+    unsigned int seed = width * 1000 + height;
+    tui32 pixel;
+    int x;
+    int y;
+
+    for (y = 0; y < height; ++y)
+    {
+        for (x = 0; x < width; ++x)
+        {
+            switch ((x / 8 + y / 8) % 4)
+            {
+                case 0:
+                    pixel = 0xff336699;
+                    break;
+                case 1:
+                    pixel = 0xff000000 | (x * 0x030201) | (y << 16);
+                    break;
+                case 2:
+                    pixel = next_rand(&seed) | (next_rand(&seed) << 24);
+                    break;
+                default:
+                    pixel = ((x + y) % 3 == 0) ? 0x80ffffff : 0xff000000;
+                    break;
+            }
+            data[y * width + x] = pixel;
+        }
+    }
+}
+
+/******************************************************************************/
+static void
+run_compress(const struct compress_test *t, int *lines, int *bytes,
+             tui64 *hash)
+{
+    tui32 *data;
+    struct stream *s;
+    struct stream *temp_s;
+    int e;
+
+    data = g_new(tui32, MAX_WIDTH * MAX_HEIGHT);
+    ck_assert_ptr_ne(data, NULL);
+    make_bitmap(data, t->width, t->height);
+    make_stream(s);
+    init_stream(s, STREAM_SIZE);
+    make_stream(temp_s);
+    init_stream(temp_s, STREAM_SIZE);
+
+    e = (4 - t->width % 4) % 4;
+    *lines = xrdp_bitmap32_compress((char *)data, t->width, t->height, s, 32,
+                                    t->byte_limit, t->height - 1, temp_s, e,
+                                    t->flags);
+    *bytes = (int)(s->p - s->data);
+    *hash = xxhash64(s->data, *bytes, 0);
+
+    free_stream(temp_s);
+    free_stream(s);
+    g_free(data);
+}
+
+/* Generated from the original implementation */
+static const struct compress_test tests[] =
+{
+    { 64, 64, 0x10, 16000, 64, 11528, 0xCE7C00572449909BULL },
+    { 64, 64, 0x30, 16000, 64, 8956, 0xD8F421F1F47C6807ULL },
+    { 64, 64, 0x00, 16000, 62, 15874, 0x305ED23584D25690ULL },
+    { 64, 64, 0x20, 16000, 64, 12290, 0xB584D572EA9391E5ULL },
+    { 13, 7, 0x10, 16000, 7, 87, 0x807CD5AA94FECD74ULL },
+    { 13, 7, 0x30, 16000, 7, 79, 0x7C5073466417F6D0ULL },
+    { 13, 7, 0x00, 16000, 7, 450, 0xC2F2F29B0E99D7A1ULL },
+    { 13, 7, 0x20, 16000, 7, 338, 0xF7BE695BD53C21B6ULL },
+    { 61, 20, 0x10, 16000, 20, 3466, 0xC14CC9866B5DC7BBULL },
+    { 61, 20, 0x30, 16000, 20, 2696, 0x2FE47BD1CD547D79ULL },
+    { 61, 20, 0x00, 16000, 20, 5122, 0xA5C272A0FBF19BF7ULL },
+    { 61, 20, 0x20, 16000, 20, 3842, 0x49AD5E476F877A12ULL },
+    { 1, 1, 0x10, 16000, 1, 9, 0x50D93A4FC851F933ULL },
+    { 1, 1, 0x30, 16000, 1, 7, 0xAB29ED3BBCEE590CULL },
+    { 1, 1, 0x00, 16000, 1, 18, 0x444254FD22975CF0ULL },
+    { 1, 1, 0x20, 16000, 1, 14, 0x650B0199BCE5CC43ULL },
+    { 17, 33, 0x10, 16000, 33, 1630, 0xCD8D57078F9055FFULL },
+    { 17, 33, 0x30, 16000, 33, 1274, 0x905A770C4314354FULL },
+    { 17, 33, 0x00, 16000, 33, 2642, 0x954FE0ADBA1EA94FULL },
+    { 17, 33, 0x20, 16000, 33, 1982, 0x2425EADED0D92953ULL },
+    { 64, 64, 0x10, 3000, 16, 2837, 0x30D4E00C6AEA3F79ULL },
+    { 64, 64, 0x30, 3000, 21, 2937, 0x9AF08E213160F9BCULL },
+    { 64, 64, 0x00, 3000, 11, 2818, 0x5991A8E83C508F01ULL },
+    { 64, 64, 0x20, 3000, 15, 2882, 0xDBF641405B514B9CULL },
+    { 0, 0, 0, 0, 0, 0, 0 }
+};
+
+/******************************************************************************/
+START_TEST(test_xrdp_bitmap32_compress__golden)
+{
+    const struct compress_test *t;
+    int lines;
+    int bytes;
+    tui64 hash;
+
+    for (t = tests; t->width != 0; ++t)
+    {
+        run_compress(t, &lines, &bytes, &hash);
+        ck_assert_msg(lines == t->lines && bytes == t->bytes &&
+                      hash == t->hash,
+                      "%dx%d flags 0x%x limit %d: got lines %d bytes %d "
+                      "hash 0x%016llx", t->width, t->height, t->flags,
+                      t->byte_limit, lines, bytes, (unsigned long long)hash);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_bitmap32_compress(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_bitmap32_compress");
+
+    tc = tcase_create("xrdp_bitmap32_compress");
+    tcase_add_test(tc, test_xrdp_bitmap32_compress__golden);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,262 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "xxhash64.h"
+
+#include "test_libxrdp.h"
+
+#define MAX_WIDTH 64
+#define MAX_HEIGHT 64
+#define STREAM_SIZE (64 * 1024)
+
+/* Test images */
+enum pattern
+{
+    PAT_SOLID,
+    PAT_NOISE,
+    PAT_STRIPES, /* vertical stripes, so each line is the same (fill) */
+    PAT_XOR_LINES, /* lines alternate with their inverse (mix) */
+    PAT_CHECKS, /* two colours alternating (bicolor) */
+    PAT_TEXT, /* a few colours on a plain background (fill-or-mix) */
+    PAT_GRADIENT,
+    PAT_MIXED /* blocks of all the above */
+};
+
+struct compress_test
+{
+    int bpp;
+    int width;
+    int height;
+    enum pattern pattern;
+    int byte_limit;
+    /* output from the original per-pixel implementation */
+    int lines;
+    int bytes;
+    tui64 hash;
+};
+
+/******************************************************************************/
+static unsigned int
+next_rand(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/******************************************************************************/
+static unsigned int
+pattern_pixel(enum pattern pattern, int x, int y, unsigned int *seed)
+{
+    unsigned int rv;
+
+    switch (pattern)
+    {
+        case PAT_SOLID:
+            return 0x123456;
+        case PAT_NOISE:
+            return next_rand(seed);
+        case PAT_STRIPES:
+            return (x / 3) * 0x050403;
+        case PAT_XOR_LINES:
+            rv = (x / 5) * 0x010203;
+            return (y & 1) ? ~rv : rv;
+        case PAT_CHECKS:
+            return ((x + y) & 1) ? 0xff00ff : 0x00ff00;
+        case PAT_TEXT:
+            rv = next_rand(seed) % 16;
+            return (rv < 12) ? 0xffffff : (rv < 14) ? 0 : 0x808080;
+        case PAT_GRADIENT:
+            return x * 0x0101 + y * 0x010000;
+        default:
+            return pattern_pixel((enum pattern)((x / 8 + y / 8) % PAT_MIXED),
+                                 x, y, seed);
+    }
+}
+
+/******************************************************************************/
+/* fills a bitmap in the layout xrdp_bitmap_compress() expects */
+static void
+make_bitmap(char *data, const struct compress_test *t)
+{
+    unsigned int seed = t->width * 1000 + t->height;
+    unsigned int pixel;
+    int x;
+    int y;
+
+    for (y = 0; y < t->height; ++y)
+    {
+        for (x = 0; x < t->width; ++x)
+        {
+            pixel = pattern_pixel(t->pattern, x, y, &seed);
+            if (t->bpp == 8)
+            {
+                ((tui8 *)data)[y * t->width + x] = pixel;
+            }
+            else if (t->bpp == 15)
+            {
+                ((tui16 *)data)[y * t->width + x] = pixel & 0x7fff;
+            }
+            else if (t->bpp == 16)
+            {
+                ((tui16 *)data)[y * t->width + x] = pixel;
+            }
+            else
+            {
+                /* the top byte isn't sent, but the compressor sees it */
+                ((tui32 *)data)[y * t->width + x] = pixel;
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+static void
+run_compress(const struct compress_test *t, int *lines, int *bytes,
+             tui64 *hash)
+{
+    char *data;
+    struct stream *s;
+    struct stream *temp_s;
+    int e;
+
+    data = (char *)g_malloc(MAX_WIDTH * MAX_HEIGHT * 4, 1);
+    ck_assert_ptr_ne(data, NULL);
+    make_bitmap(data, t);
+    make_stream(s);
+    init_stream(s, STREAM_SIZE);
+    make_stream(temp_s);
+    init_stream(temp_s, STREAM_SIZE);
+
+    e = (4 - t->width % 4) % 4;
+    *lines = xrdp_bitmap_compress(data, t->width, t->height, s, t->bpp,
+                                  t->byte_limit, t->height - 1, temp_s, e);
+    *bytes = (int)(s->p - s->data);
+    *hash = xxhash64(s->data, *bytes, 0);
+
+    free_stream(temp_s);
+    free_stream(s);
+    g_free(data);
+}
+
+/* Generated from the original implementation */
+static const struct compress_test tests[] =
+{
+    { 8, 64, 64, PAT_SOLID, 16000, 64, 6, 0xF1ACD73DB6C8EC62ULL },
+    { 8, 64, 64, PAT_NOISE, 16000, 64, 4099, 0xD2EE60561BE861ABULL },
+    { 8, 64, 64, PAT_STRIPES, 16000, 64, 69, 0x6160B4DBB0338A00ULL },
+    { 8, 64, 64, PAT_XOR_LINES, 16000, 64, 53, 0x8050FD3BC9B707FDULL },
+    { 8, 64, 64, PAT_CHECKS, 16000, 64, 12, 0x92F1804E3AD9DB31ULL },
+    { 8, 64, 64, PAT_TEXT, 16000, 64, 2603, 0x16764172614B881FULL },
+    { 8, 64, 64, PAT_GRADIENT, 16000, 64, 69, 0xB8D973F274DC8956ULL },
+    { 8, 64, 64, PAT_MIXED, 16000, 64, 1512, 0x246D853F1336044DULL },
+    { 8, 13, 7, PAT_SOLID, 16000, 7, 5, 0xABBD608348C2B3FEULL },
+    { 8, 13, 7, PAT_NOISE, 16000, 7, 114, 0x119C4BBBA793C8C5ULL },
+    { 8, 13, 7, PAT_STRIPES, 16000, 7, 19, 0xC176BC350832CD5FULL },
+    { 8, 13, 7, PAT_XOR_LINES, 16000, 7, 11, 0x27D54528C6210E3DULL },
+    { 8, 13, 7, PAT_CHECKS, 16000, 7, 5, 0x3CB32207338A6B50ULL },
+    { 8, 13, 7, PAT_TEXT, 16000, 7, 53, 0x06A93261F996F33FULL },
+    { 8, 13, 7, PAT_GRADIENT, 16000, 7, 19, 0xC6F8358E6DD6614CULL },
+    { 8, 13, 7, PAT_MIXED, 16000, 7, 73, 0xE166338959FC0A15ULL },
+    { 8, 1, 1, PAT_SOLID, 16000, 1, 5, 0xFE1F0FF28874B719ULL },
+    { 8, 64, 64, PAT_MIXED, 300, 14, 318, 0xD174A00EC71A6450ULL },
+    { 8, 61, 20, PAT_NOISE, 1000, 16, 1026, 0xC57870436F40E025ULL },
+    { 15, 64, 64, PAT_SOLID, 16000, 64, 8, 0x460AF6901DD7F47FULL },
+    { 15, 64, 64, PAT_NOISE, 16000, 64, 8195, 0x212109C0451802EAULL },
+    { 15, 64, 64, PAT_STRIPES, 16000, 64, 133, 0x9A76C358254D9902ULL },
+    { 15, 64, 64, PAT_XOR_LINES, 16000, 64, 5121, 0x7F998B9D9A015A99ULL },
+    { 15, 64, 64, PAT_CHECKS, 16000, 64, 704, 0xC9F711EBE56C75A6ULL },
+    { 15, 64, 64, PAT_TEXT, 16000, 64, 5237, 0xDF39EAD4CE4426EDULL },
+    { 15, 64, 64, PAT_GRADIENT, 16000, 64, 133, 0x449EF435EAC6E3A3ULL },
+    { 15, 64, 64, PAT_MIXED, 16000, 64, 4077, 0x921B7B6093FCAFFBULL },
+    { 15, 13, 7, PAT_SOLID, 16000, 7, 7, 0xA9596B32BA3683F2ULL },
+    { 15, 13, 7, PAT_NOISE, 16000, 7, 226, 0x31C2696CA40AFC5EULL },
+    { 15, 13, 7, PAT_STRIPES, 16000, 7, 35, 0x1EB406F76392E03BULL },
+    { 15, 13, 7, PAT_XOR_LINES, 16000, 7, 121, 0x2351371EB3111D9EULL },
+    { 15, 13, 7, PAT_CHECKS, 16000, 7, 103, 0xD8B42B271D99CEE2ULL },
+    { 15, 13, 7, PAT_TEXT, 16000, 7, 115, 0x8086A88F33E019F7ULL },
+    { 15, 13, 7, PAT_GRADIENT, 16000, 7, 35, 0x910E360877D892F1ULL },
+    { 15, 13, 7, PAT_MIXED, 16000, 7, 131, 0xBEEE64980A91123DULL },
+    { 15, 1, 1, PAT_SOLID, 16000, 1, 9, 0x943B680073D1D138ULL },
+    { 15, 64, 64, PAT_MIXED, 300, 5, 312, 0x23BB3836C399697DULL },
+    { 15, 61, 20, PAT_NOISE, 1000, 8, 1027, 0xAAA9E6C2FD326F0BULL },
+    { 16, 64, 64, PAT_SOLID, 16000, 64, 8, 0x460AF6901DD7F47FULL },
+    { 16, 64, 64, PAT_NOISE, 16000, 64, 8195, 0x7FB9E9C808EA9C49ULL },
+    { 16, 64, 64, PAT_STRIPES, 16000, 64, 133, 0x9A76C358254D9902ULL },
+    { 16, 64, 64, PAT_XOR_LINES, 16000, 64, 79, 0x5BDEF0EFD9684C63ULL },
+    { 16, 64, 64, PAT_CHECKS, 16000, 64, 14, 0xBD08D8ED6F624ABAULL },
+    { 16, 64, 64, PAT_TEXT, 16000, 64, 4022, 0xAF2D1A5FB705FC7CULL },
+    { 16, 64, 64, PAT_GRADIENT, 16000, 64, 133, 0x449EF435EAC6E3A3ULL },
+    { 16, 64, 64, PAT_MIXED, 16000, 64, 2543, 0xC71BFA80A6239534ULL },
+    { 16, 13, 7, PAT_SOLID, 16000, 7, 7, 0xA9596B32BA3683F2ULL },
+    { 16, 13, 7, PAT_NOISE, 16000, 7, 226, 0x9C50E3AABBDC9897ULL },
+    { 16, 13, 7, PAT_STRIPES, 16000, 7, 35, 0x1EB406F76392E03BULL },
+    { 16, 13, 7, PAT_XOR_LINES, 16000, 7, 15, 0x333D7164C2D1DA7AULL },
+    { 16, 13, 7, PAT_CHECKS, 16000, 7, 21, 0x993E8AE5DA158396ULL },
+    { 16, 13, 7, PAT_TEXT, 16000, 7, 76, 0x9463199A25A513F5ULL },
+    { 16, 13, 7, PAT_GRADIENT, 16000, 7, 35, 0x910E360877D892F1ULL },
+    { 16, 13, 7, PAT_MIXED, 16000, 7, 131, 0x6B7295C08B6C1DF5ULL },
+    { 16, 1, 1, PAT_SOLID, 16000, 1, 9, 0x943B680073D1D138ULL },
+    { 16, 64, 64, PAT_MIXED, 300, 9, 399, 0x9555BDB9329D43C3ULL },
+    { 16, 61, 20, PAT_NOISE, 1000, 8, 1027, 0x6596477CC97DFD96ULL },
+    { 24, 64, 64, PAT_SOLID, 16000, 64, 10, 0x7145183F6B2DD3E7ULL },
+    { 24, 64, 64, PAT_NOISE, 16000, 64, 12291, 0xFF8E055DBA50E692ULL },
+    { 24, 64, 64, PAT_STRIPES, 16000, 64, 197, 0xE920B0F6703B93E2ULL },
+    { 24, 64, 64, PAT_XOR_LINES, 16000, 64, 6913, 0x2E61F2E479392C92ULL },
+    { 24, 64, 64, PAT_CHECKS, 16000, 64, 18, 0xC88EEA1E26971407ULL },
+    { 24, 64, 64, PAT_TEXT, 16000, 64, 5441, 0x658DD60263112241ULL },
+    { 24, 64, 64, PAT_GRADIENT, 16000, 64, 12291, 0x9DA874E012410C41ULL },
+    { 24, 64, 64, PAT_MIXED, 16000, 64, 6349, 0x54810BD33149CEBAULL },
+    { 24, 13, 7, PAT_SOLID, 16000, 7, 9, 0x3A3C23FBA0E1DD72ULL },
+    { 24, 13, 7, PAT_NOISE, 16000, 7, 338, 0x46503C2B419BE62DULL },
+    { 24, 13, 7, PAT_STRIPES, 16000, 7, 51, 0xF73765283B8C0A8FULL },
+    { 24, 13, 7, PAT_XOR_LINES, 16000, 7, 161, 0x37AC983DD579F352ULL },
+    { 24, 13, 7, PAT_CHECKS, 16000, 7, 29, 0x1684198875A1298EULL },
+    { 24, 13, 7, PAT_TEXT, 16000, 7, 99, 0xDC98985673C22828ULL },
+    { 24, 13, 7, PAT_GRADIENT, 16000, 7, 338, 0xFBFB13CC8EE4C4A0ULL },
+    { 24, 13, 7, PAT_MIXED, 16000, 7, 189, 0x27493B303A5D9E21ULL },
+    { 24, 1, 1, PAT_SOLID, 16000, 1, 13, 0x07FA699BCD417CE3ULL },
+    { 24, 64, 64, PAT_MIXED, 300, 3, 303, 0xDA166363A142CB86ULL },
+    { 24, 61, 20, PAT_NOISE, 1000, 6, 1155, 0x92C59B76FE4DD7E9ULL },
+    { 0, 0, 0, PAT_SOLID, 0, 0, 0, 0 }
+};
+
+/******************************************************************************/
+START_TEST(test_xrdp_bitmap_compress__golden)
+{
+    const struct compress_test *t;
+    int lines;
+    int bytes;
+    tui64 hash;
+
+    for (t = tests; t->bpp != 0; ++t)
+    {
+        run_compress(t, &lines, &bytes, &hash);
+        ck_assert_msg(lines == t->lines && bytes == t->bytes &&
+                      hash == t->hash,
+                      "bpp %d %dx%d pattern %d limit %d: got lines %d "
+                      "bytes %d hash 0x%016llx", t->bpp, t->width,
+                      t->height, (int)t->pattern, t->byte_limit, lines,
+                      bytes, (unsigned long long)hash);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_bitmap_compress(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_bitmap_compress");
+
+    tc = tcase_create("xrdp_bitmap_compress");
+    tcase_add_test(tc, test_xrdp_bitmap_compress__golden);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,518 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <string.h>
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "ms-rdpegdi.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+/* Flags in the compressed packet header */
+#define PACKET_COMPRESSED 0x20
+#define PACKET_AT_FRONT   0x40
+#define PACKET_FLUSHED    0x80
+
+#define MAX_HISTORY (64 * 1024)
+#define XCRUSH_HISTORY 2000000
+
+/*
+ * Minimal MPPC decompressor, used to check the output of the encoder
+ */
+struct mppc_dec
+{
+    int rdp_40;
+    int hist_len;
+    int hist_offset;
+    unsigned char history[MAX_HISTORY];
+    /* bit reader */
+    const unsigned char *in;
+    int in_bits;
+    int bit_pos;
+};
+
+/******************************************************************************/
+static unsigned int
+get_bits(struct mppc_dec *d, int count)
+{
+    unsigned int rv = 0;
+
+    while (count-- > 0)
+    {
+        ck_assert_int_lt(d->bit_pos, d->in_bits);
+        rv <<= 1;
+        rv |= (d->in[d->bit_pos / 8] >> (7 - d->bit_pos % 8)) & 1;
+        d->bit_pos++;
+    }
+    return rv;
+}
+
+/******************************************************************************/
+/* counts '1' bits up to and including the next '0', to a maximum of max */
+static int
+get_ones(struct mppc_dec *d, int max)
+{
+    int rv = 0;
+
+    while (rv < max && get_bits(d, 1) == 1)
+    {
+        ++rv;
+    }
+    return rv;
+}
+
+/******************************************************************************/
+/* decompresses a packet. Returns the start of the packet in the history */
+static int
+mppc_decode(struct mppc_dec *d, const char *data, int len, int flags)
+{
+    unsigned int offset;
+    unsigned int lom;
+    int ones;
+    int start;
+
+    if (flags & PACKET_FLUSHED)
+    {
+        memset(d->history, 0, sizeof(d->history));
+    }
+    if (flags & PACKET_AT_FRONT)
+    {
+        d->hist_offset = 0;
+    }
+    start = d->hist_offset;
+    d->in = (const unsigned char *)data;
+    d->in_bits = len * 8;
+    d->bit_pos = 0;
+
+    /* Anything shorter than a literal is padding */
+    while (d->in_bits - d->bit_pos >= 8)
+    {
+        ones = get_ones(d, d->rdp_40 ? 4 : 5);
+        if (ones == 0)
+        {
+            d->history[d->hist_offset++] = get_bits(d, 7);
+            continue;
+        }
+        if (ones == 1)
+        {
+            d->history[d->hist_offset++] = 0x80 | get_bits(d, 7);
+            continue;
+        }
+
+        if (d->rdp_40)
+        {
+            /* 110 + 13, 1110 + 8, 1111 + 6 */
+            offset = (ones == 2) ? get_bits(d, 13) + 320 :
+                     (ones == 3) ? get_bits(d, 8) + 64 :
+                     get_bits(d, 6);
+        }
+        else
+        {
+            /* 110 + 16, 1110 + 11, 11110 + 8, 11111 + 6 */
+            offset = (ones == 2) ? get_bits(d, 16) + 2368 :
+                     (ones == 3) ? get_bits(d, 11) + 320 :
+                     (ones == 4) ? get_bits(d, 8) + 64 :
+                     get_bits(d, 6);
+        }
+
+        ones = get_ones(d, 16);
+        if (ones == 0)
+        {
+            lom = 3;
+        }
+        else
+        {
+            lom = (1 << (ones + 1)) + get_bits(d, ones + 1);
+        }
+
+        ck_assert_int_gt(offset, 0);
+        ck_assert_int_le(offset, d->hist_offset);
+        ck_assert_int_le(d->hist_offset + lom, d->hist_len);
+        /* Copy a byte at a time, as the regions may overlap */
+        while (lom-- > 0)
+        {
+            d->history[d->hist_offset] = d->history[d->hist_offset - offset];
+            d->hist_offset++;
+        }
+    }
+    return start;
+}
+
+/******************************************************************************/
+/* reads a little-endian value from RDP61_COMPRESSED_DATA */
+static unsigned int
+get_le(const unsigned char *p, int bytes)
+{
+    unsigned int rv = 0;
+
+    while (bytes-- > 0)
+    {
+        rv = (rv << 8) | p[bytes];
+    }
+    return rv;
+}
+
+/*
+ * Minimal RDP 6.1 decompressor
+ */
+struct xcrush_dec
+{
+    int hist_offset;
+    unsigned char history[XCRUSH_HISTORY];
+    struct mppc_dec level2;
+};
+
+/******************************************************************************/
+/* decompresses a packet. Returns the start of the packet in the history */
+static int
+xcrush_decode(struct xcrush_dec *d, const char *data, int len, int flags)
+{
+    const unsigned char *in;
+    const unsigned char *in_end;
+    const unsigned char *literals;
+    int level1_flags;
+    int level2_flags;
+    int start;
+    int out;
+    int count;
+    int i;
+    unsigned int match_len;
+    unsigned int output_offset;
+    unsigned int history_offset;
+
+    ck_assert_int_eq(flags & 0x0f, PACKET_COMPR_TYPE_RDP61);
+    ck_assert_int_ne(flags & PACKET_COMPRESSED, 0);
+    ck_assert_int_ge(len, 2);
+    if (flags & PACKET_FLUSHED)
+    {
+        memset(d->history, 0, sizeof(d->history));
+        d->hist_offset = 0;
+    }
+    level1_flags = (unsigned char)data[0];
+    level2_flags = (unsigned char)data[1];
+    in = (const unsigned char *)data + 2;
+    in_end = in + len - 2;
+
+    if (level2_flags & PACKET_COMPRESSED)
+    {
+        ck_assert_int_ne(level1_flags & L1_INNER_COMPRESSION, 0);
+        start = mppc_decode(&d->level2, (const char *)in, len - 2,
+                            level2_flags);
+        in = d->level2.history + start;
+        in_end = d->level2.history + d->level2.hist_offset;
+    }
+
+    if (level1_flags & L1_PACKET_AT_FRONT)
+    {
+        d->hist_offset = 0;
+    }
+    start = d->hist_offset;
+    literals = in;
+    if (!(level1_flags & L1_NO_COMPRESSION))
+    {
+        ck_assert_int_ne(level1_flags & L1_COMPRESSED, 0);
+        count = get_le(in, 2);
+        literals = in + 2 + count * 8;
+        ck_assert(literals <= in_end);
+        out = 0;
+        for (i = 0; i < count; ++i)
+        {
+            match_len = get_le(in + 2 + i * 8, 2);
+            output_offset = get_le(in + 2 + i * 8 + 2, 2);
+            history_offset = get_le(in + 2 + i * 8 + 4, 4);
+            ck_assert_int_ge(output_offset, out);
+            ck_assert(literals + (output_offset - out) <= in_end);
+            memcpy(d->history + d->hist_offset, literals, output_offset - out);
+            d->hist_offset += output_offset - out;
+            literals += output_offset - out;
+            ck_assert_int_lt(history_offset + match_len, XCRUSH_HISTORY);
+            ck_assert_int_lt(d->hist_offset + match_len, XCRUSH_HISTORY);
+            /* Source must not overlap the destination */
+            ck_assert(history_offset + match_len <=
+                      (unsigned int)d->hist_offset ||
+                      history_offset >= d->hist_offset + match_len);
+            memcpy(d->history + d->hist_offset, d->history + history_offset,
+                   match_len);
+            d->hist_offset += match_len;
+            out = output_offset + match_len;
+        }
+    }
+    ck_assert_int_lt(d->hist_offset + (in_end - literals), XCRUSH_HISTORY);
+    memcpy(d->history + d->hist_offset, literals, in_end - literals);
+    d->hist_offset += in_end - literals;
+    return start;
+}
+
+/******************************************************************************/
+/* fills a buffer with something a bit like a mixture of text and images */
+static void
+make_test_data(char *buff, int len, unsigned int seed)
+{
+    int i;
+
+    for (i = 0; i < len; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        switch ((i / 512) % 4)
+        {
+            case 0: /* incompressible */
+                buff[i] = (char)(seed >> 16);
+                break;
+            case 1: /* runs */
+                buff[i] = (char)(i / 100);
+                break;
+            case 2: /* text-like */
+                buff[i] = "the quick brown fox "[(seed >> 16) % 20];
+                break;
+            default: /* repeating 'pixels' with a long period */
+                buff[i] = (char)((i % 300) | 0x80);
+                break;
+        }
+    }
+}
+
+/******************************************************************************/
+static void
+round_trip(int protocol_type, int hist_len)
+{
+    struct xrdp_mppc_enc *enc;
+    struct mppc_dec *d;
+    char *src;
+    int sizes[] = { 1, 2, 3, 4, 100, 2000, 5000, 8000, 16, 3000, 6000 };
+    int i;
+    int len;
+    int start;
+    int flushed = 1;
+
+    enc = mppc_enc_new(protocol_type);
+    ck_assert_ptr_ne(enc, NULL);
+    d = (struct mppc_dec *)g_malloc(sizeof(struct mppc_dec), 1);
+    ck_assert_ptr_ne(d, NULL);
+    d->rdp_40 = (protocol_type == PROTO_RDP_40);
+    d->hist_len = hist_len;
+    src = (char *)g_malloc(hist_len, 0);
+    ck_assert_ptr_ne(src, NULL);
+
+    /* Send the sizes round a few times, so the history fills and has
+     * to be rewound */
+    for (i = 0; i < 40; ++i)
+    {
+        len = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        len = MIN(len, hist_len);
+        make_test_data(src, len, i % 5);
+        if (!compress_rdp(enc, (tui8 *)src, len))
+        {
+            /* Only short packets of mostly random data can fail */
+            ck_assert_int_lt(len, 2000);
+            /* Sent uncompressed. Next packet must reset the history */
+            flushed = 0;
+            continue;
+        }
+        ck_assert_int_eq(enc->flags & 0x0f,
+                         d->rdp_40 ? PACKET_COMPR_TYPE_8K :
+                         PACKET_COMPR_TYPE_64K);
+        ck_assert_int_ne(enc->flags & PACKET_COMPRESSED, 0);
+        if (!flushed)
+        {
+            ck_assert_int_ne(enc->flags & PACKET_FLUSHED, 0);
+            flushed = 1;
+        }
+        ck_assert_int_le(enc->bytes_in_opb, len);
+        start = mppc_decode(d, enc->outputBuffer, enc->bytes_in_opb,
+                            enc->flags);
+        ck_assert_int_eq(d->hist_offset - start, len);
+        ck_assert_mem_eq(d->history + start, src, len);
+    }
+
+    g_free(src);
+    g_free(d);
+    mppc_enc_free(enc);
+}
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__rdp_50_round_trip)
+{
+    round_trip(PROTO_RDP_50, 64 * 1024);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__rdp_40_round_trip)
+{
+    round_trip(PROTO_RDP_40, 8 * 1024);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__long_match)
+{
+    struct xrdp_mppc_enc *enc;
+    char *src;
+    int len = 60000;
+
+    enc = mppc_enc_new(PROTO_RDP_50);
+    ck_assert_ptr_ne(enc, NULL);
+    src = (char *)g_malloc(len, 1);
+    ck_assert_ptr_ne(src, NULL);
+
+    /* A single run needs just a few literals and one copy tuple */
+    ck_assert_int_ne(compress_rdp(enc, (tui8 *)src, len), 0);
+    ck_assert_int_lt(enc->bytes_in_opb, 16);
+
+    g_free(src);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__incompressible)
+{
+    struct xrdp_mppc_enc *enc;
+    char *src;
+    int len = 64 * 1024;
+    unsigned int seed = 1;
+    int i;
+
+    enc = mppc_enc_new(PROTO_RDP_50);
+    ck_assert_ptr_ne(enc, NULL);
+    src = (char *)g_malloc(len, 0);
+    ck_assert_ptr_ne(src, NULL);
+    for (i = 0; i < len; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        src[i] = (char)((seed >> 16) | 0x80);
+    }
+
+    /* Encoder must give up without overrunning its output buffer */
+    ck_assert_int_eq(compress_rdp(enc, (tui8 *)src, len), 0);
+    ck_assert_int_eq(compress_rdp(enc, (tui8 *)src, 1000), 0);
+
+    g_free(src);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__rdp_61_round_trip)
+{
+    struct xrdp_mppc_enc *enc;
+    struct xcrush_dec *d;
+    char *src;
+    int len = 16000;
+    int i;
+    int start;
+    int wrapped = 0;
+
+    enc = mppc_enc_new(PROTO_RDP_61);
+    ck_assert_ptr_ne(enc, NULL);
+    d = (struct xcrush_dec *)g_malloc(sizeof(struct xcrush_dec), 1);
+    ck_assert_ptr_ne(d, NULL);
+    d->level2.hist_len = MAX_HISTORY;
+    src = (char *)g_malloc(len, 0);
+    ck_assert_ptr_ne(src, NULL);
+
+    /* Packets repeat further back than level 2 can see, and there's
+     * enough data for the level 1 history to wrap */
+    for (i = 0; i < 150; ++i)
+    {
+        make_test_data(src, len - (i % 3), i % 7);
+        ck_assert_int_ne(compress_rdp(enc, (tui8 *)src, len - (i % 3)), 0);
+        if ((unsigned char)enc->outputBuffer[0] & L1_PACKET_AT_FRONT)
+        {
+            wrapped = 1;
+        }
+        start = xcrush_decode(d, enc->outputBuffer, enc->bytes_in_opb,
+                              enc->flags);
+        ck_assert_int_eq(d->hist_offset - start, len - (i % 3));
+        ck_assert_mem_eq(d->history + start, src, len - (i % 3));
+        if (i >= 21)
+        {
+            /* Seen it all before */
+            ck_assert_int_lt(enc->bytes_in_opb, 100);
+        }
+    }
+    ck_assert_int_ne(wrapped, 0);
+
+    g_free(src);
+    g_free(d);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__rdp_61_incompressible)
+{
+    struct xrdp_mppc_enc *enc;
+    struct xcrush_dec *d;
+    char *src;
+    int len = 1000;
+    unsigned int seed = 1;
+    int i;
+    int start;
+
+    enc = mppc_enc_new(PROTO_RDP_61);
+    ck_assert_ptr_ne(enc, NULL);
+    d = (struct xcrush_dec *)g_malloc(sizeof(struct xcrush_dec), 1);
+    ck_assert_ptr_ne(d, NULL);
+    d->level2.hist_len = MAX_HISTORY;
+    src = (char *)g_malloc(len, 0);
+    ck_assert_ptr_ne(src, NULL);
+    for (i = 0; i < len; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        src[i] = (char)(seed >> 16);
+    }
+
+    /* Still sent compressed, so the client's history keeps up */
+    ck_assert_int_ne(compress_rdp(enc, (tui8 *)src, len), 0);
+    ck_assert_int_eq(enc->bytes_in_opb, len + 2);
+    ck_assert_int_eq(enc->outputBuffer[0], L1_NO_COMPRESSION);
+    start = xcrush_decode(d, enc->outputBuffer, enc->bytes_in_opb,
+                          enc->flags);
+    ck_assert_mem_eq(d->history + start, src, len);
+
+    /* Same again is a level 1 match */
+    ck_assert_int_ne(compress_rdp(enc, (tui8 *)src, len), 0);
+    ck_assert_int_ne(enc->outputBuffer[0] & L1_COMPRESSED, 0);
+    start = xcrush_decode(d, enc->outputBuffer, enc->bytes_in_opb,
+                          enc->flags);
+    ck_assert_mem_eq(d->history + start, src, len);
+
+    g_free(src);
+    g_free(d);
+    mppc_enc_free(enc);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_xrdp_mppc_enc__bad_protocol)
+{
+    ck_assert_ptr_eq(mppc_enc_new(0), NULL);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_mppc_enc(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_mppc_enc");
+
+    tc = tcase_create("xrdp_mppc_enc");
+    tcase_add_test(tc, test_xrdp_mppc_enc__rdp_50_round_trip);
+    tcase_add_test(tc, test_xrdp_mppc_enc__rdp_40_round_trip);
+    tcase_add_test(tc, test_xrdp_mppc_enc__long_match);
+    tcase_add_test(tc, test_xrdp_mppc_enc__incompressible);
+    tcase_add_test(tc, test_xrdp_mppc_enc__rdp_61_round_trip);
+    tcase_add_test(tc, test_xrdp_mppc_enc__rdp_61_incompressible);
+    tcase_add_test(tc, test_xrdp_mppc_enc__bad_protocol);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,244 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "os_calls.h"
+#include "trans.h"
+
+#include "test_libxrdp.h"
+
+static struct xrdp_sec *sec_layer;
+static struct xrdp_rdp *rdp_layer;
+static struct xrdp_session *session;
+static int sck[2];
+
+static void setup(void)
+{
+    rdp_layer = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
+    session = (struct xrdp_session *)g_malloc(sizeof(struct xrdp_session), 1);
+    session->rdp = rdp_layer;
+    session->client_info = &rdp_layer->client_info;
+    sec_layer = (struct xrdp_sec *)g_malloc(sizeof(struct xrdp_sec), 1);
+    sec_layer->rdp_layer = rdp_layer;
+    sec_layer->crypt_level = CRYPT_LEVEL_NONE;
+    sec_layer->fastpath_layer =
+        (struct xrdp_fastpath *)g_malloc(sizeof(struct xrdp_fastpath), 1);
+    sec_layer->fastpath_layer->sec_layer = sec_layer;
+    sec_layer->fastpath_layer->session = session;
+
+    ck_assert_int_eq(g_sck_local_socketpair(sck), 0);
+    sec_layer->fastpath_layer->trans = trans_create(TRANS_MODE_UNIX, 0, 0);
+    ck_assert_ptr_ne(sec_layer->fastpath_layer->trans, NULL);
+    sec_layer->fastpath_layer->trans->sck = sck[0];
+    sec_layer->fastpath_layer->trans->status = TRANS_STATUS_UP;
+}
+
+static void teardown(void)
+{
+    trans_delete(sec_layer->fastpath_layer->trans); /* Closes sck[0] */
+    g_sck_close(sck[1]);
+    g_free(sec_layer->fastpath_layer);
+    free_stream(sec_layer->fp_batch);
+    g_free(sec_layer);
+    g_free(session);
+    g_free(rdp_layer);
+}
+
+/* Sends a TS_FP_UPDATE with data_bytes bytes of data */
+static int
+send_update(int code, int data_bytes)
+{
+    struct stream *s;
+    int i;
+    int rv;
+
+    make_stream(s);
+    xrdp_sec_init_fastpath(sec_layer, s);
+    out_uint8(s, code);
+    out_uint16_le(s, data_bytes);
+    for (i = 0 ; i < data_bytes ; ++i)
+    {
+        out_uint8(s, code);
+    }
+    s_mark_end(s);
+    rv = xrdp_sec_send_fastpath(sec_layer, s);
+    free_stream(s);
+    return rv;
+}
+
+/* Reads all the bytes in a buffer from the client end of the socket */
+static void
+read_all(char *buff, int len)
+{
+    int got;
+
+    while (len > 0)
+    {
+        got = g_sck_recv(sck[1], buff, len, 0);
+        ck_assert_int_gt(got, 0);
+        buff += got;
+        len -= got;
+    }
+}
+
+/* Reads a TS_FP_UPDATE_PDU, and returns the length of its updates */
+static int
+read_pdu(char *buff, int size)
+{
+    char hdr[3];
+    int len;
+
+    read_all(hdr, 3);
+    ck_assert_int_eq(hdr[0], 0);
+    ck_assert_int_ne(hdr[1] & 0x80, 0);
+    len = (((unsigned char)hdr[1] & 0x7f) << 8) | (unsigned char)hdr[2];
+    len -= 3;
+    ck_assert_int_le(len, size);
+    read_all(buff, len);
+    return len;
+}
+
+/* Checks a TS_FP_UPDATE written by send_update() */
+static int
+check_update(const char *p, int code, int data_bytes)
+{
+    int i;
+
+    ck_assert_int_eq(p[0], code);
+    ck_assert_int_eq((unsigned char)p[1] | ((unsigned char)p[2] << 8),
+                     data_bytes);
+    for (i = 0 ; i < data_bytes ; ++i)
+    {
+        ck_assert_int_eq(p[3 + i], code);
+    }
+    return 3 + data_bytes;
+}
+
+static int
+pending(void)
+{
+    return g_sck_can_recv(sck[1], 0);
+}
+
+START_TEST(test_fastpath_batch__not_batching__one_pdu_per_update)
+{
+    char buff[64];
+    int len;
+
+    ck_assert_int_eq(send_update(1, 10), 0);
+    ck_assert_int_eq(send_update(2, 20), 0);
+
+    len = read_pdu(buff, sizeof(buff));
+    ck_assert_int_eq(len, check_update(buff, 1, 10));
+    len = read_pdu(buff, sizeof(buff));
+    ck_assert_int_eq(len, check_update(buff, 2, 20));
+    ck_assert_int_eq(pending(), 0);
+}
+END_TEST
+
+START_TEST(test_fastpath_batch__batching__updates_share_a_pdu)
+{
+    char buff[128];
+    int len;
+    int pos;
+
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_begin(sec_layer), 0);
+    ck_assert_int_eq(send_update(1, 10), 0);
+    ck_assert_int_eq(send_update(2, 20), 0);
+    ck_assert_int_eq(send_update(3, 30), 0);
+    ck_assert_int_eq(pending(), 0);
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_end(sec_layer), 0);
+
+    len = read_pdu(buff, sizeof(buff));
+    pos = check_update(buff, 1, 10);
+    pos += check_update(buff + pos, 2, 20);
+    pos += check_update(buff + pos, 3, 30);
+    ck_assert_int_eq(len, pos);
+    ck_assert_int_eq(pending(), 0);
+}
+END_TEST
+
+START_TEST(test_fastpath_batch__nested__sent_by_outer_end)
+{
+    char buff[64];
+    int len;
+    int pos;
+
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_begin(sec_layer), 0);
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_begin(sec_layer), 0);
+    ck_assert_int_eq(send_update(1, 10), 0);
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_end(sec_layer), 0);
+    ck_assert_int_eq(pending(), 0);
+    ck_assert_int_eq(send_update(2, 10), 0);
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_end(sec_layer), 0);
+
+    len = read_pdu(buff, sizeof(buff));
+    pos = check_update(buff, 1, 10);
+    pos += check_update(buff + pos, 2, 10);
+    ck_assert_int_eq(len, pos);
+}
+END_TEST
+
+START_TEST(test_fastpath_batch__flush__sends_pdu)
+{
+    char buff[64];
+    int len;
+
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_begin(sec_layer), 0);
+    ck_assert_int_eq(send_update(1, 10), 0);
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_flush(sec_layer), 0);
+    len = read_pdu(buff, sizeof(buff));
+    ck_assert_int_eq(len, check_update(buff, 1, 10));
+
+    ck_assert_int_eq(send_update(2, 10), 0);
+    ck_assert_int_eq(pending(), 0);
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_end(sec_layer), 0);
+    len = read_pdu(buff, sizeof(buff));
+    ck_assert_int_eq(len, check_update(buff, 2, 10));
+}
+END_TEST
+
+START_TEST(test_fastpath_batch__full__starts_new_pdu)
+{
+    static char buff[0x8000];
+    int len;
+    int pos;
+
+    /* Three of these don't fit in one PDU */
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_begin(sec_layer), 0);
+    ck_assert_int_eq(send_update(1, 12000), 0);
+    ck_assert_int_eq(send_update(2, 12000), 0);
+    ck_assert_int_eq(send_update(3, 12000), 0);
+    ck_assert_int_eq(xrdp_sec_fastpath_batch_end(sec_layer), 0);
+
+    len = read_pdu(buff, sizeof(buff));
+    pos = check_update(buff, 1, 12000);
+    pos += check_update(buff + pos, 2, 12000);
+    ck_assert_int_eq(len, pos);
+    len = read_pdu(buff, sizeof(buff));
+    ck_assert_int_eq(len, check_update(buff, 3, 12000));
+    ck_assert_int_eq(pending(), 0);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_sec_fastpath_batch(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("FastpathBatch");
+
+    tc = tcase_create("xrdp_sec_fastpath_batch");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_fastpath_batch__not_batching__one_pdu_per_update);
+    tcase_add_test(tc, test_fastpath_batch__batching__updates_share_a_pdu);
+    tcase_add_test(tc, test_fastpath_batch__nested__sent_by_outer_end);
+    tcase_add_test(tc, test_fastpath_batch__flush__sends_pdu);
+    tcase_add_test(tc, test_fastpath_batch__full__starts_new_pdu);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
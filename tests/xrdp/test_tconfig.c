@@ -95,6 +95,23 @@ START_TEST(test_tconfig_gfx_missing_h264)
 }
 END_TEST
 
+START_TEST(test_tconfig_gfx_content_adaptive)
+{
+    struct xrdp_tconfig_gfx gfxconfig;
+
+    /* On unless it's turned off */
+    tconfig_load_gfx(GFXCONF_STUBDIR "/gfx.toml", &gfxconfig);
+    ck_assert_int_eq(gfxconfig.content_adaptive, 1);
+
+    tconfig_load_gfx(GFXCONF_STUBDIR "/no_such_file.toml", &gfxconfig);
+    ck_assert_int_eq(gfxconfig.content_adaptive, 1);
+
+    tconfig_load_gfx(GFXCONF_STUBDIR "/gfx_content_adaptive_off.toml",
+                     &gfxconfig);
+    ck_assert_int_eq(gfxconfig.content_adaptive, 0);
+}
+END_TEST
+
 /******************************************************************************/
 Suite *
 make_suite_tconfig_load_gfx(void)
@@ -110,6 +127,7 @@ make_suite_tconfig_load_gfx(void)
     tcase_add_test(tc_tconfig_load_gfx, test_tconfig_gfx_codec_order);
     tcase_add_test(tc_tconfig_load_gfx, test_tconfig_gfx_missing_file);
     tcase_add_test(tc_tconfig_load_gfx, test_tconfig_gfx_missing_h264);
+    tcase_add_test(tc_tconfig_load_gfx, test_tconfig_gfx_content_adaptive);
 
     suite_add_tcase(s, tc_tconfig_load_gfx);
 
@@ -0,0 +1,207 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "xrdp_enc_classify.h"
+#include "os_calls.h"
+
+#include "test_xrdp.h"
+
+#define TILE XRDP_ENC_TILE_SIZE
+#define PLANE_BYTES (TILE * TILE)
+
+static tui8 planes[3 * PLANE_BYTES];
+
+/******************************************************************************/
+/* Black text on a white background */
+static void
+make_text_tile(void)
+{
+    int i;
+    int j;
+    int ink;
+
+    for (j = 0; j < TILE; j++)
+    {
+        for (i = 0; i < TILE; i++)
+        {
+            ink = (j % 12) < 8 && (i % 6) < 2;
+            planes[j * TILE + i] = ink ? 16 : 235;
+            planes[PLANE_BYTES + j * TILE + i] = 128;
+            planes[2 * PLANE_BYTES + j * TILE + i] = 128;
+        }
+    }
+}
+
+/******************************************************************************/
+/* Smooth shading in all three planes */
+static void
+make_photo_tile(void)
+{
+    int i;
+    int j;
+
+    for (j = 0; j < TILE; j++)
+    {
+        for (i = 0; i < TILE; i++)
+        {
+            planes[j * TILE + i] = 40 + i + j;
+            planes[PLANE_BYTES + j * TILE + i] = 100 + i / 2;
+            planes[2 * PLANE_BYTES + j * TILE + i] = 150 - j / 2;
+        }
+    }
+}
+
+/******************************************************************************/
+static enum xrdp_enc_content
+classify(struct xrdp_enc_classifier *c, int x, int y)
+{
+    return xrdp_enc_classify_tile(c, x, y, TILE, TILE,
+                                  planes,
+                                  planes + PLANE_BYTES,
+                                  planes + 2 * PLANE_BYTES,
+                                  TILE);
+}
+
+/******************************************************************************/
+START_TEST(test_enc_classify__flat)
+{
+    struct xrdp_enc_classifier *c = xrdp_enc_classifier_create(256, 256);
+    ck_assert_ptr_ne(c, NULL);
+
+    g_memset(planes, 128, sizeof(planes));
+    ck_assert_int_eq(classify(c, 0, 0), XRDP_ENC_CONTENT_TEXT);
+
+    xrdp_enc_classifier_delete(c);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_enc_classify__text_and_photo)
+{
+    struct xrdp_enc_classifier *c = xrdp_enc_classifier_create(256, 256);
+    ck_assert_ptr_ne(c, NULL);
+
+    make_text_tile();
+    ck_assert_int_eq(classify(c, 0, 0), XRDP_ENC_CONTENT_TEXT);
+    make_photo_tile();
+    ck_assert_int_eq(classify(c, 64, 0), XRDP_ENC_CONTENT_PHOTO);
+
+    xrdp_enc_classifier_delete(c);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_enc_classify__video)
+{
+    struct xrdp_enc_classifier *c = xrdp_enc_classifier_create(256, 256);
+    int frame;
+
+    ck_assert_ptr_ne(c, NULL);
+
+    /* A photo tile changing every frame soon becomes video */
+    make_photo_tile();
+    for (frame = 0; frame < 3; frame++)
+    {
+        xrdp_enc_classifier_new_frame(c);
+        ck_assert_int_eq(classify(c, 128, 128), XRDP_ENC_CONTENT_PHOTO);
+    }
+    xrdp_enc_classifier_new_frame(c);
+    ck_assert_int_eq(classify(c, 128, 128), XRDP_ENC_CONTENT_VIDEO);
+
+    /* Classifying it twice in one frame doesn't count twice */
+    ck_assert_int_eq(classify(c, 192, 128), XRDP_ENC_CONTENT_PHOTO);
+    ck_assert_int_eq(classify(c, 192, 128), XRDP_ENC_CONTENT_PHOTO);
+    ck_assert_int_eq(classify(c, 192, 128), XRDP_ENC_CONTENT_PHOTO);
+    ck_assert_int_eq(classify(c, 192, 128), XRDP_ENC_CONTENT_PHOTO);
+
+    /* When it stops changing, it goes back to being a photo */
+    for (frame = 0; frame < 4; frame++)
+    {
+        xrdp_enc_classifier_new_frame(c);
+    }
+    ck_assert_int_eq(classify(c, 128, 128), XRDP_ENC_CONTENT_PHOTO);
+
+    /* Text which changes every frame is still text */
+    make_text_tile();
+    for (frame = 0; frame < 10; frame++)
+    {
+        xrdp_enc_classifier_new_frame(c);
+        ck_assert_int_eq(classify(c, 0, 64), XRDP_ENC_CONTENT_TEXT);
+    }
+
+    xrdp_enc_classifier_delete(c);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_enc_classify__occasional_updates)
+{
+    struct xrdp_enc_classifier *c = xrdp_enc_classifier_create(256, 256);
+    int frame;
+
+    ck_assert_ptr_ne(c, NULL);
+
+    /* Every other frame isn't enough to be video */
+    make_photo_tile();
+    for (frame = 0; frame < 40; frame++)
+    {
+        xrdp_enc_classifier_new_frame(c);
+        if ((frame & 1) == 0)
+        {
+            ck_assert_int_eq(classify(c, 0, 0), XRDP_ENC_CONTENT_PHOTO);
+        }
+    }
+
+    xrdp_enc_classifier_delete(c);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_enc_classify__outside_surface)
+{
+    struct xrdp_enc_classifier *c = xrdp_enc_classifier_create(100, 100);
+    int frame;
+
+    ck_assert_ptr_ne(c, NULL);
+
+    /* Partial tiles at the edge are tracked */
+    make_photo_tile();
+    for (frame = 0; frame < 4; frame++)
+    {
+        xrdp_enc_classifier_new_frame(c);
+        classify(c, 64, 64);
+    }
+    ck_assert_int_eq(classify(c, 64, 64), XRDP_ENC_CONTENT_VIDEO);
+
+    /* Tiles beyond the surface are never video */
+    for (frame = 0; frame < 4; frame++)
+    {
+        xrdp_enc_classifier_new_frame(c);
+        ck_assert_int_eq(classify(c, 128, 0), XRDP_ENC_CONTENT_PHOTO);
+    }
+
+    xrdp_enc_classifier_delete(c);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_enc_classify(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("EncClassify");
+
+    tc = tcase_create("xrdp_enc_classify");
+    tcase_add_test(tc, test_enc_classify__flat);
+    tcase_add_test(tc, test_enc_classify__text_and_photo);
+    tcase_add_test(tc, test_enc_classify__video);
+    tcase_add_test(tc, test_enc_classify__occasional_updates);
+    tcase_add_test(tc, test_enc_classify__outside_surface);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -1,4 +1,5 @@
 #include <X11/extensions/Xrandr.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,6 +7,11 @@
 #include <unistd.h>
 
 #include "config_ac.h"
+
+#if defined(HAVE_SYS_INOTIFY_H)
+#include <sys/inotify.h>
+#endif
+
 #include "os_calls.h"
 #include "string_calls.h"
 #include "xwait.h" // For return status codes
@@ -13,6 +19,15 @@
 #define ATTEMPTS 10
 #define ALARM_WAIT 30
 
+/* Time to wait for the X server to create its socket (ms) */
+#define SOCKET_WAIT 10000
+/* Delay before the first retry to open the display (ms). This doubles
+ * with each retry */
+#define RETRY_WAIT 50
+#define MAX_RETRY_WAIT 1000
+
+#define X11_UNIX_DIR "/tmp/.X11-unix"
+
 /*****************************************************************************/
 static void
 alarm_handler(int signal_num)
@@ -21,11 +36,68 @@ alarm_handler(int signal_num)
      *
      * Prefix the message with a newline in case another message
      * has been partly output */
-    const char msg[] = "\n<E>Timed out waiting for RandR outputs\n";
+    const char msg[] = "\n<E>Timed out waiting for X server\n";
     g_file_write(1, msg, g_strlen(msg));
     exit(XW_STATUS_TIMED_OUT);
 }
 
+/*****************************************************************************/
+/**
+ * Wait for the X server for a local display to create its socket
+ *
+ * Where inotify is available, we're told as soon as the socket is
+ * created, rather than having to poll for it.
+ *
+ * @param display Display name
+ * @param millis Longest time to wait
+ */
+static void
+wait_for_socket(const char *display, int millis)
+{
+    char path[64];
+    int start = g_time3();
+    int elapsed = 0;
+
+    if (display[0] != ':')
+    {
+        return; /* Not a local display */
+    }
+    g_snprintf(path, sizeof(path), X11_UNIX_DIR "/X%d", g_atoi(display + 1));
+
+#if defined(HAVE_SYS_INOTIFY_H)
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd >= 0)
+    {
+        /* Add the watch before looking for the socket, so we can't
+         * miss it being created */
+        if (inotify_add_watch(fd, X11_UNIX_DIR, IN_CREATE | IN_MOVED_TO) >= 0)
+        {
+            char buff[sizeof(struct inotify_event) + NAME_MAX + 1];
+
+            while (!g_file_exist(path) && elapsed < millis)
+            {
+                /* Any event in the directory is a reason to look again */
+                if (g_sck_can_recv(fd, millis - elapsed) &&
+                        g_file_read(fd, buff, sizeof(buff)) <= 0)
+                {
+                    break;
+                }
+                elapsed = g_time3() - start;
+            }
+            g_file_close(fd);
+            return;
+        }
+        g_file_close(fd);
+    }
+#endif
+
+    while (!g_file_exist(path) && elapsed < millis)
+    {
+        g_sleep(RETRY_WAIT);
+        elapsed = g_time3() - start;
+    }
+}
+
 /*****************************************************************************/
 static Display *
 open_display(const char *display)
@@ -33,6 +105,10 @@ open_display(const char *display)
     Display *dpy = NULL;
     unsigned int wait = ATTEMPTS;
     unsigned int n;
+    unsigned int retry_wait = RETRY_WAIT;
+
+    printf("<D>Waiting for socket for display %s\n", display);
+    wait_for_socket(display, SOCKET_WAIT);
 
     for (n = 1; n <= ATTEMPTS; ++n)
     {
@@ -43,16 +119,47 @@ open_display(const char *display)
             printf("<D>Opened display %s\n", display);
             break;
         }
-        g_sleep(1000);
+        g_sleep(retry_wait);
+        retry_wait *= 2;
+        if (retry_wait > MAX_RETRY_WAIT)
+        {
+            retry_wait = MAX_RETRY_WAIT;
+        }
     }
 
     return dpy;
 }
 
+/*****************************************************************************/
+/**
+ * Counts the RandR outputs on a display
+ */
+static unsigned int
+count_outputs(Display *dpy)
+{
+    unsigned int outputs = 0;
+    XRRScreenResources *res;
+
+    res = XRRGetScreenResources(dpy, DefaultRootWindow(dpy));
+    if (res != NULL)
+    {
+        if (res->noutput > 0)
+        {
+            outputs = res->noutput;
+        }
+        XRRFreeScreenResources(res);
+    }
+
+    return outputs;
+}
+
 /*****************************************************************************/
 /**
  * Wait for the RandR extension (if in use) to be available
  *
+ * Rather than polling for outputs, we ask for RandR events, and look
+ * again whenever one arrives. The alarm limits the wait.
+ *
  * @param dpy Display
  * @return 0 if/when outputs are available, 1 otherwise
  */
@@ -61,11 +168,11 @@ wait_for_r_and_r(Display *dpy)
 {
     int error_base = 0;
     int event_base = 0;
-    unsigned int outputs = 0;
-    unsigned int wait = ATTEMPTS;
-    unsigned int n;
-
-    XRRScreenResources *res = NULL;
+    int major = 0;
+    int minor = 0;
+    int mask = RRScreenChangeNotifyMask;
+    unsigned int outputs;
+    XEvent ev;
 
     if (!XRRQueryExtension(dpy, &event_base, &error_base))
     {
@@ -74,30 +181,31 @@ wait_for_r_and_r(Display *dpy)
         return 0;
     }
 
-    for (n = 1; n <= wait; ++n)
+    if (!XRRQueryVersion(dpy, &major, &minor))
     {
-        printf("<D>Waiting for outputs. Attempt %u of %u\n", n, wait);
-        res = XRRGetScreenResources(dpy, DefaultRootWindow(dpy));
-        if (res != NULL)
-        {
-            if (res->noutput > 0)
-            {
-                outputs = res->noutput;
-            }
-            XRRFreeScreenResources(res);
-        }
+        printf("<E>Can't get RandR version on display %s\n",
+               DisplayString(dpy));
+        return 1;
+    }
 
-        if (outputs > 0)
-        {
-            printf("<D>Display %s ready with %u RandR outputs\n",
-                   DisplayString(dpy), outputs);
-            return 0;
-        }
-        g_sleep(1000);
+    if (major > 1 || (major == 1 && minor >= 2))
+    {
+        /* Outputs were added in RandR 1.2 */
+        mask |= RROutputChangeNotifyMask;
+    }
+
+    /* Ask for events before looking, so we can't miss a change */
+    XRRSelectInput(dpy, DefaultRootWindow(dpy), mask);
+
+    while ((outputs = count_outputs(dpy)) == 0)
+    {
+        printf("<D>Waiting for RandR outputs\n");
+        XNextEvent(dpy, &ev);
     }
 
-    printf("<E>Unable to find any RandR outputs\n");
-    return 1;
+    printf("<D>Display %s ready with %u RandR outputs\n",
+           DisplayString(dpy), outputs);
+    return 0;
 }
 
 /*****************************************************************************/
@@ -263,11 +263,11 @@ xrdp_bitmap_get_child_by_id(struct xrdp_bitmap *self, int id);
 int
 xrdp_bitmap_set_focus(struct xrdp_bitmap *self, int focused);
 int
-xrdp_bitmap_hash_crc(struct xrdp_bitmap *self);
+xrdp_bitmap_hash(struct xrdp_bitmap *self);
 int
-xrdp_bitmap_copy_box_with_crc(struct xrdp_bitmap *self,
-                              struct xrdp_bitmap *dest,
-                              int x, int y, int cx, int cy);
+xrdp_bitmap_copy_box_with_hash(struct xrdp_bitmap *self,
+                               struct xrdp_bitmap *dest,
+                               int x, int y, int cx, int cy);
 int
 xrdp_bitmap_compare(struct xrdp_bitmap *self,
                     struct xrdp_bitmap *b);
@@ -63,23 +63,120 @@ xrdp_cache_reset_lru(struct xrdp_cache *self)
 
 /*****************************************************************************/
 static int
-xrdp_cache_reset_crc(struct xrdp_cache *self)
+xrdp_cache_reset_hash(struct xrdp_cache *self)
 {
     int index;
     int jndex;
 
     for (index = 0; index < XRDP_MAX_BITMAP_CACHE_ID; index++)
     {
-        for (jndex = 0; jndex < 64 * 1024; jndex++)
+        for (jndex = 0; jndex < XRDP_BITMAP_HASH_SLOTS; jndex++)
         {
-            /* it's ok to deinit a zeroed out struct list16 */
-            list16_deinit(&(self->crc16[index][jndex]));
-            list16_init(&(self->crc16[index][jndex]));
+            self->bitmap_hash[index][jndex].hash = 0;
+            self->bitmap_hash[index][jndex].cache_idx = -1;
         }
     }
     return 0;
 }
 
+#define HASH_SLOT_MASK (XRDP_BITMAP_HASH_SLOTS - 1)
+
+/*****************************************************************************/
+/* returns the cache_idx of a bitmap matching bitmap, or -1 */
+static int
+xrdp_cache_hash_find(struct xrdp_cache *self, int cache_id,
+                     struct xrdp_bitmap *bitmap)
+{
+    struct xrdp_bitmap_hash_slot *slots;
+    struct xrdp_bitmap *lbm;
+    unsigned int slot;
+
+    slots = self->bitmap_hash[cache_id];
+    slot = (unsigned int)bitmap->hash & HASH_SLOT_MASK;
+    while (slots[slot].cache_idx >= 0)
+    {
+        if (slots[slot].hash == bitmap->hash)
+        {
+            lbm = self->bitmap_items[cache_id][slots[slot].cache_idx].bitmap;
+            if ((lbm != NULL) && (lbm->hash == bitmap->hash) &&
+                    (lbm->bpp == bitmap->bpp) &&
+                    (lbm->width == bitmap->width) &&
+                    (lbm->height == bitmap->height))
+            {
+                return slots[slot].cache_idx;
+            }
+        }
+        slot = (slot + 1) & HASH_SLOT_MASK;
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+static void
+xrdp_cache_hash_add(struct xrdp_cache *self, int cache_id, tui64 hash,
+                    int cache_idx)
+{
+    struct xrdp_bitmap_hash_slot *slots;
+    unsigned int slot;
+
+    /* there are always free slots, as we never hold more than
+       XRDP_MAX_BITMAP_CACHE_IDX entries */
+    slots = self->bitmap_hash[cache_id];
+    slot = (unsigned int)hash & HASH_SLOT_MASK;
+    while (slots[slot].cache_idx >= 0)
+    {
+        slot = (slot + 1) & HASH_SLOT_MASK;
+    }
+    slots[slot].hash = hash;
+    slots[slot].cache_idx = cache_idx;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+xrdp_cache_hash_remove(struct xrdp_cache *self, int cache_id, tui64 hash,
+                       int cache_idx)
+{
+    struct xrdp_bitmap_hash_slot *slots;
+    unsigned int hole;
+    unsigned int slot;
+    unsigned int home;
+
+    slots = self->bitmap_hash[cache_id];
+    hole = (unsigned int)hash & HASH_SLOT_MASK;
+    while (slots[hole].cache_idx != cache_idx)
+    {
+        if (slots[hole].cache_idx < 0)
+        {
+            return 1;
+        }
+        hole = (hole + 1) & HASH_SLOT_MASK;
+    }
+
+    /* move any following entries which would no longer be reachable
+       back into the hole, so we don't need tombstones */
+    slot = hole;
+    while (1)
+    {
+        slot = (slot + 1) & HASH_SLOT_MASK;
+        if (slots[slot].cache_idx < 0)
+        {
+            break;
+        }
+        home = (unsigned int)slots[slot].hash & HASH_SLOT_MASK;
+        /* can the entry at slot stay where it is? */
+        if (((slot - home) & HASH_SLOT_MASK) < ((slot - hole) & HASH_SLOT_MASK))
+        {
+            continue;
+        }
+        slots[hole] = slots[slot];
+        hole = slot;
+    }
+    slots[hole].hash = 0;
+    slots[hole].cache_idx = -1;
+    return 0;
+}
+
 /*****************************************************************************/
 struct xrdp_cache *
 xrdp_cache_create(struct xrdp_wm *owner,
@@ -113,7 +210,7 @@ xrdp_cache_create(struct xrdp_wm *owner,
     self->pointer_cache_entries = client_info->pointer_cache_entries;
     self->xrdp_os_del_list = list_create();
     xrdp_cache_reset_lru(self);
-    xrdp_cache_reset_crc(self);
+    xrdp_cache_reset_hash(self);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_create: 0 %d 1 %d 2 %d",
               self->cache1_entries, self->cache2_entries, self->cache3_entries);
     return self;
@@ -156,15 +253,6 @@ clear_all_cached_items(struct xrdp_cache *self)
     }
 
     list_delete(self->xrdp_os_del_list);
-
-    /* free all crc lists */
-    for (i = 0; i < XRDP_MAX_BITMAP_CACHE_ID; i++)
-    {
-        for (j = 0; j < 64 * 1024; j++)
-        {
-            list16_deinit(&(self->crc16[i][j]));
-        }
-    }
 }
 
 /*****************************************************************************/
@@ -204,15 +292,10 @@ xrdp_cache_reset(struct xrdp_cache *self,
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
     xrdp_cache_reset_lru(self);
-    xrdp_cache_reset_crc(self);
+    xrdp_cache_reset_hash(self);
     return 0;
 }
 
-#define COMPARE_WITH_CRC32(_b1, _b2) \
-    ((_b1->crc32 == _b2->crc32) && \
-     (_b1->bpp == _b2->bpp) && \
-     (_b1->width == _b2->width) && (_b1->height == _b2->height))
-
 /*****************************************************************************/
 static int
 xrdp_cache_update_lru(struct xrdp_cache *self, int cache_id, int lru_index)
@@ -290,27 +373,21 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
                       int hints)
 {
     int index;
-    int jndex;
     int cache_id;
     int cache_idx;
     int bmp_size;
     int e;
     int Bpp;
-    int crc16;
-    int iig;
-    int found;
     int cache_entries;
     int lru_index;
-    struct list16 *ll;
     struct xrdp_bitmap *lbm;
     struct xrdp_lru_item *llru;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap:");
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: crc16 0x%4.4x",
-              bitmap->crc16);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: hash 0x%16.16llx",
+              (unsigned long long)bitmap->hash);
 
     e = (4 - (bitmap->width % 4)) & 3;
-    found = 0;
     cache_id = 0;
     cache_entries = 0;
 
@@ -341,21 +418,10 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
         return 0;
     }
 
-    crc16 = bitmap->crc16;
-    ll = &(self->crc16[cache_id][crc16]);
-    for (jndex = 0; jndex < ll->count; jndex++)
-    {
-        cache_idx = list16_get_item(ll, jndex);
-        lbm = self->bitmap_items[cache_id][cache_idx].bitmap;
-        if ((lbm != NULL) && COMPARE_WITH_CRC32(lbm, bitmap))
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "found bitmap at %d %d", cache_idx, jndex);
-            found = 1;
-            break;
-        }
-    }
-    if (found)
+    cache_idx = xrdp_cache_hash_find(self, cache_id, bitmap);
+    if (cache_idx >= 0)
     {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "found bitmap at %d %d", cache_id, cache_idx);
         lru_index = self->bitmap_items[cache_id][cache_idx].lru_index;
         self->bitmap_items[cache_id][cache_idx].stamp = self->bitmap_stamp;
         xrdp_bitmap_delete(bitmap);
@@ -394,20 +460,14 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
               self->bitmap_items[cache_id][cache_idx].bitmap,
               bitmap);
 
-    /* remove old, about to be deleted, from crc16 list */
+    /* remove old, about to be deleted, from hash index */
     lbm = self->bitmap_items[cache_id][cache_idx].bitmap;
     if (lbm != 0)
     {
-        crc16 = lbm->crc16;
-        ll = &(self->crc16[cache_id][crc16]);
-        iig = list16_index_of(ll, cache_idx);
-        if (iig == -1)
+        if (xrdp_cache_hash_remove(self, cache_id, lbm->hash, cache_idx) != 0)
         {
             LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_cache_add_bitmap: error removing cache_idx");
         }
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: removing index %d from crc16 %d",
-                  iig, crc16);
-        list16_remove_item(ll, iig);
         xrdp_bitmap_delete(lbm);
     }
 
@@ -417,14 +477,8 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     self->bitmap_items[cache_id][cache_idx].stamp = self->bitmap_stamp;
     self->bitmap_items[cache_id][cache_idx].lru_index = lru_index;
 
-    /* add to crc16 list */
-    crc16 = bitmap->crc16;
-    ll = &(self->crc16[cache_id][crc16]);
-    list16_add_item(ll, cache_idx);
-    if (ll->count > 1)
-    {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_cache_add_bitmap: count %d", ll->count);
-    }
+    /* add to hash index */
+    xrdp_cache_hash_add(self, cache_id, bitmap->hash, cache_idx);
 
     if (self->use_bitmap_comp)
     {
@@ -0,0 +1,241 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Per-tile content classifier for the encoder
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "xrdp_enc_classify.h"
+#include "os_calls.h"
+#include "log.h"
+
+/* more colours than this and it's not text. Anti-aliased text on a
+ * plain background doesn't get close */
+#define CLASSIFY_MAX_TEXT_COLORS 64
+/* a tile with this few colours is text whatever its edges are like */
+#define CLASSIFY_FEW_COLORS 8
+#define CLASSIFY_COLOR_SET_BITS 7
+#define CLASSIFY_COLOR_SET_SIZE (1 << CLASSIFY_COLOR_SET_BITS)
+/* a difference between neighbouring pixels which counts as an edge */
+#define CLASSIFY_SHARP_EDGE 48
+/* each update adds this to the activity, and each frame takes away a
+ * quarter of it. A tile updated on every frame tends towards 255, and
+ * one updated on every other frame settles at about 146 */
+#define CLASSIFY_ACTIVITY_STEP 64
+#define CLASSIFY_VIDEO_ACTIVITY 160
+/* after this many frames without an update, any activity is gone */
+#define CLASSIFY_MAX_DECAY 16
+
+/*****************************************************************************/
+struct xrdp_enc_classifier *
+xrdp_enc_classifier_create(int width, int height)
+{
+    struct xrdp_enc_classifier *self;
+    int num_tiles;
+
+    self = g_new0(struct xrdp_enc_classifier, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->tiles_x = (width + XRDP_ENC_TILE_SIZE - 1) / XRDP_ENC_TILE_SIZE;
+    self->tiles_y = (height + XRDP_ENC_TILE_SIZE - 1) / XRDP_ENC_TILE_SIZE;
+    num_tiles = MAX(self->tiles_x * self->tiles_y, 1);
+    self->activity = g_new0(tui8, num_tiles);
+    self->last_frame = g_new0(int, num_tiles);
+    if (self->activity == NULL || self->last_frame == NULL)
+    {
+        xrdp_enc_classifier_delete(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_enc_classifier_delete(struct xrdp_enc_classifier *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    g_free(self->activity);
+    g_free(self->last_frame);
+    g_free(self);
+}
+
+/*****************************************************************************/
+void
+xrdp_enc_classifier_new_frame(struct xrdp_enc_classifier *self)
+{
+    self->frame++;
+}
+
+/*****************************************************************************/
+/* Counts the distinct colours in a tile, giving up once there are more
+ * than CLASSIFY_MAX_TEXT_COLORS */
+static int
+count_colors(int cx, int cy,
+             const tui8 *p0, const tui8 *p1, const tui8 *p2, int stride)
+{
+    tui32 set[CLASSIFY_COLOR_SET_SIZE];
+    tui32 key;
+    int slot;
+    int count;
+    int i;
+    int j;
+
+    g_memset(set, 0, sizeof(set));
+    count = 0;
+    for (j = 0; j < cy; j++)
+    {
+        for (i = 0; i < cx; i++)
+        {
+            /* the top bit marks the slot as used */
+            key = 0x80000000 | (p0[i] << 16) | (p1[i] << 8) | p2[i];
+            slot = (key * 2654435761U) >> (32 - CLASSIFY_COLOR_SET_BITS);
+            while (set[slot] != 0 && set[slot] != key)
+            {
+                slot = (slot + 1) & (CLASSIFY_COLOR_SET_SIZE - 1);
+            }
+            if (set[slot] == 0)
+            {
+                if (++count > CLASSIFY_MAX_TEXT_COLORS)
+                {
+                    return count;
+                }
+                set[slot] = key;
+            }
+        }
+        p0 += stride;
+        p1 += stride;
+        p2 += stride;
+    }
+    return count;
+}
+
+/*****************************************************************************/
+/* Text is made of flat areas with sharp edges between them. Photos are
+ * mostly gradual changes */
+static int
+mostly_sharp_edges(int cx, int cy, const tui8 *p0, int stride)
+{
+    const tui8 *above;
+    int sharp;
+    int smooth;
+    int d;
+    int i;
+    int j;
+
+    sharp = 0;
+    smooth = 0;
+    above = NULL;
+    for (j = 0; j < cy; j++)
+    {
+        for (i = 0; i < cx; i++)
+        {
+            if (i > 0)
+            {
+                d = p0[i] - p0[i - 1];
+                d = d < 0 ? -d : d;
+                sharp += d >= CLASSIFY_SHARP_EDGE;
+                smooth += d > 0 && d < CLASSIFY_SHARP_EDGE;
+            }
+            if (above != NULL)
+            {
+                d = p0[i] - above[i];
+                d = d < 0 ? -d : d;
+                sharp += d >= CLASSIFY_SHARP_EDGE;
+                smooth += d > 0 && d < CLASSIFY_SHARP_EDGE;
+            }
+        }
+        above = p0;
+        p0 += stride;
+    }
+    return sharp >= smooth;
+}
+
+/*****************************************************************************/
+/* Records an update to a tile, and returns its activity */
+static int
+update_activity(struct xrdp_enc_classifier *self, int x, int y)
+{
+    int index;
+    int elapsed;
+    int activity;
+
+    x /= XRDP_ENC_TILE_SIZE;
+    y /= XRDP_ENC_TILE_SIZE;
+    if (x < 0 || y < 0 || x >= self->tiles_x || y >= self->tiles_y)
+    {
+        /* surface must have grown, we know nothing about this tile */
+        return 0;
+    }
+    index = y * self->tiles_x + x;
+    activity = self->activity[index];
+    elapsed = self->frame - self->last_frame[index];
+    if (elapsed == 0)
+    {
+        /* already counted this frame */
+        return activity;
+    }
+    elapsed = MIN(elapsed, CLASSIFY_MAX_DECAY);
+    while (elapsed-- > 0)
+    {
+        activity = activity * 3 / 4;
+    }
+    activity = MIN(activity + CLASSIFY_ACTIVITY_STEP, 255);
+    self->activity[index] = activity;
+    self->last_frame[index] = self->frame;
+    return activity;
+}
+
+/*****************************************************************************/
+enum xrdp_enc_content
+xrdp_enc_classify_tile(struct xrdp_enc_classifier *self,
+                       int x, int y, int cx, int cy,
+                       const tui8 *p0, const tui8 *p1, const tui8 *p2,
+                       int stride)
+{
+    enum xrdp_enc_content rv;
+    int colors;
+    int activity;
+
+    cx = MIN(cx, XRDP_ENC_TILE_SIZE);
+    cy = MIN(cy, XRDP_ENC_TILE_SIZE);
+    activity = update_activity(self, x, y);
+    colors = count_colors(cx, cy, p0, p1, p2, stride);
+    if (colors <= CLASSIFY_FEW_COLORS ||
+            (colors <= CLASSIFY_MAX_TEXT_COLORS &&
+             mostly_sharp_edges(cx, cy, p0, stride)))
+    {
+        rv = XRDP_ENC_CONTENT_TEXT;
+    }
+    else if (activity >= CLASSIFY_VIDEO_ACTIVITY)
+    {
+        rv = XRDP_ENC_CONTENT_VIDEO;
+    }
+    else
+    {
+        rv = XRDP_ENC_CONTENT_PHOTO;
+    }
+    LOG_DEVEL(LOG_LEVEL_TRACE, "xrdp_enc_classify_tile: x %d y %d "
+              "colors %d activity %d content %d",
+              x, y, colors, activity, rv);
+    return rv;
+}
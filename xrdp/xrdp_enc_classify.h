@@ -0,0 +1,97 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file xrdp_enc_classify.h
+ * @brief Per-tile content classifier for the encoder
+ *
+ * Each 64x64 tile sent by the encoder is scored as text, photo or
+ * video, so the encoder can pick a suitable quality for it.
+ *
+ * - Text has few distinct colours, and mostly sharp edges.
+ * - Video is anything else which changes on most frames.
+ * - Photo is everything else.
+ *
+ * How often a tile changes is tracked over a grid covering the
+ * surface, so a classifier is needed for each surface. A classifier
+ * must only be used from one thread.
+ */
+
+#ifndef _XRDP_ENC_CLASSIFY_H
+#define _XRDP_ENC_CLASSIFY_H
+
+#include "arch.h"
+
+#define XRDP_ENC_TILE_SIZE 64
+
+enum xrdp_enc_content
+{
+    XRDP_ENC_CONTENT_TEXT,
+    XRDP_ENC_CONTENT_PHOTO,
+    XRDP_ENC_CONTENT_VIDEO
+};
+
+struct xrdp_enc_classifier
+{
+    int tiles_x;
+    int tiles_y;
+    int frame;
+    tui8 *activity; /* decaying average of updates, one per tile */
+    int *last_frame; /* frame the activity was last brought up to date */
+};
+
+struct xrdp_enc_classifier *
+xrdp_enc_classifier_create(int width, int height);
+void
+xrdp_enc_classifier_delete(struct xrdp_enc_classifier *self);
+
+/**
+ * Start a new frame
+ *
+ * Tiles which are not classified in a frame become less active.
+ *
+ * @param self classifier
+ */
+void
+xrdp_enc_classifier_new_frame(struct xrdp_enc_classifier *self);
+
+/**
+ * Classify a tile, and record that it has been updated this frame
+ *
+ * The planes are 8 bits per pixel, and all use the same stride.
+ * They can be luma and chroma, or any three colour components, but
+ * the first plane is used for edge detection so it should be luma
+ * or something close to it.
+ *
+ * @param self classifier
+ * @param x Left edge of tile on the surface
+ * @param y Top edge of tile on the surface
+ * @param cx Tile width, at most XRDP_ENC_TILE_SIZE
+ * @param cy Tile height, at most XRDP_ENC_TILE_SIZE
+ * @param p0 First pixel of the first plane
+ * @param p1 First pixel of the second plane
+ * @param p2 First pixel of the third plane
+ * @param stride Bytes from one line to the next in each plane
+ * @return content type of the tile
+ */
+enum xrdp_enc_content
+xrdp_enc_classify_tile(struct xrdp_enc_classifier *self,
+                       int x, int y, int cx, int cy,
+                       const tui8 *p0, const tui8 *p1, const tui8 *p2,
+                       int stride);
+
+#endif
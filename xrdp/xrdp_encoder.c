@@ -27,8 +27,10 @@
 #include "ms-rdpbcgr.h"
 #include "thread_calls.h"
 #include "fifo.h"
+#include "spsc_ring.h"
 #include "xrdp_egfx.h"
 #include "string_calls.h"
+#include "xrdp_enc_classify.h"
 
 #ifdef XRDP_RFXCODEC
 #include "rfxcodec_encode.h"
@@ -48,6 +50,30 @@
 #define MIN_XRDP_GFX_MAX_COMPRESSED_BYTES (64 * 1024)
 #define MAX_XRDP_GFX_MAX_COMPRESSED_BYTES (256 * 1024 * 1024)
 
+#define DEFAULT_XRDP_ENCODER_THREADS 1
+/* limits used for validate env var XRDP_ENCODER_THREADS */
+#define MIN_XRDP_ENCODER_THREADS 1
+#define MAX_XRDP_ENCODER_THREADS 64
+
+#define DEFAULT_XRDP_ENCODER_POOL_BYTES (64 * 1024 * 1024)
+/* limits used for validate env var XRDP_ENCODER_POOL_BYTES */
+#define MIN_XRDP_ENCODER_POOL_BYTES 0
+#define MAX_XRDP_ENCODER_POOL_BYTES (1024 * 1024 * 1024)
+
+/* output buffers are pooled in power-of-two size classes from
+   1 << POOL_MIN_SHIFT to 1 << POOL_MAX_SHIFT bytes. Class 0 is
+   used for buffers which aren't pooled */
+#define POOL_MIN_SHIFT 12
+#define POOL_MAX_SHIFT 25
+#define POOL_NUM_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 2)
+#define POOL_CLASS_BYTES(_class) (1 << ((_class) + POOL_MIN_SHIFT - 1))
+/* max number of idle XRDP_ENC_DATA_DONE records to keep */
+#define POOL_MAX_IDLE_DONES 1024
+
+/* size of the rings between the main thread and the encoder thread.
+   If a ring fills up, the producer queues items in a private backlog */
+#define XRDP_ENC_RING_ITEMS 1024
+
 #define XRDP_SURCMD_PREFIX_BYTES 256
 #define OUT_DATA_BYTES_DEFAULT_SIZE (16 * 1024 * 1024)
 
@@ -77,6 +103,25 @@ static const unsigned char g_rfx_quantization_values_ulq[] =
     0x66, 0x66, 0x77, 0x87, 0x98,
     0xBB, 0xBB, 0xBB, 0xBB, 0xBB /* TODO: tentative value */
 };
+
+/*
+ * For content adaptive encoding, these are added after the two
+ * quantizers above. Text is sent at the finest quantization, and
+ * video at a coarse one
+ */
+#define QUANT_BYTES 5
+#define QUANT_IDX_TEXT 2
+#define QUANT_IDX_VIDEO 3
+
+static const unsigned char g_rfx_quantization_values_text[] =
+{
+    0x66, 0x66, 0x66, 0x66, 0x66
+};
+
+static const unsigned char g_rfx_quantization_values_video[] =
+{
+    0xBB, 0xBB, 0xBB, 0xBB, 0xBB
+};
 #endif
 
 struct enc_rect
@@ -87,12 +132,31 @@ struct enc_rect
     short y2;
 };
 
+/* Surface commands for JPEG and RFX are split by crects over a pool of
+ * these. Worker 0 is the proc_enc_msg thread itself, the others each
+ * have their own thread. Every worker has its own codec handle, so
+ * no locking is needed while encoding */
+struct xrdp_enc_worker
+{
+    struct xrdp_encoder *self;
+    void *codec_handle;
+    tbus work_sem; /* posted when a job is ready, or term is set */
+    int term;
+    /* job, set up by process_enc_tiles() */
+    XRDP_ENC_DATA *enc;
+    int start_crect;
+    int num_crects;
+    struct fifo *done; /* XRDP_ENC_DATA_DONE output for this job */
+};
+
 /*****************************************************************************/
 static int
-process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+process_enc_tiles(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+static int
+process_tiles_jpg(struct xrdp_encoder *self, struct xrdp_enc_worker *worker);
 #ifdef XRDP_RFXCODEC
 static int
-process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+process_tiles_rfx(struct xrdp_encoder *self, struct xrdp_enc_worker *worker);
 #endif
 #ifdef XRDP_X264
 static int
@@ -102,7 +166,7 @@ static int
 process_enc_egfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
 
 /*****************************************************************************/
-/* Item destructor for self->fifo_to_proc */
+/* Item destructor for self->ring_to_proc */
 static void
 xrdp_enc_data_destructor(void *item, void *closure)
 {
@@ -119,7 +183,8 @@ xrdp_enc_data_destructor(void *item, void *closure)
     g_free(enc);
 }
 
-/* Item destructor for self->fifo_processed */
+/* Item destructor for self->ring_processed. Everything in the pool
+ * comes from g_malloc(), so items can be freed directly */
 static void
 xrdp_enc_data_done_destructor(void *item, void *closure)
 {
@@ -128,6 +193,409 @@ xrdp_enc_data_done_destructor(void *item, void *closure)
     g_free(enc_done);
 }
 
+/*****************************************************************************/
+/* Pool of output buffers and XRDP_ENC_DATA_DONE records.
+ *
+ * Buffers are taken by the encoder threads and given back by the main
+ * thread once the data has been sent. Idle buffers are kept on a free
+ * list per size class, up to max_idle_bytes in total. Free items are
+ * chained through their first bytes. */
+struct xrdp_enc_pool_item
+{
+    struct xrdp_enc_pool_item *next;
+};
+
+struct xrdp_enc_pool
+{
+    tbus mutex;
+    int max_idle_bytes;
+    int idle_bytes;
+    struct xrdp_enc_pool_item *free_bufs[POOL_NUM_CLASSES];
+    struct xrdp_enc_pool_item *free_dones;
+    int num_free_dones;
+};
+
+/*****************************************************************************/
+static struct xrdp_enc_pool *
+xrdp_enc_pool_create(void)
+{
+    struct xrdp_enc_pool *pool;
+    const char *env_var;
+
+    pool = g_new0(struct xrdp_enc_pool, 1);
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pool->max_idle_bytes = DEFAULT_XRDP_ENCODER_POOL_BYTES;
+    env_var = g_getenv("XRDP_ENCODER_POOL_BYTES");
+    if (env_var != NULL)
+    {
+        int pool_bytes = g_atoix(env_var);
+        if (pool_bytes >= MIN_XRDP_ENCODER_POOL_BYTES &&
+                pool_bytes <= MAX_XRDP_ENCODER_POOL_BYTES)
+        {
+            pool->max_idle_bytes = pool_bytes;
+            LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: "
+                "XRDP_ENCODER_POOL_BYTES set to %d", pool_bytes);
+        }
+        else
+        {
+            LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: "
+                "XRDP_ENCODER_POOL_BYTES set but invalid %s", env_var);
+        }
+    }
+    pool->mutex = tc_mutex_create();
+    return pool;
+}
+
+/*****************************************************************************/
+static void
+xrdp_enc_pool_delete(struct xrdp_enc_pool *pool)
+{
+    struct xrdp_enc_pool_item *item;
+    int index;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+    for (index = 0; index < POOL_NUM_CLASSES; index++)
+    {
+        while ((item = pool->free_bufs[index]) != NULL)
+        {
+            pool->free_bufs[index] = item->next;
+            g_free(item);
+        }
+    }
+    while ((item = pool->free_dones) != NULL)
+    {
+        pool->free_dones = item->next;
+        g_free(item);
+    }
+    tc_mutex_delete(pool->mutex);
+    g_free(pool);
+}
+
+/*****************************************************************************/
+/* called from encoder threads
+ * @param bytes size of buffer needed
+ * @param pool_class returned size class, to be stored in the
+ *                   XRDP_ENC_DATA_DONE with the buffer */
+static char *
+xrdp_enc_pool_get_buf(struct xrdp_enc_pool *pool, int bytes, int *pool_class)
+{
+    struct xrdp_enc_pool_item *item;
+    int lclass;
+
+    lclass = 1;
+    while (lclass < POOL_NUM_CLASSES && POOL_CLASS_BYTES(lclass) < bytes)
+    {
+        lclass++;
+    }
+    if (pool == NULL || lclass == POOL_NUM_CLASSES)
+    {
+        *pool_class = 0;
+        return g_new(char, bytes);
+    }
+    *pool_class = lclass;
+    tc_mutex_lock(pool->mutex);
+    item = pool->free_bufs[lclass];
+    if (item != NULL)
+    {
+        pool->free_bufs[lclass] = item->next;
+        pool->idle_bytes -= POOL_CLASS_BYTES(lclass);
+    }
+    tc_mutex_unlock(pool->mutex);
+    if (item == NULL)
+    {
+        item = (struct xrdp_enc_pool_item *)
+               g_malloc(POOL_CLASS_BYTES(lclass), 0);
+    }
+    return (char *) item;
+}
+
+/*****************************************************************************/
+static void
+xrdp_enc_pool_put_buf(struct xrdp_enc_pool *pool, char *buf, int pool_class)
+{
+    struct xrdp_enc_pool_item *item;
+    int bytes;
+
+    if (buf == NULL)
+    {
+        return;
+    }
+    if (pool == NULL || pool_class < 1 || pool_class >= POOL_NUM_CLASSES)
+    {
+        g_free(buf);
+        return;
+    }
+    bytes = POOL_CLASS_BYTES(pool_class);
+    item = (struct xrdp_enc_pool_item *) buf;
+    tc_mutex_lock(pool->mutex);
+    if (pool->idle_bytes + bytes <= pool->max_idle_bytes)
+    {
+        item->next = pool->free_bufs[pool_class];
+        pool->free_bufs[pool_class] = item;
+        pool->idle_bytes += bytes;
+        item = NULL;
+    }
+    tc_mutex_unlock(pool->mutex);
+    g_free(item);
+}
+
+/*****************************************************************************/
+/* called from encoder threads. Returns a zeroed record */
+static XRDP_ENC_DATA_DONE *
+xrdp_enc_pool_get_done(struct xrdp_enc_pool *pool)
+{
+    struct xrdp_enc_pool_item *item;
+
+    item = NULL;
+    if (pool != NULL)
+    {
+        tc_mutex_lock(pool->mutex);
+        item = pool->free_dones;
+        if (item != NULL)
+        {
+            pool->free_dones = item->next;
+            pool->num_free_dones--;
+        }
+        tc_mutex_unlock(pool->mutex);
+    }
+    if (item == NULL)
+    {
+        return g_new0(XRDP_ENC_DATA_DONE, 1);
+    }
+    g_memset(item, 0, sizeof(XRDP_ENC_DATA_DONE));
+    return (XRDP_ENC_DATA_DONE *) item;
+}
+
+/*****************************************************************************/
+static void
+xrdp_enc_pool_put_done(struct xrdp_enc_pool *pool,
+                       XRDP_ENC_DATA_DONE *enc_done)
+{
+    struct xrdp_enc_pool_item *item;
+
+    item = (struct xrdp_enc_pool_item *) enc_done;
+    if (pool != NULL && item != NULL)
+    {
+        tc_mutex_lock(pool->mutex);
+        if (pool->num_free_dones < POOL_MAX_IDLE_DONES)
+        {
+            item->next = pool->free_dones;
+            pool->free_dones = item;
+            pool->num_free_dones++;
+            item = NULL;
+        }
+        tc_mutex_unlock(pool->mutex);
+    }
+    g_free(item);
+}
+
+/*****************************************************************************/
+/* called from main thread once enc_done has been sent */
+void
+xrdp_encoder_free_enc_done(struct xrdp_encoder *self,
+                           XRDP_ENC_DATA_DONE *enc_done)
+{
+    if (enc_done == NULL)
+    {
+        return;
+    }
+    xrdp_enc_pool_put_buf(self->pool, enc_done->comp_pad_data,
+                          enc_done->pool_class);
+    xrdp_enc_pool_put_done(self->pool, enc_done);
+}
+
+/*****************************************************************************/
+/* called from encoder worker threads other than proc_enc_msg */
+static THREAD_RV THREAD_CC
+proc_enc_worker(void *arg)
+{
+    struct xrdp_enc_worker *worker;
+    struct xrdp_encoder *self;
+
+    worker = (struct xrdp_enc_worker *) arg;
+    self = worker->self;
+    while (1)
+    {
+        tc_sem_dec(worker->work_sem);
+        if (worker->term)
+        {
+            break;
+        }
+        self->process_tiles(self, worker);
+        tc_sem_inc(self->worker_done_sem);
+    }
+    /* acknowledge the term request */
+    tc_sem_inc(self->worker_done_sem);
+    return 0;
+}
+
+/*****************************************************************************/
+static void *
+xrdp_encoder_create_codec_handle(struct xrdp_encoder *self, int index)
+{
+    if (self->process_tiles == process_tiles_jpg)
+    {
+        return libxrdp_codec_jpeg_init();
+    }
+#ifdef XRDP_RFXCODEC
+    if (self->process_tiles == process_tiles_rfx)
+    {
+        /* worker 0 uses the handle created with the session */
+        if (index == 0)
+        {
+            return self->codec_handle_rfx;
+        }
+        return rfxcodec_encode_create(self->mm->wm->screen->width,
+                                      self->mm->wm->screen->height,
+                                      RFX_FORMAT_YUV, 0);
+    }
+#endif
+    return NULL;
+}
+
+/*****************************************************************************/
+static void
+xrdp_encoder_delete_codec_handle(struct xrdp_encoder *self, int index,
+                                 void *handle)
+{
+    if (handle == NULL)
+    {
+        return;
+    }
+    if (self->process_tiles == process_tiles_jpg)
+    {
+        libxrdp_codec_jpeg_deinit(handle);
+    }
+#ifdef XRDP_RFXCODEC
+    else if (self->process_tiles == process_tiles_rfx && index != 0)
+    {
+        rfxcodec_encode_destroy(handle);
+    }
+#endif
+}
+
+/*****************************************************************************/
+/* Sets up the tile encoding workers for the JPEG and RFX surface command
+ * codecs. The number of workers is taken from XRDP_ENCODER_THREADS.
+ * If anything can't be created, we carry on with fewer workers */
+static void
+xrdp_encoder_create_workers(struct xrdp_encoder *self)
+{
+    struct xrdp_enc_worker *worker;
+    const char *env_var;
+    int num_workers;
+    int index;
+
+    if (self->process_tiles == NULL)
+    {
+        return;
+    }
+    num_workers = DEFAULT_XRDP_ENCODER_THREADS;
+    env_var = g_getenv("XRDP_ENCODER_THREADS");
+    if (env_var != NULL)
+    {
+        int threads = g_atoix(env_var);
+        if (threads >= MIN_XRDP_ENCODER_THREADS &&
+                threads <= MAX_XRDP_ENCODER_THREADS)
+        {
+            num_workers = threads;
+            LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: "
+                "XRDP_ENCODER_THREADS set to %d", threads);
+        }
+        else
+        {
+            LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: "
+                "XRDP_ENCODER_THREADS set but invalid %s", env_var);
+        }
+    }
+
+    self->workers = g_new0(struct xrdp_enc_worker, num_workers);
+    if (self->workers == NULL)
+    {
+        return;
+    }
+    self->worker_done_sem = tc_sem_create(0);
+    for (index = 0; index < num_workers; index++)
+    {
+        worker = self->workers + index;
+        worker->self = self;
+        worker->codec_handle = xrdp_encoder_create_codec_handle(self, index);
+        worker->done = fifo_create(xrdp_enc_data_done_destructor);
+        if (worker->done == NULL)
+        {
+            xrdp_encoder_delete_codec_handle(self, index,
+                                             worker->codec_handle);
+            break;
+        }
+        if (index > 0)
+        {
+            worker->work_sem = tc_sem_create(0);
+            if (tc_thread_create(proc_enc_worker, worker) != 0)
+            {
+                LOG(LOG_LEVEL_WARNING, "xrdp_encoder_create: can't create "
+                    "encoder worker thread %d", index);
+                tc_sem_delete(worker->work_sem);
+                fifo_delete(worker->done, NULL);
+                xrdp_encoder_delete_codec_handle(self, index,
+                                                 worker->codec_handle);
+                break;
+            }
+        }
+    }
+    self->num_workers = index;
+    LOG_DEVEL(LOG_LEVEL_INFO, "Using %d encoder worker(s)", self->num_workers);
+}
+
+/*****************************************************************************/
+/* called from the encoder thread as it exits. Waits for all the worker
+ * threads to finish */
+static void
+xrdp_encoder_stop_workers(struct xrdp_encoder *self)
+{
+    int index;
+
+    for (index = 1; index < self->num_workers; index++)
+    {
+        self->workers[index].term = 1;
+        tc_sem_inc(self->workers[index].work_sem);
+    }
+    for (index = 1; index < self->num_workers; index++)
+    {
+        tc_sem_dec(self->worker_done_sem);
+    }
+}
+
+/*****************************************************************************/
+static void
+xrdp_encoder_delete_workers(struct xrdp_encoder *self)
+{
+    struct xrdp_enc_worker *worker;
+    int index;
+
+    if (self->workers == NULL)
+    {
+        return;
+    }
+    for (index = 0; index < self->num_workers; index++)
+    {
+        worker = self->workers + index;
+        xrdp_encoder_delete_codec_handle(self, index, worker->codec_handle);
+        fifo_delete(worker->done, NULL);
+        if (index > 0)
+        {
+            tc_sem_delete(worker->work_sem);
+        }
+    }
+    tc_sem_delete(self->worker_done_sem);
+    g_free(self->workers);
+}
+
 /*****************************************************************************/
 struct xrdp_encoder *
 xrdp_encoder_create(struct xrdp_mm *mm)
@@ -164,18 +632,21 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     if (client_info->jpeg_codec_id != 0)
     {
         LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: starting jpeg codec session");
+        self->codec_name = "jpeg";
         self->codec_id = client_info->jpeg_codec_id;
         self->in_codec_mode = 1;
         self->codec_quality = client_info->jpeg_prop[0];
         client_info->capture_code = CC_SIMPLE;
         client_info->capture_format = XRDP_a8b8g8r8;
-        self->process_enc = process_enc_jpg;
+        self->process_enc = process_enc_tiles;
+        self->process_tiles = process_tiles_jpg;
     }
 #ifdef XRDP_X264
     else if (mm->egfx_flags & XRDP_EGFX_H264)
     {
         LOG(LOG_LEVEL_INFO,
             "xrdp_encoder_create: starting h264 codec session gfx");
+        self->codec_name = "h264 gfx";
         self->in_codec_mode = 1;
         client_info->capture_code = CC_GFX_A2;
         client_info->capture_format = XRDP_nv12_709fr;
@@ -184,6 +655,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     else if (client_info->h264_codec_id != 0)
     {
         LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: starting h264 codec session");
+        self->codec_name = "h264";
         self->codec_id = client_info->h264_codec_id;
         self->in_codec_mode = 1;
         client_info->capture_code = CC_SUF_A2;
@@ -196,6 +668,7 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     {
         LOG(LOG_LEVEL_INFO,
             "xrdp_encoder_create: starting gfx rfx pro codec session");
+        self->codec_name = "rfx pro gfx";
         self->in_codec_mode = 1;
         client_info->capture_code = CC_GFX_PRO;
         self->gfx = 1;
@@ -221,14 +694,30 @@ xrdp_encoder_create(struct xrdp_mm *mm)
                 self->quants = (const char *) g_rfx_quantization_values_std;
 
         }
+        if (mm->wm->gfx_config->content_adaptive)
+        {
+            LOG(LOG_LEVEL_INFO,
+                "xrdp_encoder_create: content adaptive quantization on");
+            self->content_adaptive = 1;
+            g_memcpy(self->adaptive_quants, self->quants,
+                     self->num_quants * QUANT_BYTES);
+            g_memcpy(self->adaptive_quants + QUANT_IDX_TEXT * QUANT_BYTES,
+                     g_rfx_quantization_values_text, QUANT_BYTES);
+            g_memcpy(self->adaptive_quants + QUANT_IDX_VIDEO * QUANT_BYTES,
+                     g_rfx_quantization_values_video, QUANT_BYTES);
+            self->quants = self->adaptive_quants;
+            self->num_quants = QUANT_IDX_VIDEO + 1;
+        }
     }
     else if (client_info->rfx_codec_id != 0)
     {
         LOG(LOG_LEVEL_INFO, "xrdp_encoder_create: starting rfx codec session");
+        self->codec_name = "rfx";
         self->codec_id = client_info->rfx_codec_id;
         self->in_codec_mode = 1;
         client_info->capture_code = CC_SUF_RFX;
-        self->process_enc = process_enc_rfx;
+        self->process_enc = process_enc_tiles;
+        self->process_tiles = process_tiles_rfx;
         self->codec_handle_rfx = rfxcodec_encode_create(mm->wm->screen->width,
                                  mm->wm->screen->height,
                                  RFX_FORMAT_YUV, 0);
@@ -245,9 +734,13 @@ xrdp_encoder_create(struct xrdp_mm *mm)
               self->codec_id);
 
     /* setup required FIFOs */
-    self->fifo_to_proc = fifo_create(xrdp_enc_data_destructor);
-    self->fifo_processed = fifo_create(xrdp_enc_data_done_destructor);
-    self->mutex = tc_mutex_create();
+    self->pool = xrdp_enc_pool_create();
+    self->ring_to_proc = spsc_ring_create(XRDP_ENC_RING_ITEMS,
+                                          xrdp_enc_data_destructor);
+    self->backlog_to_proc = fifo_create(xrdp_enc_data_destructor);
+    self->ring_processed = spsc_ring_create(XRDP_ENC_RING_ITEMS,
+                                            xrdp_enc_data_done_destructor);
+    self->backlog_processed = fifo_create(xrdp_enc_data_done_destructor);
 
     pid = g_getpid();
     /* setup wait objects for signalling */
@@ -309,6 +802,8 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     /* make sure frames_in_flight is at least 1 */
     self->frames_in_flight = MAX(self->frames_in_flight, 1);
 
+    xrdp_encoder_create_workers(self);
+
     /* create thread to process messages */
     tc_thread_create(proc_enc_msg, self);
 
@@ -340,13 +835,16 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
         LOG(LOG_LEVEL_WARNING, "Encoder failed to shut down cleanly");
     }
 
+    xrdp_encoder_delete_workers(self);
+
 #ifdef XRDP_RFXCODEC
-    for (index = 0; index < 16; index++)
+    for (index = 0; index < ENC_MAX_MONITORS; index++)
     {
         if (self->codec_handle_prfx_gfx[index] != NULL)
         {
             rfxcodec_encode_destroy(self->codec_handle_prfx_gfx[index]);
         }
+        xrdp_enc_classifier_delete(self->classifier[index]);
     }
     if (self->codec_handle_rfx != NULL)
     {
@@ -355,7 +853,7 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
 #endif
 
 #if defined(XRDP_X264)
-    for (index = 0; index < 16; index++)
+    for (index = 0; index < ENC_MAX_MONITORS; index++)
     {
         if (self->codec_handle_h264_gfx[index] != NULL)
         {
@@ -375,16 +873,179 @@ xrdp_encoder_delete(struct xrdp_encoder *self)
     g_delete_wait_obj(self->xrdp_encoder_term_done);
 
     /* cleanup fifos */
-    fifo_delete(self->fifo_to_proc, NULL);
-    fifo_delete(self->fifo_processed, NULL);
-    tc_mutex_delete(self->mutex);
+    spsc_ring_delete(self->ring_to_proc, NULL);
+    fifo_delete(self->backlog_to_proc, NULL);
+    spsc_ring_delete(self->ring_processed, NULL);
+    fifo_delete(self->backlog_processed, NULL);
+    xrdp_enc_pool_delete(self->pool);
     g_free(self);
 }
 
 /*****************************************************************************/
-/* called from encoder thread */
+/* Adds an item to a ring. If the ring is full, the item is kept in
+ * the backlog instead. Anything already in the backlog is moved to the
+ * ring first, so the order of items is kept.
+ *
+ * Only the producer for the ring may call this.
+ *
+ * @param item Item to add, or NULL just to move items from the backlog
+ * @return 1 for success, 0 for no memory */
 static int
-process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+ring_add_with_backlog(struct spsc_ring *ring, struct fifo *backlog,
+                      void *item)
+{
+    while (!fifo_is_empty(backlog) && !spsc_ring_is_full(ring))
+    {
+        spsc_ring_add_item(ring, fifo_remove_item(backlog));
+    }
+    if (item == NULL)
+    {
+        return 1;
+    }
+    if (fifo_is_empty(backlog) && spsc_ring_add_item(ring, item))
+    {
+        return 1;
+    }
+    return fifo_add_item(backlog, item);
+}
+
+/*****************************************************************************/
+/* called from main thread */
+int
+xrdp_encoder_queue_enc(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    int rv;
+
+    enc->queue_time = g_time_us();
+    rv = ring_add_with_backlog(self->ring_to_proc, self->backlog_to_proc,
+                               enc);
+    /* signal xrdp_encoder thread */
+    g_set_wait_obj(self->xrdp_encoder_event_to_proc);
+    return rv ? 0 : 1;
+}
+
+/*****************************************************************************/
+/* called from main thread, when self->backlog_to_proc isn't empty */
+void
+xrdp_encoder_flush_backlog(struct xrdp_encoder *self)
+{
+    ring_add_with_backlog(self->ring_to_proc, self->backlog_to_proc, NULL);
+    g_set_wait_obj(self->xrdp_encoder_event_to_proc);
+}
+
+/*****************************************************************************/
+/* called from main thread */
+XRDP_ENC_DATA_DONE *
+xrdp_encoder_get_enc_done(struct xrdp_encoder *self)
+{
+    return (XRDP_ENC_DATA_DONE *) spsc_ring_remove_item(self->ring_processed);
+}
+
+/*****************************************************************************/
+/* called from encoder thread. The main thread must be signalled
+ * separately */
+static int
+xrdp_encoder_add_enc_done(struct xrdp_encoder *self,
+                          XRDP_ENC_DATA_DONE *enc_done)
+{
+    if (enc_done != NULL && enc_done->last && enc_done->enc != NULL)
+    {
+        /* the main thread may free enc as soon as this is queued */
+        enc_done->enc->end_time = g_time_us();
+    }
+    return ring_add_with_backlog(self->ring_processed,
+                                 self->backlog_processed, enc_done) ? 0 : 1;
+}
+
+/*****************************************************************************/
+/* called from encoder thread. Splits the crects in a surface command
+ * between the workers, waits for them all to finish, and then passes
+ * the output to the main thread in crect order */
+static int
+process_enc_tiles(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+{
+    struct xrdp_enc_worker *worker;
+    XRDP_ENC_DATA_DONE *enc_done;
+    XRDP_ENC_DATA_DONE *prev_done;
+    int num_jobs;
+    int start_crect;
+    int index;
+
+    num_jobs = MIN(self->num_workers, enc->u.sc.num_crects);
+    num_jobs = MAX(num_jobs, 1);
+    if (self->num_workers < 1)
+    {
+        num_jobs = 0;
+    }
+
+    start_crect = 0;
+    for (index = 0; index < num_jobs; index++)
+    {
+        worker = self->workers + index;
+        worker->enc = enc;
+        worker->start_crect = start_crect;
+        worker->num_crects = (enc->u.sc.num_crects - start_crect) /
+                             (num_jobs - index);
+        start_crect += worker->num_crects;
+        if (index > 0)
+        {
+            tc_sem_inc(worker->work_sem);
+        }
+    }
+    if (num_jobs > 0)
+    {
+        self->process_tiles(self, self->workers);
+    }
+    for (index = 1; index < num_jobs; index++)
+    {
+        tc_sem_dec(self->worker_done_sem);
+    }
+
+    /* only the first message for enc starts a frame, and the last one
+       must be marked so enc is freed and Xorg gets its ack */
+    prev_done = NULL;
+    for (index = 0; index < num_jobs; index++)
+    {
+        worker = self->workers + index;
+        while ((enc_done = (XRDP_ENC_DATA_DONE *)
+                           fifo_remove_item(worker->done)) != NULL)
+        {
+            enc_done->continuation = prev_done != NULL;
+            enc_done->last = 0;
+            if (prev_done != NULL)
+            {
+                xrdp_encoder_add_enc_done(self, prev_done);
+            }
+            prev_done = enc_done;
+        }
+    }
+    if (prev_done == NULL)
+    {
+        /* nothing encoded, send back an empty message */
+        prev_done = xrdp_enc_pool_get_done(self->pool);
+        if (prev_done == NULL)
+        {
+            return 1;
+        }
+        prev_done->enc = enc;
+        prev_done->x = enc->u.sc.left;
+        prev_done->y = enc->u.sc.top;
+        prev_done->cx = enc->u.sc.width;
+        prev_done->cy = enc->u.sc.height;
+        prev_done->frame_id = enc->u.sc.frame_id;
+    }
+    prev_done->last = 1;
+    xrdp_encoder_add_enc_done(self, prev_done);
+
+    /* signal completion for main thread */
+    g_set_wait_obj(self->xrdp_encoder_event_processed);
+    return 0;
+}
+
+/*****************************************************************************/
+/* called from encoder thread or an encoder worker thread */
+static int
+process_tiles_jpg(struct xrdp_encoder *self, struct xrdp_enc_worker *worker)
 {
     int index;
     int x;
@@ -394,20 +1055,17 @@ process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     int quality;
     int error;
     int out_data_bytes;
-    int count;
+    int end_crect;
+    int pool_class;
     char *out_data;
+    XRDP_ENC_DATA *enc;
     XRDP_ENC_DATA_DONE *enc_done;
-    struct fifo *fifo_processed;
-    tbus mutex;
-    tbus event_processed;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_jpg:");
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_tiles_jpg:");
+    enc = worker->enc;
     quality = self->codec_quality;
-    fifo_processed = self->fifo_processed;
-    mutex = self->mutex;
-    event_processed = self->xrdp_encoder_event_processed;
-    count = enc->u.sc.num_crects;
-    for (index = 0; index < count; index++)
+    end_crect = worker->start_crect + worker->num_crects;
+    for (index = worker->start_crect; index < end_crect; index++)
     {
         x = enc->u.sc.crects[index * 4 + 0];
         y = enc->u.sc.crects[index * 4 + 1];
@@ -415,73 +1073,74 @@ process_enc_jpg(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
         cy = enc->u.sc.crects[index * 4 + 3];
         if (cx < 1 || cy < 1)
         {
-            LOG_DEVEL(LOG_LEVEL_WARNING, "process_enc_jpg: error 1");
+            LOG_DEVEL(LOG_LEVEL_WARNING, "process_tiles_jpg: error 1");
             continue;
         }
 
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_jpg: x %d y %d cx %d cy %d",
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "process_tiles_jpg: x %d y %d cx %d cy %d",
                   x, y, cx, cy);
 
         out_data_bytes = MAX((cx + 4) * cy * 4, 8192);
         if ((out_data_bytes < 1)
                 || (out_data_bytes > OUT_DATA_BYTES_DEFAULT_SIZE))
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: error 2");
+            LOG_DEVEL(LOG_LEVEL_ERROR, "process_tiles_jpg: error 2");
             return 1;
         }
-        out_data = (char *) g_malloc(out_data_bytes
-                                     + XRDP_SURCMD_PREFIX_BYTES + 2, 0);
+        out_data = xrdp_enc_pool_get_buf(self->pool, out_data_bytes
+                                         + XRDP_SURCMD_PREFIX_BYTES + 2,
+                                         &pool_class);
         if (out_data == 0)
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: error 3");
+            LOG_DEVEL(LOG_LEVEL_ERROR, "process_tiles_jpg: error 3");
             return 1;
         }
 
         out_data[256] = 0; /* header bytes */
         out_data[257] = 0;
-        error = libxrdp_codec_jpeg_compress(self->mm->wm->session, 0, enc->u.sc.data,
-                                            enc->u.sc.width, enc->u.sc.height,
-                                            enc->u.sc.width * 4, x, y, cx, cy,
-                                            quality,
-                                            out_data
-                                            + XRDP_SURCMD_PREFIX_BYTES + 2,
-                                            &out_data_bytes);
+        error = libxrdp_codec_jpeg_compress_han(worker->codec_handle, 0,
+                                                enc->u.sc.data,
+                                                enc->u.sc.width,
+                                                enc->u.sc.height,
+                                                enc->u.sc.width * 4,
+                                                x, y, cx, cy, quality,
+                                                out_data
+                                                + XRDP_SURCMD_PREFIX_BYTES + 2,
+                                                &out_data_bytes);
         if (error < 0)
         {
-            LOG_DEVEL(LOG_LEVEL_ERROR, "process_enc_jpg: jpeg error %d "
+            LOG_DEVEL(LOG_LEVEL_ERROR, "process_tiles_jpg: jpeg error %d "
                       "bytes %d", error, out_data_bytes);
-            g_free(out_data);
+            xrdp_enc_pool_put_buf(self->pool, out_data, pool_class);
             return 1;
         }
         LOG_DEVEL(LOG_LEVEL_WARNING,
                   "jpeg error %d bytes %d", error, out_data_bytes);
-        enc_done = (XRDP_ENC_DATA_DONE *)
-                   g_malloc(sizeof(XRDP_ENC_DATA_DONE), 1);
+        enc_done = xrdp_enc_pool_get_done(self->pool);
+        if (enc_done == NULL)
+        {
+            xrdp_enc_pool_put_buf(self->pool, out_data, pool_class);
+            return 1;
+        }
         enc_done->comp_bytes = out_data_bytes + 2;
         enc_done->pad_bytes = 256;
         enc_done->comp_pad_data = out_data;
+        enc_done->pool_class = pool_class;
         enc_done->enc = enc;
-        enc_done->last = index == (enc->u.sc.num_crects - 1);
         enc_done->x = x;
         enc_done->y = y;
         enc_done->cx = cx;
         enc_done->cy = cy;
-        /* done with msg */
-        /* inform main thread done */
-        tc_mutex_lock(mutex);
-        fifo_add_item(fifo_processed, enc_done);
-        tc_mutex_unlock(mutex);
-        /* signal completion for main thread */
-        g_set_wait_obj(event_processed);
+        fifo_add_item(worker->done, enc_done);
     }
     return 0;
 }
 
 #ifdef XRDP_RFXCODEC
 /*****************************************************************************/
-/* called from encoder thread */
+/* called from encoder thread or an encoder worker thread */
 static int
-process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
+process_tiles_rfx(struct xrdp_encoder *self, struct xrdp_enc_worker *worker)
 {
     int index;
     int x;
@@ -494,32 +1153,33 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
     int all_tiles_written;
     int tiles_left;
     int finished;
+    int pool_class;
+    short *crects;
     char *out_data;
+    XRDP_ENC_DATA *enc;
     XRDP_ENC_DATA_DONE *enc_done;
-    struct fifo *fifo_processed;
-    tbus mutex;
-    tbus event_processed;
     struct rfx_tile *tiles;
     struct rfx_rect *rfxrects;
     int alloc_bytes;
     int encode_flags;
     int encode_passes;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_rfx:");
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_enc_rfx: num_crects %d num_drects %d",
-              enc->u.sc.num_crects, enc->u.sc.num_drects);
-    fifo_processed = self->fifo_processed;
-    mutex = self->mutex;
-    event_processed = self->xrdp_encoder_event_processed;
+    enc = worker->enc;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_tiles_rfx:");
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_tiles_rfx: start_crect %d "
+              "num_crects %d num_drects %d", worker->start_crect,
+              worker->num_crects, enc->u.sc.num_drects);
+    crects = enc->u.sc.crects + worker->start_crect * 4;
 
     all_tiles_written = 0;
     encode_passes = 0;
     do
     {
         tiles_written = 0;
-        tiles_left = enc->u.sc.num_crects - all_tiles_written;
+        tiles_left = worker->num_crects - all_tiles_written;
         out_data = NULL;
         out_data_bytes = 0;
+        pool_class = 0;
 
         if ((tiles_left > 0) && (enc->u.sc.num_drects > 0))
         {
@@ -527,7 +1187,8 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
             alloc_bytes += self->max_compressed_bytes;
             alloc_bytes += sizeof(struct rfx_tile) * tiles_left +
                            sizeof(struct rfx_rect) * enc->u.sc.num_drects;
-            out_data = g_new(char, alloc_bytes);
+            out_data = xrdp_enc_pool_get_buf(self->pool, alloc_bytes,
+                                             &pool_class);
             if (out_data != NULL)
             {
                 tiles = (struct rfx_tile *)
@@ -538,10 +1199,10 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
                 count = tiles_left;
                 for (index = 0; index < count; index++)
                 {
-                    x = enc->u.sc.crects[(index + all_tiles_written) * 4 + 0];
-                    y = enc->u.sc.crects[(index + all_tiles_written) * 4 + 1];
-                    cx = enc->u.sc.crects[(index + all_tiles_written) * 4 + 2];
-                    cy = enc->u.sc.crects[(index + all_tiles_written) * 4 + 3];
+                    x = crects[(index + all_tiles_written) * 4 + 0];
+                    y = crects[(index + all_tiles_written) * 4 + 1];
+                    cx = crects[(index + all_tiles_written) * 4 + 2];
+                    cy = crects[(index + all_tiles_written) * 4 + 3];
                     tiles[index].x = x;
                     tiles[index].y = y;
                     tiles[index].cx = cx;
@@ -567,17 +1228,18 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
                 out_data_bytes = self->max_compressed_bytes;
 
                 encode_flags = 0;
-                if (((int)enc->flags & KEY_FRAME_REQUESTED) && encode_passes == 0)
+                if (((int)enc->flags & KEY_FRAME_REQUESTED) &&
+                        encode_passes == 0 && worker->start_crect == 0)
                 {
                     encode_flags = RFX_FLAGS_PRO_KEY;
                 }
-                tiles_written = rfxcodec_encode_ex(self->codec_handle_rfx,
+                tiles_written = rfxcodec_encode_ex(worker->codec_handle,
                                                    out_data + XRDP_SURCMD_PREFIX_BYTES,
                                                    &out_data_bytes, enc->u.sc.data,
                                                    enc->u.sc.width, enc->u.sc.height,
                                                    ((enc->u.sc.width + 63) & ~63) * 4,
                                                    rfxrects, enc->u.sc.num_drects,
-                                                   tiles, enc->u.sc.num_crects,
+                                                   tiles, tiles_left,
                                                    self->quants, self->num_quants,
                                                    encode_flags);
             }
@@ -585,45 +1247,41 @@ process_enc_rfx(struct xrdp_encoder *self, XRDP_ENC_DATA *enc)
         }
 
         LOG_DEVEL(LOG_LEVEL_DEBUG,
-                  "process_enc_rfx: rfxcodec_encode tiles_written %d",
+                  "process_tiles_rfx: rfxcodec_encode tiles_written %d",
                   tiles_written);
         /* only if enc_done->comp_bytes is not zero is something sent
-           to the client but you must always send something back even
-           on error so Xorg can get ack */
-        enc_done = g_new0(XRDP_ENC_DATA_DONE, 1);
-        if (enc_done == NULL)
-        {
-            return 1;
-        }
-        enc_done->comp_bytes = tiles_written > 0 ? out_data_bytes : 0;
-        enc_done->pad_bytes = XRDP_SURCMD_PREFIX_BYTES;
-        enc_done->comp_pad_data = out_data;
-        enc_done->enc = enc;
-        enc_done->x = enc->u.sc.left;
-        enc_done->y = enc->u.sc.top;
-        enc_done->cx = enc->u.sc.width;
-        enc_done->cy = enc->u.sc.height;
-        enc_done->frame_id = enc->u.sc.frame_id;
-        enc_done->continuation = all_tiles_written > 0;
+           to the client. process_enc_tiles() makes sure something is
+           always sent back even on error so Xorg can get ack */
         if (tiles_written > 0)
         {
+            enc_done = xrdp_enc_pool_get_done(self->pool);
+            if (enc_done == NULL)
+            {
+                xrdp_enc_pool_put_buf(self->pool, out_data, pool_class);
+                return 1;
+            }
+            enc_done->comp_bytes = out_data_bytes;
+            enc_done->pad_bytes = XRDP_SURCMD_PREFIX_BYTES;
+            enc_done->comp_pad_data = out_data;
+            enc_done->pool_class = pool_class;
+            enc_done->enc = enc;
+            enc_done->x = enc->u.sc.left;
+            enc_done->y = enc->u.sc.top;
+            enc_done->cx = enc->u.sc.width;
+            enc_done->cy = enc->u.sc.height;
+            enc_done->frame_id = enc->u.sc.frame_id;
+            fifo_add_item(worker->done, enc_done);
             all_tiles_written += tiles_written;
         }
+        else
+        {
+            xrdp_enc_pool_put_buf(self->pool, out_data, pool_class);
+        }
         finished =
-            (all_tiles_written == enc->u.sc.num_crects) || (tiles_written < 0);
-        enc_done->last = finished;
-
-        /* done with msg */
-        /* inform main thread done */
-        tc_mutex_lock(mutex);
-        fifo_add_item(fifo_processed, enc_done);
-        tc_mutex_unlock(mutex);
+            (all_tiles_written == worker->num_crects) || (tiles_written <= 0);
     }
     while (!finished);
 
-    /* signal completion for main thread */
-    g_set_wait_obj(event_processed);
-
     return 0;
 }
 #endif
@@ -703,7 +1361,7 @@ gfx_send_done(struct xrdp_encoder *self, XRDP_ENC_DATA *enc,
 {
     XRDP_ENC_DATA_DONE *enc_done;
 
-    enc_done = g_new0(XRDP_ENC_DATA_DONE, 1);
+    enc_done = xrdp_enc_pool_get_done(self->pool);
     if (enc_done == NULL)
     {
         return 1;
@@ -720,9 +1378,7 @@ gfx_send_done(struct xrdp_encoder *self, XRDP_ENC_DATA *enc,
         enc_done->frame_id = frame_id;
     }
     /* inform main thread done */
-    tc_mutex_lock(self->mutex);
-    fifo_add_item(self->fifo_processed, enc_done);
-    tc_mutex_unlock(self->mutex);
+    xrdp_encoder_add_enc_done(self, enc_done);
     /* signal completion for main thread */
     g_set_wait_obj(self->xrdp_encoder_event_processed);
     return 0;
@@ -946,6 +1602,72 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
 #endif
 }
 
+/*****************************************************************************/
+#ifdef XRDP_RFXCODEC
+/* Chooses the quantizers for each tile from its content.
+ * Progressive RFX sessions capture in YUVA tiles, where each 64x64
+ * tile is a Y plane followed by U, V and A planes */
+static void
+gfx_classify_tiles(struct xrdp_encoder *self, XRDP_ENC_DATA *enc,
+                   int mon_index, int width, int height,
+                   struct rfx_tile *tiles, int num_tiles)
+{
+    struct xrdp_enc_classifier *classifier;
+    const tui8 *tile_data;
+    int tile_bytes;
+    int stride;
+    int offset;
+    int index;
+    int x;
+    int y;
+
+    classifier = self->classifier[mon_index];
+    if (classifier == NULL)
+    {
+        classifier = xrdp_enc_classifier_create(width, height);
+        if (classifier == NULL)
+        {
+            return;
+        }
+        self->classifier[mon_index] = classifier;
+    }
+    tile_bytes = XRDP_ENC_TILE_SIZE * XRDP_ENC_TILE_SIZE;
+    stride = ((width + 63) & ~63) * 4;
+    for (index = 0; index < num_tiles; index++)
+    {
+        x = tiles[index].x;
+        y = tiles[index].y;
+        offset = y * stride + x * XRDP_ENC_TILE_SIZE * 4;
+        if (((x | y) & (XRDP_ENC_TILE_SIZE - 1)) != 0 || x < 0 || y < 0 ||
+                offset + tile_bytes * 4 > enc->u.gfx.data_bytes)
+        {
+            continue;
+        }
+        tile_data = (const tui8 *) enc->u.gfx.data + offset;
+        switch (xrdp_enc_classify_tile(classifier, x, y,
+                                       tiles[index].cx, tiles[index].cy,
+                                       tile_data,
+                                       tile_data + tile_bytes,
+                                       tile_data + tile_bytes * 2,
+                                       XRDP_ENC_TILE_SIZE))
+        {
+            case XRDP_ENC_CONTENT_TEXT:
+                tiles[index].quant_y = QUANT_IDX_TEXT;
+                tiles[index].quant_cb = QUANT_IDX_TEXT;
+                tiles[index].quant_cr = QUANT_IDX_TEXT;
+                break;
+            case XRDP_ENC_CONTENT_VIDEO:
+                tiles[index].quant_y = self->quant_idx_u;
+                tiles[index].quant_cb = QUANT_IDX_VIDEO;
+                tiles[index].quant_cr = QUANT_IDX_VIDEO;
+                break;
+            default:
+                break;
+        }
+    }
+}
+#endif
+
 /*****************************************************************************/
 static struct stream *
 gfx_wiretosurface2(struct xrdp_encoder *self,
@@ -1066,6 +1788,11 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
             return NULL;
         }
     }
+    if (self->content_adaptive)
+    {
+        gfx_classify_tiles(self, enc, mon_index, width, height,
+                           tiles, num_rects_c);
+    }
     bitmap_data_length = self->max_compressed_bytes;
     bitmap_data = g_new(char, bitmap_data_length);
     if (bitmap_data == NULL)
@@ -1238,6 +1965,7 @@ gfx_startframe(struct xrdp_encoder *self,
 {
     int frame_id;
     int time_stamp;
+    int index;
 
     if (!s_check_rem(in_s, 8))
     {
@@ -1245,6 +1973,13 @@ gfx_startframe(struct xrdp_encoder *self,
     }
     in_uint32_le(in_s, frame_id);
     in_uint32_le(in_s, time_stamp);
+    for (index = 0; index < ENC_MAX_MONITORS; index++)
+    {
+        if (self->classifier[index] != NULL)
+        {
+            xrdp_enc_classifier_new_frame(self->classifier[index]);
+        }
+    }
     return xrdp_egfx_frame_start(bulk, frame_id, time_stamp);
 }
 
@@ -1432,8 +2167,7 @@ THREAD_RV THREAD_CC
 proc_enc_msg(void *arg)
 {
     XRDP_ENC_DATA *enc;
-    struct fifo *fifo_to_proc;
-    tbus mutex;
+    struct spsc_ring *ring_to_proc;
     tbus event_to_proc;
     tbus term_obj;
     tbus lterm_obj;
@@ -1454,8 +2188,7 @@ proc_enc_msg(void *arg)
         return 0;
     }
 
-    fifo_to_proc = self->fifo_to_proc;
-    mutex = self->mutex;
+    ring_to_proc = self->ring_to_proc;
     event_to_proc = self->xrdp_encoder_event_to_proc;
 
     term_obj = g_get_term();
@@ -1464,7 +2197,8 @@ proc_enc_msg(void *arg)
     cont = 1;
     while (cont)
     {
-        timeout = -1;
+        /* poll until the main thread has made room for our backlog */
+        timeout = fifo_is_empty(self->backlog_processed) ? -1 : 1;
         robjs_count = 0;
         wobjs_count = 0;
         robjs[robjs_count++] = term_obj;
@@ -1490,26 +2224,30 @@ proc_enc_msg(void *arg)
             break;
         }
 
+        if (!fifo_is_empty(self->backlog_processed))
+        {
+            xrdp_encoder_add_enc_done(self, NULL);
+            g_set_wait_obj(self->xrdp_encoder_event_processed);
+        }
+
         if (g_is_wait_obj_set(event_to_proc))
         {
             /* clear it right away */
             g_reset_wait_obj(event_to_proc);
             /* get first msg */
-            tc_mutex_lock(mutex);
-            enc = (XRDP_ENC_DATA *) fifo_remove_item(fifo_to_proc);
-            tc_mutex_unlock(mutex);
+            enc = (XRDP_ENC_DATA *) spsc_ring_remove_item(ring_to_proc);
             while (enc != 0)
             {
                 /* do work */
+                enc->start_time = g_time_us();
                 self->process_enc(self, enc);
                 /* get next msg */
-                tc_mutex_lock(mutex);
-                enc = (XRDP_ENC_DATA *) fifo_remove_item(fifo_to_proc);
-                tc_mutex_unlock(mutex);
+                enc = (XRDP_ENC_DATA *) spsc_ring_remove_item(ring_to_proc);
             }
         }
 
     } /* end while (cont) */
+    xrdp_encoder_stop_workers(self);
     g_set_wait_obj(self->xrdp_encoder_term_done);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "proc_enc_msg: thread exit");
     return 0;
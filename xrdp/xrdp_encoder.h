@@ -4,6 +4,7 @@
 
 #include "arch.h"
 #include "fifo.h"
+#include "spsc_ring.h"
 #include "xrdp_client_info.h"
 
 #define ENC_IS_BIT_SET(_flags, _bit) (((_flags) & (1 << (_bit))) != 0)
@@ -12,7 +13,13 @@
 #define ENC_SET_BITS(_flags, _mask, _bits) \
     do { _flags &= ~(_mask); _flags |= (_bits) & (_mask); } while (0)
 
+/* Monitor index in a GFX surface command is 4 bits */
+#define ENC_MAX_MONITORS 16
+
 struct xrdp_enc_data;
+struct xrdp_enc_worker;
+struct xrdp_enc_pool;
+struct xrdp_enc_classifier;
 
 /* for codec mode operations */
 struct xrdp_encoder
@@ -20,21 +27,33 @@ struct xrdp_encoder
     struct xrdp_mm *mm;
     int in_codec_mode;
     int codec_id;
+    const char *codec_name;
     int codec_quality;
     int max_compressed_bytes;
     tbus xrdp_encoder_event_to_proc;
     tbus xrdp_encoder_event_processed;
     tbus xrdp_encoder_term_request;
     tbus xrdp_encoder_term_done;
-    struct fifo *fifo_to_proc;
-    struct fifo *fifo_processed;
-    tbus mutex;
+    /* XRDP_ENC_DATA from the main thread to the encoder thread */
+    struct spsc_ring *ring_to_proc;
+    struct fifo *backlog_to_proc; /* main thread only, used if ring full */
+    /* XRDP_ENC_DATA_DONE from the encoder thread to the main thread */
+    struct spsc_ring *ring_processed;
+    struct fifo *backlog_processed; /* encoder thread only */
+    /* recycled output buffers and XRDP_ENC_DATA_DONE records */
+    struct xrdp_enc_pool *pool;
     int (*process_enc)(struct xrdp_encoder *self, struct xrdp_enc_data *enc);
+    /* encodes one worker's share of the crects in a surface command */
+    int (*process_tiles)(struct xrdp_encoder *self,
+                         struct xrdp_enc_worker *worker);
+    int num_workers; /* including the proc_enc_msg thread */
+    struct xrdp_enc_worker *workers;
+    tbus worker_done_sem;
     void *codec_handle_rfx;
     void *codec_handle_jpg;
     void *codec_handle_h264;
-    void *codec_handle_prfx_gfx[16];
-    void *codec_handle_h264_gfx[16];
+    void *codec_handle_prfx_gfx[ENC_MAX_MONITORS];
+    void *codec_handle_h264_gfx[ENC_MAX_MONITORS];
     int frame_id_client; /* last frame id received from client */
     int frame_id_server; /* last frame id received from Xorg */
     int frame_id_server_sent;
@@ -46,6 +65,10 @@ struct xrdp_encoder
     int quant_idx_y;
     int quant_idx_u;
     int quant_idx_v;
+    /* per tile quantizer choice, for progressive RFX */
+    int content_adaptive;
+    char adaptive_quants[4 * 5];
+    struct xrdp_enc_classifier *classifier[ENC_MAX_MONITORS];
 };
 
 /* cmd_id = 0 */
@@ -95,6 +118,8 @@ struct xrdp_enc_data_done
     int cy;
     int flags; /* ENC_DONE_FLAGS_* */
     int frame_id;
+    int pool_class; /* size class of comp_pad_data in the encoder pool,
+                       or 0 if it was allocated some other way */
 };
 
 #define ENC_FLAGS_GFX_BIT   0
@@ -108,6 +133,10 @@ struct xrdp_enc_data
     void *shmem_ptr;
     int shmem_bytes;
     int pad1;
+    /* g_time_us() timestamps, for the session stats */
+    tui64 queue_time; /* queued for the encoder thread */
+    tui64 start_time; /* encoder thread started on it */
+    tui64 end_time; /* last XRDP_ENC_DATA_DONE passed back */
     union _u
     {
         struct xrdp_enc_surface_command sc;
@@ -121,6 +150,15 @@ struct xrdp_encoder *
 xrdp_encoder_create(struct xrdp_mm *mm);
 void
 xrdp_encoder_delete(struct xrdp_encoder *self);
+int
+xrdp_encoder_queue_enc(struct xrdp_encoder *self, XRDP_ENC_DATA *enc);
+void
+xrdp_encoder_flush_backlog(struct xrdp_encoder *self);
+XRDP_ENC_DATA_DONE *
+xrdp_encoder_get_enc_done(struct xrdp_encoder *self);
+void
+xrdp_encoder_free_enc_done(struct xrdp_encoder *self,
+                           XRDP_ENC_DATA_DONE *enc_done);
 THREAD_RV THREAD_CC
 proc_enc_msg(void *arg);
 
@@ -1300,6 +1300,11 @@ load_xrdp_config(struct xrdp_config *config, const char *xrdp_ini, int bpp)
             globals->enable_token_login = g_text2bool(v);
         }
 
+        else if (g_strncmp(n, "enable_stats_socket", 64) == 0)
+        {
+            globals->enable_stats_socket = g_text2bool(v);
+        }
+
         /* login screen values */
         else if (g_strcmp(n, "default_dpi") == 0)
         {
@@ -1477,6 +1482,7 @@ load_xrdp_config(struct xrdp_config *config, const char *xrdp_ini, int bpp)
     LOG(LOG_LEVEL_DEBUG, "nego_sec_layer:          %d", globals->nego_sec_layer);
     LOG(LOG_LEVEL_DEBUG, "allow_multimon:          %d", globals->allow_multimon);
     LOG(LOG_LEVEL_DEBUG, "enable_token_login:      %d", globals->enable_token_login);
+    LOG(LOG_LEVEL_DEBUG, "enable_stats_socket:     %d", globals->enable_stats_socket);
 
     LOG(LOG_LEVEL_DEBUG, "ls_top_window_bg_color:  %x", globals->ls_top_window_bg_color);
     LOG(LOG_LEVEL_DEBUG, "ls_width (unscaled):     %d", globals->ls_unscaled.width);
@@ -31,6 +31,7 @@
 #include "scp.h"
 #include <ctype.h>
 #include "xrdp_encoder.h"
+#include "xrdp_stats.h"
 #include "xrdp_sockets.h"
 #include "xrdp_egfx.h"
 #include "libxrdp.h"
@@ -78,6 +79,7 @@ xrdp_mm_create(struct xrdp_wm *owner)
     {
         self->encoder = xrdp_encoder_create(self);
     }
+    self->stats = xrdp_stats_create(self);
 
     return self;
 }
@@ -162,6 +164,7 @@ xrdp_mm_delete(struct xrdp_mm *self)
 
     /* shutdown thread */
     xrdp_encoder_delete(self->encoder);
+    xrdp_stats_delete(self->stats);
 
     trans_delete(self->sesman_trans);
     self->sesman_trans = 0;
@@ -1593,6 +1596,7 @@ xrdp_mm_egfx_frame_ack(void *user, uint32_t queue_depth, int frame_id,
         /* frame acks can come out of order so ignore older one */
         encoder->frame_id_client = MAX(frame_id, encoder->frame_id_client);
     }
+    xrdp_stats_frame_ack(self->stats, encoder->frame_id_client);
     xrdp_mm_update_module_frame_ack(self);
     return 0;
 }
@@ -3485,6 +3489,14 @@ xrdp_mm_get_wait_objs(struct xrdp_mm *self,
     if (self->encoder != 0)
     {
         read_objs[(*rcount)++] = self->encoder->xrdp_encoder_event_processed;
+        if (!fifo_is_empty(self->encoder->backlog_to_proc))
+        {
+            /* poll until the encoder has made room for the backlog */
+            if ((*timeout < 0) || (*timeout > 1))
+            {
+                *timeout = 1;
+            }
+        }
     }
 
     if (self->resize_queue != 0)
@@ -3492,6 +3504,8 @@ xrdp_mm_get_wait_objs(struct xrdp_mm *self,
         read_objs[(*rcount)++] = self->resize_ready;
     }
 
+    xrdp_stats_get_wait_objs(self->stats, read_objs, rcount);
+
     if (self->wm->screen_dirty_region != NULL)
     {
         if (xrdp_region_not_empty(self->wm->screen_dirty_region))
@@ -3604,12 +3618,13 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
 
     LOG(LOG_LEVEL_TRACE, "xrdp_mm_process_enc_done:");
 
+    /* Pack the frame markers and surface commands for each frame
+     * into as few PDUs as we can */
+    libxrdp_fastpath_batch_begin(self->wm->session);
+
     while (1)
     {
-        tc_mutex_lock(self->encoder->mutex);
-        enc_done = (XRDP_ENC_DATA_DONE *)
-                   fifo_remove_item(self->encoder->fifo_processed);
-        tc_mutex_unlock(self->encoder->mutex);
+        enc_done = xrdp_encoder_get_enc_done(self->encoder);
         if (enc_done == NULL)
         {
             break;
@@ -3630,6 +3645,8 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
                   "bytes %d", enc_done->comp_bytes);
         if (enc_done->comp_bytes > 0)
         {
+            xrdp_stats_add_output(self->stats, self->encoder->codec_name,
+                                  enc_done->comp_bytes);
             if (is_gfx)
             {
                 xrdp_egfx_send_data(self->egfx,
@@ -3660,6 +3677,11 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
                     libxrdp_fastpath_send_frame_marker(self->wm->session, 1,
                                                        enc_done->frame_id);
                 }
+                if (enc_done->last)
+                {
+                    /* Don't hold a finished frame back */
+                    libxrdp_fastpath_batch_flush(self->wm->session);
+                }
             }
         }
         /* free enc_done */
@@ -3667,10 +3689,12 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
         {
             enc = enc_done->enc;
             LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_mm_process_enc_done: last set");
+            xrdp_stats_add_enc(self->stats, enc);
             if (got_frame_id)
             {
                 if (client_ack)
                 {
+                    xrdp_stats_frame_sent(self->stats, enc_done->frame_id);
                     self->encoder->frame_id_server = enc_done->frame_id;
                     xrdp_mm_update_module_frame_ack(self);
                 }
@@ -3695,9 +3719,10 @@ xrdp_mm_process_enc_done(struct xrdp_mm *self)
             }
             g_free(enc);
         }
-        g_free(enc_done->comp_pad_data);
-        g_free(enc_done);
+        xrdp_encoder_free_enc_done(self->encoder, enc_done);
     }
+
+    libxrdp_fastpath_batch_end(self->wm->session);
     return 0;
 }
 
@@ -3875,6 +3900,8 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
         dynamic_monitor_process_queue(self);
     }
 
+    xrdp_stats_check_wait_objs(self->stats);
+
     if (self->encoder != NULL)
     {
         if (g_is_wait_obj_set(self->encoder->xrdp_encoder_event_processed))
@@ -3882,6 +3909,10 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
             g_reset_wait_obj(self->encoder->xrdp_encoder_event_processed);
             xrdp_mm_process_enc_done(self);
         }
+        if (!fifo_is_empty(self->encoder->backlog_to_proc))
+        {
+            xrdp_encoder_flush_backlog(self->encoder);
+        }
     }
 
     if (self->wm->screen_dirty_region != NULL)
@@ -3940,6 +3971,7 @@ xrdp_mm_frame_ack(struct xrdp_mm *self, int frame_id)
         /* frame acks can come out of order so ignore older one */
         encoder->frame_id_client = MAX(frame_id, encoder->frame_id_client);
     }
+    xrdp_stats_frame_ack(self->stats, encoder->frame_id_client);
     xrdp_mm_update_module_frame_ack(self);
     return 0;
 }
@@ -4259,13 +4291,8 @@ server_paint_rects_ex(struct xrdp_mod *mod,
             LOG_DEVEL(LOG_LEVEL_WARNING, "server_paint_rects: error");
         }
 
-        /* insert into fifo for encoder thread to process */
-        tc_mutex_lock(mm->encoder->mutex);
-        fifo_add_item(mm->encoder->fifo_to_proc, (void *) enc_data);
-        tc_mutex_unlock(mm->encoder->mutex);
-
-        /* signal xrdp_encoder thread */
-        g_set_wait_obj(mm->encoder->xrdp_encoder_event_to_proc);
+        /* queue for encoder thread to process */
+        xrdp_encoder_queue_enc(mm->encoder, enc_data);
 
         return 0;
     }
@@ -4359,12 +4386,8 @@ server_egfx_cmd(struct xrdp_mod *mod,
     enc->u.gfx.data_bytes = data_bytes;
     enc->shmem_ptr = data;
     enc->shmem_bytes = data_bytes;
-    /* insert into fifo for encoder thread to process */
-    tc_mutex_lock(mm->encoder->mutex);
-    fifo_add_item(mm->encoder->fifo_to_proc, enc);
-    tc_mutex_unlock(mm->encoder->mutex);
-    /* signal xrdp_encoder thread */
-    g_set_wait_obj(mm->encoder->xrdp_encoder_event_to_proc);
+    /* queue for encoder thread to process */
+    xrdp_encoder_queue_enc(mm->encoder, enc);
     return 0;
 }
 
@@ -0,0 +1,343 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file xrdp_stats.c
+ * @brief Per-session encoder and transmit statistics
+ *
+ * The stats socket is a listening UNIX socket. Each connection to it
+ * is sent a text dump of the current statistics and is then closed,
+ * so something like 'socat - UNIX-CONNECT:<socket>' is all that's
+ * needed to read them.
+ *
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "xrdp.h"
+#include "xrdp_encoder.h"
+#include "xrdp_sockets.h"
+#include "xrdp_stats.h"
+#include "string_calls.h"
+
+#define STATS_DUMP_BYTES 4096
+
+/*****************************************************************************/
+struct xrdp_stats *
+xrdp_stats_create(struct xrdp_mm *mm)
+{
+    struct xrdp_stats *self;
+
+    self = g_new0(struct xrdp_stats, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->mm = mm;
+    self->start_time = g_time_us();
+    histogram_init(&self->queue_latency);
+    histogram_init(&self->encode_latency);
+    histogram_init(&self->ack_latency);
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_delete(struct xrdp_stats *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    trans_delete(self->listener);
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* appends a histogram line to the dump. Returns the new length */
+static int
+stats_dump_histogram(char *text, int len, const char *name,
+                     const struct histogram *h)
+{
+    if (len < STATS_DUMP_BYTES)
+    {
+        len += g_snprintf(text + len, STATS_DUMP_BYTES - len,
+                          "%s_us count %u min %u mean %u p50 %u p90 %u "
+                          "p99 %u max %u\n",
+                          name, h->count, h->min, histogram_mean(h),
+                          histogram_percentile(h, 50),
+                          histogram_percentile(h, 90),
+                          histogram_percentile(h, 99),
+                          h->max);
+    }
+    return len;
+}
+
+/*****************************************************************************/
+/* writes the text dump of the stats. Returns the length */
+static int
+stats_dump(struct xrdp_stats *self, char *text)
+{
+    struct xrdp_mm *mm = self->mm;
+    struct xrdp_encoder *encoder = mm->encoder;
+    const struct xrdp_stats_codec *codec;
+    int len;
+    int index;
+
+    len = g_snprintf(text, STATS_DUMP_BYTES,
+                     "pid %d\n"
+                     "session_id %d\n"
+                     "display %d\n"
+                     "uid %d\n"
+                     "uptime_s %d\n"
+                     "codec %s\n",
+                     g_getpid(), self->session_id, mm->display, mm->uid,
+                     (int)((g_time_us() - self->start_time) / 1000000),
+                     (encoder != NULL && encoder->codec_name != NULL) ?
+                     encoder->codec_name : "none");
+    if (encoder != NULL && len < STATS_DUMP_BYTES)
+    {
+        len += g_snprintf(text + len, STATS_DUMP_BYTES - len,
+                          "frames_in_flight %d\n"
+                          "max_frames_in_flight %d\n",
+                          encoder->frame_id_server - encoder->frame_id_client,
+                          encoder->frames_in_flight);
+    }
+    if (len < STATS_DUMP_BYTES)
+    {
+        len += g_snprintf(text + len, STATS_DUMP_BYTES - len,
+                          "encodes %llu\n"
+                          "frames_sent %llu\n"
+                          "frames_acked %llu\n"
+                          "frames_untracked %llu\n",
+                          (unsigned long long)self->encodes,
+                          (unsigned long long)self->frames_sent,
+                          (unsigned long long)self->frames_acked,
+                          (unsigned long long)self->frames_untracked);
+    }
+    for (index = 0; index < self->num_codecs; ++index)
+    {
+        codec = self->codecs + index;
+        if (len < STATS_DUMP_BYTES)
+        {
+            len += g_snprintf(text + len, STATS_DUMP_BYTES - len,
+                              "codec_output %s messages %llu bytes %llu\n",
+                              codec->name,
+                              (unsigned long long)codec->messages,
+                              (unsigned long long)codec->bytes);
+        }
+    }
+    len = stats_dump_histogram(text, len, "queue", &self->queue_latency);
+    len = stats_dump_histogram(text, len, "encode", &self->encode_latency);
+    len = stats_dump_histogram(text, len, "ack", &self->ack_latency);
+    return MIN(len, STATS_DUMP_BYTES - 1);
+}
+
+/*****************************************************************************/
+static int
+xrdp_stats_conn_in(struct trans *self, struct trans *new_self)
+{
+    struct xrdp_stats *stats;
+    struct stream *s;
+    int len;
+
+    stats = (struct xrdp_stats *) (self->callback_data);
+    s = trans_get_out_s(new_self, STATS_DUMP_BYTES);
+    len = stats_dump(stats, s->data);
+    s->p = s->data + len;
+    s_mark_end(s);
+    if (trans_force_write_s(new_self, s) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_stats_conn_in: write failed");
+    }
+    /* non-zero tells the caller to close the connection */
+    return 1;
+}
+
+/*****************************************************************************/
+int
+xrdp_stats_listen(struct xrdp_stats *self, int session_id)
+{
+    char port[XRDP_SOCKETS_MAXPATH];
+
+    if (self == NULL)
+    {
+        return 1;
+    }
+    if (self->listener != NULL)
+    {
+        return 0;
+    }
+    self->session_id = session_id;
+    g_snprintf(port, sizeof(port), XRDP_STATS_STR, g_getpid(), session_id);
+    self->listener = trans_create(TRANS_MODE_UNIX, 16, STATS_DUMP_BYTES);
+    if (self->listener == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_stats_listen: trans_create failed");
+        return 1;
+    }
+    if (trans_listen(self->listener, port) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "xrdp_stats_listen: can't listen on %s",
+            port);
+        trans_delete(self->listener);
+        self->listener = NULL;
+        return 1;
+    }
+    self->listener->trans_conn_in = xrdp_stats_conn_in;
+    self->listener->callback_data = self;
+    self->listener->is_term = g_is_term;
+    LOG(LOG_LEVEL_INFO, "Session stats available on %s", port);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_stats_get_wait_objs(struct xrdp_stats *self, tbus *objs, int *count)
+{
+    if (self != NULL && self->listener != NULL)
+    {
+        return trans_get_wait_objs(self->listener, objs, count);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xrdp_stats_check_wait_objs(struct xrdp_stats *self)
+{
+    if (self != NULL && self->listener != NULL)
+    {
+        if (trans_check_wait_objs(self->listener) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "xrdp_stats_check_wait_objs: "
+                "stats socket has failed");
+            trans_delete(self->listener);
+            self->listener = NULL;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_add_output(struct xrdp_stats *self, const char *codec_name,
+                      int bytes)
+{
+    struct xrdp_stats_codec *codec;
+    int index;
+
+    if (self == NULL || codec_name == NULL || bytes <= 0)
+    {
+        return;
+    }
+    /* codec names are string constants, so only the pointer is compared */
+    for (index = 0; index < self->num_codecs; ++index)
+    {
+        if (self->codecs[index].name == codec_name)
+        {
+            break;
+        }
+    }
+    if (index == self->num_codecs)
+    {
+        if (index >= XRDP_STATS_MAX_CODECS)
+        {
+            return;
+        }
+        self->codecs[index].name = codec_name;
+        self->num_codecs++;
+    }
+    codec = self->codecs + index;
+    codec->messages++;
+    codec->bytes += bytes;
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_add_enc(struct xrdp_stats *self, const struct xrdp_enc_data *enc)
+{
+    if (self == NULL || enc->queue_time == 0)
+    {
+        return;
+    }
+    self->encodes++;
+    if (enc->start_time >= enc->queue_time)
+    {
+        histogram_record(&self->queue_latency,
+                         (unsigned int)(enc->start_time - enc->queue_time));
+    }
+    if (enc->end_time >= enc->start_time && enc->start_time != 0)
+    {
+        histogram_record(&self->encode_latency,
+                         (unsigned int)(enc->end_time - enc->start_time));
+    }
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_frame_sent(struct xrdp_stats *self, int frame_id)
+{
+    struct xrdp_stats_sent_frame *sent;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    self->frames_sent++;
+    if (self->sent_count == XRDP_STATS_SENT_FRAMES)
+    {
+        /* client isn't keeping up with acks - forget the oldest */
+        self->sent_start = (self->sent_start + 1) % XRDP_STATS_SENT_FRAMES;
+        self->sent_count--;
+        self->frames_untracked++;
+    }
+    sent = self->sent_frames +
+           (self->sent_start + self->sent_count) % XRDP_STATS_SENT_FRAMES;
+    sent->frame_id = frame_id;
+    sent->sent_time = g_time_us();
+    self->sent_count++;
+}
+
+/*****************************************************************************/
+void
+xrdp_stats_frame_ack(struct xrdp_stats *self, int frame_id)
+{
+    struct xrdp_stats_sent_frame *sent;
+    tui64 now;
+
+    if (self == NULL || self->sent_count == 0)
+    {
+        return;
+    }
+    now = g_time_us();
+    while (self->sent_count > 0)
+    {
+        sent = self->sent_frames + self->sent_start;
+        if (frame_id >= 0 && sent->frame_id > frame_id)
+        {
+            break;
+        }
+        histogram_record(&self->ack_latency,
+                         (unsigned int)(now - sent->sent_time));
+        self->frames_acked++;
+        self->sent_start = (self->sent_start + 1) % XRDP_STATS_SENT_FRAMES;
+        self->sent_count--;
+    }
+}
@@ -0,0 +1,144 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file xrdp_stats.h
+ * @brief Per-session encoder and transmit statistics
+ *
+ * Latencies are measured for each XRDP_ENC_DATA as it passes through
+ * the encoder, and for each frame from the time it is sent to the
+ * time the client acknowledges it. These are kept in histograms,
+ * along with byte counts for each codec.
+ *
+ * If enabled, a text dump of the statistics is written to anything
+ * which connects to a UNIX socket for the session.
+ *
+ * All functions must be called from the main thread.
+ */
+
+#ifndef _XRDP_STATS_H
+#define _XRDP_STATS_H
+
+#include "arch.h"
+#include "histogram.h"
+
+struct xrdp_mm;
+struct xrdp_enc_data;
+struct trans;
+
+#define XRDP_STATS_MAX_CODECS 8
+/* Frames we can remember while waiting for a client ack */
+#define XRDP_STATS_SENT_FRAMES 64
+
+struct xrdp_stats_codec
+{
+    const char *name;
+    tui64 messages;
+    tui64 bytes;
+};
+
+struct xrdp_stats_sent_frame
+{
+    int frame_id;
+    tui64 sent_time;
+};
+
+struct xrdp_stats
+{
+    struct xrdp_mm *mm; /* owner */
+    struct trans *listener;
+    int session_id;
+    tui64 start_time;
+    /* all latencies are in microseconds */
+    struct histogram queue_latency; /* queued until encoder starts */
+    struct histogram encode_latency; /* encoder start to last output */
+    struct histogram ack_latency; /* frame sent to client ack */
+    tui64 encodes;
+    tui64 frames_sent;
+    tui64 frames_acked;
+    tui64 frames_untracked; /* dropped from sent_frames before an ack */
+    int num_codecs;
+    struct xrdp_stats_codec codecs[XRDP_STATS_MAX_CODECS];
+    /* ring of frames waiting for an ack, in frame_id order */
+    unsigned int sent_start;
+    unsigned int sent_count;
+    struct xrdp_stats_sent_frame sent_frames[XRDP_STATS_SENT_FRAMES];
+};
+
+struct xrdp_stats *
+xrdp_stats_create(struct xrdp_mm *mm);
+void
+xrdp_stats_delete(struct xrdp_stats *self);
+
+/**
+ * Start listening for connections on the stats socket
+ *
+ * Does nothing if the socket is already listening.
+ *
+ * @param self stats object
+ * @param session_id Session number within this process
+ * @return 0 for success
+ */
+int
+xrdp_stats_listen(struct xrdp_stats *self, int session_id);
+int
+xrdp_stats_get_wait_objs(struct xrdp_stats *self, tbus *objs, int *count);
+int
+xrdp_stats_check_wait_objs(struct xrdp_stats *self);
+
+/**
+ * Record an encoder output message
+ *
+ * @param self stats object
+ * @param codec_name Name of the codec which produced the output
+ * @param bytes Size of the output
+ */
+void
+xrdp_stats_add_output(struct xrdp_stats *self, const char *codec_name,
+                      int bytes);
+
+/**
+ * Record the latencies for an XRDP_ENC_DATA the encoder has finished with
+ *
+ * @param self stats object
+ * @param enc Completed encoder request
+ */
+void
+xrdp_stats_add_enc(struct xrdp_stats *self,
+                   const struct xrdp_enc_data *enc);
+
+/**
+ * Record that a frame has been sent to the client
+ *
+ * @param self stats object
+ * @param frame_id ID of frame. Must be larger than the last frame_id sent
+ */
+void
+xrdp_stats_frame_sent(struct xrdp_stats *self, int frame_id);
+
+/**
+ * Record a frame ack from the client
+ *
+ * All frames up to and including frame_id are considered acknowledged
+ *
+ * @param self stats object
+ * @param frame_id ID of frame, or -1 to acknowledge all sent frames
+ */
+void
+xrdp_stats_frame_ack(struct xrdp_stats *self, int frame_id);
+
+#endif
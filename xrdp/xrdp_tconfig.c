@@ -318,6 +318,26 @@ static int tconfig_load_gfx_order(toml_table_t *tfile, struct xrdp_tconfig_gfx *
     return 0;
 }
 
+static void
+tconfig_load_gfx_content_adaptive(toml_table_t *tfile,
+                                  struct xrdp_tconfig_gfx *config)
+{
+    toml_table_t *codec;
+    toml_datum_t datum;
+
+    if ((codec = toml_table_in(tfile, "codec")) != NULL)
+    {
+        datum = toml_bool_in(codec, "content_adaptive");
+        if (datum.ok)
+        {
+            config->content_adaptive = datum.u.b;
+        }
+    }
+
+    TCLOG(LOG_LEVEL_DEBUG, "[codec] content_adaptive = %s",
+          config->content_adaptive ? "true" : "false");
+}
+
 /**
  * Determines whether a codec is enabled
  * @param co Ordered codec list
@@ -372,6 +392,7 @@ tconfig_load_gfx(const char *filename, struct xrdp_tconfig_gfx *config)
     /* Default to just RFX support. in case we can't load anything */
     config->codec.codec_count = 1;
     config->codec.codecs[0] = XTC_RFX;
+    config->content_adaptive = 1;
     memset(config->x264_param, 0, sizeof(config->x264_param));
 
     if ((fp = fopen(filename, "r")) == NULL)
@@ -393,6 +414,7 @@ tconfig_load_gfx(const char *filename, struct xrdp_tconfig_gfx *config)
 
     /* Load GFX codec order */
     tconfig_load_gfx_order(tfile, config);
+    tconfig_load_gfx_content_adaptive(tfile, config);
 
     /* H.264 configuration */
     if (codec_enabled(&config->codec, XTC_H264))
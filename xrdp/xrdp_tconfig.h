@@ -57,6 +57,8 @@ struct xrdp_tconfig_gfx_codec_order
 struct xrdp_tconfig_gfx
 {
     struct xrdp_tconfig_gfx_codec_order codec;
+    /* choose the RFX quantizer for each tile from its content */
+    int content_adaptive;
     /* store x264 parameters for each connection type */
     struct xrdp_tconfig_gfx_x264_param x264_param[NUM_CONNECTION_TYPES];
 };
@@ -43,7 +43,6 @@
 #define XRDP_MM_IMPLEMENTS_TOUCH(mm) ((mm)->code != XVNC_SESSION_CODE)
 
 struct source_info;
-struct list16;
 
 /* lib */
 struct xrdp_mod
@@ -286,6 +285,16 @@ struct xrdp_brush_item
 /* moved to xrdp_constants.h
 #define XRDP_BITMAP_CACHE_ENTRIES 2048 */
 
+/* Open-addressed, so must be a power of two comfortably larger than
+ * XRDP_MAX_BITMAP_CACHE_IDX to keep the probe sequences short */
+#define XRDP_BITMAP_HASH_SLOTS 4096
+
+struct xrdp_bitmap_hash_slot
+{
+    tui64 hash;
+    int cache_idx; /* -1 for an empty slot */
+};
+
 /* difference caches */
 struct xrdp_cache
 {
@@ -306,8 +315,9 @@ struct xrdp_cache
     int lru_tail[XRDP_MAX_BITMAP_CACHE_ID];
     int lru_reset[XRDP_MAX_BITMAP_CACHE_ID];
 
-    /* crc optimize */
-    struct list16 crc16[XRDP_MAX_BITMAP_CACHE_ID][64 * 1024];
+    /* hash index into bitmap_items */
+    struct xrdp_bitmap_hash_slot bitmap_hash[XRDP_MAX_BITMAP_CACHE_ID]
+        [XRDP_BITMAP_HASH_SLOTS];
 
     int use_bitmap_comp;
     int cache1_entries;
@@ -436,6 +446,7 @@ struct xrdp_mm
     struct guid guid; /* GUID for the session, or all zeros  */
     int code; /* 0=Xvnc session, 20=xorg driver mode */
     struct xrdp_encoder *encoder;
+    struct xrdp_stats *stats; /* encoder and transmit statistics */
     int cs2xr_cid_map[256];
     int xr2cr_cid_map[256];
     int dynamic_monitor_chanid;
@@ -691,9 +702,8 @@ struct xrdp_bitmap
     /* for popup */
     struct xrdp_bitmap *popped_from;
     int item_height;
-    /* crc */
-    int crc32;
-    int crc16;
+    /* content hash, for the bitmap cache */
+    tui64 hash;
 };
 
 #define MAX_FONT_CHARS 0x4e00
@@ -815,6 +825,7 @@ struct xrdp_cfg_globals
     int  nego_sec_layer;
     int  allow_multimon;
     int  enable_token_login;
+    int  enable_stats_socket;
 
     /* colors */
 
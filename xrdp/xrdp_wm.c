@@ -29,6 +29,7 @@
 #include "log.h"
 #include "string_calls.h"
 #include "unicode_defines.h"
+#include "xrdp_stats.h"
 
 /*****************************************************************************/
 static void
@@ -651,6 +652,11 @@ xrdp_wm_init(struct xrdp_wm *self)
 
     tconfig_load_gfx(XRDP_CFG_PATH "/gfx.toml", self->gfx_config);
 
+    if (self->xrdp_config->cfg_globals.enable_stats_socket)
+    {
+        xrdp_stats_listen(self->mm->stats, self->pro_layer->session_id);
+    }
+
     /* Remove a font loaded on the previous config */
     xrdp_font_delete(self->default_font);
     self->painter->font = NULL; /* May be set to the default_font */